@@ -5,7 +5,7 @@ CFLAGS="-g -O0 -std=c11 --static -D_CRT_SECURE_NO_WARNINGS
         -Wextra -Wno-sign-compare -Wno-unused-parameter
         -lkernel32 -lgdi32 -luser32 -lruntimeobject
         -lwinmm -ld3d11 -ldxguid -ld3dcompiler 
-        -lshlwapi -lole32 -lavrt -lksuser -ldbghelp
+        -lshlwapi -lole32 -lavrt -lksuser -ldbghelp -lsynchronization
         -lshcore"
 SRC=../build.c
 EXENAME=game.exe
@@ -1,6 +1,6 @@
 //: defines
 // Memory limit
-#define MAX_ENTITIES_COUNT 1024
+#define ENTITIES_PER_CHUNK 1024
 #define MAX_IMAGES_COUNT 1024
 #define MAX_ITEMS_COUNT 1024
 
@@ -114,7 +114,7 @@ typedef struct Entity
 
 typedef struct World
 {
-	Entity entitites[MAX_ENTITIES_COUNT];
+	Pool entities;
 	Entity *selectedEntity;
 	Item *inventory[INV_COUNT];
 	Item hotbar[INV_HOTBAR_AMOUNT];
@@ -130,6 +130,8 @@ ItemData itemsData[ITEM_MAX] = {0};
 EntityData entityData[ENTITY_MAX] = {0};
 Gfx_Font *font = 0;
 Entity *player = 0;
+Atom entityHitSound = NULL_ATOM;
+Atom entityDestroySound = NULL_ATOM;
 
 //: Foward declarations
 Entity *createEntity();
@@ -255,7 +257,7 @@ Vector2 getMousePosInNDC()
 void destroyEntity(Entity *entity)
 {
 	entity->isValid = false;
-	memset(entity, 0, sizeof(Entity));
+	pool_release(&world->entities, entity);
 }
 
 bool addItemToInventoryAtIndex(struct Entity *itemEntity, int id)
@@ -490,6 +492,8 @@ void drawHotBar()
 
 void initEntity()
 {
+	pool_init_typed(&world->entities, Entity, ENTITIES_PER_CHUNK, get_heap_allocator());
+
 	entityData[ENTITY_player] = (EntityData){.spriteId = SPRITE_player};
 	entityData[ENTITY_mineral] = (EntityData){.spriteId = SPRITE_mineral, .isDestroyable = true, .isSelectable = true, .lootType = ITEM_iron};
 	entityData[ENTITY_tree] = (EntityData){.spriteId = SPRITE_tree, .isDestroyable = true, .isSelectable = true, .lootType = ITEM_log};
@@ -510,21 +514,10 @@ EntityData *getEntityData(EntityType type)
 
 Entity *createEntity()
 {
-	Entity *entityFound = 0;
-	for (int i = 0; i < MAX_ENTITIES_COUNT; i++)
-	{
-		Entity *curEntity = &world->entitites[i];
-		if (!curEntity->isValid)
-		{
-			entityFound = curEntity;
-			break;
-		}
-	}
-
-	assert(entityFound, "entityCreate: No entity found");
-	entityFound->isValid = true;
+	Entity *entity = pool_acquire(&world->entities);
+	entity->isValid = true;
 
-	return entityFound;
+	return entity;
 }
 
 void setupEntity(Entity *entity, EntityType type, Vector2 pos)
@@ -615,7 +608,7 @@ void checkMouseClickEntity()
 		if (entityData->isDestroyable)
 		{
 			selectedEntity->health--;
-			play_one_audio_clip(STR("assets/sounds/EntityHit.wav"));
+			play_one_audio_clip_atom(entityHitSound);
 
 			if (selectedEntity->health <= 0)
 			{
@@ -628,7 +621,7 @@ void checkMouseClickEntity()
 					newEntity->amount = 3;
 				}
 
-				play_one_audio_clip(STR("assets/sounds/EntityDestroy.wav"));
+				play_one_audio_clip_atom(entityDestroySound);
 				destroyEntity(selectedEntity);
 			}
 		}
@@ -680,6 +673,9 @@ int entry(int argc, char **argv)
 	initItems();
 	initEntity();
 
+	entityHitSound = ATOM("assets/sounds/EntityHit.wav");
+	entityDestroySound = ATOM("assets/sounds/EntityDestroy.wav");
+
 	player = createEntity();
 	setupEntity(player, ENTITY_player, v2(0, 0));
 	player->health = 100;
@@ -744,9 +740,10 @@ int entry(int argc, char **argv)
 		{
 			float distMin = 1000;
 			world->selectedEntity = 0;
-			for (int i = 0; i < MAX_ENTITIES_COUNT; i++)
+			Pool_Iterator it = {0};
+			Entity *curEntity;
+			while ((curEntity = pool_next(&world->entities, &it)))
 			{
-				Entity *curEntity = &world->entitites[i];
 				EntityData *entityData = getEntityData(curEntity->entityType);
 				if (curEntity->isValid && entityData->isSelectable)
 				{
@@ -806,9 +803,10 @@ int entry(int argc, char **argv)
 		drawGround(player->pos, v2(10, 6));
 
 		// Entity
-		for (int i = 0; i < MAX_ENTITIES_COUNT; i++)
+		Pool_Iterator it = {0};
+		Entity *curEntity;
+		while ((curEntity = pool_next(&world->entities, &it)))
 		{
-			Entity *curEntity = &world->entitites[i];
 			if (curEntity->isValid)
 			{
 				drawEntity(curEntity);
@@ -5,6 +5,8 @@
 		
 	bool audio_open_source_stream(Audio_Source *src, string path, Allocator allocator);
 	bool audio_open_source_load(Audio_Source *src, string path, Allocator allocator);
+	bool audio_open_source_stream_atom(Audio_Source *src, Atom path, Allocator allocator);
+	bool audio_open_source_load_atom(Audio_Source *src, Atom path, Allocator allocator);
 	void audio_source_destroy(Audio_Source *src);
 
 		Playing audio (the simple way):
@@ -14,6 +16,10 @@
 	void play_one_audio_clip_source_config(Audio_Source source, Audio_Playback_Config config);
 	void play_one_audio_clip_config(string path, Audio_Playback_Config config);
 	
+	// Same as above but with an interned path, which skips hashing & comparing the path
+	void play_one_audio_clip_atom(Atom path);
+	void play_one_audio_clip_atom_with_config(Atom path, Audio_Playback_Config config);
+	
 		Playing audio (with players):
 	
 	Audio_Player * audio_player_get_one();
@@ -681,6 +687,14 @@ audio_open_source_load(Audio_Source *src, string path, Allocator allocator) {
 	mutex_release(&audio_init_mutex);
 	return audio_open_source_load_format(src, path, format, allocator);
 }
+inline bool
+audio_open_source_stream_atom(Audio_Source *src, Atom path, Allocator allocator) {
+	return audio_open_source_stream(src, atom_get_string(path), allocator);
+}
+inline bool
+audio_open_source_load_atom(Audio_Source *src, Atom path, Allocator allocator) {
+	return audio_open_source_load(src, atom_get_string(path), allocator);
+}
 
 void 
 audio_source_destroy(Audio_Source *src) {
@@ -1180,57 +1194,46 @@ typedef struct Audio_Player {
 	
 } Audio_Player;
 #define AUDIO_PLAYERS_PER_BLOCK 128
-typedef struct Audio_Player_Block {
-	Audio_Player players[AUDIO_PLAYERS_PER_BLOCK]; // Players need to be persistent in memory
-	
-	struct Audio_Player_Block *next;
-} Audio_Player_Block;
 
+// Players need to be persistent in memory, which pool chunks are.
+// Players are acquired on the program thread and released on the audio thread, hence the lock.
+// The audio thread iterates without the lock, which is fine with pools.
 // #Global
-ogb_instance Audio_Player_Block audio_player_block;
+ogb_instance Pool audio_player_pool;
+ogb_instance Spinlock audio_player_pool_lock;
 
 #if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
-Audio_Player_Block audio_player_block = {0};
+Pool audio_player_pool = {0};
+Spinlock audio_player_pool_lock = {0};
 #endif
 
 Audio_Player *
 audio_player_get_one() {
 
-	Audio_Player_Block *block = &audio_player_block;
-	Audio_Player_Block *last = 0;
-	
-	while (block) {
-		
-		for (u64 i = 0; i < AUDIO_PLAYERS_PER_BLOCK; i++) {
-			if (!block->players[i].allocated) {
-			
-				memset(&block->players[i], 0, sizeof(block->players[i]));
-				block->players[i].allocated = true;
-				block->players[i].config.volume = 1.0;
-				block->players[i].config.playback_speed = 1.0;
-				
-				return &block->players[i];
-			}
-		}
-		
-		last = block;
-		block = block->next;
+	spinlock_acquire_or_wait(&audio_player_pool_lock);
+	if (!audio_player_pool.slots_per_chunk) {
+		pool_init_typed(&audio_player_pool, Audio_Player, AUDIO_PLAYERS_PER_BLOCK, get_heap_allocator());
 	}
+	Audio_Player *p = (Audio_Player*)pool_acquire(&audio_player_pool);
+	spinlock_release(&audio_player_pool_lock);
 	
-	// No free player found, make another block
-	// #Volatile can't assign to last->next before this is zero initialized
-	Audio_Player_Block *new_block = alloc(get_heap_allocator(), sizeof(Audio_Player_Block));
+	p->config.volume = 1.0;
+	p->config.playback_speed = 1.0;
 	
-#if !DO_ZERO_INITIALIATION
-	memset(new_block, 0, sizeof(*new_block));
-#endif
-
-	last->next = new_block;
+	// Audio thread skips players until this is set
+	MEMORY_BARRIER;
+	p->allocated = true;
+	
+	return p;
+}
 
-	new_block->players[0].allocated = true;
-	new_block->players[0].config.volume = 1.0;
-	block->players[0].config.playback_speed = 1.0;
-	return &new_block->players[0];
+// Only the audio thread does this
+void
+audio_player_free(Audio_Player *p) {
+	p->allocated = false;
+	spinlock_acquire_or_wait(&audio_player_pool_lock);
+	pool_release(&audio_player_pool, p);
+	spinlock_release(&audio_player_pool_lock);
 }
 
 void 
@@ -1360,14 +1363,65 @@ audio_player_set_looping(Audio_Player *p, bool looping) {
 }
 
 // #Global
-ogb_instance Hash_Table just_audio_clips;
-ogb_instance bool just_audio_clips_initted;
+ogb_instance Concurrent_Hash_Map just_audio_clips;
+ogb_instance Concurrent_Hash_Map just_audio_clip_atoms; // Atom -> Audio_Source* in just_audio_clips
+ogb_instance volatile u8 just_audio_clips_init_state; // 0: Not initted, 1: Initting, 2: Initted
 
 #if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
-Hash_Table just_audio_clips;
-bool just_audio_clips_initted = false;
+Concurrent_Hash_Map just_audio_clips;
+Concurrent_Hash_Map just_audio_clip_atoms;
+volatile u8 just_audio_clips_init_state = 0;
 #endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
 
+// Clips can be played from any thread, so this is synced
+void
+init_just_audio_clips_if_needed() {
+	if (just_audio_clips_init_state == 2) return;
+	
+	if (compare_and_swap_8(&just_audio_clips_init_state, 1, 0)) {
+		just_audio_clips = make_concurrent_hash_map(string, Audio_Source, get_heap_allocator());
+		just_audio_clip_atoms = make_concurrent_hash_map(Atom, Audio_Source*, get_heap_allocator());
+		MEMORY_BARRIER;
+		just_audio_clips_init_state = 2;
+	}
+	u64 backoff = 1;
+	while (just_audio_clips_init_state != 2) spin_pause(&backoff);
+}
+Audio_Source *
+get_or_load_just_audio_clip(string path) {
+	init_just_audio_clips_if_needed();
+	
+	Audio_Source *src_ptr = concurrent_hash_map_find(&just_audio_clips, path);
+	if (src_ptr) return src_ptr;
+	
+	Audio_Source new_src;
+	bool ok = audio_open_source_stream(&new_src, path, get_heap_allocator());
+	if (!ok) {
+		log_error("Could not load audio to play from %s", path);
+		return 0;
+	}
+	
+	bool added;
+	src_ptr = concurrent_hash_map_find_or_add(&just_audio_clips, path, new_src, &added);
+	
+	// Another thread loaded the same clip at the same time
+	if (!added) audio_source_destroy(&new_src);
+	
+	return src_ptr;
+}
+Audio_Source *
+get_or_load_just_audio_clip_atom(Atom path) {
+	init_just_audio_clips_if_needed();
+	
+	Audio_Source **src_ptr_ptr = concurrent_hash_map_find(&just_audio_clip_atoms, path);
+	if (src_ptr_ptr) return *src_ptr_ptr;
+	
+	Audio_Source *src_ptr = get_or_load_just_audio_clip(atom_get_string(path));
+	if (src_ptr) concurrent_hash_map_find_or_add(&just_audio_clip_atoms, path, src_ptr, 0);
+	
+	return src_ptr;
+}
+
 void
 DEPRECATED(play_one_audio_clip_source_at_position(Audio_Source source, Vector3 pos), "Use play_one_audio_clip_source_with_config() instead") {
 	Audio_Player *p = audio_player_get_one();
@@ -1396,45 +1450,16 @@ play_one_audio_clip_source(Audio_Source source) {
 }
 void
 DEPRECATED(play_one_audio_clip_at_position(string path, Vector3 pos), "Use play_one_audio_clip_with_config() instead") {
-	if (!just_audio_clips_initted) {
-		just_audio_clips_initted = true;
-		just_audio_clips = make_hash_table(string, Audio_Source, get_heap_allocator());
-	}
-	
-	Audio_Source *src_ptr = hash_table_find(&just_audio_clips, path);
+	Audio_Source *src_ptr = get_or_load_just_audio_clip(path);
 	if (src_ptr) {
 		play_one_audio_clip_source_at_position(*src_ptr, pos);
-	} else {
-		Audio_Source new_src;
-		bool ok = audio_open_source_stream(&new_src, path, get_heap_allocator());
-		if (!ok) {
-			log_error("Could not load audio to play from %s", path);
-			return;
-		}
-		hash_table_add(&just_audio_clips, path, new_src);
-		play_one_audio_clip_source_at_position(new_src, pos);
 	}
-	
 }
 void
 play_one_audio_clip_with_config(string path, Audio_Playback_Config config) {
-	if (!just_audio_clips_initted) {
-		just_audio_clips_initted = true;
-		just_audio_clips = make_hash_table(string, Audio_Source, get_heap_allocator());
-	}
-	
-	Audio_Source *src_ptr = hash_table_find(&just_audio_clips, path);
+	Audio_Source *src_ptr = get_or_load_just_audio_clip(path);
 	if (src_ptr) {
 		play_one_audio_clip_source_with_config(*src_ptr, config);
-	} else {
-		Audio_Source new_src;
-		bool ok = audio_open_source_stream(&new_src, path, get_heap_allocator());
-		if (!ok) {
-			log_error("Could not load audio to play from %s", path);
-			return;
-		}
-		hash_table_add(&just_audio_clips, path, new_src);
-		play_one_audio_clip_source_with_config(new_src, config);
 	}
 }
 void inline
@@ -1444,6 +1469,20 @@ play_one_audio_clip(string path) {
 	config.playback_speed = 1.0;
 	play_one_audio_clip_with_config(path, config);
 }
+void
+play_one_audio_clip_atom_with_config(Atom path, Audio_Playback_Config config) {
+	Audio_Source *src_ptr = get_or_load_just_audio_clip_atom(path);
+	if (src_ptr) {
+		play_one_audio_clip_source_with_config(*src_ptr, config);
+	}
+}
+void inline
+play_one_audio_clip_atom(Atom path) {
+	Audio_Playback_Config config = {0};
+	config.volume = 1.0;
+	config.playback_speed = 1.0;
+	play_one_audio_clip_atom_with_config(path, config);
+}
 
 void
 audio_apply_fade_in(void *frames, u64 number_of_frames, Audio_Format format, 
@@ -1660,7 +1699,7 @@ void
 do_program_audio_sample(u64 number_of_output_frames, Audio_Format out_format, 
 							 void *output) {
 							 
-	reset_temporary_storage();
+	Scratch scratch = scratch_begin();
 							 
 	u64 out_comp_size  = get_audio_bit_width_byte_size(out_format.bit_width);
     u64 out_frame_size = out_comp_size * out_format.channels;
@@ -1668,8 +1707,6 @@ do_program_audio_sample(u64 number_of_output_frames, Audio_Format out_format,
     
 	memset(output, 0, output_size);
 	
-	Audio_Player_Block *block = &audio_player_block;
-	
 	// #Cleanup #Memory refactor intermediate buffers
 	local_persist thread_local void *mix_buffer = 0;
 	local_persist thread_local u64 mix_buffer_size;
@@ -1681,209 +1718,208 @@ do_program_audio_sample(u64 number_of_output_frames, Audio_Format out_format,
 	u64 *started_this_frame;
 	growing_array_init((void**)&started_this_frame, sizeof(u64), get_temporary_allocator());
 	
-	while (block) {
+	Pool_Iterator it = ZERO(Pool_Iterator);
+	Audio_Player *p;
+	while ((p = (Audio_Player*)pool_next(&audio_player_pool, &it))) {
+		if (!p->allocated) {
+			continue;
+		}
+		if (p->release_when_done && (p->frame_index >= p->source.number_of_frames
+									  || !p->has_source)) {
+			audio_player_free(p);
+			continue;
+		}
 		
-		for (u64 i = 0; i < AUDIO_PLAYERS_PER_BLOCK; i++) {
-			Audio_Player *p = &block->players[i];
-			if (p->release_when_done && (p->frame_index >= p->source.number_of_frames
-										  || !p->has_source)) {
-				p->allocated = false;
-			}
-			if (!p->allocated) {
-				continue;
-			}
-			
-			if (p->marked_for_release) {
-				p->marked_for_release = false;
-				p->allocated = false;
-				continue;
-			}
-			
-			if (p->state != AUDIO_PLAYER_STATE_PLAYING) {
-				if (p->fade_frames == 0) continue;
-			}
-			
-			// #Incomplete Reverse playback ?
-			if (p->config.playback_speed <= 0.0) continue;
-			
-			if (p->frame_index >= p->source.number_of_frames && !p->looping) continue;
-			
-			spinlock_acquire_or_wait(&p->sample_lock);
-			
-			Audio_Source src = p->source;
-			
-			mutex_acquire_or_wait(&src.mutex_for_destroy);
+		if (p->marked_for_release) {
+			p->marked_for_release = false;
+			audio_player_free(p);
+			continue;
+		}
+		
+		if (p->state != AUDIO_PLAYER_STATE_PLAYING) {
+			if (p->fade_frames == 0) continue;
+		}
+		
+		// #Incomplete Reverse playback ?
+		if (p->config.playback_speed <= 0.0) continue;
+		
+		if (p->frame_index >= p->source.number_of_frames && !p->looping) continue;
+		
+		spinlock_acquire_or_wait(&p->sample_lock);
+		
+		Audio_Source src = p->source;
+		
+		mutex_acquire_or_wait(&src.mutex_for_destroy);
 
-			Audio_Format sample_format = src.format;
-			sample_format.sample_rate = sample_format.sample_rate*p->config.playback_speed;
-			
-			bool need_convert = !bytes_match(
-				&out_format, 
-				&sample_format, 
-				sizeof(Audio_Format)
-			);
-			
-			u64 in_comp_size 
-				= get_audio_bit_width_byte_size(sample_format.bit_width);
-			
-			u64 in_frame_size = in_comp_size * sample_format.channels;
-			u64 input_size = number_of_output_frames * in_frame_size;
+		Audio_Format sample_format = src.format;
+		sample_format.sample_rate = sample_format.sample_rate*p->config.playback_speed;
+		
+		bool need_convert = !bytes_match(
+			&out_format, 
+			&sample_format, 
+			sizeof(Audio_Format)
+		);
+		
+		u64 in_comp_size 
+			= get_audio_bit_width_byte_size(sample_format.bit_width);
+		
+		u64 in_frame_size = in_comp_size * sample_format.channels;
+		u64 input_size = number_of_output_frames * in_frame_size;
+		
+		// #Copypaste #Cleanup
+		u64 biggest_size = max(input_size, output_size);
+		if (!mix_buffer || mix_buffer_size < biggest_size) {
+			u64 new_size = get_next_power_of_two(biggest_size);
+			if (mix_buffer) dealloc(get_heap_allocator(), mix_buffer);
+			mix_buffer = alloc(get_heap_allocator(), new_size);
+			mix_buffer_size = new_size;
+			memset(mix_buffer, 0, new_size);
+		}
+		
+		void *target_buffer = mix_buffer;
+		u64 number_of_sample_frames = number_of_output_frames;
+		
+		if (need_convert) {
+			if (sample_format.sample_rate != out_format.sample_rate) {
+				f64 src_ratio 
+					= (f64)sample_format.sample_rate 
+					  / (f64)out_format.sample_rate;
+					
+				number_of_sample_frames = round(number_of_output_frames * src_ratio);
+				input_size = number_of_sample_frames * in_frame_size;
+
+				// #Copypaste #Cleanup  we need to potentially grow the mix buffer again after we change input_size
+				u64 biggest_size = max(input_size, output_size);
+				if (!mix_buffer || mix_buffer_size < biggest_size) {
+					u64 new_size = get_next_power_of_two(biggest_size);
+					if (mix_buffer) dealloc(get_heap_allocator(), mix_buffer);
+					mix_buffer = alloc(get_heap_allocator(), new_size);
+					mix_buffer_size = new_size;
+					memset(mix_buffer, 0, new_size);
+				}
+			}
 			
-			// #Copypaste #Cleanup
 			u64 biggest_size = max(input_size, output_size);
-			if (!mix_buffer || mix_buffer_size < biggest_size) {
+			if (!convert_buffer || convert_buffer_size < biggest_size) {
 				u64 new_size = get_next_power_of_two(biggest_size);
-				if (mix_buffer) dealloc(get_heap_allocator(), mix_buffer);
-				mix_buffer = alloc(get_heap_allocator(), new_size);
-				mix_buffer_size = new_size;
-				memset(mix_buffer, 0, new_size);
+				if (convert_buffer) dealloc(get_heap_allocator(), convert_buffer);
+				convert_buffer = alloc(get_heap_allocator(), new_size);
+				convert_buffer_size = new_size;
+				memset(convert_buffer, 0, new_size);
 			}
+			target_buffer = convert_buffer;
 			
-			void *target_buffer = mix_buffer;
-			u64 number_of_sample_frames = number_of_output_frames;
+		}
+
+		// :PhaseCancellation
+		if (p->frame_index == 0) { // The players' source just started playing
+		
+			s64 existing_index = growing_array_find_index_from_left_by_value((void**)&started_this_frame, &src.uid);
 			
-			if (need_convert) {
-				if (sample_format.sample_rate != out_format.sample_rate) {
-					f64 src_ratio 
-						= (f64)sample_format.sample_rate 
-						  / (f64)out_format.sample_rate;
-						
-					number_of_sample_frames = round(number_of_output_frames * src_ratio);
-					input_size = number_of_sample_frames * in_frame_size;
-
-					// #Copypaste #Cleanup  we need to potentially grow the mix buffer again after we change input_size
-					u64 biggest_size = max(input_size, output_size);
-					if (!mix_buffer || mix_buffer_size < biggest_size) {
-						u64 new_size = get_next_power_of_two(biggest_size);
-						if (mix_buffer) dealloc(get_heap_allocator(), mix_buffer);
-						mix_buffer = alloc(get_heap_allocator(), new_size);
-						mix_buffer_size = new_size;
-						memset(mix_buffer, 0, new_size);
-					}
-				}
-				
-				u64 biggest_size = max(input_size, output_size);
-				if (!convert_buffer || convert_buffer_size < biggest_size) {
-					u64 new_size = get_next_power_of_two(biggest_size);
-					if (convert_buffer) dealloc(get_heap_allocator(), convert_buffer);
-					convert_buffer = alloc(get_heap_allocator(), new_size);
-					convert_buffer_size = new_size;
-					memset(convert_buffer, 0, new_size);
-				}
-				target_buffer = convert_buffer;
-				
+			if (existing_index != -1) {
+				// If this source already started playing this round from another player, then we pretend that
+				// we're already done playing by skipping to the last frame.
+				// For non-looping players, this means we don't play this instance at all.
+				// For looping players, this means we have a slight offset between the players that start
+				// playing at the exact same time. I'm not sure how else to deal with phase cancellation
+				// in looping players.
+				// #Incomplete player->is_muted_for_phase_cancellation ? 
+				p->frame_index = src.number_of_frames;
+				continue;
 			}
-	
-			// :PhaseCancellation
-			if (p->frame_index == 0) { // The players' source just started playing
+			growing_array_add((void**)&started_this_frame, &src.uid);
+		}
+
+		u64 last_frame_index = p->frame_index;
+		p->frame_index = audio_source_sample_next_frames(
+			&src,
+			p->frame_index, 
+			number_of_sample_frames,
+			target_buffer,
+			p->looping
+		);
+		if (p->frame_index > last_frame_index && (p->looping || p->frame_index != src.number_of_frames)) {
+			assert(p->frame_index - last_frame_index == number_of_sample_frames);
+		}
+		
+		if (p->fade_frames > 0) {
+			u64 frames_to_fade = min(p->fade_frames, number_of_sample_frames);
 			
-				s64 existing_index = growing_array_find_index_from_left_by_value((void**)&started_this_frame, &src.uid);
-				
-				if (existing_index != -1) {
-					// If this source already started playing this round from another player, then we pretend that
-					// we're already done playing by skipping to the last frame.
-					// For non-looping players, this means we don't play this instance at all.
-					// For looping players, this means we have a slight offset between the players that start
-					// playing at the exact same time. I'm not sure how else to deal with phase cancellation
-					// in looping players.
-					// #Incomplete player->is_muted_for_phase_cancellation ? 
-					p->frame_index = src.number_of_frames;
-					continue;
-				}
-				growing_array_add((void**)&started_this_frame, &src.uid);
-			}
-	
-			u64 last_frame_index = p->frame_index;
-			p->frame_index = audio_source_sample_next_frames(
-				&src,
-				p->frame_index, 
-				number_of_sample_frames,
-				target_buffer,
-				p->looping
-			);
-			if (p->frame_index > last_frame_index && (p->looping || p->frame_index != src.number_of_frames)) {
-				assert(p->frame_index - last_frame_index == number_of_sample_frames);
-			}
+			u64 frames_faded_so_far = (p->fade_frames_total-p->fade_frames);
 			
-			if (p->fade_frames > 0) {
-				u64 frames_to_fade = min(p->fade_frames, number_of_sample_frames);
-				
-				u64 frames_faded_so_far = (p->fade_frames_total-p->fade_frames);
-				
-				switch (p->state) {
-					case AUDIO_PLAYER_STATE_PLAYING: {
-						// We need to fade in
-						float64 fade_from 
-							= (f64)frames_faded_so_far / (f64)p->fade_frames_total;
-							
-						float64 fade_to 
-							= (f64)(frames_faded_so_far + frames_to_fade) / (f64)p->fade_frames_total;
-						audio_apply_fade_in(
-							target_buffer, 
-							frames_to_fade, 
-							p->source.format, 
-							fade_from,
-							fade_to
-						);
-						break;
-					}
-					case AUDIO_PLAYER_STATE_PAUSED: {
-						// We need to fade out
-						// #Bug #Incomplete
-						// I can't get this to fade out without noise.
-						// I tried dithering but that didn't help.
-						float64 fade_from 
-							= 1.0 - (f64)frames_faded_so_far / (f64)p->fade_frames_total;
-							
-						float64 fade_to 
-							= 1.0 - (f64)(frames_faded_so_far + frames_to_fade) / (f64)p->fade_frames_total;
-						audio_apply_fade_out(
-							target_buffer, 
-							frames_to_fade, 
-							p->source.format, 
-							fade_from,
-							fade_to
-						);
-						break;
-					}
+			switch (p->state) {
+				case AUDIO_PLAYER_STATE_PLAYING: {
+					// We need to fade in
+					float64 fade_from 
+						= (f64)frames_faded_so_far / (f64)p->fade_frames_total;
+						
+					float64 fade_to 
+						= (f64)(frames_faded_so_far + frames_to_fade) / (f64)p->fade_frames_total;
+					audio_apply_fade_in(
+						target_buffer, 
+						frames_to_fade, 
+						p->source.format, 
+						fade_from,
+						fade_to
+					);
+					break;
 				}
-				
-				p->fade_frames -= frames_to_fade;
-				
-				if (frames_to_fade < number_of_sample_frames) {
-					memset(
-						(u8*)target_buffer+frames_to_fade, 
-						0, 
-						number_of_sample_frames-frames_to_fade
+				case AUDIO_PLAYER_STATE_PAUSED: {
+					// We need to fade out
+					// #Bug #Incomplete
+					// I can't get this to fade out without noise.
+					// I tried dithering but that didn't help.
+					float64 fade_from 
+						= 1.0 - (f64)frames_faded_so_far / (f64)p->fade_frames_total;
+						
+					float64 fade_to 
+						= 1.0 - (f64)(frames_faded_so_far + frames_to_fade) / (f64)p->fade_frames_total;
+					audio_apply_fade_out(
+						target_buffer, 
+						frames_to_fade, 
+						p->source.format, 
+						fade_from,
+						fade_to
 					);
+					break;
 				}
 			}
 			
-			spinlock_release(&p->sample_lock);
-						
-			if (need_convert) {
-				int converted = convert_frames(
-					mix_buffer, 
-					out_format, 
-					convert_buffer, 
-					sample_format,
-					number_of_output_frames
+			p->fade_frames -= frames_to_fade;
+			
+			if (frames_to_fade < number_of_sample_frames) {
+				memset(
+					(u8*)target_buffer+frames_to_fade, 
+					0, 
+					number_of_sample_frames-frames_to_fade
 				);
-				assert(converted == number_of_output_frames);
 			}
+		}
+		
+		spinlock_release(&p->sample_lock);
+					
+		if (need_convert) {
+			int converted = convert_frames(
+				mix_buffer, 
+				out_format, 
+				convert_buffer, 
+				sample_format,
+				number_of_output_frames
+			);
+			assert(converted == number_of_output_frames);
+		}
 
-			if (p->config.enable_spacialization) {
-				apply_audio_spacialization(mix_buffer, out_format, number_of_output_frames, p->config.position_ndc);
-			}
-			if (p->config.volume != 0.0) {
-				apply_audio_volume(mix_buffer, out_format, number_of_output_frames, p->config.volume);
-			}
-			
-			mix_frames(output, mix_buffer, number_of_output_frames, out_format);
-			
-			mutex_release(&src.mutex_for_destroy);
+		if (p->config.enable_spacialization) {
+			apply_audio_spacialization(mix_buffer, out_format, number_of_output_frames, p->config.position_ndc);
+		}
+		if (p->config.volume != 0.0) {
+			apply_audio_volume(mix_buffer, out_format, number_of_output_frames, p->config.volume);
 		}
 		
-		block = block->next;
+		mix_frames(output, mix_buffer, number_of_output_frames, out_format);
+		
+		mutex_release(&src.mutex_for_destroy);
 	}
+	
+	scratch_end(scratch);
 }
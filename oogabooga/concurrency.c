@@ -10,12 +10,55 @@ inline bool compare_and_swap_32(volatile uint32_t *a, uint32_t b, uint32_t old);
 inline bool compare_and_swap_64(volatile uint64_t *a, uint64_t b, uint64_t old);
 inline bool compare_and_swap_bool(volatile bool *a, bool b, bool old);
 
+// Acquire loads see everything written before the release store they read from. Relaxed ones
+// only promise that the value itself isn't torn.
+inline u32 atomic_load_relaxed_32(volatile u32 *a);
+inline u64 atomic_load_relaxed_64(volatile u64 *a);
+inline u32 atomic_load_acquire_32(volatile u32 *a);
+inline u64 atomic_load_acquire_64(volatile u64 *a);
+inline void atomic_store_relaxed_32(volatile u32 *a, u32 x);
+inline void atomic_store_relaxed_64(volatile u64 *a, u64 x);
+inline void atomic_store_release_32(volatile u32 *a, u32 x);
+inline void atomic_store_release_64(volatile u64 *a, u64 x);
+// These return the previous value and are full barriers, like compare_and_swap
+inline u32 atomic_fetch_add_32(volatile u32 *a, s32 x);
+inline u64 atomic_fetch_add_64(volatile u64 *a, s64 x);
+inline u32 atomic_exchange_32(volatile u32 *a, u32 x);
+inline u64 atomic_exchange_64(volatile u64 *a, u64 x);
+// Orders everything before it against everything after it, including a store before a load
+inline void atomic_fence();
+
 ///
 // Spinlock "primitive"
 // Like a mutex but it eats up the entire core while waiting.
 // Beneficial if contention is low or sync speed is important
+//
+// Waiting threads pause between reads of the lock and back off exponentially, so they don't
+// hammer the cache line or starve a hyperthread sibling. Not fair, a thread can get the lock
+// many times in a row while another is waiting. Use Ticket_Spinlock if that matters.
+//
+// The backoff is spin_pause() (cpu.c), so SPINLOCK_MAX_BACKOFF_PAUSES caps how many pause
+// instructions a waiter does between reads of the lock.
+//
+// With ENABLE_PROFILING each lock counts how often and how long threads had to wait for it.
+
+// Number of backoff rounds a waiter does before it also yields to the OS every round. Only
+// matters when there are more threads than cores, where the holder may not even be running.
+#ifndef SPINLOCK_ROUNDS_BEFORE_YIELD
+	#define SPINLOCK_ROUNDS_BEFORE_YIELD 128
+#endif
+#ifndef SPINLOCK_CYCLE_CALIBRATION_SECONDS
+	#define SPINLOCK_CYCLE_CALIBRATION_SECONDS 0.05
+#endif
 typedef struct Spinlock {
 	volatile bool locked;
+#if ENABLE_PROFILING
+	// Only written by the thread holding the lock
+	u64 acquire_count;
+	u64 contended_count;
+	u64 wait_cycles;
+	u64 max_wait_cycles;
+#endif
 } Spinlock;
 
 void ogb_instance
@@ -31,17 +74,50 @@ spinlock_acquire_or_wait_timeout(Spinlock* l, f64 timeout_seconds);
 void ogb_instance
 spinlock_release(Spinlock* l);
 
+///
+// Ticket spinlock
+// Threads get the lock in the order they started waiting for it, at the cost of every waiter
+// spinning on the same counter. There's no timeout since a thread can't give up its place in line.
+typedef struct Ticket_Spinlock {
+	volatile u32 next_ticket;
+	volatile u32 now_serving;
+#if ENABLE_PROFILING
+	u64 acquire_count;
+	u64 contended_count;
+	u64 wait_cycles;
+	u64 max_wait_cycles;
+#endif
+} Ticket_Spinlock;
+
+void ogb_instance
+ticket_spinlock_init(Ticket_Spinlock *l);
+
+void ogb_instance
+ticket_spinlock_acquire_or_wait(Ticket_Spinlock *l);
+
+void ogb_instance
+ticket_spinlock_release(Ticket_Spinlock *l);
+
+// rdtsc cycles per second, or 0 if it's not measured yet. It's measured against
+// os_get_elapsed_seconds() over the first SPINLOCK_CYCLE_CALIBRATION_SECONDS after it's first asked for.
+u64 ogb_instance
+get_rdtsc_cycles_per_second();
+
 
 ///
-// High-level mutex primitive (short spinlock then OS mutex lock)
-// Just spins for a few (configurable) microseconds with a spinlock,
-// and if acquiring fails it falls back to a OS mutex.
+// High-level mutex primitive (short spin then park on the OS)
+// Just spins for a few (configurable) microseconds, and if the mutex is still taken the
+// thread parks with os_wait_on_address() until the holder releases it. Taking and releasing
+// a mutex nobody else wants never calls into the OS.
 #define MUTEX_DEFAULT_SPIN_TIME_MICROSECONDS 100
+typedef enum Mutex_State {
+	MUTEX_UNLOCKED = 0,
+	MUTEX_LOCKED = 1,
+	MUTEX_LOCKED_CONTENDED = 2, // Locked and threads may be parked on it
+} Mutex_State;
 typedef struct Mutex {
-	Spinlock spinlock;
+	volatile u32 state; // Mutex_State
 	f64 spin_time_microseconds;
-	Mutex_Handle os_handle;
-	volatile bool spinlock_acquired;
 	volatile u64 acquiring_thread;
 } Mutex;
 
@@ -54,40 +130,344 @@ mutex_destroy(Mutex *m);
 void ogb_instance
 mutex_acquire_or_wait(Mutex *m);
 
+// Returns false if the mutex is already taken
+bool ogb_instance
+mutex_try_acquire(Mutex *m);
+
 void ogb_instance
 mutex_release(Mutex *m);
 
+///
+// Condition variable
+// Waiting releases the mutex, parks until signaled and takes the mutex again before returning.
+// Wakeups can be spurious, so always wait in a loop which checks what you are waiting for.
+typedef struct Condition_Variable {
+	volatile u32 sequence;
+	volatile u32 waiters;
+} Condition_Variable;
+
+void ogb_instance
+condition_variable_init(Condition_Variable *cv);
+
+void ogb_instance
+condition_variable_wait(Condition_Variable *cv, Mutex *m);
+
+// Returns false if timeout_seconds passed without a signal. The mutex is taken again either way.
+bool ogb_instance
+condition_variable_wait_timeout(Condition_Variable *cv, Mutex *m, f64 timeout_seconds);
+
+// Wakes one waiting thread, does nothing if there are none
+void ogb_instance
+condition_variable_signal(Condition_Variable *cv);
+
+void ogb_instance
+condition_variable_broadcast(Condition_Variable *cv);
+
+///
+// Counting semaphore
+// Each signal lets one wait through, a wait with nothing signaled parks the thread.
+typedef struct Semaphore {
+	volatile u32 count;
+	volatile u32 waiters;
+} Semaphore;
+
+void ogb_instance
+semaphore_init(Semaphore *s, u32 initial_count);
+
+void ogb_instance
+semaphore_signal(Semaphore *s, u32 count);
+
+void ogb_instance
+semaphore_wait(Semaphore *s);
+
+// Returns false if the count is 0
+bool ogb_instance
+semaphore_try_wait(Semaphore *s);
+
+// Returns false if timeout_seconds passed before the semaphore was signaled
+bool ogb_instance
+semaphore_wait_timeout(Semaphore *s, f64 timeout_seconds);
+
+///
+// Lock-free ring buffers
+// Bounded queues of fixed size items. Capacity must be a power of 2. Pushing to a full ring or
+// popping from an empty one fails instead of waiting, so pair them with a Semaphore if the
+// consumer should sleep while there's nothing to do.
+//
+// Spsc_Ring: exactly one thread pushes and exactly one thread pops.
+// Mpmc_Ring: any number of threads push and pop. Every slot has a sequence number which says
+// if it's ready to be written or read for the current lap around the ring (Vyukov's bounded queue).
+//
+// The _many versions move as many items as there is room for (or as are available) and return
+// how many. They touch the shared counters once per call, so they are much cheaper per item.
+// In an Mpmc_Ring they may briefly spin on a slot which another thread has claimed but not
+// finished copying yet.
+/*
+
+	Example Usage:
+
+	Spsc_Ring ring;
+	spsc_ring_init(&ring, sizeof(Audio_Command), 256, get_heap_allocator());
+	
+	// Game thread
+	if (!spsc_ring_push(&ring, &command)) log_warning("Audio command ring is full");
+	
+	// Audio thread
+	Audio_Command commands[32];
+	u64 count = spsc_ring_pop_many(&ring, commands, 32);
+*/
+typedef struct Spsc_Ring {
+	// Only written by the consumer
+	volatile u64 read;
+	u64 cached_write;
+	u8 read_padding[64-2*sizeof(u64)];
+	// Only written by the producer
+	volatile u64 write;
+	u64 cached_read;
+	u8 write_padding[64-2*sizeof(u64)];
+	
+	u8 *items;
+	u64 item_size;
+	u64 capacity;
+	Allocator allocator;
+} Spsc_Ring;
+
+typedef struct Mpmc_Ring {
+	volatile u64 write;
+	u8 write_padding[64-sizeof(u64)];
+	volatile u64 read;
+	u8 read_padding[64-sizeof(u64)];
+	
+	u8 *slots; // Each is a u64 sequence followed by the item
+	u64 slot_size;
+	u64 item_size;
+	u64 capacity;
+	Allocator allocator;
+} Mpmc_Ring;
+
+void ogb_instance
+spsc_ring_init(Spsc_Ring *r, u64 item_size, u64 capacity, Allocator allocator);
+
+void ogb_instance
+spsc_ring_destroy(Spsc_Ring *r);
+
+bool ogb_instance
+spsc_ring_push(Spsc_Ring *r, void *item);
+
+u64 ogb_instance
+spsc_ring_push_many(Spsc_Ring *r, void *items, u64 max_count);
+
+bool ogb_instance
+spsc_ring_pop(Spsc_Ring *r, void *item);
+
+u64 ogb_instance
+spsc_ring_pop_many(Spsc_Ring *r, void *items, u64 max_count);
+
+// Only exact when called from the producer or consumer thread while the other is idle
+u64 ogb_instance
+spsc_ring_count(Spsc_Ring *r);
+
+void ogb_instance
+mpmc_ring_init(Mpmc_Ring *r, u64 item_size, u64 capacity, Allocator allocator);
+
+void ogb_instance
+mpmc_ring_destroy(Mpmc_Ring *r);
+
+bool ogb_instance
+mpmc_ring_push(Mpmc_Ring *r, void *item);
+
+u64 ogb_instance
+mpmc_ring_push_many(Mpmc_Ring *r, void *items, u64 max_count);
+
+bool ogb_instance
+mpmc_ring_pop(Mpmc_Ring *r, void *item);
+
+u64 ogb_instance
+mpmc_ring_pop_many(Mpmc_Ring *r, void *items, u64 max_count);
+
+// Includes items which are claimed but not finished being pushed or popped
+u64 ogb_instance
+mpmc_ring_count(Mpmc_Ring *r);
+
+///
+// Job system
+// A worker thread per logical processor (minus the thread that calls job_system_init, which
+// also takes part) with a Chase-Lev work stealing deque each. Jobs pushed from a worker or the
+// init thread go on that thread's own deque, jobs pushed from any other thread go through a
+// shared queue. Workers with nothing to do steal from the others and sleep when there's
+// nothing to steal.
+//
+// Dependencies are expressed with Job_Counter's: every job run with a counter increments it and
+// decrements it when done, and job_wait_for_counter() runs other jobs while it waits.
+//
+// Each worker has its own temporary storage which is reset after every job, so don't return
+// memory from get_temporary_allocator() out of a job.
+/*
+
+	Example Usage:
+
+	job_system_init(0); // 0 workers means one per logical processor
+
+	Job_Counter counter = ZERO(Job_Counter);
+	job_run(decode_image, &images[0], &counter);
+	job_run(decode_image, &images[1], &counter);
+	job_wait_for_counter(&counter);
+
+	// proc(start, end, data) for ranges of [0, particle_count), batch size 0 picks one
+	parallel_for(particle_count, 0, update_particles, particles);
+
+	job_system_shutdown();
+*/
+
+#ifndef JOB_DEQUE_CAPACITY
+	#define JOB_DEQUE_CAPACITY 4096 // Per worker, must be a power of 2. Jobs run right away when full.
+#endif
+#ifndef JOB_SHARED_QUEUE_CAPACITY
+	#define JOB_SHARED_QUEUE_CAPACITY 1024
+#endif
+#ifndef JOB_WORKER_TEMPORARY_STORAGE_SIZE
+	#define JOB_WORKER_TEMPORARY_STORAGE_SIZE (1024ULL*1024ULL)
+#endif
+#ifndef PARALLEL_FOR_MAX_JOBS
+	#define PARALLEL_FOR_MAX_JOBS 256
+#endif
+
+typedef void(*Job_Proc)(void *data);
+typedef void(*Parallel_For_Proc)(u64 start, u64 end, void *data);
+
+typedef struct Job_Counter {
+	volatile u64 pending;
+} Job_Counter;
+
+typedef struct Job {
+	Job_Proc proc;
+	void *data;
+	Job_Counter *counter;
+} Job;
+
+// 0 workers means os_get_number_of_logical_processors()-1
+void ogb_instance
+job_system_init(u64 worker_count);
+
+// Waits for the workers to finish what they are doing, jobs left in the queues are not run
+void ogb_instance
+job_system_shutdown();
+
+// Runs right away on this thread if the job system is not initialized
+void ogb_instance
+job_run(Job_Proc proc, void *data, Job_Counter *counter);
+
+bool ogb_instance
+job_counter_is_done(Job_Counter *counter);
+
+// Runs other jobs until the counter reaches 0
+void ogb_instance
+job_wait_for_counter(Job_Counter *counter);
+
+// Calls proc with ranges covering [0, count) on all workers and waits for them to finish.
+void ogb_instance
+parallel_for(u64 count, u64 batch_size, Parallel_For_Proc proc, void *data);
+
+// Number of threads running jobs, including the one that called job_system_init. 1 if not initialized.
+u64 ogb_instance
+job_system_get_thread_count();
+
+// In [0, job_system_get_thread_count()) on threads in the job system, -1 on others
+s64 ogb_instance
+job_system_get_thread_index();
+
 
 #if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
 
+u64 rdtsc_calibration_start_cycles = 0;
+f64 rdtsc_calibration_start_seconds = 0;
+u64 rdtsc_cycles_per_second = 0;
+
+u64 get_rdtsc_cycles_per_second() {
+	if (rdtsc_cycles_per_second) return rdtsc_cycles_per_second;
+	
+	// Threads racing on this all end up with about the same answer, which is fine
+	if (!rdtsc_calibration_start_cycles) {
+		rdtsc_calibration_start_seconds = os_get_elapsed_seconds();
+		MEMORY_BARRIER;
+		rdtsc_calibration_start_cycles = rdtsc();
+		return 0;
+	}
+	f64 seconds = os_get_elapsed_seconds() - rdtsc_calibration_start_seconds;
+	if (seconds < SPINLOCK_CYCLE_CALIBRATION_SECONDS) return 0;
+	
+	rdtsc_cycles_per_second = (u64)((f64)(rdtsc() - rdtsc_calibration_start_cycles) / seconds);
+	return rdtsc_cycles_per_second;
+}
+
 void spinlock_init(Spinlock *l) {
 	memset(l, 0, sizeof(*l));
 }
+#if ENABLE_PROFILING
+	#define SPINLOCK_RECORD_ACQUIRE(l, start_cycles) { \
+		(l)->acquire_count += 1; \
+		if (start_cycles) { \
+			u64 _waited = rdtsc() - (start_cycles); \
+			(l)->contended_count += 1; \
+			(l)->wait_cycles += _waited; \
+			if (_waited > (l)->max_wait_cycles) (l)->max_wait_cycles = _waited; \
+		} \
+	}
+#else
+	#define SPINLOCK_RECORD_ACQUIRE(l, start_cycles)
+#endif
 void spinlock_acquire_or_wait(Spinlock* l) {
+	if (compare_and_swap_bool(&l->locked, true, false)) {
+		SPINLOCK_RECORD_ACQUIRE(l, 0);
+		return;
+	}
+	
+	u64 start_cycles = rdtsc();
+	u64 backoff = 1;
+	u64 rounds = 0;
 	while (true) {
-        bool expected = false;
-        if (compare_and_swap_bool(&l->locked, true, expected)) {
-            return;
-        }
-        while (l->locked) {
-            // spinny boi
-        }
-    }
+		// Only read while it's taken so the cache line isn't bounced between cores
+		while (l->locked) {
+			spin_pause(&backoff);
+			if (++rounds > SPINLOCK_ROUNDS_BEFORE_YIELD) os_yield_thread();
+		}
+		if (compare_and_swap_bool(&l->locked, true, false)) {
+			SPINLOCK_RECORD_ACQUIRE(l, start_cycles);
+			return;
+		}
+	}
 }
 // Returns true on aquired, false if timeout seconds reached
 bool spinlock_acquire_or_wait_timeout(Spinlock* l, f64 timeout_seconds) {
-    f64 start = os_get_elapsed_seconds();
+	if (compare_and_swap_bool(&l->locked, true, false)) {
+		SPINLOCK_RECORD_ACQUIRE(l, 0);
+		return true;
+	}
+	
+	u64 start_cycles = rdtsc();
+	u64 cycles_per_second = get_rdtsc_cycles_per_second();
+	f64 start_seconds = cycles_per_second ? 0 : os_get_elapsed_seconds();
+	u64 timeout_cycles = (u64)(timeout_seconds*(f64)cycles_per_second);
+	u64 backoff = 1;
+	u64 rounds = 0;
 	while (true) {
-        bool expected = false;
-        if (compare_and_swap_bool(&l->locked, true, expected)) {
-            return true;
-        }
-        while (l->locked) {
-            // spinny boi
-            if ((os_get_elapsed_seconds()-start) >= timeout_seconds) return false;
-        }
-    }
-    return true;
+		while (l->locked) {
+			spin_pause(&backoff);
+			if (++rounds > SPINLOCK_ROUNDS_BEFORE_YIELD) os_yield_thread();
+			
+			// Until rdtsc is calibrated, fall back to asking the OS
+			if (cycles_per_second) {
+				if (rdtsc() - start_cycles >= timeout_cycles) return false;
+			} else {
+				if ((os_get_elapsed_seconds()-start_seconds) >= timeout_seconds) return false;
+			}
+		}
+		if (compare_and_swap_bool(&l->locked, true, false)) {
+			SPINLOCK_RECORD_ACQUIRE(l, start_cycles);
+			return true;
+		}
+	}
+	return true;
 }
 void spinlock_release(Spinlock* l) {
 	bool expected = true;
@@ -95,40 +475,706 @@ void spinlock_release(Spinlock* l) {
     assert(success, "This thread should have acquired the spinlock but compare_and_swap failed");
 }
 
+///
+// Ticket spinlock
+
+void ticket_spinlock_init(Ticket_Spinlock *l) {
+	memset(l, 0, sizeof(*l));
+}
+void ticket_spinlock_acquire_or_wait(Ticket_Spinlock *l) {
+	u32 ticket;
+	do {
+		ticket = l->next_ticket;
+	} while (!compare_and_swap_32(&l->next_ticket, ticket+1, ticket));
+	
+	if (l->now_serving == ticket) {
+		SPINLOCK_RECORD_ACQUIRE(l, 0);
+		return;
+	}
+	
+	u64 start_cycles = rdtsc();
+	u64 rounds = 0;
+	while (true) {
+		u32 serving = l->now_serving;
+		if (serving == ticket) break;
+		// Back off by how many are ahead of us in line
+		u32 ahead = ticket - serving;
+		for (u64 i = 0; i < min(ahead, SPINLOCK_MAX_BACKOFF_PAUSES); i++) _mm_pause();
+		// The thread whose turn it is might not be running, and nobody can cut in line for it
+		if (++rounds > SPINLOCK_ROUNDS_BEFORE_YIELD) os_yield_thread();
+	}
+	MEMORY_BARRIER;
+	SPINLOCK_RECORD_ACQUIRE(l, start_cycles);
+}
+void ticket_spinlock_release(Ticket_Spinlock *l) {
+	assert(l->next_ticket != l->now_serving, "Tried to release a Ticket_Spinlock which is not acquired");
+	MEMORY_BARRIER;
+	// Only the holder writes this so it doesn't need to be atomic
+	l->now_serving = l->now_serving + 1;
+}
 
 ///
-// High-level mutex primitive (short spinlock then OS mutex lock)
+// High-level mutex primitive (short spin then park on the OS)
+
+// Converts what's left of timeout_seconds to what os_wait_on_address() wants, rounding up
+s64 sync_remaining_timeout_ms(f64 start_seconds, f64 timeout_seconds) {
+	f64 remaining = timeout_seconds - (os_get_elapsed_seconds() - start_seconds);
+	if (remaining <= 0) return 0;
+	return (s64)(remaining*1000.0) + 1;
+}
 
 void mutex_init(Mutex *m) {
-	spinlock_init(&m->spinlock);
+	m->state = MUTEX_UNLOCKED;
 	m->spin_time_microseconds = MUTEX_DEFAULT_SPIN_TIME_MICROSECONDS;
-	m->os_handle = os_make_mutex();
-	m->spinlock_acquired = false;
 	m->acquiring_thread = 0;
 }
 void mutex_destroy(Mutex *m) {
-	os_destroy_mutex(m->os_handle);
+	assert(m->state == MUTEX_UNLOCKED, "Destroyed a mutex which is still acquired");
 }
 void mutex_acquire_or_wait(Mutex *m) {
-	if (spinlock_acquire_or_wait_timeout(&m->spinlock, m->spin_time_microseconds / 1000000.0)) {
-        assert(!m->spinlock_acquired, "Internal sync error in Mutex");
-    	m->spinlock_acquired = true;
-    }
-    os_lock_mutex(m->os_handle);
-    
-    assert(!m->acquiring_thread, "Internal sync error in Mutex: Multiple threads acquired");
-    m->acquiring_thread = context.thread_id;
+	if (!compare_and_swap_32(&m->state, MUTEX_LOCKED, MUTEX_UNLOCKED)) {
+		
+		// The holder is probably about to release it, so spin for a bit before parking
+		u64 cycles_per_second = get_rdtsc_cycles_per_second();
+		f64 spin_seconds = m->spin_time_microseconds / 1000000.0;
+		u64 spin_cycles = (u64)(spin_seconds*(f64)cycles_per_second);
+		u64 start_cycles = rdtsc();
+		f64 start_seconds = cycles_per_second ? 0 : os_get_elapsed_seconds();
+		u64 backoff = 1;
+		bool acquired = false;
+		while (true) {
+			u32 state = m->state;
+			if (state == MUTEX_UNLOCKED && compare_and_swap_32(&m->state, MUTEX_LOCKED, MUTEX_UNLOCKED)) {
+				acquired = true;
+				break;
+			}
+			// Others are already parked, get in line with them
+			if (state == MUTEX_LOCKED_CONTENDED) break;
+			
+			if (cycles_per_second) {
+				if (rdtsc() - start_cycles >= spin_cycles) break;
+			} else {
+				if ((os_get_elapsed_seconds()-start_seconds) >= spin_seconds) break;
+			}
+			spin_pause(&backoff);
+		}
+		
+		if (!acquired) {
+			// We can't know if we're the last one parked, so taking it from here always leaves
+			// it marked as contended. That costs at most one unnecessary wake on release.
+			u32 contended = MUTEX_LOCKED_CONTENDED;
+			while (atomic_exchange_32(&m->state, MUTEX_LOCKED_CONTENDED) != MUTEX_UNLOCKED) {
+				os_wait_on_address(&m->state, &contended, sizeof(u32), -1);
+			}
+		}
+	}
+	
+	assert(!m->acquiring_thread, "Internal sync error in Mutex: Multiple threads acquired");
+	m->acquiring_thread = context.thread_id;
+}
+bool mutex_try_acquire(Mutex *m) {
+	if (!compare_and_swap_32(&m->state, MUTEX_LOCKED, MUTEX_UNLOCKED)) return false;
+	
+	assert(!m->acquiring_thread, "Internal sync error in Mutex: Multiple threads acquired");
+	m->acquiring_thread = context.thread_id;
+	return true;
 }
 void mutex_release(Mutex *m) {
 	assert(m->acquiring_thread != 0, "Tried to release a mutex which is not acquired");
 	assert(m->acquiring_thread == context.thread_id, "Non-owning thread tried to release mutex");
 	m->acquiring_thread = 0;
-	bool was_spinlock_acquired = m->spinlock_acquired;
-	m->spinlock_acquired = false;
-	os_unlock_mutex(m->os_handle);
-	if (was_spinlock_acquired) {
-		spinlock_release(&m->spinlock);
+	u32 previous = atomic_exchange_32(&m->state, MUTEX_UNLOCKED);
+	assert(previous != MUTEX_UNLOCKED, "Internal sync error in Mutex: Released while unlocked");
+	if (previous == MUTEX_LOCKED_CONTENDED) {
+		os_wake_one_on_address(&m->state);
+	}
+}
+
+///
+// Condition variable
+
+void condition_variable_init(Condition_Variable *cv) {
+	cv->sequence = 0;
+	cv->waiters = 0;
+}
+bool condition_variable_wait_internal(Condition_Variable *cv, Mutex *m, s64 timeout_ms) {
+	// Registering and reading the sequence happens while we still hold the mutex, so a signal
+	// sent after the caller checked its condition either bumps the sequence before we park or
+	// sees us in waiters and wakes us up.
+	atomic_fetch_add_32(&cv->waiters, 1);
+	u32 sequence = cv->sequence;
+	mutex_release(m);
+	
+	bool woken = os_wait_on_address(&cv->sequence, &sequence, sizeof(u32), timeout_ms);
+	
+	atomic_fetch_add_32(&cv->waiters, -1);
+	mutex_acquire_or_wait(m);
+	return woken || cv->sequence != sequence;
+}
+void condition_variable_wait(Condition_Variable *cv, Mutex *m) {
+	condition_variable_wait_internal(cv, m, -1);
+}
+bool condition_variable_wait_timeout(Condition_Variable *cv, Mutex *m, f64 timeout_seconds) {
+	return condition_variable_wait_internal(cv, m, sync_remaining_timeout_ms(os_get_elapsed_seconds(), timeout_seconds));
+}
+void condition_variable_signal(Condition_Variable *cv) {
+	atomic_fetch_add_32(&cv->sequence, 1);
+	if (cv->waiters) os_wake_one_on_address(&cv->sequence);
+}
+void condition_variable_broadcast(Condition_Variable *cv) {
+	atomic_fetch_add_32(&cv->sequence, 1);
+	if (cv->waiters) os_wake_all_on_address(&cv->sequence);
+}
+
+///
+// Counting semaphore
+
+void semaphore_init(Semaphore *s, u32 initial_count) {
+	s->count = initial_count;
+	s->waiters = 0;
+}
+void semaphore_signal(Semaphore *s, u32 count) {
+	if (count == 0) return;
+	atomic_fetch_add_32(&s->count, (s32)count);
+	if (s->waiters) {
+		if (count == 1) os_wake_one_on_address(&s->count);
+		else            os_wake_all_on_address(&s->count);
+	}
+}
+bool semaphore_try_wait(Semaphore *s) {
+	while (true) {
+		u32 count = s->count;
+		if (count == 0) return false;
+		if (compare_and_swap_32(&s->count, count-1, count)) return true;
+	}
+}
+bool semaphore_wait_internal(Semaphore *s, f64 timeout_seconds) {
+	if (semaphore_try_wait(s)) return true;
+	
+	f64 start_seconds = timeout_seconds >= 0 ? os_get_elapsed_seconds() : 0;
+	u32 zero = 0;
+	while (true) {
+		atomic_fetch_add_32(&s->waiters, 1);
+		// A signal between registering and parking changes count, so the wait returns right away
+		bool woken = true;
+		if (s->count == 0) {
+			s64 timeout_ms = timeout_seconds >= 0 ? sync_remaining_timeout_ms(start_seconds, timeout_seconds) : -1;
+			woken = os_wait_on_address(&s->count, &zero, sizeof(u32), timeout_ms);
+		}
+		atomic_fetch_add_32(&s->waiters, -1);
+		
+		if (semaphore_try_wait(s)) return true;
+		if (!woken) return false;
+	}
+}
+void semaphore_wait(Semaphore *s) {
+	semaphore_wait_internal(s, -1);
+}
+bool semaphore_wait_timeout(Semaphore *s, f64 timeout_seconds) {
+	return semaphore_wait_internal(s, max(timeout_seconds, 0));
+}
+
+
+///
+// Lock-free ring buffers
+
+void spsc_ring_init(Spsc_Ring *r, u64 item_size, u64 capacity, Allocator allocator) {
+	assert(capacity > 0 && (capacity & (capacity-1)) == 0, "Ring capacity must be a power of 2, got %i", capacity);
+	assert(item_size > 0, "Ring item_size must not be 0");
+	memset(r, 0, sizeof(*r));
+	r->item_size = item_size;
+	r->capacity = capacity;
+	r->allocator = allocator;
+	r->items = (u8*)alloc(allocator, item_size*capacity);
+}
+void spsc_ring_destroy(Spsc_Ring *r) {
+	dealloc(r->allocator, r->items);
+	memset(r, 0, sizeof(*r));
+}
+// Copies count items between the ring and a flat array, wrapping around the end of the ring
+void ring_copy_in(u8 *ring_items, u64 item_size, u64 capacity, u64 position, void *items, u64 count) {
+	u64 index = position & (capacity-1);
+	u64 first = min(count, capacity-index);
+	memcpy(ring_items + index*item_size, items, first*item_size);
+	memcpy(ring_items, (u8*)items + first*item_size, (count-first)*item_size);
+}
+void ring_copy_out(u8 *ring_items, u64 item_size, u64 capacity, u64 position, void *items, u64 count) {
+	u64 index = position & (capacity-1);
+	u64 first = min(count, capacity-index);
+	memcpy(items, ring_items + index*item_size, first*item_size);
+	memcpy((u8*)items + first*item_size, ring_items, (count-first)*item_size);
+}
+u64 spsc_ring_push_many(Spsc_Ring *r, void *items, u64 max_count) {
+	u64 write = r->write;
+	// Only look at the consumer's counter when the last one we saw says there's not enough room
+	u64 room = r->capacity - (write - r->cached_read);
+	if (room < max_count) {
+		r->cached_read = atomic_load_acquire_64(&r->read);
+		room = r->capacity - (write - r->cached_read);
 	}
+	u64 count = min(max_count, room);
+	if (count == 0) return 0;
+	
+	ring_copy_in(r->items, r->item_size, r->capacity, write, items, count);
+	atomic_store_release_64(&r->write, write + count);
+	return count;
+}
+bool spsc_ring_push(Spsc_Ring *r, void *item) {
+	return spsc_ring_push_many(r, item, 1) == 1;
+}
+u64 spsc_ring_pop_many(Spsc_Ring *r, void *items, u64 max_count) {
+	u64 read = r->read;
+	u64 available = r->cached_write - read;
+	if (available < max_count) {
+		r->cached_write = atomic_load_acquire_64(&r->write);
+		available = r->cached_write - read;
+	}
+	u64 count = min(max_count, available);
+	if (count == 0) return 0;
+	
+	ring_copy_out(r->items, r->item_size, r->capacity, read, items, count);
+	atomic_store_release_64(&r->read, read + count);
+	return count;
+}
+bool spsc_ring_pop(Spsc_Ring *r, void *item) {
+	return spsc_ring_pop_many(r, item, 1) == 1;
+}
+u64 spsc_ring_count(Spsc_Ring *r) {
+	return atomic_load_acquire_64(&r->write) - atomic_load_acquire_64(&r->read);
+}
+
+void mpmc_ring_init(Mpmc_Ring *r, u64 item_size, u64 capacity, Allocator allocator) {
+	assert(capacity > 0 && (capacity & (capacity-1)) == 0, "Ring capacity must be a power of 2, got %i", capacity);
+	assert(item_size > 0, "Ring item_size must not be 0");
+	memset(r, 0, sizeof(*r));
+	r->item_size = item_size;
+	r->slot_size = align_next(sizeof(u64) + item_size, sizeof(u64));
+	r->capacity = capacity;
+	r->allocator = allocator;
+	r->slots = (u8*)alloc(allocator, r->slot_size*capacity);
+	for (u64 i = 0; i < capacity; i++) {
+		*(u64*)(r->slots + i*r->slot_size) = i;
+	}
+}
+void mpmc_ring_destroy(Mpmc_Ring *r) {
+	dealloc(r->allocator, r->slots);
+	memset(r, 0, sizeof(*r));
+}
+inline volatile u64 *mpmc_ring_slot(Mpmc_Ring *r, u64 position) {
+	return (volatile u64*)(r->slots + (position & (r->capacity-1))*r->slot_size);
+}
+// For slots which are already claimed, so the thread we're waiting on is in the middle of a copy
+void mpmc_ring_wait_for_slot(volatile u64 *slot, u64 sequence) {
+	u64 rounds = 0;
+	while (atomic_load_acquire_64(slot) != sequence) {
+		_mm_pause();
+		if (++rounds > SPINLOCK_ROUNDS_BEFORE_YIELD) os_yield_thread();
+	}
+}
+bool mpmc_ring_push(Mpmc_Ring *r, void *item) {
+	u64 write = atomic_load_relaxed_64(&r->write);
+	volatile u64 *slot;
+	while (true) {
+		slot = mpmc_ring_slot(r, write);
+		s64 diff = (s64)(atomic_load_acquire_64(slot) - write);
+		if (diff == 0) {
+			if (compare_and_swap_64(&r->write, write+1, write)) break;
+		} else if (diff < 0) {
+			// Still holds the item from the previous lap
+			return false;
+		}
+		write = atomic_load_relaxed_64(&r->write);
+	}
+	memcpy((u8*)slot + sizeof(u64), item, r->item_size);
+	atomic_store_release_64(slot, write+1);
+	return true;
+}
+u64 mpmc_ring_push_many(Mpmc_Ring *r, void *items, u64 max_count) {
+	u64 write;
+	u64 count;
+	while (true) {
+		write = atomic_load_relaxed_64(&r->write);
+		u64 read = atomic_load_acquire_64(&r->read);
+		// read is newer than write, so this can only underestimate the room once the CAS
+		// confirms write is still current
+		s64 used = (s64)(write - read);
+		if (used < 0) continue;
+		u64 room = r->capacity - (u64)used;
+		count = min(max_count, room);
+		if (count == 0) return 0;
+		if (compare_and_swap_64(&r->write, write+count, write)) break;
+	}
+	
+	for (u64 i = 0; i < count; i++) {
+		volatile u64 *slot = mpmc_ring_slot(r, write+i);
+		mpmc_ring_wait_for_slot(slot, write+i);
+		memcpy((u8*)slot + sizeof(u64), (u8*)items + i*r->item_size, r->item_size);
+		atomic_store_release_64(slot, write+i+1);
+	}
+	return count;
+}
+bool mpmc_ring_pop(Mpmc_Ring *r, void *item) {
+	u64 read = atomic_load_relaxed_64(&r->read);
+	volatile u64 *slot;
+	while (true) {
+		slot = mpmc_ring_slot(r, read);
+		s64 diff = (s64)(atomic_load_acquire_64(slot) - (read+1));
+		if (diff == 0) {
+			if (compare_and_swap_64(&r->read, read+1, read)) break;
+		} else if (diff < 0) {
+			// Not written for this lap yet
+			return false;
+		}
+		read = atomic_load_relaxed_64(&r->read);
+	}
+	memcpy(item, (u8*)slot + sizeof(u64), r->item_size);
+	atomic_store_release_64(slot, read + r->capacity);
+	return true;
+}
+u64 mpmc_ring_pop_many(Mpmc_Ring *r, void *items, u64 max_count) {
+	u64 read;
+	u64 count;
+	while (true) {
+		read = atomic_load_relaxed_64(&r->read);
+		u64 write = atomic_load_acquire_64(&r->write);
+		s64 available = (s64)(write - read);
+		if (available <= 0 || max_count == 0) return 0;
+		count = min(max_count, (u64)available);
+		if (compare_and_swap_64(&r->read, read+count, read)) break;
+	}
+	
+	for (u64 i = 0; i < count; i++) {
+		volatile u64 *slot = mpmc_ring_slot(r, read+i);
+		mpmc_ring_wait_for_slot(slot, read+i+1);
+		memcpy((u8*)items + i*r->item_size, (u8*)slot + sizeof(u64), r->item_size);
+		atomic_store_release_64(slot, read+i + r->capacity);
+	}
+	return count;
+}
+u64 mpmc_ring_count(Mpmc_Ring *r) {
+	u64 read = atomic_load_acquire_64(&r->read);
+	u64 write = atomic_load_acquire_64(&r->write);
+	return write > read ? write - read : 0;
+}
+
+///
+// Job system
+
+// In memory.c
+ogb_instance void reset_temporary_storage();
+
+typedef struct Job_Deque {
+	// Owner pushes and pops at the bottom, thieves take from the top
+	volatile s64 top;
+	u8 top_padding[64-sizeof(s64)];
+	volatile s64 bottom;
+	u8 bottom_padding[64-sizeof(s64)];
+	Job jobs[JOB_DEQUE_CAPACITY];
+} Job_Deque;
+
+typedef struct Job_Worker {
+	Job_Deque deque;
+	Thread thread;
+	Semaphore wake;
+	volatile bool sleeping;
+	u64 index;
+	u64 steal_seed;
+} Job_Worker;
+
+typedef struct Job_System {
+	Job_Worker *workers; // [0] is the thread which called job_system_init, it has no Thread
+	u64 worker_count;
+	
+	Spinlock shared_lock;
+	Job shared_jobs[JOB_SHARED_QUEUE_CAPACITY];
+	volatile u64 shared_read;
+	volatile u64 shared_write;
+	
+	volatile u64 sleeping_count;
+	volatile bool shutting_down;
+	bool initted;
+} Job_System;
+
+Job_System job_system = ZERO(Job_System);
+thread_local s64 job_worker_index = -1;
+
+bool job_deque_push(Job_Deque *d, Job job) {
+	s64 b = d->bottom;
+	s64 t = d->top;
+	if (b - t >= JOB_DEQUE_CAPACITY) return false;
+	d->jobs[b & (JOB_DEQUE_CAPACITY-1)] = job;
+	MEMORY_BARRIER; // The job must be written before thieves can see it
+	d->bottom = b + 1;
+	return true;
+}
+bool job_deque_pop(Job_Deque *d, Job *job) {
+	s64 b = d->bottom - 1;
+	d->bottom = b;
+	atomic_fence(); // The store to bottom must be visible before we read top
+	s64 t = d->top;
+	if (t > b) {
+		d->bottom = b + 1;
+		return false;
+	}
+	*job = d->jobs[b & (JOB_DEQUE_CAPACITY-1)];
+	if (t == b) {
+		// Last one, race the thieves for it
+		bool won = compare_and_swap_64((volatile u64*)&d->top, (u64)(t + 1), (u64)t);
+		d->bottom = b + 1;
+		return won;
+	}
+	return true;
+}
+bool job_deque_steal(Job_Deque *d, Job *job) {
+	s64 t = d->top;
+	MEMORY_BARRIER;
+	s64 b = d->bottom;
+	if (t >= b) return false;
+	// Might be overwritten while we read it, but then top has moved and the swap fails
+	Job stolen = d->jobs[t & (JOB_DEQUE_CAPACITY-1)];
+	if (!compare_and_swap_64((volatile u64*)&d->top, (u64)(t + 1), (u64)t)) return false;
+	*job = stolen;
+	return true;
+}
+
+bool job_shared_pop(Job *job) {
+	if (job_system.shared_read == job_system.shared_write) return false;
+	bool found = false;
+	spinlock_acquire_or_wait(&job_system.shared_lock);
+	if (job_system.shared_read != job_system.shared_write) {
+		*job = job_system.shared_jobs[job_system.shared_read % JOB_SHARED_QUEUE_CAPACITY];
+		job_system.shared_read += 1;
+		found = true;
+	}
+	spinlock_release(&job_system.shared_lock);
+	return found;
+}
+
+bool job_find(Job *job) {
+	Job_Worker *self = job_worker_index >= 0 ? &job_system.workers[job_worker_index] : 0;
+	
+	if (self && job_deque_pop(&self->deque, job)) return true;
+	if (job_shared_pop(job)) return true;
+	
+	// Start at a random worker so thieves don't all go for the same one
+	u64 n = job_system.worker_count;
+	u64 start = self ? xx_hash(self->steal_seed++) % n : 0;
+	for (u64 i = 0; i < n; i++) {
+		Job_Worker *victim = &job_system.workers[(start + i) % n];
+		if (victim == self) continue;
+		if (job_deque_steal(&victim->deque, job)) return true;
+	}
+	return false;
+}
+
+bool job_any_available() {
+	if (job_system.shared_read != job_system.shared_write) return true;
+	for (u64 i = 0; i < job_system.worker_count; i++) {
+		Job_Deque *d = &job_system.workers[i].deque;
+		if (d->bottom > d->top) return true;
+	}
+	return false;
+}
+
+void job_execute(Job job) {
+	job.proc(job.data);
+	if (job.counter) atomic_fetch_add_64(&job.counter->pending, -1);
+}
+
+void job_wake_one() {
+	atomic_fence(); // The pushed job must be visible before we check who's sleeping
+	if (job_system.sleeping_count == 0) return;
+	for (u64 i = 1; i < job_system.worker_count; i++) {
+		Job_Worker *w = &job_system.workers[i];
+		if (w->sleeping && compare_and_swap_bool(&w->sleeping, false, true)) {
+			atomic_fetch_add_64(&job_system.sleeping_count, -1);
+			semaphore_signal(&w->wake, 1);
+			return;
+		}
+	}
+}
+
+void job_worker_proc(Thread *t) {
+	Job_Worker *w = (Job_Worker*)t->data;
+	job_worker_index = (s64)w->index;
+	
+	while (!job_system.shutting_down) {
+		Job job;
+		bool found = false;
+		for (u64 spin = 0; spin < 64 && !found; spin++) {
+			found = job_find(&job);
+			if (!found) _mm_pause();
+		}
+		
+		if (found) {
+			job_execute(job);
+			reset_temporary_storage();
+			continue;
+		}
+		
+		// Announce that we're going to sleep, then check again so a job pushed in between isn't missed
+		w->sleeping = true;
+		atomic_fetch_add_64(&job_system.sleeping_count, 1);
+		atomic_fence();
+		if (job_any_available() || job_system.shutting_down) {
+			if (compare_and_swap_bool(&w->sleeping, false, true)) {
+				atomic_fetch_add_64(&job_system.sleeping_count, -1);
+				continue;
+			}
+			// Someone is already waking us up, eat the signal
+		}
+		semaphore_wait(&w->wake);
+	}
+}
+
+void job_system_init(u64 worker_count) {
+	assert(!job_system.initted, "job_system_init called twice");
+	
+	if (worker_count == 0) {
+		u64 processors = os_get_number_of_logical_processors();
+		worker_count = processors > 1 ? processors-1 : 1;
+	}
+	
+	job_system = ZERO(Job_System);
+	job_system.worker_count = worker_count + 1;
+	job_system.workers = (Job_Worker*)alloc(get_heap_allocator(), job_system.worker_count*sizeof(Job_Worker));
+	memset(job_system.workers, 0, job_system.worker_count*sizeof(Job_Worker));
+	spinlock_init(&job_system.shared_lock);
+	
+	job_worker_index = 0;
+	for (u64 i = 0; i < job_system.worker_count; i++) {
+		Job_Worker *w = &job_system.workers[i];
+		w->index = i;
+		w->steal_seed = i*7919 + 1;
+		if (i == 0) continue;
+		
+		semaphore_init(&w->wake, 0);
+		os_thread_init(&w->thread, job_worker_proc);
+		w->thread.data = w;
+		w->thread.temporary_storage_size = JOB_WORKER_TEMPORARY_STORAGE_SIZE;
+	}
+	job_system.initted = true;
+	MEMORY_BARRIER;
+	for (u64 i = 1; i < job_system.worker_count; i++) {
+		os_thread_start(&job_system.workers[i].thread);
+	}
+}
+
+void job_system_shutdown() {
+	if (!job_system.initted) return;
+	
+	job_system.shutting_down = true;
+	atomic_fence();
+	for (u64 i = 1; i < job_system.worker_count; i++) {
+		semaphore_signal(&job_system.workers[i].wake, 1);
+	}
+	for (u64 i = 1; i < job_system.worker_count; i++) {
+		Job_Worker *w = &job_system.workers[i];
+		os_thread_destroy(&w->thread);
+	}
+	
+	dealloc(get_heap_allocator(), job_system.workers);
+	job_system = ZERO(Job_System);
+	job_worker_index = -1;
+}
+
+void job_run(Job_Proc proc, void *data, Job_Counter *counter) {
+	Job job = { proc, data, counter };
+	if (counter) atomic_fetch_add_64(&counter->pending, 1);
+	
+	if (!job_system.initted) {
+		job_execute(job);
+		return;
+	}
+	
+	if (job_worker_index >= 0) {
+		if (!job_deque_push(&job_system.workers[job_worker_index].deque, job)) {
+			job_execute(job);
+			return;
+		}
+	} else {
+		while (true) {
+			spinlock_acquire_or_wait(&job_system.shared_lock);
+			bool pushed = job_system.shared_write - job_system.shared_read < JOB_SHARED_QUEUE_CAPACITY;
+			if (pushed) {
+				job_system.shared_jobs[job_system.shared_write % JOB_SHARED_QUEUE_CAPACITY] = job;
+				job_system.shared_write += 1;
+			}
+			spinlock_release(&job_system.shared_lock);
+			if (pushed) break;
+			
+			// Full, help out until there's room
+			Job other;
+			if (job_find(&other)) job_execute(other);
+			else _mm_pause();
+		}
+	}
+	
+	job_wake_one();
+}
+
+bool job_counter_is_done(Job_Counter *counter) {
+	return counter->pending == 0;
+}
+
+void job_wait_for_counter(Job_Counter *counter) {
+	u64 idle_spins = 0;
+	while (counter->pending != 0) {
+		Job job;
+		if (job_system.initted && job_find(&job)) {
+			job_execute(job);
+			idle_spins = 0;
+		} else if (idle_spins < 1000) {
+			_mm_pause();
+			idle_spins += 1;
+		} else {
+			os_yield_thread();
+		}
+	}
+	MEMORY_BARRIER; // Don't read results before the counter
+}
+
+typedef struct Parallel_For_Job {
+	Parallel_For_Proc proc;
+	void *data;
+	u64 start;
+	u64 end;
+} Parallel_For_Job;
+
+void parallel_for_job_proc(void *data) {
+	Parallel_For_Job *j = (Parallel_For_Job*)data;
+	j->proc(j->start, j->end, j->data);
+}
+
+void parallel_for(u64 count, u64 batch_size, Parallel_For_Proc proc, void *data) {
+	if (count == 0) return;
+	
+	// A few batches per thread so threads that finish early can steal the rest
+	if (batch_size == 0) batch_size = max(count / (job_system_get_thread_count()*4), 1);
+	if ((count + batch_size - 1) / batch_size > PARALLEL_FOR_MAX_JOBS) {
+		batch_size = (count + PARALLEL_FOR_MAX_JOBS - 1) / PARALLEL_FOR_MAX_JOBS;
+	}
+	u64 batch_count = (count + batch_size - 1) / batch_size;
+	
+	Parallel_For_Job jobs[PARALLEL_FOR_MAX_JOBS];
+	Job_Counter counter = ZERO(Job_Counter);
+	for (u64 i = 0; i < batch_count; i++) {
+		jobs[i] = (Parallel_For_Job){ proc, data, i*batch_size, min((i+1)*batch_size, count) };
+	}
+	// The first batch is run on this thread right away
+	for (u64 i = batch_count-1; i >= 1; i--) {
+		job_run(parallel_for_job_proc, &jobs[i], &counter);
+	}
+	parallel_for_job_proc(&jobs[0]);
+	
+	job_wait_for_counter(&counter);
+}
+
+u64 job_system_get_thread_count() {
+	return job_system.initted ? job_system.worker_count : 1;
+}
+s64 job_system_get_thread_index() {
+	return job_worker_index;
 }
 
 #endif
\ No newline at end of file
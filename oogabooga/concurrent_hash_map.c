@@ -0,0 +1,418 @@
+// A hash map which can be used from many threads at once, made for read-mostly things like
+// asset caches.
+//
+// Lookups never lock. They walk the slots of the current table and see either a node or not,
+// because slots are only ever changed with compare_and_swap_64.
+// Writes lock one of CONCURRENT_HASH_MAP_STRIPE_COUNT spinlocks picked from the key hash, so
+// writes to different keys rarely wait on each other. Growing the table takes all of them.
+//
+// Each entry is its own node which is never changed after it's published. Setting an existing
+// key publishes a new node, and removing an entry just clears its slot. Old nodes and old
+// tables are kept around until the map is destroyed so a reader can never see freed memory,
+// which is fine for caches but means you shouldn't churn through lots of keys with this.
+
+/*
+
+	Example Usage:
+
+	// Same as Hash_Table, but keys & values are copied into nodes allocated with the allocator
+	Concurrent_Hash_Map map = make_concurrent_hash_map(string, Audio_Source, get_heap_allocator());
+
+	// From any thread:
+	Audio_Source *src = concurrent_hash_map_find(&map, path);
+	if (!src) {
+		Audio_Source new_src = load(path);
+
+		// If another thread added this key after our find, we get its value and ours was not added.
+		bool added;
+		src = concurrent_hash_map_find_or_add(&map, path, new_src, &added);
+		if (!added) unload(new_src);
+	}
+
+	// Removes & sets also work from any thread
+	concurrent_hash_map_set(&map, path, other_src);
+	concurrent_hash_map_remove(&map, path);
+
+	// Needs to be the only thread touching the map
+	concurrent_hash_map_destroy(&map);
+
+
+	Limitations:
+		- Same key types as Hash_Table; string keys are copied.
+		- Values are immutable once added. Pointers returned by find stay valid until the map is
+		  destroyed, but point to the old value if the key is set again or removed.
+		- Creating and destroying the map is not thread safe.
+*/
+
+typedef struct Concurrent_Hash_Map Concurrent_Hash_Map;
+
+// API:
+#define make_concurrent_hash_map(Key_Type, Value_Type, allocator) \
+	make_concurrent_hash_map_raw(sizeof(Key_Type), sizeof(Value_Type), get_hash_table_key_kind(Key_Type), allocator)
+
+#define concurrent_hash_map_find(map_ptr, key) \
+	concurrent_hash_map_find_raw((map_ptr), get_hash(key), &(key), sizeof(key))
+
+#define concurrent_hash_map_contains(map_ptr, key) \
+	concurrent_hash_map_contains_raw((map_ptr), get_hash(key), &(key), sizeof(key))
+
+#define concurrent_hash_map_set(map_ptr, key, value) \
+	concurrent_hash_map_set_raw((map_ptr), get_hash(key), &(key), &(value), sizeof(key), sizeof(value))
+
+#define concurrent_hash_map_find_or_add(map_ptr, key, value, added_ptr) \
+	concurrent_hash_map_find_or_add_raw((map_ptr), get_hash(key), &(key), &(value), sizeof(key), sizeof(value), (added_ptr))
+
+#define concurrent_hash_map_remove(map_ptr, key) \
+	concurrent_hash_map_remove_raw((map_ptr), get_hash(key), &(key), sizeof(key))
+
+#ifndef CONCURRENT_HASH_MAP_STRIPE_COUNT
+	#define CONCURRENT_HASH_MAP_STRIPE_COUNT 16 // Needs to be a power of two
+#endif
+
+// Slot that used to have an entry. Lookups probe past it.
+#define CONCURRENT_HASH_MAP_TOMBSTONE 1ull
+
+typedef struct Concurrent_Hash_Map_Node Concurrent_Hash_Map_Node;
+typedef struct Concurrent_Hash_Map_Node {
+	Concurrent_Hash_Map_Node *next_retired;
+	u64 hash;
+	// Followed by key & value, each padded to 8 bytes
+} Concurrent_Hash_Map_Node;
+
+typedef struct Concurrent_Hash_Map_Table Concurrent_Hash_Map_Table;
+typedef struct Concurrent_Hash_Map_Table {
+	Concurrent_Hash_Map_Table *next_retired;
+	u64 slot_count; // Power of two
+	// Node pointer, 0 for empty or CONCURRENT_HASH_MAP_TOMBSTONE
+	volatile u64 slots[];
+} Concurrent_Hash_Map_Table;
+
+typedef struct Concurrent_Hash_Map_Stripe {
+	Spinlock lock;
+	// Own cache line(s) so stripes don't slow each other down. Spinlock has stats in it, so pad
+	// up from whatever size it is rather than assuming one byte.
+	u8 padding[64 - sizeof(Spinlock)%64];
+} Concurrent_Hash_Map_Stripe;
+
+typedef struct Concurrent_Hash_Map {
+	Concurrent_Hash_Map_Table *volatile table;
+
+	volatile u64 count; // Entries in the map
+	volatile u64 used_slot_count; // Entries + tombstones in the current table
+
+	// Lists of replaced nodes & tables which readers may still be looking at
+	volatile u64 retired_nodes;
+	Concurrent_Hash_Map_Table *retired_tables;
+
+	Concurrent_Hash_Map_Stripe stripes[CONCURRENT_HASH_MAP_STRIPE_COUNT];
+
+	u64 _key_size;
+	u64 _value_size;
+	Hash_Table_Key_Kind _key_kind;
+
+	Allocator allocator;
+} Concurrent_Hash_Map;
+
+inline u64 concurrent_hash_map_key_offset(Concurrent_Hash_Map *m) {
+	return sizeof(Concurrent_Hash_Map_Node);
+}
+inline u64 concurrent_hash_map_value_offset(Concurrent_Hash_Map *m) {
+	return sizeof(Concurrent_Hash_Map_Node) + align_next(m->_key_size, 8);
+}
+
+inline void concurrent_hash_map_add_to(volatile u64 *x, s64 amount) {
+	while (true) {
+		u64 old = *x;
+		if (compare_and_swap_64(x, old+(u64)amount, old)) return;
+	}
+}
+
+Concurrent_Hash_Map_Table *concurrent_hash_map_make_table(Concurrent_Hash_Map *m, u64 slot_count) {
+	u64 size = sizeof(Concurrent_Hash_Map_Table) + slot_count*sizeof(u64);
+	Concurrent_Hash_Map_Table *t = (Concurrent_Hash_Map_Table*)alloc(m->allocator, size);
+	memset(t, 0, size);
+	t->slot_count = slot_count;
+	return t;
+}
+
+Concurrent_Hash_Map make_concurrent_hash_map_raw(u64 key_size, u64 value_size, Hash_Table_Key_Kind key_kind, Allocator allocator) {
+	Concurrent_Hash_Map m = ZERO(Concurrent_Hash_Map);
+
+	m._key_size = key_size;
+	m._value_size = value_size;
+	m._key_kind = key_kind;
+	m.allocator = allocator;
+
+	assert(key_kind != HASH_TABLE_KEY_STRING || key_size == sizeof(string), "Concurrent hash map key kind is string but the key size doesn't match");
+
+	for (u64 i = 0; i < CONCURRENT_HASH_MAP_STRIPE_COUNT; i++) spinlock_init(&m.stripes[i].lock);
+
+	m.table = concurrent_hash_map_make_table(&m, 64);
+
+	return m;
+}
+
+void concurrent_hash_map_free_node(Concurrent_Hash_Map *m, Concurrent_Hash_Map_Node *node) {
+	if (m->_key_kind == HASH_TABLE_KEY_STRING) {
+		string *key = (string*)((u8*)node + concurrent_hash_map_key_offset(m));
+		if (key->count) dealloc_string(m->allocator, *key);
+	}
+	dealloc(m->allocator, node);
+}
+
+// Not thread safe, nobody else can be using the map
+void concurrent_hash_map_destroy(Concurrent_Hash_Map *m) {
+	Concurrent_Hash_Map_Table *t = m->table;
+	if (t) {
+		for (u64 i = 0; i < t->slot_count; i++) {
+			u64 slot = t->slots[i];
+			if (slot > CONCURRENT_HASH_MAP_TOMBSTONE) concurrent_hash_map_free_node(m, (Concurrent_Hash_Map_Node*)slot);
+		}
+		dealloc(m->allocator, t);
+	}
+
+	Concurrent_Hash_Map_Node *node = (Concurrent_Hash_Map_Node*)m->retired_nodes;
+	while (node) {
+		Concurrent_Hash_Map_Node *next = node->next_retired;
+		concurrent_hash_map_free_node(m, node);
+		node = next;
+	}
+
+	Concurrent_Hash_Map_Table *retired = m->retired_tables;
+	while (retired) {
+		Concurrent_Hash_Map_Table *next = retired->next_retired;
+		dealloc(m->allocator, retired);
+		retired = next;
+	}
+
+	m->table = 0;
+	m->retired_nodes = 0;
+	m->retired_tables = 0;
+	m->count = 0;
+	m->used_slot_count = 0;
+}
+
+// Removed or replaced nodes may still be read by other threads, so we can't free them yet
+void concurrent_hash_map_retire_node(Concurrent_Hash_Map *m, Concurrent_Hash_Map_Node *node) {
+	while (true) {
+		u64 head = m->retired_nodes;
+		node->next_retired = (Concurrent_Hash_Map_Node*)head;
+		if (compare_and_swap_64(&m->retired_nodes, (u64)node, head)) return;
+	}
+}
+
+bool concurrent_hash_map_node_matches(Concurrent_Hash_Map *m, Concurrent_Hash_Map_Node *node, u64 hash, void *k) {
+	if (node->hash != hash) return false;
+	void *node_key = (u8*)node + concurrent_hash_map_key_offset(m);
+	if (m->_key_kind == HASH_TABLE_KEY_STRING) return strings_match(*(string*)node_key, *(string*)k);
+	return memcmp(node_key, k, m->_key_size) == 0;
+}
+
+// Returns the slot index of key in t, or -1
+s64 concurrent_hash_map_find_slot(Concurrent_Hash_Map *m, Concurrent_Hash_Map_Table *t, u64 hash, void *k) {
+	u64 mask = t->slot_count-1;
+	u64 pos = hash & mask;
+
+	for (u64 i = 0; i < t->slot_count; i++) {
+		u64 slot = t->slots[pos];
+		if (slot == 0) return -1;
+		if (slot != CONCURRENT_HASH_MAP_TOMBSTONE && concurrent_hash_map_node_matches(m, (Concurrent_Hash_Map_Node*)slot, hash, k)) {
+			return (s64)pos;
+		}
+		pos = (pos+1) & mask;
+	}
+	return -1;
+}
+
+void *concurrent_hash_map_find_raw(Concurrent_Hash_Map *m, u64 hash, void *k, u64 key_size) {
+	assert(m->_key_size == key_size, "Key type size does not match concurrent hash map initted key type size");
+
+	Concurrent_Hash_Map_Table *t = m->table;
+	s64 pos = concurrent_hash_map_find_slot(m, t, hash, k);
+	if (pos < 0) return 0;
+
+	// The slot may have been changed since we looked at it, but whatever node we read last is
+	// still valid to return.
+	u64 slot = t->slots[pos];
+	if (slot <= CONCURRENT_HASH_MAP_TOMBSTONE) return 0;
+	return (u8*)slot + concurrent_hash_map_value_offset(m);
+}
+
+bool concurrent_hash_map_contains_raw(Concurrent_Hash_Map *m, u64 hash, void *k, u64 key_size) {
+	return concurrent_hash_map_find_raw(m, hash, k, key_size) != 0;
+}
+
+Concurrent_Hash_Map_Stripe *concurrent_hash_map_get_stripe(Concurrent_Hash_Map *m, u64 hash) {
+	// Top bits, since the low bits pick the slot
+	return &m->stripes[(hash >> 58) & (CONCURRENT_HASH_MAP_STRIPE_COUNT-1)];
+}
+
+// Grows into a new table with twice the slots and without tombstones.
+// Takes all stripe locks, so the caller can't hold any.
+void concurrent_hash_map_grow(Concurrent_Hash_Map *m, Concurrent_Hash_Map_Table *full_table) {
+	for (u64 i = 0; i < CONCURRENT_HASH_MAP_STRIPE_COUNT; i++) spinlock_acquire_or_wait(&m->stripes[i].lock);
+
+	// Someone else may have grown it while we were waiting
+	Concurrent_Hash_Map_Table *old = m->table;
+	if (old == full_table) {
+		u64 new_slot_count = old->slot_count;
+		while (m->count*4 >= new_slot_count) new_slot_count *= 2;
+
+		Concurrent_Hash_Map_Table *t = concurrent_hash_map_make_table(m, new_slot_count);
+		u64 mask = new_slot_count-1;
+		for (u64 i = 0; i < old->slot_count; i++) {
+			u64 slot = old->slots[i];
+			if (slot <= CONCURRENT_HASH_MAP_TOMBSTONE) continue;
+			u64 pos = ((Concurrent_Hash_Map_Node*)slot)->hash & mask;
+			while (t->slots[pos]) pos = (pos+1) & mask;
+			t->slots[pos] = slot;
+		}
+
+		m->used_slot_count = m->count;
+		MEMORY_BARRIER;
+		m->table = t;
+
+		old->next_retired = m->retired_tables;
+		m->retired_tables = old;
+	}
+
+	for (s64 i = CONCURRENT_HASH_MAP_STRIPE_COUNT-1; i >= 0; i--) spinlock_release(&m->stripes[i].lock);
+}
+
+// Returns the stripe of hash, locked, with a current table that has room for one more entry
+Concurrent_Hash_Map_Stripe *concurrent_hash_map_lock_for_write(Concurrent_Hash_Map *m, u64 hash) {
+	Concurrent_Hash_Map_Stripe *stripe = concurrent_hash_map_get_stripe(m, hash);
+	while (true) {
+		spinlock_acquire_or_wait(&stripe->lock);
+		Concurrent_Hash_Map_Table *t = m->table;
+
+		// Other stripes can be inserting at the same time, so leave room for all of them
+		if ((m->used_slot_count+CONCURRENT_HASH_MAP_STRIPE_COUNT)*4 <= t->slot_count*3) return stripe;
+
+		spinlock_release(&stripe->lock);
+		concurrent_hash_map_grow(m, t);
+	}
+}
+
+Concurrent_Hash_Map_Node *concurrent_hash_map_make_node(Concurrent_Hash_Map *m, u64 hash, void *k, void *v) {
+	u64 size = concurrent_hash_map_value_offset(m) + align_next(m->_value_size, 8);
+	Concurrent_Hash_Map_Node *node = (Concurrent_Hash_Map_Node*)alloc(m->allocator, size);
+	node->next_retired = 0;
+	node->hash = hash;
+
+	u8 *key = (u8*)node + concurrent_hash_map_key_offset(m);
+	if (m->_key_kind == HASH_TABLE_KEY_STRING) {
+		string src = *(string*)k;
+		string copy = ZERO(string);
+		if (src.count) {
+			copy = alloc_string(m->allocator, src.count);
+			memcpy(copy.data, src.data, src.count);
+		}
+		memcpy(key, &copy, sizeof(string));
+	} else {
+		memcpy(key, k, m->_key_size);
+	}
+	memcpy((u8*)node + concurrent_hash_map_value_offset(m), v, m->_value_size);
+
+	return node;
+}
+
+// Expects the stripe of hash to be locked and the key to not be in the table
+void concurrent_hash_map_insert_node(Concurrent_Hash_Map *m, Concurrent_Hash_Map_Node *node) {
+	// Node needs to be written before other threads can see it
+	MEMORY_BARRIER;
+
+	Concurrent_Hash_Map_Table *t = m->table;
+	u64 mask = t->slot_count-1;
+	u64 pos = node->hash & mask;
+
+	// Only take empty slots. Other stripes are racing us for them, so we need to CAS.
+	while (true) {
+		if (t->slots[pos] == 0 && compare_and_swap_64(&t->slots[pos], (u64)node, 0)) break;
+		pos = (pos+1) & mask;
+	}
+
+	concurrent_hash_map_add_to(&m->used_slot_count, 1);
+	concurrent_hash_map_add_to(&m->count, 1);
+}
+
+// Returns the value of key if it exists, otherwise adds key & value and returns the new value.
+// *added is set to whether or not it was added.
+void *concurrent_hash_map_find_or_add_raw(Concurrent_Hash_Map *m, u64 hash, void *k, void *v, u64 key_size, u64 value_size, bool *added) {
+	assert(m->_key_size == key_size, "Key type size does not match concurrent hash map initted key type size");
+	assert(m->_value_size == value_size, "Value type size does not match concurrent hash map initted value type size");
+
+	// Fast path, no lock
+	void *existing = concurrent_hash_map_find_raw(m, hash, k, key_size);
+	if (existing) {
+		if (added) *added = false;
+		return existing;
+	}
+
+	Concurrent_Hash_Map_Stripe *stripe = concurrent_hash_map_lock_for_write(m, hash);
+
+	// Writes to this key go through this stripe, so if it's still not here nobody can add it
+	existing = concurrent_hash_map_find_raw(m, hash, k, key_size);
+	if (existing) {
+		spinlock_release(&stripe->lock);
+		if (added) *added = false;
+		return existing;
+	}
+
+	Concurrent_Hash_Map_Node *node = concurrent_hash_map_make_node(m, hash, k, v);
+	concurrent_hash_map_insert_node(m, node);
+
+	spinlock_release(&stripe->lock);
+
+	if (added) *added = true;
+	return (u8*)node + concurrent_hash_map_value_offset(m);
+}
+
+// Returns true if key was newly added or false if it already existed
+bool concurrent_hash_map_set_raw(Concurrent_Hash_Map *m, u64 hash, void *k, void *v, u64 key_size, u64 value_size) {
+	assert(m->_key_size == key_size, "Key type size does not match concurrent hash map initted key type size");
+	assert(m->_value_size == value_size, "Value type size does not match concurrent hash map initted value type size");
+
+	Concurrent_Hash_Map_Stripe *stripe = concurrent_hash_map_lock_for_write(m, hash);
+
+	Concurrent_Hash_Map_Node *node = concurrent_hash_map_make_node(m, hash, k, v);
+
+	Concurrent_Hash_Map_Table *t = m->table;
+	s64 pos = concurrent_hash_map_find_slot(m, t, hash, k);
+	bool newly_added = pos < 0;
+
+	if (newly_added) {
+		concurrent_hash_map_insert_node(m, node);
+	} else {
+		// Only this stripe writes to this slot now that it has a node, so no CAS needed
+		MEMORY_BARRIER;
+		Concurrent_Hash_Map_Node *old = (Concurrent_Hash_Map_Node*)t->slots[pos];
+		t->slots[pos] = (u64)node;
+		concurrent_hash_map_retire_node(m, old);
+	}
+
+	spinlock_release(&stripe->lock);
+
+	return newly_added;
+}
+
+// Returns true if the key existed
+bool concurrent_hash_map_remove_raw(Concurrent_Hash_Map *m, u64 hash, void *k, u64 key_size) {
+	assert(m->_key_size == key_size, "Key type size does not match concurrent hash map initted key type size");
+
+	Concurrent_Hash_Map_Stripe *stripe = concurrent_hash_map_get_stripe(m, hash);
+	spinlock_acquire_or_wait(&stripe->lock);
+
+	Concurrent_Hash_Map_Table *t = m->table;
+	s64 pos = concurrent_hash_map_find_slot(m, t, hash, k);
+	if (pos >= 0) {
+		Concurrent_Hash_Map_Node *old = (Concurrent_Hash_Map_Node*)t->slots[pos];
+		t->slots[pos] = CONCURRENT_HASH_MAP_TOMBSTONE;
+		concurrent_hash_map_add_to(&m->count, -1);
+		concurrent_hash_map_retire_node(m, old);
+	}
+
+	spinlock_release(&stripe->lock);
+
+	return pos >= 0;
+}
@@ -107,6 +107,83 @@ typedef struct Cpu_Capabilities {
 	
 	#define MEMORY_BARRIER _ReadWriteBarrier()
 	
+	#pragma intrinsic(_InterlockedExchangeAdd)
+	#pragma intrinsic(_InterlockedExchangeAdd64)
+	#pragma intrinsic(_InterlockedExchange)
+	#pragma intrinsic(_InterlockedExchange64)
+	
+	// Plain loads and stores are already acquire and release on x64, they just need to keep
+	// the compiler from moving other memory accesses across them.
+	inline u32 
+	atomic_load_relaxed_32(volatile u32 *a) { return *a; }
+	inline u64 
+	atomic_load_relaxed_64(volatile u64 *a) { return *a; }
+	inline u32 
+	atomic_load_acquire_32(volatile u32 *a) { u32 x = *a; _ReadWriteBarrier(); return x; }
+	inline u64 
+	atomic_load_acquire_64(volatile u64 *a) { u64 x = *a; _ReadWriteBarrier(); return x; }
+	inline void 
+	atomic_store_relaxed_32(volatile u32 *a, u32 x) { *a = x; }
+	inline void 
+	atomic_store_relaxed_64(volatile u64 *a, u64 x) { *a = x; }
+	inline void 
+	atomic_store_release_32(volatile u32 *a, u32 x) { _ReadWriteBarrier(); *a = x; }
+	inline void 
+	atomic_store_release_64(volatile u64 *a, u64 x) { _ReadWriteBarrier(); *a = x; }
+	
+	inline u32 
+	atomic_fetch_add_32(volatile u32 *a, s32 x) {
+		return (u32)_InterlockedExchangeAdd((volatile long*)a, (long)x);
+	}
+	inline u64 
+	atomic_fetch_add_64(volatile u64 *a, s64 x) {
+		return (u64)_InterlockedExchangeAdd64((volatile long long*)a, (long long)x);
+	}
+	inline u32 
+	atomic_exchange_32(volatile u32 *a, u32 x) {
+		return (u32)_InterlockedExchange((volatile long*)a, (long)x);
+	}
+	inline u64 
+	atomic_exchange_64(volatile u64 *a, u64 x) {
+		return (u64)_InterlockedExchange64((volatile long long*)a, (long long)x);
+	}
+	
+	inline void 
+	atomic_fence() { _mm_mfence(); }
+	
+	#pragma intrinsic(_BitScanForward)
+	// x must not be 0
+	inline u32 
+	count_trailing_zeros_u32(u32 x) {
+		unsigned long index;
+		_BitScanForward(&index, x);
+		return (u32)index;
+	}
+	#pragma intrinsic(_BitScanReverse)
+	// x must not be 0
+	inline u32 
+	count_leading_zeros_u32(u32 x) {
+		unsigned long index;
+		_BitScanReverse(&index, x);
+		return 31 - (u32)index;
+	}
+	
+	// msvc lets us use any intrinsic in any function, so code for newer instruction sets can be
+	// compiled in and picked at runtime with query_cpu_capabilities()
+	#define COMPILER_CAN_TARGET_SSE2 1
+	#define COMPILER_CAN_TARGET_AVX2 1
+	#define target_sse2
+	#define target_avx2
+	
+	#define prefetch(p) _mm_prefetch((const char*)(p), _MM_HINT_T0)
+	
+	#pragma intrinsic(_umul128)
+	// Returns the low 64 bits of a*b, high 64 bits go in *high
+	inline u64 
+	multiply_u64_128(u64 a, u64 b, u64 *high) {
+		return _umul128(a, b, high);
+	}
+	
 	#define thread_local __declspec(thread)
 	
 	#define SHARED_EXPORT __declspec(dllexport)
@@ -227,6 +304,72 @@ typedef struct Cpu_Capabilities {
 	
 	#define MEMORY_BARRIER {__asm__ __volatile__("" ::: "memory");__sync_synchronize();}
 	
+	inline u32 
+	atomic_load_relaxed_32(volatile u32 *a) { return __atomic_load_n(a, __ATOMIC_RELAXED); }
+	inline u64 
+	atomic_load_relaxed_64(volatile u64 *a) { return __atomic_load_n(a, __ATOMIC_RELAXED); }
+	inline u32 
+	atomic_load_acquire_32(volatile u32 *a) { return __atomic_load_n(a, __ATOMIC_ACQUIRE); }
+	inline u64 
+	atomic_load_acquire_64(volatile u64 *a) { return __atomic_load_n(a, __ATOMIC_ACQUIRE); }
+	inline void 
+	atomic_store_relaxed_32(volatile u32 *a, u32 x) { __atomic_store_n(a, x, __ATOMIC_RELAXED); }
+	inline void 
+	atomic_store_relaxed_64(volatile u64 *a, u64 x) { __atomic_store_n(a, x, __ATOMIC_RELAXED); }
+	inline void 
+	atomic_store_release_32(volatile u32 *a, u32 x) { __atomic_store_n(a, x, __ATOMIC_RELEASE); }
+	inline void 
+	atomic_store_release_64(volatile u64 *a, u64 x) { __atomic_store_n(a, x, __ATOMIC_RELEASE); }
+	
+	inline u32 
+	atomic_fetch_add_32(volatile u32 *a, s32 x) {
+		return __atomic_fetch_add(a, (u32)x, __ATOMIC_SEQ_CST);
+	}
+	inline u64 
+	atomic_fetch_add_64(volatile u64 *a, s64 x) {
+		return __atomic_fetch_add(a, (u64)x, __ATOMIC_SEQ_CST);
+	}
+	inline u32 
+	atomic_exchange_32(volatile u32 *a, u32 x) {
+		return __atomic_exchange_n(a, x, __ATOMIC_SEQ_CST);
+	}
+	inline u64 
+	atomic_exchange_64(volatile u64 *a, u64 x) {
+		return __atomic_exchange_n(a, x, __ATOMIC_SEQ_CST);
+	}
+	
+	inline void 
+	atomic_fence() { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+	
+	// x must not be 0
+	inline u32 
+	count_trailing_zeros_u32(u32 x) {
+		return (u32)__builtin_ctz(x);
+	}
+	// x must not be 0
+	inline u32 
+	count_leading_zeros_u32(u32 x) {
+		return (u32)__builtin_clz(x);
+	}
+	
+	// Functions marked with these may use the instruction set even if the rest of the program
+	// is not compiled for it. Only call them after checking query_cpu_capabilities().
+	// They can't be inlined into functions without the same target.
+	#define COMPILER_CAN_TARGET_SSE2 1
+	#define COMPILER_CAN_TARGET_AVX2 1
+	#define target_sse2 __attribute__((target("sse2")))
+	#define target_avx2 __attribute__((target("avx2")))
+	
+	#define prefetch(p) __builtin_prefetch((p))
+	
+	// Returns the low 64 bits of a*b, high 64 bits go in *high
+	inline u64 
+	multiply_u64_128(u64 a, u64 b, u64 *high) {
+		__uint128_t r = (__uint128_t)a*b;
+		*high = (u64)(r >> 64);
+		return (u64)r;
+	}
+	
 	#define thread_local __thread
 	
 #if TARGET_OS == WINDOWS
@@ -253,9 +396,53 @@ typedef struct Cpu_Capabilities {
     
     #define MEMORY_BARRIER
     
+    inline u32 
+    count_trailing_zeros_u32(u32 x) {
+    	u32 n = 0;
+    	while (!(x & 1)) { x >>= 1; n += 1; }
+    	return n;
+    }
+    inline u32 
+    count_leading_zeros_u32(u32 x) {
+    	u32 n = 0;
+    	while (!(x & 0x80000000)) { x <<= 1; n += 1; }
+    	return n;
+    }
+    
+    #define COMPILER_CAN_TARGET_SSE2 0
+    #define COMPILER_CAN_TARGET_AVX2 0
+    #define target_sse2
+    #define target_avx2
+    
+    #define prefetch(p)
+    
+    inline u64 
+    multiply_u64_128(u64 a, u64 b, u64 *high) {
+    	u64 a_lo = a & 0xFFFFFFFF, a_hi = a >> 32;
+    	u64 b_lo = b & 0xFFFFFFFF, b_hi = b >> 32;
+    	u64 lo_lo = a_lo*b_lo, hi_lo = a_hi*b_lo, lo_hi = a_lo*b_hi, hi_hi = a_hi*b_hi;
+    	u64 cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+    	*high = hi_hi + (hi_lo >> 32) + (cross >> 32);
+    	return (cross << 32) | (lo_lo & 0xFFFFFFFF);
+    }
+    
     #warning "Compiler is not explicitly supported, some things will probably not work as expected"
 #endif
 
+///
+// Spin waiting
+// Waits *backoff pause instructions and doubles it for next time, up to
+// SPINLOCK_MAX_BACKOFF_PAUSES. Start *backoff at 1. For loops waiting on another thread, so they
+// don't hammer the cache line or starve a hyperthread sibling.
+#ifndef SPINLOCK_MAX_BACKOFF_PAUSES
+	#define SPINLOCK_MAX_BACKOFF_PAUSES 64
+#endif
+inline void 
+spin_pause(u64 *backoff) {
+	for (u64 i = 0; i < *backoff; i++) _mm_pause();
+	if (*backoff < SPINLOCK_MAX_BACKOFF_PAUSES) *backoff *= 2;
+}
+
 
 
 Cpu_Capabilities 
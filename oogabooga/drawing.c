@@ -93,6 +93,12 @@
 			The projection and xform gets applied directly in each draw_xxx call. So, you need to set
 			the camera stuff just before drawing stuff to a specific camera.
 			
+			projection*inverse(camera_xform) is cached in the frame and only recomputed when one of
+			them has changed since the last draw, so changing the camera often is fine but there is
+			no need to re-set it every draw call either. You can get it with:
+			
+			Matrix4 draw_frame_get_world_to_clip(Draw_Frame *frame);
+			
 			The cbuffer is for passing a constant buffer to the custom shader. For more info on custom
 			shading, see examples/custom_shader.c.
 				
@@ -204,6 +210,12 @@ typedef struct Draw_Frame {
 	s32 z_stack[Z_STACK_MAX];
 	bool enable_z_sorting;
 	
+	// projection*inverse(camera_xform), and the values it was computed from
+	Matrix4 world_to_clip;
+	Matrix4 world_to_clip_projection;
+	Matrix4 world_to_clip_camera_xform;
+	bool world_to_clip_valid;
+	
 } Draw_Frame;
 
 void draw_frame_init(Draw_Frame *frame) {
@@ -245,12 +257,32 @@ ogb_instance Draw_Frame draw_frame;
 Draw_Frame draw_frame;
 #endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
 
+Matrix4 draw_frame_get_world_to_clip(Draw_Frame *frame) {
+	// The fields are set directly by the user so we can't know when they change, but comparing
+	// them is a lot cheaper than an inverse and a multiply for every quad
+	if (!frame->world_to_clip_valid
+	 || memcmp(&frame->projection, &frame->world_to_clip_projection, sizeof(Matrix4)) != 0
+	 || memcmp(&frame->camera_xform, &frame->world_to_clip_camera_xform, sizeof(Matrix4)) != 0) {
+		frame->world_to_clip_projection = frame->projection;
+		frame->world_to_clip_camera_xform = frame->camera_xform;
+		frame->world_to_clip = m4_mul(frame->projection, m4_inverse(frame->camera_xform));
+		frame->world_to_clip_valid = true;
+	}
+	return frame->world_to_clip;
+}
+
+// Quad corners have z=0 and w=1 and we only keep xy, so only 6 of the matrix values matter
+inline Vector2 draw_transform_point(Matrix4 *m, Vector2 p) {
+	return v2(m->m[0][0]*p.x + m->m[0][1]*p.y + m->m[0][3],
+	          m->m[1][0]*p.x + m->m[1][1]*p.y + m->m[1][3]);
+}
+
 Draw_Quad _nil_quad = {0};
 Draw_Quad *draw_quad_projected_in_frame(Draw_Quad quad, Matrix4 world_to_clip, Draw_Frame *frame) {
-	quad.bottom_left  = m4_transform(world_to_clip, v4(v2_expand(quad.bottom_left), 0, 1)).xy;
-	quad.top_left     = m4_transform(world_to_clip, v4(v2_expand(quad.top_left), 0, 1)).xy;
-	quad.top_right    = m4_transform(world_to_clip, v4(v2_expand(quad.top_right), 0, 1)).xy;
-	quad.bottom_right = m4_transform(world_to_clip, v4(v2_expand(quad.bottom_right), 0, 1)).xy;
+	quad.bottom_left  = draw_transform_point(&world_to_clip, quad.bottom_left);
+	quad.top_left     = draw_transform_point(&world_to_clip, quad.top_left);
+	quad.top_right    = draw_transform_point(&world_to_clip, quad.top_right);
+	quad.bottom_right = draw_transform_point(&world_to_clip, quad.bottom_right);
 	
 	bool should_cull = 
 	    (quad.bottom_left.x < -1 && quad.top_left.x < -1 && quad.top_right.x < -1 && quad.bottom_right.x < -1) ||
@@ -305,15 +337,11 @@ Draw_Quad *draw_quad_projected_in_frame(Draw_Quad quad, Matrix4 world_to_clip, D
 	return q;
 }
 Draw_Quad *draw_quad_in_frame(Draw_Quad quad, Draw_Frame *frame) {
-	return draw_quad_projected_in_frame(quad, m4_mul(frame->projection, m4_inverse(frame->camera_xform)), frame);
+	return draw_quad_projected_in_frame(quad, draw_frame_get_world_to_clip(frame), frame);
 }
 
 Draw_Quad *draw_quad_xform_in_frame(Draw_Quad quad, Matrix4 xform, Draw_Frame *frame) {
-	Matrix4 world_to_clip = m4_scalar(1.0);
-	world_to_clip         = m4_mul(world_to_clip, frame->projection);
-	world_to_clip         = m4_mul(world_to_clip, m4_inverse(frame->camera_xform));
-	world_to_clip         = m4_mul(world_to_clip, xform);
-	return draw_quad_projected_in_frame(quad, world_to_clip, frame);
+	return draw_quad_projected_in_frame(quad, m4_mul(draw_frame_get_world_to_clip(frame), xform), frame);
 }
 
 Draw_Quad *draw_rect_in_frame(Vector2 position, Vector2 size, Vector4 color, Draw_Frame *frame) {
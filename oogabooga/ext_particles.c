@@ -188,28 +188,28 @@ float32 sample_interp_one(Emission_Interpolation_Kind interp, float32 min, float
 	}
 }
 
-float32 sample_emission_property_f32(Emission_Property p, u64 seed, float32 t) {
+float32 sample_emission_property_f32(Emission_Property p, Random_State *rng, float32 t) {
 	
 	switch (p.mode) {
 		case EMISSION_PROPERTY_MODE_FLAT:
 			return p.flat_f32;
 		case EMISSION_PROPERTY_MODE_RANDOM:
-			float32 v = get_random_float32_in_range(p.min_f32, p.max_f32);
+			float32 v = random_f32_in_range(rng, p.min_f32, p.max_f32);
 			return v;
 		case EMISSION_PROPERTY_MODE_INTERPOLATE:
 			return sample_interp_one(p.interp_kind, p.min_f32, p.max_f32, t);
 	}
 	return 0.0;
 }
-Vector2 sample_emission_property_v2(Emission_Property p, u64 seed, float32 t) {
+Vector2 sample_emission_property_v2(Emission_Property p, Random_State *rng, float32 t) {
 	
 	switch (p.mode) {
 		case EMISSION_PROPERTY_MODE_FLAT:
 			return p.flat_v2;
 		case EMISSION_PROPERTY_MODE_RANDOM:
 			Vector2 v;
-			v.x = get_random_float32_in_range(p.min_v2.x, p.max_v2.x);
-			v.y = get_random_float32_in_range(p.min_v2.y, p.max_v2.y);
+			v.x = random_f32_in_range(rng, p.min_v2.x, p.max_v2.x);
+			v.y = random_f32_in_range(rng, p.min_v2.y, p.max_v2.y);
 			return v;
 		case EMISSION_PROPERTY_MODE_INTERPOLATE:
 			return v2(
@@ -219,16 +219,16 @@ Vector2 sample_emission_property_v2(Emission_Property p, u64 seed, float32 t) {
 	}
 	return v2(0, 0);
 }
-Vector3 sample_emission_property_v3(Emission_Property p, u64 seed, float32 t) {
+Vector3 sample_emission_property_v3(Emission_Property p, Random_State *rng, float32 t) {
 	
 	switch (p.mode) {
 		case EMISSION_PROPERTY_MODE_FLAT:
 			return p.flat_v3;
 		case EMISSION_PROPERTY_MODE_RANDOM:
 			Vector3 v;
-			v.x = get_random_float32_in_range(p.min_v3.x, p.max_v3.x);
-			v.y = get_random_float32_in_range(p.min_v3.y, p.max_v3.y);
-			v.z = get_random_float32_in_range(p.min_v3.z, p.max_v3.z);
+			v.x = random_f32_in_range(rng, p.min_v3.x, p.max_v3.x);
+			v.y = random_f32_in_range(rng, p.min_v3.y, p.max_v3.y);
+			v.z = random_f32_in_range(rng, p.min_v3.z, p.max_v3.z);
 			return v;
 		case EMISSION_PROPERTY_MODE_INTERPOLATE:
 			return v3(
@@ -239,17 +239,17 @@ Vector3 sample_emission_property_v3(Emission_Property p, u64 seed, float32 t) {
 	}
 	return v3(0, 0, 0);
 }
-Vector4 sample_emission_property_v4(Emission_Property p, u64 seed, float32 t) {
+Vector4 sample_emission_property_v4(Emission_Property p, Random_State *rng, float32 t) {
 	
 	switch (p.mode) {
 		case EMISSION_PROPERTY_MODE_FLAT:
 			return p.flat_v4;
 		case EMISSION_PROPERTY_MODE_RANDOM:
 			Vector4 v;
-			v.x = get_random_float32_in_range(p.min_v4.x, p.max_v4.x);
-			v.y = get_random_float32_in_range(p.min_v4.y, p.max_v4.y);
-			v.z = get_random_float32_in_range(p.min_v4.z, p.max_v4.z);
-			v.w = get_random_float32_in_range(p.min_v4.w, p.max_v4.w);
+			v.x = random_f32_in_range(rng, p.min_v4.x, p.max_v4.x);
+			v.y = random_f32_in_range(rng, p.min_v4.y, p.max_v4.y);
+			v.z = random_f32_in_range(rng, p.min_v4.z, p.max_v4.z);
+			v.w = random_f32_in_range(rng, p.min_v4.w, p.max_v4.w);
 			return v;
 		case EMISSION_PROPERTY_MODE_INTERPOLATE:
 			return v4(
@@ -266,7 +266,7 @@ Emission_Handle emit_particles(Emission_Config config, Vector2 pos) {
 
 	config.number_of_particles = max(config.number_of_particles, 1);
 	config.emissions_per_second = max(config.emissions_per_second, 1);
-	if (config.seed == 0) config.seed = get_random();
+	if (config.seed == 0) config.seed = random_u64(get_thread_random_state());
 
 	for (u64 i = 0; i < growing_array_get_valid_count(emissions); i += 1) {
 		if (!emissions[i].allocated) {
@@ -338,15 +338,17 @@ void particles_draw() {
 	
 	float32 now = os_get_elapsed_seconds();
 
-	u64 backup_seed = seed_for_random;
-	
 	for (u64 i = 0; i < growing_array_get_valid_count(emissions); i += 1) {
 		Emission_Instance *e = &emissions[i];
 		if (!e->allocated) continue;
 		
 		float32 passed = now - e->start_time;
 		
-		float32 sample_life_time = sample_emission_property_f32(e->config.life_time, 69, 0.0);
+		// Particles are recomputed every frame, so restart the emission's stream from its seed
+		Random_State rng;
+		random_state_init(&rng, e->config.seed, 0);
+		
+		float32 sample_life_time = sample_emission_property_f32(e->config.life_time, &rng, 0.0);
 		
 		// Duration until last particle is emitted
 		float32 last_emit_duration  = (float32)e->config.number_of_particles/e->config.emissions_per_second;
@@ -363,8 +365,6 @@ void particles_draw() {
 			continue;
 		}
 		
-		seed_for_random = e->config.seed;
-			
 		for (u64 j = 0; j < max_emitted; j += 1) {
 			Particle p = ZERO(Particle);
 			
@@ -376,11 +376,11 @@ void particles_draw() {
 			if (e->config.number_of_kinds <= 1) {
 				p.kind = e->config.kind_pool[0];
 			} else {
-				p.kind = e->config.kind_pool[get_random_int_in_range(0, e->config.number_of_kinds-1)];
+				p.kind = e->config.kind_pool[random_int_in_range(&rng, 0, e->config.number_of_kinds-1)];
 			}
 			
 			
-			float32 life_time = sample_emission_property_f32(e->config.life_time, e->config.seed, 0.0);
+			float32 life_time = sample_emission_property_f32(e->config.life_time, &rng, 0.0);
 			
 			float32 age = passed - emission_time;
 			
@@ -389,23 +389,23 @@ void particles_draw() {
 			float32 t = age/life_time;
 			
 			Vector2 origin = e->pos;
-			origin = v2_add(origin, sample_emission_property_v2(e->config.start_position, e->config.seed, t));
+			origin = v2_add(origin, sample_emission_property_v2(e->config.start_position, &rng, t));
 			
-			p.pivot = sample_emission_property_v2(e->config.pivot, e->config.seed, t);
+			p.pivot = sample_emission_property_v2(e->config.pivot, &rng, t);
 			
-			Vector2 velocity = sample_emission_property_v2(e->config.velocity, e->config.seed, t);
-			Vector2 acceleration = sample_emission_property_v2(e->config.acceleration, e->config.seed, t);
+			Vector2 velocity = sample_emission_property_v2(e->config.velocity, &rng, t);
+			Vector2 acceleration = sample_emission_property_v2(e->config.acceleration, &rng, t);
 			
 			velocity = v2_add(velocity, v2_mulf(acceleration, age));
 			p.position = v2_add(origin, v2_mulf(velocity, age));
 			
 			
-			p.rotation = sample_emission_property_f32(e->config.rotation, e->config.seed, t);
-			p.rotation += sample_emission_property_f32(e->config.rotational_acceleration, e->config.seed, t) * age;
+			p.rotation = sample_emission_property_f32(e->config.rotation, &rng, t);
+			p.rotation += sample_emission_property_f32(e->config.rotational_acceleration, &rng, t) * age;
 			
-			p.color = sample_emission_property_v4(e->config.color, e->config.seed, t);
+			p.color = sample_emission_property_v4(e->config.color, &rng, t);
 			
-			p.size = sample_emission_property_v2(e->config.size, e->config.seed, t);
+			p.size = sample_emission_property_v2(e->config.size, &rng, t);
 
 			p.index = j;
 			
@@ -436,7 +436,7 @@ void particles_draw() {
 					if (e->config.number_of_images == 1) {
 						image = e->config.image_pool[0];
 					} else {
-						image = e->config.image_pool[get_random_int_in_range(0, e->config.number_of_images-1)];
+						image = e->config.image_pool[random_int_in_range(&rng, 0, e->config.number_of_images-1)];
 					}
 					draw_image_xform(image, m3_to_m4(xform), p.size, p.color);
 					break;
@@ -446,7 +446,6 @@ void particles_draw() {
 		
 		
 	}
-	
-	seed_for_random = backup_seed;
+
 }
 
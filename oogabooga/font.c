@@ -139,6 +139,9 @@ Gfx_Font *load_font_from_disk(string path, Allocator allocator) {
 	
 	return font;
 }
+inline Gfx_Font *load_font_from_disk_atom(Atom path, Allocator allocator) {
+	return load_font_from_disk(atom_get_string(path), allocator);
+}
 void destroy_font(Gfx_Font *font) {
 
 	third_party_allocator = font->allocator;
@@ -306,43 +309,46 @@ void walk_glyphs(Walk_Glyphs_Spec spec, Walk_Glyphs_Callback_Proc proc) {
 	float y = 0;
 	
 	u32 last_c = 0;
-	u32 c = next_utf8(&spec.text);
-	while (c != 0) {
-		
-		render_atlas_if_not_yet_rendered(spec.font, spec.raster_height, c);
-		
-		if (c == '\n') {
-			x = 0;
-			y -= variation->metrics.new_line_offset*spec.scale.y;
-			last_c = 0;
-		}
-		
-		if (c < 32 && spec.ignore_control_codes) {
-			c = next_utf8(&spec.text);
-			continue;
-		}
-		
-		u32 atlas_index = c/variation->codepoint_range_per_atlas;
-		
-		Gfx_Font_Atlas *atlas = (Gfx_Font_Atlas*)hash_table_find(&variation->atlases, atlas_index);
-		Gfx_Glyph glyph = atlas->glyphs[c-atlas->first_codepoint];
-		
-		float glyph_x = x+glyph.xoffset*spec.scale.x;
-		float glyph_y = y+(glyph.yoffset)*spec.scale.y;
-		bool should_continue = proc(glyph, atlas, glyph_x, glyph_y, spec.ud);
-		
-		if (!should_continue) break;
-		
-		// #Incomplete kerning
-		x += glyph.advance*spec.scale.x;
-		if (last_c != 0) {
-			int kerning_unscaled = stbtt_GetCodepointKernAdvance(&spec.font->stbtt_handle, last_c, c);
-			float kerning_scaled_to_font_height = kerning_unscaled * variation->scale;
-			x += kerning_scaled_to_font_height*spec.scale.x;
+	
+	// Decode a batch of codepoints at a time rather than calling next_utf8() per glyph
+	u32 codepoints[256];
+	u64 codepoint_count;
+	while ((codepoint_count = utf8_to_utf32_many(&spec.text, codepoints, sizeof(codepoints)/sizeof(u32))) != 0) {
+		for (u64 i = 0; i < codepoint_count; i += 1) {
+			u32 c = codepoints[i];
+			if (c == 0) return;
+			
+			render_atlas_if_not_yet_rendered(spec.font, spec.raster_height, c);
+			
+			if (c == '\n') {
+				x = 0;
+				y -= variation->metrics.new_line_offset*spec.scale.y;
+				last_c = 0;
+			}
+			
+			if (c < 32 && spec.ignore_control_codes) continue;
+			
+			u32 atlas_index = c/variation->codepoint_range_per_atlas;
+			
+			Gfx_Font_Atlas *atlas = (Gfx_Font_Atlas*)hash_table_find(&variation->atlases, atlas_index);
+			Gfx_Glyph glyph = atlas->glyphs[c-atlas->first_codepoint];
+			
+			float glyph_x = x+glyph.xoffset*spec.scale.x;
+			float glyph_y = y+(glyph.yoffset)*spec.scale.y;
+			bool should_continue = proc(glyph, atlas, glyph_x, glyph_y, spec.ud);
+			
+			if (!should_continue) return;
+			
+			// #Incomplete kerning
+			x += glyph.advance*spec.scale.x;
+			if (last_c != 0) {
+				int kerning_unscaled = stbtt_GetCodepointKernAdvance(&spec.font->stbtt_handle, last_c, c);
+				float kerning_scaled_to_font_height = kerning_unscaled * variation->scale;
+				x += kerning_scaled_to_font_height*spec.scale.x;
+			}
+			
+			last_c = c;
 		}
-		
-		last_c = c;
-		c = next_utf8(&spec.text);
 	}
 }
 
@@ -501,20 +507,23 @@ string *split_text_to_lines_with_wrapping(string str, float32 width, Gfx_Font *f
 	string *lines;
 	growing_array_init((void**)&lines, sizeof(string), get_temporary_allocator());
 
+	// Line break indices only move forward, so keep a cursor instead of walking from the start of the text for every line
+	u64 cursor_utf8_index = 0;
+	u64 cursor_byte_index = 0;
 	for (u64 i = 0; i < growing_array_get_valid_count(result.line_break_indices); i += 1) {
 		u64 utf8_index = result.line_break_indices[i];
-		u64 byte_index = utf8_index_to_byte_index(text, utf8_index);
+		u64 byte_index = utf8_cursor_to_byte_index(text, &cursor_utf8_index, &cursor_byte_index, utf8_index);
 		u64 utf8_count = result.glyph_count_per_line[i];
-		u64 byte_count = utf8_index_to_byte_index(text, utf8_index + utf8_count) - byte_index;
+		u64 byte_count = utf8_cursor_to_byte_index(text, &cursor_utf8_index, &cursor_byte_index, utf8_index + utf8_count) - byte_index;
 		string line_str = string_view(text, byte_index, byte_count);
 		if (do_trim_lines)  line_str = string_trim(line_str);
 		growing_array_add((void**)&lines, &line_str);
 	}
 	if (result.count > 0) {
 		u64 utf8_index = result.start_index;
-		u64 byte_index = utf8_index_to_byte_index(text, utf8_index);
+		u64 byte_index = utf8_cursor_to_byte_index(text, &cursor_utf8_index, &cursor_byte_index, utf8_index);
 		u64 utf8_count = result.count;
-		u64 byte_count = utf8_index_to_byte_index(text, utf8_index + utf8_count) - byte_index;
+		u64 byte_count = utf8_cursor_to_byte_index(text, &cursor_utf8_index, &cursor_byte_index, utf8_index + utf8_count) - byte_index;
 		string line_str = string_view(text, byte_index, byte_count);
 		if (do_trim_lines)  line_str = string_trim(line_str);
 		growing_array_add((void**)&lines, &line_str);
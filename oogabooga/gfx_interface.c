@@ -124,6 +124,9 @@ Gfx_Image *load_image_from_disk(string path, Allocator allocator) {
 
     return image;
 }
+inline Gfx_Image *load_image_from_disk_atom(Atom path, Allocator allocator) {
+    return load_image_from_disk(atom_get_string(path), allocator);
+}
 
 void 
 delete_image(Gfx_Image *image) {
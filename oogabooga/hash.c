@@ -18,34 +18,6 @@ static inline u64 xx_hash(u64 x) {
     return h64;
 }
 
-static inline u64 city_hash(string s) {
-    const u64 k = 0x9ddfea08eb382d69ULL;
-    u64 a = s.count;
-    u64 b = s.count * 5;
-    u64 c = 9;
-    u64 d = b;
-
-    if (s.count <= 16) {
-        memcpy(&a, s.data, sizeof(u64));
-        memcpy(&b, s.data + s.count - 8, sizeof(u64));
-    } else {
-        memcpy(&a, s.data, sizeof(u64));
-        memcpy(&b, s.data + 8, sizeof(u64));
-        memcpy(&c, s.data + s.count - 8, sizeof(u64));
-        memcpy(&d, s.data + s.count - 16, sizeof(u64));
-    }
-
-    a += b;
-    a = (a << 43) | (a >> (64 - 43));
-    a += c;
-    a = a * 5 + 0x52dce729;
-    d ^= a;
-    d = (d << 44) | (d >> (64 - 44));
-    d += b;
-
-    return d * k;
-}
-
 u64 djb2_hash(string s) {
     u64 hash = 5381;
     for (u64 i = 0; i < s.count; i++) {
@@ -54,9 +26,91 @@ u64 djb2_hash(string s) {
     return hash;
 }
 
+///
+// String hash
+// wyhash: 16 bytes per 64x64->128 bit multiply, with three independent lanes for long strings
+// so the multiplies run in parallel. On x64 this is faster than an sse2 xxh3-style loop since
+// sse2 can only multiply 32 bit lanes.
+//
+// Use string_get_hash_seeded() with a random seed for tables with keys that can come from
+// someone who wants to make you slow (hash flooding). The plain string_get_hash() uses a fixed
+// seed so hashes are the same every run.
+
+static const u64 string_hash_secret[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL,
+};
+
+inline u64 string_hash_read_64(u8 *p) {
+    u64 x;
+    memcpy(&x, p, sizeof(u64));
+    return x;
+}
+inline u64 string_hash_read_32(u8 *p) {
+    u32 x;
+    memcpy(&x, p, sizeof(u32));
+    return x;
+}
+inline u64 string_hash_mix(u64 a, u64 b) {
+    u64 high;
+    u64 low = multiply_u64_128(a, b, &high);
+    return low ^ high;
+}
+
+u64 string_get_hash_seeded(string s, u64 seed) {
+    u8 *p = s.data;
+    u64 count = s.count;
+
+    const u64 *secret = string_hash_secret;
+    seed ^= string_hash_mix(seed ^ secret[0], secret[1]);
+
+    u64 a, b;
+    if (count <= 16) {
+        // Only ever read inside the string
+        if (count >= 4) {
+            u64 middle = (count >> 3) << 2;
+            a = (string_hash_read_32(p) << 32) | string_hash_read_32(p + middle);
+            b = (string_hash_read_32(p + count-4) << 32) | string_hash_read_32(p + count-4-middle);
+        } else if (count > 0) {
+            a = ((u64)p[0] << 16) | ((u64)p[count >> 1] << 8) | p[count-1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        u64 left = count;
+        if (left > 48) {
+            // Three independent lanes so the multiplies can run in parallel
+            u64 seed1 = seed;
+            u64 seed2 = seed;
+            do {
+                seed  = string_hash_mix(string_hash_read_64(p)    ^ secret[1], string_hash_read_64(p+8)  ^ seed);
+                seed1 = string_hash_mix(string_hash_read_64(p+16) ^ secret[2], string_hash_read_64(p+24) ^ seed1);
+                seed2 = string_hash_mix(string_hash_read_64(p+32) ^ secret[3], string_hash_read_64(p+40) ^ seed2);
+                p += 48;
+                left -= 48;
+            } while (left > 48);
+            seed ^= seed1 ^ seed2;
+        }
+        while (left > 16) {
+            seed = string_hash_mix(string_hash_read_64(p) ^ secret[1], string_hash_read_64(p+8) ^ seed);
+            p += 16;
+            left -= 16;
+        }
+        // Last 16 bytes, which can overlap with what we already did since count > 16
+        a = string_hash_read_64(p + left-16);
+        b = string_hash_read_64(p + left-8);
+    }
+
+    a ^= secret[1];
+    b ^= seed;
+    u64 high;
+    a = multiply_u64_128(a, b, &high);
+    b = high;
+    return string_hash_mix(a ^ secret[0] ^ count, b ^ secret[1]);
+}
+
 u64 string_get_hash(string s) {
-    if (s.count > 32) return djb2_hash(s);
-    return city_hash(s);
+    return string_get_hash_seeded(s, 0);
 }
 u64 pointer_get_hash(void *p) {
 	return xx_hash((u64)p);
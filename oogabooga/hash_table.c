@@ -1,218 +1,407 @@
-
-// Very naive implementation but it should be very cache efficient so it's alright
-// for non-excessive use for now.
+// Open addressing with robin hood hashing, so lookups stay constant time no matter how many
+// entries there are.
+// Entries (hash-key-value) are packed in one array with no holes, so they're cache friendly to
+// iterate with hash_table_get_nth_value(). Next to that is a power-of-two array of slots which
+// each point at an entry. Removing an entry moves the last entry into its place.
 
 /*
 
 	Example Usage:
-	
-	
+
+
 	// Make a table with key type 'string' and value type 'int', allocated on the heap
 	Hash_Table table = make_hash_table(string, int, get_heap_allocator());
-	
+
 	// Set key "Key string" to integer value 69. This returns whether or not key was newly added.
 	string key = STR("Key string");
 	bool newly_added = hash_table_set(&table, key, 69);
-	
+
 	// Find value associated with given key. Returns pointer to that value.
 	string other_key = STR("Some other key");
 	int* value = hash_table_find(&table, other_key);
-	
+
 	if (value) {
 		// Pointer is OK, item with key exists
 	} else {
 		// Pointer is null, item with key does NOT exist
 	}
-	
+
 	// Same as hash_table_find() != NULL
 	string another_key = STR("Another key");
 	if (hash_table_contains(&table, another_key)) {
-		
+
+	}
+
+	// Remove an entry. Returns whether or not key existed.
+	bool removed = hash_table_remove(&table, key);
+
+	// Go through all entries
+	for (u64 i = 0; i < table.count; i++) {
+		string *k = hash_table_get_nth_key(&table, i);
+		int *v = hash_table_get_nth_value(&table, i);
 	}
-	
+
 	// Reset all entries (but keep allocated memory)
 	hash_table_reset(&table);
-	
+
 	// Free allocated entries in hash table
 	hash_table_destroy(&table);
-	
-	
+
+
 	Limitations:
-		- Key can only be a base type or pointer
+		- Key can only be a base type, pointer or string.
+		  String keys are copied into the table's allocator, so the string you pass can go away.
+		  Other keys are compared byte by byte.
+		- Pointers returned by hash_table_find & friends are only valid until the table is
+		  changed; adding can grow the entries and removing moves the last entry.
 		- Key and value passed to the following function needs to be lvalues (we need to be able to take their addresses with '&'):
 			- hash_table_add
 			- hash_table_find
 			- hash_table_contains
 			- hash_table_set
-			
+			- hash_table_remove
+
 			Example:
-			
+
 			hash_table_set(&table, my_key+5, my_value+3); // ERROR
-			
+
 			int key = my_key+5;
 			int value = my_value+3;
 			hash_table_set(&table, key, value); // OK
-			
+
 
 */
 
 typedef struct Hash_Table Hash_Table;
 
+typedef enum Hash_Table_Key_Kind {
+	HASH_TABLE_KEY_BYTES,
+	HASH_TABLE_KEY_STRING,
+} Hash_Table_Key_Kind;
+
+#define get_hash_table_key_kind(Key_Type) _Generic(((Key_Type){0}), \
+		string: HASH_TABLE_KEY_STRING, \
+		default: HASH_TABLE_KEY_BYTES \
+	)
+
 // API:
 #define make_hash_table_reserve(Key_Type, Value_Type, capacity_count, allocator) \
-	make_hash_table_reserve(sizeof(Key_Type), sizeof(Value_Type), capacity_count, allocator)
-	
+	make_hash_table_reserve_raw(sizeof(Key_Type), sizeof(Value_Type), get_hash_table_key_kind(Key_Type), capacity_count, allocator)
+
 #define make_hash_table(Key_Type, Value_Type, allocator) \
-	make_hash_table_raw(sizeof(Key_Type), sizeof(Value_Type), allocator)
+	make_hash_table_raw(sizeof(Key_Type), sizeof(Value_Type), get_hash_table_key_kind(Key_Type), allocator)
 
 #define hash_table_add(table_ptr, key, value) \
 	hash_table_add_raw((table_ptr), get_hash(key), &(key), &(value), sizeof(key), sizeof(value))
 
 #define hash_table_find(table_ptr, key) \
-	hash_table_find_raw((table_ptr), get_hash(key))
-	
+	hash_table_find_raw((table_ptr), get_hash(key), &(key), sizeof(key))
+
 #define hash_table_contains(table_ptr, key) \
-	hash_table_contains_raw((table_ptr), get_hash(key))
-	
+	hash_table_contains_raw((table_ptr), get_hash(key), &(key), sizeof(key))
+
 #define hash_table_set(table_ptr, key, value) \
 	hash_table_set_raw((table_ptr), get_hash(key), &key, &value, sizeof(key), sizeof(value))
 
+#define hash_table_remove(table_ptr, key) \
+	hash_table_remove_raw((table_ptr), get_hash(key), &(key), sizeof(key))
+
 void hash_table_reserve(Hash_Table *t, u64 required_count);
 
+// Grow when more than 3/4 of the slots are used
+#define HASH_TABLE_MAX_LOAD_NUMERATOR 3
+#define HASH_TABLE_MAX_LOAD_DENOMINATOR 4
+
+typedef struct Hash_Table_Slot {
+	u32 hash; // Low bits of the entry hash, so we rarely need to look at the entry
+	u32 entry_plus_one; // 0 means empty
+} Hash_Table_Slot;
 
 typedef struct Hash_Table {
-	
+
 	// Each entry is hash-key-value
-	// Hash is sizeof(u64) bytes, key is _key_size bytes and value is _value_size bytes
-	void *entries; 
-	
+	// Hash is sizeof(u64) bytes, key is _key_size bytes and value is _value_size bytes,
+	// each padded to 8 bytes.
+	void *entries;
+
 	u64 count; // Number of valid entries
 	u64 capacity_count; // Number of allocated entries
-	
+
+	Hash_Table_Slot *slots;
+	u64 slot_count; // Power of two
+
 	u64 _key_size;
 	u64 _value_size;
-	
+	Hash_Table_Key_Kind _key_kind;
+
 	Allocator allocator;
 } Hash_Table;
 
-Hash_Table make_hash_table_reserve_raw(u64 key_size, u64 value_size, u64 capacity_count, Allocator allocator) {
+inline u64 hash_table_key_offset(Hash_Table *t) {
+	return sizeof(u64);
+}
+inline u64 hash_table_value_offset(Hash_Table *t) {
+	return sizeof(u64) + align_next(t->_key_size, 8);
+}
+inline u64 hash_table_entry_size(Hash_Table *t) {
+	return hash_table_value_offset(t) + align_next(t->_value_size, 8);
+}
+inline u8 *hash_table_get_entry(Hash_Table *t, u64 index) {
+	return (u8*)t->entries + index*hash_table_entry_size(t);
+}
+
+Hash_Table make_hash_table_reserve_raw(u64 key_size, u64 value_size, Hash_Table_Key_Kind key_kind, u64 capacity_count, Allocator allocator) {
 
-	capacity_count = min(capacity_count, 8);
+	capacity_count = max(capacity_count, 8);
 
 	Hash_Table t = ZERO(Hash_Table);
-	
+
 	t._key_size = key_size;
 	t._value_size = value_size;
+	t._key_kind = key_kind;
 	t.allocator = allocator;
-	
-	u64 entry_size = value_size+sizeof(u64);
-	t.entries = alloc(t.allocator, entry_size*capacity_count);
-	memset(t.entries, 0, entry_size*capacity_count);
-	t.capacity_count = capacity_count;
-	
+
+	assert(key_kind != HASH_TABLE_KEY_STRING || key_size == sizeof(string), "Hash table key kind is string but the key size doesn't match");
+
+	hash_table_reserve(&t, capacity_count);
+
 	return t;
 }
-inline Hash_Table make_hash_table_raw(u64 key_size, u64 value_size, Allocator allocator) {
-	return make_hash_table_reserve_raw(key_size, value_size, 128, allocator);
+inline Hash_Table make_hash_table_raw(u64 key_size, u64 value_size, Hash_Table_Key_Kind key_kind, Allocator allocator) {
+	return make_hash_table_reserve_raw(key_size, value_size, key_kind, 128, allocator);
+}
+
+void hash_table_free_keys(Hash_Table *t) {
+	if (t->_key_kind != HASH_TABLE_KEY_STRING) return;
+	for (u64 i = 0; i < t->count; i++) {
+		string *key = (string*)(hash_table_get_entry(t, i) + hash_table_key_offset(t));
+		if (key->count) dealloc_string(t->allocator, *key);
+	}
 }
 
 void hash_table_reset(Hash_Table *t) {
+	hash_table_free_keys(t);
 	t->count = 0;
+	if (t->slots) memset(t->slots, 0, t->slot_count*sizeof(Hash_Table_Slot));
 }
 void hash_table_destroy(Hash_Table *t) {
+	hash_table_free_keys(t);
 	dealloc(t->allocator, t->entries);
-	
+	if (t->slots) dealloc(t->allocator, t->slots);
+
 	t->entries = 0;
+	t->slots = 0;
 	t->count = 0;
 	t->capacity_count = 0;
+	t->slot_count = 0;
+}
+
+// Expects there to be a free slot
+void hash_table_insert_slot(Hash_Table *t, Hash_Table_Slot slot) {
+	u64 mask = t->slot_count-1;
+	u64 pos = slot.hash & mask;
+	u64 distance = 0;
+
+	while (true) {
+		Hash_Table_Slot *existing = &t->slots[pos];
+		if (existing->entry_plus_one == 0) {
+			*existing = slot;
+			return;
+		}
+
+		// Robin hood: whoever is further from their home slot gets to stay
+		u64 existing_distance = (pos - (existing->hash & mask)) & mask;
+		if (existing_distance < distance) {
+			Hash_Table_Slot temp = *existing;
+			*existing = slot;
+			slot = temp;
+			distance = existing_distance;
+		}
+
+		pos = (pos+1) & mask;
+		distance += 1;
+	}
 }
 
 void hash_table_reserve(Hash_Table *t, u64 required_count) {
-	u64 entry_size = t->_value_size+sizeof(u64);
-	
-	u64 required_size = required_count*entry_size;
-	
-	u64 current_size = t->capacity_count*entry_size;
-	
-	if (current_size >= required_size) return;
-	
-	u64 new_count = get_next_power_of_two(required_count);
-	u64 new_size = new_count*entry_size;
-	
-	void *new_entries = alloc(t->allocator, new_size);
-	memcpy(new_entries, t->entries, current_size);
-	
-	dealloc(t->allocator, t->entries);
-	
-	t->entries = new_entries;
-	t->capacity_count = new_count;
+
+	assert(required_count < UINT32_MAX, "Hash table can't have more than UINT32_MAX entries");
+
+	u64 entry_size = hash_table_entry_size(t);
+
+	if (required_count > t->capacity_count) {
+		u64 new_count = get_next_power_of_two(required_count);
+
+		void *new_entries = alloc(t->allocator, new_count*entry_size);
+		if (t->entries) {
+			memcpy(new_entries, t->entries, t->count*entry_size);
+			dealloc(t->allocator, t->entries);
+		}
+
+		t->entries = new_entries;
+		t->capacity_count = new_count;
+	}
+
+	if (required_count*HASH_TABLE_MAX_LOAD_DENOMINATOR > t->slot_count*HASH_TABLE_MAX_LOAD_NUMERATOR) {
+		u64 new_slot_count = get_next_power_of_two((required_count*HASH_TABLE_MAX_LOAD_DENOMINATOR)/HASH_TABLE_MAX_LOAD_NUMERATOR+1);
+
+		if (t->slots) dealloc(t->allocator, t->slots);
+		t->slots = (Hash_Table_Slot*)alloc(t->allocator, new_slot_count*sizeof(Hash_Table_Slot));
+		memset(t->slots, 0, new_slot_count*sizeof(Hash_Table_Slot));
+		t->slot_count = new_slot_count;
+
+		// Rehash
+		for (u64 i = 0; i < t->count; i++) {
+			Hash_Table_Slot slot;
+			slot.hash = (u32)*(u64*)hash_table_get_entry(t, i);
+			slot.entry_plus_one = (u32)(i+1);
+			hash_table_insert_slot(t, slot);
+		}
+	}
+}
+
+bool hash_table_keys_match(Hash_Table *t, void *a, void *b) {
+	if (t->_key_kind == HASH_TABLE_KEY_STRING) return strings_match(*(string*)a, *(string*)b);
+	return memcmp(a, b, t->_key_size) == 0;
 }
 
-// This can add multiple entries of same hash, beware!
+// Returns the slot index, or -1 if key is not in the table
+s64 hash_table_find_slot(Hash_Table *t, u64 hash, void *k) {
+	if (t->count == 0) return -1;
+
+	u64 mask = t->slot_count-1;
+	u64 pos = hash & mask;
+	u64 distance = 0;
+
+	while (true) {
+		Hash_Table_Slot slot = t->slots[pos];
+		if (slot.entry_plus_one == 0) return -1;
+
+		// If we were here, we would have taken this slot when inserting
+		if (((pos - (slot.hash & mask)) & mask) < distance) return -1;
+
+		if (slot.hash == (u32)hash) {
+			u8 *entry = hash_table_get_entry(t, slot.entry_plus_one-1);
+			if (*(u64*)entry == hash && hash_table_keys_match(t, entry+hash_table_key_offset(t), k)) {
+				return (s64)pos;
+			}
+		}
+
+		pos = (pos+1) & mask;
+		distance += 1;
+	}
+}
+
+// This doesn't check if the key already exists, so it can add multiple entries of the same key.
+// Beware!
 void hash_table_add_raw(Hash_Table *t, u64 hash, void *k, void *v, u64 key_size, u64 value_size) {
 
 	assert(t->_key_size == key_size, "Key type size does not match hash table initted key type size");
 	assert(t->_value_size == value_size, "Value type size does not match hash table initted value type size");
 
 	hash_table_reserve(t, t->count+1);
-	
-	u64 entry_size = t->_value_size+sizeof(u64);
-	
-	u64 index = entry_size*t->count;
+
+	u64 index = t->count;
 	t->count += 1;
-	
-	u64 hash_offset = 0;
-	u64 value_offset = hash_offset + sizeof(u64);
-	
-	memcpy((u8*)t->entries+index+hash_offset,  &hash, sizeof(u64));
-	memcpy((u8*)t->entries+index+value_offset, v,     value_size);
-}
-
-void *hash_table_find_raw(Hash_Table *t, u64 hash) {
-
-	// #Speed #Incomplete
-	// Do quadratic probe 'triangular numbers'
-
-	u64 entry_size = t->_value_size+sizeof(u64);
-	u64 hash_offset = 0;
-	u64 value_offset = hash_offset + sizeof(u64);
-	
-	for (u64 i = 0; i < t->count; i += 1) {
-		u64 existing_hash = *(u64*)((u8*)t->entries+i*entry_size+hash_offset);
-		if (existing_hash == hash) {
-			void *value = ((u8*)t->entries+i*entry_size+value_offset);
-			return value;
+
+	u8 *entry = hash_table_get_entry(t, index);
+	memcpy(entry, &hash, sizeof(u64));
+	memcpy(entry+hash_table_value_offset(t), v, value_size);
+
+	if (t->_key_kind == HASH_TABLE_KEY_STRING) {
+		string key = *(string*)k;
+		string copy = ZERO(string);
+		if (key.count) {
+			copy = alloc_string(t->allocator, key.count);
+			memcpy(copy.data, key.data, key.count);
 		}
+		memcpy(entry+hash_table_key_offset(t), &copy, sizeof(string));
+	} else {
+		memcpy(entry+hash_table_key_offset(t), k, key_size);
 	}
-	return 0;
+
+	Hash_Table_Slot slot;
+	slot.hash = (u32)hash;
+	slot.entry_plus_one = (u32)(index+1);
+	hash_table_insert_slot(t, slot);
+}
+
+void *hash_table_find_raw(Hash_Table *t, u64 hash, void *k, u64 key_size) {
+	assert(t->_key_size == key_size, "Key type size does not match hash table initted key type size");
+
+	s64 pos = hash_table_find_slot(t, hash, k);
+	if (pos < 0) return 0;
+
+	return hash_table_get_entry(t, t->slots[pos].entry_plus_one-1) + hash_table_value_offset(t);
 }
 
 void *hash_table_get_nth_value(Hash_Table *t, u64 n) {
 	assert(n < t->count, "Hash table n is out of range");
-	
-	u64 entry_size = t->_value_size+sizeof(u64);
-	u64 hash_offset = 0;
-	u64 value_offset = hash_offset + sizeof(u64);
-	
-	return (u8*)t->entries+entry_size*n+value_offset;
+	return hash_table_get_entry(t, n) + hash_table_value_offset(t);
+}
+void *hash_table_get_nth_key(Hash_Table *t, u64 n) {
+	assert(n < t->count, "Hash table n is out of range");
+	return hash_table_get_entry(t, n) + hash_table_key_offset(t);
 }
 
-bool hash_table_contains_raw(Hash_Table *t, u64 hash) {
-	return hash_table_find_raw(t, hash) != 0;
+bool hash_table_contains_raw(Hash_Table *t, u64 hash, void *k, u64 key_size) {
+	return hash_table_find_raw(t, hash, k, key_size) != 0;
 }
 
 // Returns true if key was newly added or false if it already existed
 bool hash_table_set_raw(Hash_Table *t, u64 hash, void *k, void *v, u64 key_size, u64 value_size) {
-	bool newly_added = true;
-	
-	if (hash_table_contains_raw(t, hash)) newly_added = false;
-	
-	if (newly_added) {
-		hash_table_add_raw(t, hash, k, v, key_size, value_size);
-	} else {
-		memcpy(hash_table_find_raw(t, hash), v, value_size);
+	assert(t->_value_size == value_size, "Value type size does not match hash table initted value type size");
+
+	void *existing = hash_table_find_raw(t, hash, k, key_size);
+
+	if (existing) {
+		memcpy(existing, v, value_size);
+		return false;
 	}
-	
-	return newly_added;
+
+	hash_table_add_raw(t, hash, k, v, key_size, value_size);
+	return true;
 }
 
+// Returns true if the key existed
+bool hash_table_remove_raw(Hash_Table *t, u64 hash, void *k, u64 key_size) {
+	assert(t->_key_size == key_size, "Key type size does not match hash table initted key type size");
+
+	s64 found = hash_table_find_slot(t, hash, k);
+	if (found < 0) return false;
+
+	u64 mask = t->slot_count-1;
+	u64 hole = (u64)found;
+	u64 index = t->slots[hole].entry_plus_one-1;
+	u64 entry_size = hash_table_entry_size(t);
+
+	if (t->_key_kind == HASH_TABLE_KEY_STRING) {
+		string *key = (string*)(hash_table_get_entry(t, index) + hash_table_key_offset(t));
+		if (key->count) dealloc_string(t->allocator, *key);
+	}
+
+	// Backward shift deletion: pull the following slots back until one is empty or already home
+	while (true) {
+		u64 next = (hole+1) & mask;
+		Hash_Table_Slot slot = t->slots[next];
+		if (slot.entry_plus_one == 0 || (slot.hash & mask) == next) break;
+		t->slots[hole] = slot;
+		hole = next;
+	}
+	t->slots[hole] = ZERO(Hash_Table_Slot);
+
+	// Keep the entries packed by moving the last one into the hole
+	u64 last = t->count-1;
+	if (index != last) {
+		u8 *last_entry = hash_table_get_entry(t, last);
+		u64 last_hash = *(u64*)last_entry;
+		u64 pos = last_hash & mask;
+		while (t->slots[pos].entry_plus_one != last+1) pos = (pos+1) & mask;
+		t->slots[pos].entry_plus_one = (u32)(index+1);
+
+		memcpy(hash_table_get_entry(t, index), last_entry, entry_size);
+	}
+	t->count -= 1;
+
+	return true;
+}
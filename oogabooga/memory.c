@@ -43,16 +43,80 @@ Allocator get_initialization_allocator() {
 
 ///
 ///
-// Basic general heap allocator, free list
+// Basic general heap allocator, size classes in front of a free list
 ///
 // Technically thread safe but synchronization is horrible.
 // Fragmentation is catastrophic.
 // We could fix it by merging free nodes every now and then
 // BUT: We aren't really supposed to allocate/deallocate directly on the heap too much anyways...
+//
+// Small allocations (HEAP_SMALL_ALLOCATION_MAX including metadata) never touch the free list.
+// They are rounded up to a size class and popped from/pushed to that class's free list, so
+// alloc & dealloc is O(1) for them. When a class runs dry we carve slots out of a slab,
+// which is just a regular allocation from the general free list.
+// Everything bigger goes to the general free list, where we do a best-fit search which gives
+// up after HEAP_BEST_FIT_SEARCH_LIMIT more nodes once it has found something that fits.
+//
+// On top of the size classes, each thread keeps a small cache of free slots per class.
+// Small allocs & deallocs only take heap_lock when that cache runs dry or fills up, and then
+// move HEAP_THREAD_CACHE_BATCH slots at a time. Slots don't belong to any thread, so it's
+// fine to free memory that was allocated on another thread; it just ends up in this thread's
+// cache. When a thread exits, its cache is flushed back to the shared size classes.
+// get_heap_lock_stats() tells you how often heap_lock was taken and how much time was spent
+// waiting for it.
+//
+// Allocations of HEAP_LARGE_ALLOCATION_MIN or more don't go in the heap blocks at all. They get
+// their own pages, which are decommitted (given back to the OS) when freed. The freed address
+// ranges are kept in a list (heap_large_spans) so later large allocations can reuse them
+// instead of always growing program memory.
+//
+// heap_maintenance() merges free nodes and gives unused pages in the heap blocks back to the OS,
+// see the Maintenance section below.
 
 #define MAX_HEAP_BLOCK_SIZE align_next(MB(500), os.page_size)
+#ifndef HEAP_LARGE_ALLOCATION_MIN
+	#define HEAP_LARGE_ALLOCATION_MIN MB(1)
+#endif
 #define DEFAULT_HEAP_BLOCK_SIZE (min(MAX_HEAP_BLOCK_SIZE, program_memory_capacity))
 #define HEAP_ALIGNMENT (sizeof(Heap_Free_Node))
+
+#ifndef HEAP_SLAB_SIZE
+	#define HEAP_SLAB_SIZE KB(64)
+#endif
+#ifndef HEAP_BEST_FIT_SEARCH_LIMIT
+	#define HEAP_BEST_FIT_SEARCH_LIMIT 32
+#endif
+// What happens to the pages of free memory in the heap blocks:
+//   HEAP_PAGE_POLICY_EAGER:   They stay committed & accessible, so alloc/dealloc never makes a
+//                             syscall (unless heap_maintenance() decommitted something).
+//   HEAP_PAGE_POLICY_LAZY:    Freed ranges of at least HEAP_LAZY_DECOMMIT_MIN are decommitted,
+//                             and committed again once something is allocated there. Smaller
+//                             ones stay committed so memory that's freed & reused right away
+//                             doesn't keep going back and forth to the OS.
+//   HEAP_PAGE_POLICY_PROTECT: They're locked (Win32 PAGE_NOACCESS) so touching freed memory
+//                             crashes right away. Locking is a syscall per page and only does
+//                             anything in debug builds.
+#define HEAP_PAGE_POLICY_EAGER   0
+#define HEAP_PAGE_POLICY_LAZY    1
+#define HEAP_PAGE_POLICY_PROTECT 2
+#ifndef HEAP_PAGE_POLICY
+	#if CONFIGURATION == DEBUG
+		#define HEAP_PAGE_POLICY HEAP_PAGE_POLICY_PROTECT
+	#else
+		#define HEAP_PAGE_POLICY HEAP_PAGE_POLICY_EAGER
+	#endif
+#endif
+#ifndef HEAP_LAZY_DECOMMIT_MIN
+	#define HEAP_LAZY_DECOMMIT_MIN KB(256)
+#endif
+// Max free slots a thread holds on to per size class
+#ifndef HEAP_THREAD_CACHE_SLOT_COUNT
+	#define HEAP_THREAD_CACHE_SLOT_COUNT 64
+#endif
+#define HEAP_THREAD_CACHE_BATCH (HEAP_THREAD_CACHE_SLOT_COUNT/2)
+// 16 classes in steps of 16 bytes up to 256, then 4 classes per power of two up to 4096
+#define HEAP_SIZE_CLASS_COUNT 32
+#define HEAP_SMALL_ALLOCATION_MAX KB(4)
 typedef struct Heap_Free_Node Heap_Free_Node;
 typedef struct Heap_Block Heap_Block;
 
@@ -66,12 +130,23 @@ typedef struct Heap_Block {
 	Heap_Free_Node *free_head;
 	void* start;
 	Heap_Block *next;
-	// 32 bytes !!
+	// Free pages that were given back to the OS, by heap_maintenance() or HEAP_PAGE_POLICY_LAZY.
+	// decommitted_pages has a bit per page of the block which is set while that page is
+	// decommitted, so we only commit what was actually decommitted. It lives right after this
+	// header, before start. 0 for large allocations, which don't decommit pages this way.
+	u64 decommitted_size;
+	u64 *decommitted_pages;
+	// 48 bytes !! 64 with the DEBUG fields. Keep it a multiple of HEAP_ALIGNMENT.
 #if CONFIGURATION == DEBUG
 	u64 total_allocated;
 	u64 padding;
 #endif
 } Heap_Block;
+#if CONFIGURATION == DEBUG
+_Static_assert(sizeof(Heap_Block) == 64, "Heap_Block changed size");
+#else
+_Static_assert(sizeof(Heap_Block) == 48, "Heap_Block changed size");
+#endif
 
 #define HEAP_META_SIGNATURE 6969694206942069ull
 typedef alignat(16) struct Heap_Allocation_Metadata {
@@ -83,20 +158,87 @@ typedef alignat(16) struct Heap_Allocation_Metadata {
 #endif
 } Heap_Allocation_Metadata;
 
+// A free slot keeps its metadata intact so it can be handed out again without touching it.
+// The free list link lives in what used to be the user memory.
+#define HEAP_FREE_SLOT_SIGNATURE 4206942069696969ull
+typedef struct Heap_Free_Slot Heap_Free_Slot;
+typedef struct Heap_Free_Slot {
+	Heap_Allocation_Metadata meta;
+	Heap_Free_Slot *next;
+} Heap_Free_Slot;
+
+typedef struct Heap_Size_Class {
+	u64 slot_size; // Including metadata
+	Heap_Free_Slot *free_head;
+
+	// Current slab we carve new slots from
+	u8 *slab_next;
+	u8 *slab_end;
+	Heap_Block *slab_block;
+} Heap_Size_Class;
+
+typedef struct Heap_Thread_Cache {
+	Heap_Free_Slot *free_heads[HEAP_SIZE_CLASS_COUNT];
+	u32 counts[HEAP_SIZE_CLASS_COUNT];
+	bool flushes_on_exit;
+} Heap_Thread_Cache;
+
+// A range of decommitted pages we got from os_reserve_next_memory_pages for a large allocation
+// which has since been freed. The first page stays committed so we can keep this in it.
+typedef struct Heap_Large_Span Heap_Large_Span;
+typedef struct Heap_Large_Span {
+	u64 size; // Including this first page
+	Heap_Large_Span *next; // Sorted by address
+} Heap_Large_Span;
+
+// Only written while heap_lock is held
+typedef struct Heap_Lock_Stats {
+	u64 acquisitions;
+	u64 contended_acquisitions; // Someone else had the lock so we had to wait
+	u64 wait_cycles;
+} Heap_Lock_Stats;
+
+// Only counts the free nodes in the heap blocks. Free size class slots are part of a slab, which
+// is one allocation as far as the heap blocks are concerned.
+typedef struct Heap_Fragmentation_Stats {
+	u64 block_count;
+	u64 free_node_count;
+	u64 free_size;
+	u64 largest_free_node;
+	u64 decommitted_size; // Free pages in heap blocks which are given back to the OS right now
+	u64 released_size; // Decommitted ranges in heap_large_spans
+	// 0 when all free memory is in one node, approaching 1 the more it's split up into small ones
+	float64 fragmentation;
+} Heap_Fragmentation_Stats;
+
 // #Global
 ogb_instance Heap_Block *heap_head;
 ogb_instance bool heap_initted;
 ogb_instance Spinlock heap_lock;
+ogb_instance Heap_Lock_Stats heap_lock_stats;
+ogb_instance Heap_Large_Span *heap_large_spans;
+ogb_instance Heap_Size_Class heap_size_classes[HEAP_SIZE_CLASS_COUNT];
+ogb_instance u8 heap_size_class_lookup[HEAP_SMALL_ALLOCATION_MAX/HEAP_ALIGNMENT+1];
+// Thread locals can't be shared with an external instance, so heap_thread_cache only lives in
+// the instance and everything that touches it goes through these.
+ogb_instance Heap_Allocation_Metadata *heap_thread_cache_alloc(u64 size);
+ogb_instance void heap_thread_cache_dealloc(Heap_Allocation_Metadata *meta);
+ogb_instance void heap_thread_cache_flush_all();
 
 #if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
 Heap_Block *heap_head;
 bool heap_initted = false;
 Spinlock heap_lock;
+Heap_Lock_Stats heap_lock_stats;
+Heap_Large_Span *heap_large_spans = 0;
+Heap_Size_Class heap_size_classes[HEAP_SIZE_CLASS_COUNT];
+u8 heap_size_class_lookup[HEAP_SMALL_ALLOCATION_MAX/HEAP_ALIGNMENT+1];
+thread_local Heap_Thread_Cache heap_thread_cache;
 #endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
 	
 
 u64 get_heap_block_size_excluding_metadata(Heap_Block *block) {
-	return block->size - sizeof(Heap_Block);
+	return block->size - ((u8*)block->start - (u8*)block);
 }
 u64 get_heap_block_size_including_metadata(Heap_Block *block) {
 	return block->size;
@@ -125,7 +267,7 @@ void sanity_check_block(Heap_Block *block) {
 	if(block->next) { assert(is_pointer_in_program_memory(block->next), "Heap_Block next pointer is corrupt"); }
 	assert(block->size < GB(256), "A heap block is corrupt.");
 	assert(block->size >= INITIAL_PROGRAM_MEMORY_SIZE, "A heap block is corrupt.");
-	assert((u64)block->start == (u64)block + sizeof(Heap_Block), "A heap block is corrupt.");
+	assert((u64)block->start >= (u64)block + sizeof(Heap_Block) && (u64)block->start % HEAP_ALIGNMENT == 0, "A heap block is corrupt.");
 	
 
 	Heap_Free_Node *node = block->free_head;	
@@ -144,6 +286,7 @@ void sanity_check_block(Heap_Block *block) {
 		}
 		total_free += node->size;
 		assert(total_free <= block->size, "Free nodes are fucky wucky. This might be heap corruption, or possibly an internal error.");
+		assert(!node->next || (u8*)node + node->size <= (u8*)node->next, "Free nodes are not sorted by address. This might be heap corruption, or possibly an internal error.");
 		node = node->next;
 	}
 	
@@ -167,7 +310,8 @@ typedef struct {
 	Heap_Free_Node *previous;
 	u64 delta;
 } Heap_Search_Result;
-Heap_Search_Result search_heap_block(Heap_Block *block, u64 size) {
+// search_limit is how many more nodes we look at after finding the first fit, 0 means no limit.
+Heap_Search_Result search_heap_block(Heap_Block *block, u64 size, u64 search_limit) {
 	
 	if (block->free_head == 0)  return (Heap_Search_Result){0, 0, 0};
 		
@@ -177,9 +321,15 @@ Heap_Search_Result search_heap_block(Heap_Block *block, u64 size) {
 	Heap_Free_Node *best_fit = 0;
 	Heap_Free_Node *before_best_fit = 0;
 	u64 best_fit_delta = 0;
+	u64 searched_since_fit = 0;
 	
 	while (node != 0) {
 		
+		if (best_fit && search_limit) {
+			if (searched_since_fit >= search_limit) break;
+			searched_since_fit += 1;
+		}
+		
 		if (node->size == size) {
 			Heap_Search_Result result;
 			result.best_fit = node;
@@ -224,15 +374,29 @@ Heap_Block *make_heap_block(Heap_Block *parent, u64 size) {
 	assert((u64)block % os.page_size == 0, "Heap block not aligned to page size");
 	
 	if (parent) parent->next = block;
+	
+	u64 page_count = size/os.page_size;
+	u64 bitmap_size = ((page_count+63)/64)*sizeof(u64);
+	u8 *start = (u8*)align_next((u64)block + sizeof(Heap_Block) + bitmap_size, HEAP_ALIGNMENT);
+	
+	// Fresh pages are locked (in debug builds)
+#if HEAP_PAGE_POLICY == HEAP_PAGE_POLICY_PROTECT
+	// ... which is what we want for the free node, except for its header
+	os_unlock_program_memory_pages(block, align_next((u64)(start-(u8*)block)+sizeof(Heap_Free_Node), os.page_size));
+#else
 	os_unlock_program_memory_pages(block, size);
+#endif
 	
 #if CONFIGURATION == DEBUG
 	block->total_allocated = 0;
 #endif
 	
-	block->start = ((u8*)block)+sizeof(Heap_Block);
+	block->start = start;
 	block->size = size;
 	block->next = 0;
+	block->decommitted_size = 0;
+	block->decommitted_pages = (u64*)(block+1);
+	memset(block->decommitted_pages, 0, bitmap_size);
 	block->free_head = (Heap_Free_Node*)block->start;
 	block->free_head->size = get_heap_block_size_excluding_metadata(block);
 	block->free_head->next = 0;
@@ -240,6 +404,36 @@ Heap_Block *make_heap_block(Heap_Block *parent, u64 size) {
 	return block;
 }
 
+void heap_lock_acquire() {
+	if (compare_and_swap_bool(&heap_lock.locked, true, false)) {
+		// Same as spinlock_acquire_or_wait would, so log_spinlock_stats() sees every acquire
+		SPINLOCK_RECORD_ACQUIRE(&heap_lock, 0);
+		heap_lock_stats.acquisitions += 1;
+		return;
+	}
+
+	u64 start = rdtsc();
+	spinlock_acquire_or_wait(&heap_lock);
+	heap_lock_stats.acquisitions += 1;
+	heap_lock_stats.contended_acquisitions += 1;
+	heap_lock_stats.wait_cycles += rdtsc()-start;
+}
+void heap_lock_release() {
+	spinlock_release(&heap_lock);
+}
+
+Heap_Lock_Stats get_heap_lock_stats() {
+	heap_lock_acquire();
+	Heap_Lock_Stats stats = heap_lock_stats;
+	heap_lock_release();
+	return stats;
+}
+void reset_heap_lock_stats() {
+	heap_lock_acquire();
+	heap_lock_stats = ZERO(Heap_Lock_Stats);
+	heap_lock_release();
+}
+
 void heap_init() {
 	if (heap_initted) return;
 	assert(HEAP_ALIGNMENT == 16);
@@ -247,24 +441,95 @@ void heap_init() {
 	heap_initted = true;
 	heap_head = make_heap_block(0, DEFAULT_HEAP_BLOCK_SIZE);
 	spinlock_init(&heap_lock);
+	
+	u64 slot_size = 0;
+	for (u64 i = 0; i < HEAP_SIZE_CLASS_COUNT; i++) {
+		if (i < 16) {
+			slot_size = (i+1)*16;
+		} else {
+			u64 base = 256ull << ((i-16)/4);
+			slot_size = base + ((i-16)%4+1)*(base/4);
+		}
+		heap_size_classes[i] = ZERO(Heap_Size_Class);
+		heap_size_classes[i].slot_size = slot_size;
+	}
+	assert(slot_size == HEAP_SMALL_ALLOCATION_MAX, "Size classes do not add up to HEAP_SMALL_ALLOCATION_MAX");
+	
+	u64 class_index = 0;
+	for (u64 i = 0; i <= HEAP_SMALL_ALLOCATION_MAX/HEAP_ALIGNMENT; i++) {
+		while (heap_size_classes[class_index].slot_size < i*HEAP_ALIGNMENT) class_index += 1;
+		heap_size_class_lookup[i] = (u8)class_index;
+	}
 }
 
-void *heap_alloc(u64 size) {
-
-	if (!heap_initted) heap_init();
-
-	// #Sync #Speed oof
-	spinlock_acquire_or_wait(&heap_lock);
+inline bool heap_page_is_decommitted(Heap_Block *block, u64 page) {
+	return (block->decommitted_pages[page/64] >> (page%64)) & 1;
+}
+// Decommits (or commits) the pages in [first_page, last_page_end) which aren't already, a run
+// of them at a time, and keeps decommitted_pages & decommitted_size up to date.
+// Both must be aligned to os.page_size. Expects heap_lock to be held.
+void heap_set_pages_decommitted(Heap_Block *block, u64 first_page, u64 last_page_end, bool decommitted) {
+	u64 page = (first_page - (u64)block)/os.page_size;
+	u64 end = (last_page_end - (u64)block)/os.page_size;
 	
+	while (page < end) {
+		while (page < end && heap_page_is_decommitted(block, page) == decommitted) page += 1;
+		
+		u64 run_start = page;
+		while (page < end && heap_page_is_decommitted(block, page) != decommitted) {
+			block->decommitted_pages[page/64] ^= 1ull << (page%64);
+			page += 1;
+		}
+		if (page == run_start) break;
+		
+		void *run = (u8*)block + run_start*os.page_size;
+		u64 run_size = (page-run_start)*os.page_size;
+		if (decommitted) {
+			os_decommit_program_memory_pages(run, run_size);
+			block->decommitted_size += run_size;
+		} else {
+			os_commit_program_memory_pages(run, run_size);
+			block->decommitted_size -= run_size;
+		}
+	}
+}
 
-
-
+// The pages entirely inside [start, end) are free now, do what HEAP_PAGE_POLICY says with them.
+// Expects heap_lock to be held.
+void heap_pages_freed(Heap_Block *block, void *start, void *end) {
+	u64 first_page = align_next((u64)start, os.page_size);
+	u64 last_page_end = align_previous((u64)end, os.page_size);
+	if (last_page_end <= first_page) return;
 	
-	size += sizeof(Heap_Allocation_Metadata);
+#if HEAP_PAGE_POLICY == HEAP_PAGE_POLICY_PROTECT
+	os_lock_program_memory_pages((void*)first_page, last_page_end-first_page);
+#elif HEAP_PAGE_POLICY == HEAP_PAGE_POLICY_LAZY
+	if (last_page_end-first_page >= HEAP_LAZY_DECOMMIT_MIN) {
+		heap_set_pages_decommitted(block, first_page, last_page_end, true);
+	}
+#endif
+}
+// Make all pages touching [start, end) usable, for when we take memory out of a free node.
+// end should include the header of whatever is left of the node.
+// Expects heap_lock to be held.
+void heap_pages_used(Heap_Block *block, void *start, void *end) {
+	u64 first_page = align_previous((u64)start, os.page_size);
+	u64 last_page_end = align_next((u64)end, os.page_size);
 	
-	size = (size+HEAP_ALIGNMENT) & ~(HEAP_ALIGNMENT-1);
+	// Whatever the policy, heap_maintenance() may have decommitted some of these
+	if (block->decommitted_size) {
+		heap_set_pages_decommitted(block, first_page, last_page_end, false);
+	}
+#if HEAP_PAGE_POLICY == HEAP_PAGE_POLICY_PROTECT
+	os_unlock_program_memory_pages((void*)first_page, last_page_end-first_page);
+#endif
+}
+
+// Expects heap_lock to be held and size to include metadata & be aligned to HEAP_ALIGNMENT.
+// search_limit is passed to search_heap_block, 0 means a full best-fit search.
+Heap_Allocation_Metadata *heap_general_alloc(u64 size, u64 search_limit) {
 	
-	assert(size < MAX_HEAP_BLOCK_SIZE, "Past Charlie has been lazy and did not handle large allocations like this. I apologize on behalf of past Charlie. A quick fix could be to increase the heap block size for now. #Incomplete #Limitation");
+	assert(size < HEAP_LARGE_ALLOCATION_MIN, "Internal heap error: Large allocations should not go through the heap blocks");
 	
 	
 #if VERY_DEBUG
@@ -284,9 +549,10 @@ void *heap_alloc(u64 size) {
 	Heap_Block *best_fit_block = 0;
 	Heap_Free_Node *previous = 0;
 	u64 best_fit_delta = 0;
-	// #Speed
-	// Maybe instead of going through EVERY free node to find best fit we do a good-enough fit
 	while (block != 0) {
+		
+		// Good enough, don't go through every block
+		if (best_fit && search_limit) break;
 
 		if (get_heap_block_size_excluding_metadata(block) < size) {
 			last_block = block;
@@ -294,7 +560,7 @@ void *heap_alloc(u64 size) {
 			continue;
 		}
 	
-		Heap_Search_Result result = search_heap_block(block, size);
+		Heap_Search_Result result = search_heap_block(block, size, search_limit);
 		Heap_Free_Node *node = result.best_fit;
 		if (node) {
 			if (node->size < size) continue;
@@ -329,15 +595,8 @@ void *heap_alloc(u64 size) {
 	
 	assert(best_fit != 0, "Internal heap error");
 	
-	// Unlock best fit
-	
-	// #Copypaste
-	void *free_tail = (u8*)best_fit + best_fit->size;
-	void *first_page = (void*)align_previous(best_fit, os.page_size);
-	void *last_page_end = (void*)align_previous(free_tail, os.page_size);
-	if ((u8*)last_page_end > (u8*)first_page) {
-		os_unlock_program_memory_pages(first_page, (u64)last_page_end-(u64)first_page);
-	}
+	// The rest of the node stays free, so its pages can stay however they are
+	heap_pages_used(best_fit_block, best_fit, (u8*)best_fit + min(best_fit->size, size+sizeof(Heap_Free_Node)));
 	
 	Heap_Free_Node *new_free_node = 0;
 	if (size != best_fit->size) {
@@ -345,15 +604,6 @@ void *heap_alloc(u64 size) {
 		new_free_node = (Heap_Free_Node*)(((u8*)best_fit)+size);
 		new_free_node->size = remainder;
 		new_free_node->next = best_fit->next;
-		
-		// Lock remaining free node
-		// #Copypaste
-		void *free_tail = (u8*)new_free_node + new_free_node->size;
-		void *next_page = (void*)align_next(new_free_node, os.page_size);
-		void *last_page_end = (void*)align_previous(free_tail, os.page_size);
-		if ((u8*)last_page_end > (u8*)next_page) {
-			os_lock_program_memory_pages(next_page, (u64)last_page_end-(u64)next_page);
-		}
 	}
 	
 	
@@ -388,25 +638,12 @@ void *heap_alloc(u64 size) {
 	sanity_check_block(meta->block);
 #endif
 	
-	// #Sync #Speed oof
-	spinlock_release(&heap_lock);
-	
-	
-	void *p = ((u8*)meta)+sizeof(Heap_Allocation_Metadata);
-	assert((u64)p % HEAP_ALIGNMENT == 0, "Internal heap error. Result pointer is not aligned to HEAP_ALIGNMENT");
-	return p;
+	return meta;
 }
-void heap_dealloc(void *p) {
-	// #Sync #Speed oof
-	
-	if (!heap_initted) heap_init();
-
-	spinlock_acquire_or_wait(&heap_lock);
+// Expects heap_lock to be held
+void heap_general_dealloc(Heap_Allocation_Metadata *meta) {
 	
-	assert(is_pointer_in_program_memory(p), "A bad pointer was passed tp heap_dealloc: it is out of program memory bounds!"); 
-	p = (u8*)p-sizeof(Heap_Allocation_Metadata);
-	Heap_Allocation_Metadata *meta = (Heap_Allocation_Metadata*)(p);
-	check_meta(meta);
+	void *p = meta;
 	
 	// Yoink meta data before we start overwriting it
 	Heap_Block *block = meta->block;
@@ -424,18 +661,15 @@ void heap_dealloc(void *p) {
 	new_node->size = size;
 	
 	if (new_node < block->free_head) {
-		// #Copypaste
-		void *free_tail = (u8*)new_node + new_node->size;
-		void *next_page = (void*)align_next(new_node, os.page_size);
-		void *last_page_end = (void*)align_previous(free_tail, os.page_size);
-		if ((u8*)last_page_end > (u8*)next_page) {
-			os_lock_program_memory_pages(next_page, (u64)last_page_end-(u64)next_page);
-		}
+		heap_pages_freed(block, new_node+1, (u8*)new_node + size);
 		
 		if ((u8*)new_node+size == (u8*)block->free_head) {
-			new_node->size = size + block->free_head->size;
-			new_node->next = block->free_head->next;
+			Heap_Free_Node *head = block->free_head;
+			new_node->size = size + head->size;
+			new_node->next = head->next;
 			block->free_head = new_node;
+			// head's header is free memory now, so the page it's in may be entirely free
+			heap_pages_freed(block, max((u8*)align_previous(head, os.page_size), (u8*)(new_node+1)), min((u8*)new_node + new_node->size, (u8*)align_next((u64)(head+1), os.page_size)));
 		} else {
 			new_node->next = block->free_head;
 			block->free_head = new_node;
@@ -447,74 +681,50 @@ void heap_dealloc(void *p) {
 			block->free_head = new_node;
 			new_node->next = 0;
 			
-			// #Copypaste
-			void *free_tail = (u8*)new_node + new_node->size;
-			void *next_page = (void*)align_next(new_node, os.page_size);
-			void *last_page_end = (void*)align_previous(free_tail, os.page_size);
-			if ((u8*)last_page_end > (u8*)next_page) {
-				os_lock_program_memory_pages(next_page, (u64)last_page_end-(u64)next_page);
-			}
+			heap_pages_freed(block, new_node+1, (u8*)new_node + size);
 			
 		} else {
+			// Free nodes are kept sorted by address so that a freed node can be merged with both
+			// of its neighbours, and so resize & maintenance can find neighbours by walking the list.
+			// Find the last node before new_node.
 			Heap_Free_Node *node = block->free_head;
-		
-			while (true) {
+			while (node->next && node->next < new_node) {
+				node = node->next;
+			}
+			
+			Heap_Free_Node *next = node->next;
+			u8 *node_tail = (u8*)node + node->size;
+			assert(node_tail <= (u8*)new_node, "Freed memory overlaps a free node! This is likely a double free or heap corruption");
 			
-				assert(node != 0, "We didn't find where the free node should be! This is likely heap corruption (or, hopefully not, an internal error)");
+			Heap_Free_Node *merged;
+			if (node_tail == (u8*)new_node) {
 				
-				// In retrospect, I don't remember a good reason to care about where the
-				// free nodes are... maybe I'm just dumb right now? #Speed #Memory
-				// ... ACtually, it's probably to easily know when to merge free nodes.
-				// BUT. Maybe it's not worth the performance hit? Then again, if the heap
-				// allocator slows down your program you should rethink your memory management
-				// anyways...
+				// We need to account for the cases where we coalesce free blocks with start/end in the middle
+				// of a page.
 				
-				if (new_node >= node) {
-					u8* node_tail = (u8*)node + node->size;
-					if (cast(u8*)new_node == node_tail) {
-						
-						// We need to account for the cases where we coalesce free blocks with start/end in the middle
-						// of a page.
-						
-						u64 new_node_size = new_node->size;
-						
-						// #Copypaste
-						void *free_tail = (u8*)new_node + new_node->size;
-						void *next_page = (void*)align_previous(node_tail, os.page_size);
-						void *last_page_end = (void*)align_previous(free_tail, os.page_size);
-
-						if ((u8*)next_page < (u8*)node) next_page = (u8*)next_page + os.page_size;
-						
-						if ((u8*)last_page_end > (u8*)next_page) {
-							os_lock_program_memory_pages(next_page, (u64)last_page_end-(u64)next_page);
-						}
-						
-						node->size += new_node_size;
-						
-						break;
-					} else {
-						new_node->next = node->next;
-						node->next = new_node;
-						
-						u8* new_node_tail = (u8*)new_node + new_node->size;
-						if (new_node->next && (u8*)new_node->next == new_node_tail) {
-							new_node->size += new_node->next->size;
-							new_node->next = new_node->next->next;
-						}
-						
-						// #Copypaste
-						void *free_tail = (u8*)new_node + new_node->size;
-						void *next_page = (void*)align_next(new_node, os.page_size);
-						void *last_page_end = (void*)align_previous(free_tail, os.page_size);
-						if ((u8*)last_page_end > (u8*)next_page) {
-							os_lock_program_memory_pages(next_page, (u64)last_page_end-(u64)next_page);
-						}
-						
-						break;
-					}
-				}
+				// The page node_tail is in is now entirely free, unless node's header is in it too
+				u8 *free_start = (u8*)align_previous(node_tail, os.page_size);
+				if (free_start < (u8*)(node+1)) free_start = (u8*)(node+1);
+				heap_pages_freed(block, free_start, node_tail + size);
 				
-				node = node->next;
+				node->size += size;
+				merged = node;
+			} else {
+				new_node->next = next;
+				node->next = new_node;
+				
+				heap_pages_freed(block, new_node+1, (u8*)new_node + size);
+				merged = new_node;
+			}
+			
+			u8 *merged_tail = (u8*)merged + merged->size;
+			assert(!next || merged_tail <= (u8*)next, "Freed memory overlaps a free node! This is likely a double free or heap corruption");
+			if (next && merged_tail == (u8*)next) {
+				merged->size += next->size;
+				merged->next = next->next;
+				
+				// next's header is free memory now, so the page it's in may be entirely free
+				heap_pages_freed(block, max((u8*)align_previous(next, os.page_size), (u8*)(merged+1)), min((u8*)merged + merged->size, (u8*)align_next((u64)(next+1), os.page_size)));
 			}
 		}
 	}
@@ -527,29 +737,702 @@ void heap_dealloc(void *p) {
 #if VERY_DEBUG
 	sanity_check_block(block);
 #endif
-	// #Sync #Speed oof
-	spinlock_release(&heap_lock);
+}
+
+// Expects heap_lock to be held and size to include metadata & be aligned to HEAP_ALIGNMENT.
+// Returns a slot with its metadata set up, but not its signature.
+Heap_Free_Slot *heap_size_class_pop(u64 size) {
+	assert(size <= HEAP_SMALL_ALLOCATION_MAX, "Internal heap error");
+	Heap_Size_Class *c = &heap_size_classes[heap_size_class_lookup[size/HEAP_ALIGNMENT]];
+	
+	if (c->free_head) {
+		Heap_Free_Slot *slot = c->free_head;
+		c->free_head = slot->next;
+		return slot;
+	}
+	
+	if (c->slab_next+c->slot_size > c->slab_end) {
+		// Whatever is left of the old slab is wasted, but it's less than a slot
+		Heap_Allocation_Metadata *slab = heap_general_alloc(HEAP_SLAB_SIZE, HEAP_BEST_FIT_SEARCH_LIMIT);
+		c->slab_next = (u8*)(slab+1);
+		c->slab_end = (u8*)slab + slab->size;
+		c->slab_block = slab->block;
+	}
+	Heap_Free_Slot *slot = (Heap_Free_Slot*)c->slab_next;
+	c->slab_next += c->slot_size;
+	slot->meta.size = c->slot_size;
+	slot->meta.block = c->slab_block;
+	return slot;
+}
+// Expects heap_lock to be held
+void heap_size_class_push(Heap_Free_Slot *slot) {
+	Heap_Size_Class *c = &heap_size_classes[heap_size_class_lookup[slot->meta.size/HEAP_ALIGNMENT]];
+	slot->next = c->free_head;
+	c->free_head = slot;
+}
+
+// Expects heap_lock to be held and size to include metadata & be aligned to HEAP_ALIGNMENT.
+Heap_Allocation_Metadata *heap_size_class_alloc(u64 size) {
+	Heap_Allocation_Metadata *meta = &heap_size_class_pop(size)->meta;
+	
+#if CONFIGURATION == DEBUG
+	meta->signature = HEAP_META_SIGNATURE;
+#endif
+	
+	check_meta(meta);
+	
+	return meta;
+}
+// Expects heap_lock to be held
+void heap_size_class_dealloc(Heap_Allocation_Metadata *meta) {
+	assert(meta->size <= HEAP_SMALL_ALLOCATION_MAX, "Internal heap error");
+	assert(heap_size_classes[heap_size_class_lookup[meta->size/HEAP_ALIGNMENT]].slot_size == meta->size, "Heap error: Slot size does not match its size class. The heap is probably corrupt.");
+	
+#if CONFIGURATION == DEBUG
+	memset(meta+1, 0x69696969, meta->size-sizeof(Heap_Allocation_Metadata));
+	meta->signature = HEAP_FREE_SLOT_SIGNATURE;
+#endif
+	
+	heap_size_class_push((Heap_Free_Slot*)meta);
+}
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+// Moves count slots of a class from this thread's cache back to the shared size class
+void heap_thread_cache_flush(u64 class_index, u64 count) {
+	Heap_Thread_Cache *cache = &heap_thread_cache;
+	assert(count <= cache->counts[class_index], "Internal heap error");
+	
+	heap_lock_acquire();
+	for (u64 i = 0; i < count; i++) {
+		Heap_Free_Slot *slot = cache->free_heads[class_index];
+		cache->free_heads[class_index] = slot->next;
+		heap_size_class_push(slot);
+	}
+	heap_lock_release();
+	
+	cache->counts[class_index] -= count;
+}
+// Gives all free slots in this thread's cache back to the heap. This is done automatically
+// when any thread that used the cache exits, and for the main thread when the program exits.
+void heap_thread_cache_flush_all() {
+	for (u64 i = 0; i < HEAP_SIZE_CLASS_COUNT; i++) {
+		if (heap_thread_cache.counts[i]) heap_thread_cache_flush(i, heap_thread_cache.counts[i]);
+	}
+}
+
+// Size must include metadata & be aligned to HEAP_ALIGNMENT.
+Heap_Allocation_Metadata *heap_thread_cache_alloc(u64 size) {
+	u64 class_index = heap_size_class_lookup[size/HEAP_ALIGNMENT];
+	Heap_Thread_Cache *cache = &heap_thread_cache;
+	
+	if (!cache->free_heads[class_index]) {
+		if (!cache->flushes_on_exit) {
+			cache->flushes_on_exit = true;
+			os_flush_heap_thread_cache_on_exit();
+		}
+		
+		// Grab a whole batch so we don't need the lock again for a while
+		heap_lock_acquire();
+		for (u64 i = 0; i < HEAP_THREAD_CACHE_BATCH; i++) {
+			Heap_Free_Slot *slot = heap_size_class_pop(size);
+			slot->next = cache->free_heads[class_index];
+			cache->free_heads[class_index] = slot;
+		}
+		heap_lock_release();
+		cache->counts[class_index] += HEAP_THREAD_CACHE_BATCH;
+	}
+	
+	Heap_Free_Slot *slot = cache->free_heads[class_index];
+	cache->free_heads[class_index] = slot->next;
+	cache->counts[class_index] -= 1;
+	
+	Heap_Allocation_Metadata *meta = &slot->meta;
+#if CONFIGURATION == DEBUG
+	meta->signature = HEAP_META_SIGNATURE;
+#endif
+	
+	check_meta(meta);
+	
+	return meta;
+}
+void heap_thread_cache_dealloc(Heap_Allocation_Metadata *meta) {
+	u64 class_index = heap_size_class_lookup[meta->size/HEAP_ALIGNMENT];
+	assert(heap_size_classes[class_index].slot_size == meta->size, "Heap error: Slot size does not match its size class. The heap is probably corrupt.");
+	Heap_Thread_Cache *cache = &heap_thread_cache;
+	
+#if CONFIGURATION == DEBUG
+	memset(meta+1, 0x69696969, meta->size-sizeof(Heap_Allocation_Metadata));
+	meta->signature = HEAP_FREE_SLOT_SIGNATURE;
+#endif
+	
+	Heap_Free_Slot *slot = (Heap_Free_Slot*)meta;
+	slot->next = cache->free_heads[class_index];
+	cache->free_heads[class_index] = slot;
+	cache->counts[class_index] += 1;
+	
+	if (!cache->flushes_on_exit) {
+		cache->flushes_on_exit = true;
+		os_flush_heap_thread_cache_on_exit();
+	}
+	if (cache->counts[class_index] >= HEAP_THREAD_CACHE_SLOT_COUNT) {
+		heap_thread_cache_flush(class_index, HEAP_THREAD_CACHE_BATCH);
+	}
+}
+#endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
+
+// Large allocations get a Heap_Block of their own which isn't linked into heap_head.
+// That way check_meta() & friends work the same as for anything else.
+// Expects heap_lock to be held and size to include metadata & be aligned to HEAP_ALIGNMENT.
+Heap_Allocation_Metadata *heap_large_alloc(u64 size) {
+	u64 total_size = align_next(size+sizeof(Heap_Block), os.page_size);
+	
+	// Best fit out of the spans we already decommitted
+	Heap_Large_Span *span = heap_large_spans;
+	Heap_Large_Span *previous = 0;
+	Heap_Large_Span *best_fit = 0;
+	Heap_Large_Span *before_best_fit = 0;
+	while (span) {
+		if (span->size >= total_size && (!best_fit || span->size < best_fit->size)) {
+			best_fit = span;
+			before_best_fit = previous;
+			if (span->size == total_size) break;
+		}
+		previous = span;
+		span = span->next;
+	}
+	
+	Heap_Block *block;
+	if (best_fit) {
+		Heap_Large_Span *next = best_fit->next;
+		if (best_fit->size > total_size) {
+			// Keep the tail as a smaller span. Its first page needs to be committed to hold the span.
+			Heap_Large_Span *rest = (Heap_Large_Span*)((u8*)best_fit + total_size);
+			os_commit_program_memory_pages(rest, os.page_size);
+			rest->size = best_fit->size - total_size;
+			rest->next = next;
+			next = rest;
+		}
+		if (before_best_fit) before_best_fit->next = next;
+		else heap_large_spans = next;
+		
+		block = (Heap_Block*)best_fit;
+		// First page is still committed
+		if (total_size > os.page_size) {
+			os_commit_program_memory_pages((u8*)block + os.page_size, total_size - os.page_size);
+		}
+		os_unlock_program_memory_pages(block, os.page_size);
+	} else {
+		block = (Heap_Block*)os_reserve_next_memory_pages(total_size);
+		os_unlock_program_memory_pages(block, total_size);
+	}
+	
+	block->size = total_size;
+	block->start = ((u8*)block)+sizeof(Heap_Block);
+	block->next = 0;
+	block->free_head = 0;
+	block->decommitted_size = 0;
+	block->decommitted_pages = 0;
+#if CONFIGURATION == DEBUG
+	block->total_allocated = total_size - sizeof(Heap_Block);
+#endif
+	
+	Heap_Allocation_Metadata *meta = (Heap_Allocation_Metadata*)block->start;
+	// Everything to the end of the pages is ours, so let realloc use all of it
+	meta->size = total_size - sizeof(Heap_Block);
+	meta->block = block;
+#if CONFIGURATION == DEBUG
+	meta->signature = HEAP_META_SIGNATURE;
+#endif
+	
+	check_meta(meta);
+	
+	return meta;
+}
+// Decommits pages we don't need anymore and puts them in heap_large_spans.
+// Expects heap_lock to be held. The first page must be committed.
+void heap_large_release_pages(void *start, u64 size) {
+	assert((u64)start % os.page_size == 0 && size % os.page_size == 0, "Internal heap error");
+	
+	// #Speed
+	// Decommitting means a syscall while holding heap_lock, but large allocations should be rare.
+	if (size > os.page_size) {
+		os_decommit_program_memory_pages((u8*)start + os.page_size, size - os.page_size);
+	}
+	
+	Heap_Large_Span *new_span = (Heap_Large_Span*)start;
+	new_span->size = size;
+	
+	Heap_Large_Span *span = heap_large_spans;
+	Heap_Large_Span *previous = 0;
+	while (span && span < new_span) {
+		previous = span;
+		span = span->next;
+	}
+	new_span->next = span;
+	if (previous) previous->next = new_span;
+	else heap_large_spans = new_span;
+	
+	// Merge with neighbours so the range can be reused for bigger allocations later
+	if (span && (u8*)new_span + new_span->size == (u8*)span) {
+		new_span->size += span->size;
+		new_span->next = span->next;
+		os_decommit_program_memory_pages(span, os.page_size);
+	}
+	if (previous && (u8*)previous + previous->size == (u8*)new_span) {
+		previous->size += new_span->size;
+		previous->next = new_span->next;
+		os_decommit_program_memory_pages(new_span, os.page_size);
+	}
+}
+// Expects heap_lock to be held
+void heap_large_dealloc(Heap_Allocation_Metadata *meta) {
+	Heap_Block *block = meta->block;
+	assert((u8*)meta == (u8*)block->start && block->free_head == 0, "Heap error: This does not look like a large allocation. The heap is probably corrupt.");
+	
+	heap_large_release_pages(block, block->size);
+}
+
+///
+// Resizing in place
+// These return false if the allocation has to move, in which case nothing was changed.
+// size must include metadata & be aligned to HEAP_ALIGNMENT.
+
+// Expects heap_lock to be held
+bool heap_general_resize_in_place(Heap_Allocation_Metadata *meta, u64 size) {
+	Heap_Block *block = meta->block;
+	
+	if (size == meta->size) return true;
+	
+	if (size < meta->size) {
+		// Must stay out of the size class range or dealloc will think it's a slot
+		if (size <= HEAP_SMALL_ALLOCATION_MAX) return false;
+		
+		u64 tail_size = meta->size - size;
+		// Not worth giving back, and we need room for the metadata we pass to heap_general_dealloc
+		if (tail_size < sizeof(Heap_Allocation_Metadata)) return true;
+		
+		Heap_Allocation_Metadata *tail = (Heap_Allocation_Metadata*)((u8*)meta + size);
+		tail->size = tail_size;
+		tail->block = block;
+		meta->size = size;
+		heap_general_dealloc(tail);
+		return true;
+	}
+	
+	if (size >= HEAP_LARGE_ALLOCATION_MIN) return false;
+	
+	// Free nodes are sorted by address, so we can stop once we're past our tail
+	u64 extra = size - meta->size;
+	Heap_Free_Node *after = (Heap_Free_Node*)((u8*)meta + meta->size);
+	Heap_Free_Node *node = block->free_head;
+	Heap_Free_Node *previous = 0;
+	while (node && node < after) {
+		previous = node;
+		node = node->next;
+	}
+	if (node != after || node->size < extra) return false;
+	
+	heap_pages_used(block, node, (u8*)node + min(node->size, extra+sizeof(Heap_Free_Node)));
+	
+	Heap_Free_Node *next = node->next;
+	if (node->size > extra) {
+		Heap_Free_Node *rest = (Heap_Free_Node*)((u8*)node + extra);
+		rest->size = node->size - extra;
+		rest->next = next;
+		next = rest;
+	}
+	if (previous) previous->next = next;
+	else block->free_head = next;
+	
+	meta->size = size;
+#if CONFIGURATION == DEBUG
+	block->total_allocated += extra;
+#endif
+
+#if VERY_DEBUG
+	sanity_check_block(block);
+#endif
+	
+	return true;
+}
+// Expects heap_lock to be held
+bool heap_large_resize_in_place(Heap_Allocation_Metadata *meta, u64 size) {
+	Heap_Block *block = meta->block;
+	
+	// Shrinking below the large range means we should move to the general heap
+	if (size < HEAP_LARGE_ALLOCATION_MIN) return false;
+	
+	u64 total_size = align_next(size+sizeof(Heap_Block), os.page_size);
+	
+	if (total_size < block->size) {
+		u64 tail_size = block->size - total_size;
+		block->size = total_size;
+		meta->size = total_size - sizeof(Heap_Block);
+#if CONFIGURATION == DEBUG
+		block->total_allocated = meta->size;
+#endif
+		heap_large_release_pages((u8*)block + total_size, tail_size);
+		return true;
+	}
+	if (total_size == block->size) return true;
+	
+	// Grow into a freed span right after us, if there is one
+	u64 extra = total_size - block->size;
+	Heap_Large_Span *after = (Heap_Large_Span*)((u8*)block + block->size);
+	Heap_Large_Span *span = heap_large_spans;
+	Heap_Large_Span *previous = 0;
+	while (span && span < after) {
+		previous = span;
+		span = span->next;
+	}
+	if (span != after || span->size < extra) return false;
+	
+	Heap_Large_Span *next = span->next;
+	if (span->size > extra) {
+		Heap_Large_Span *rest = (Heap_Large_Span*)((u8*)span + extra);
+		os_commit_program_memory_pages(rest, os.page_size);
+		rest->size = span->size - extra;
+		rest->next = next;
+		next = rest;
+	}
+	if (previous) previous->next = next;
+	else heap_large_spans = next;
+	
+	// First page of the span is still committed
+	if (extra > os.page_size) {
+		os_commit_program_memory_pages((u8*)span + os.page_size, extra - os.page_size);
+	}
+	os_unlock_program_memory_pages(span, os.page_size);
+	
+	block->size = total_size;
+	meta->size = total_size - sizeof(Heap_Block);
+#if CONFIGURATION == DEBUG
+	block->total_allocated = meta->size;
+#endif
+	
+	return true;
+}
+bool heap_resize_in_place(Heap_Allocation_Metadata *meta, u64 size) {
+	if (meta->size <= HEAP_SMALL_ALLOCATION_MAX) {
+		// Slots can't grow, but there's no reason to move if we'd still use most of it
+		return size <= meta->size && size > meta->size/2;
+	}
+	
+	bool ok;
+	heap_lock_acquire();
+	if (meta->size < HEAP_LARGE_ALLOCATION_MIN) ok = heap_general_resize_in_place(meta, size);
+	else                                        ok = heap_large_resize_in_place(meta, size);
+	heap_lock_release();
+	return ok;
+}
+
+///
+// Maintenance
+// The heap never gives memory back to the OS on its own. Call heap_maintenance() when there's
+// time to spare (loading screens, after unloading a level, on a low priority thread...) to:
+//   - Merge any adjacent free nodes that were missed (dealloc already merges with both neighbours)
+//   - Decommit the pages that are entirely inside a free node
+//   - Release heap blocks (other than the first one) which have nothing left in them
+// Decommitted pages are committed again once an allocation needs them. Released blocks go in
+// heap_large_spans, so large allocations & virtual arenas can reuse the address range.
+
+// Expects heap_lock to be held
+Heap_Fragmentation_Stats heap_measure_fragmentation() {
+	Heap_Fragmentation_Stats stats = ZERO(Heap_Fragmentation_Stats);
+	
+	for (Heap_Block *block = heap_head; block; block = block->next) {
+		stats.block_count += 1;
+		stats.decommitted_size += block->decommitted_size;
+		for (Heap_Free_Node *node = block->free_head; node; node = node->next) {
+			stats.free_node_count += 1;
+			stats.free_size += node->size;
+			stats.largest_free_node = max(stats.largest_free_node, node->size);
+		}
+	}
+	for (Heap_Large_Span *span = heap_large_spans; span; span = span->next) {
+		stats.released_size += span->size - os.page_size;
+	}
+	
+	if (stats.free_size) {
+		stats.fragmentation = 1.0 - (float64)stats.largest_free_node/(float64)stats.free_size;
+	}
+	
+	return stats;
+}
+Heap_Fragmentation_Stats get_heap_fragmentation_stats() {
+	if (!heap_initted) heap_init();
+	heap_lock_acquire();
+	Heap_Fragmentation_Stats stats = heap_measure_fragmentation();
+	heap_lock_release();
+	return stats;
+}
+
+// before & after may be null
+void heap_maintenance(Heap_Fragmentation_Stats *before, Heap_Fragmentation_Stats *after) {
+	if (!heap_initted) heap_init();
+	
+	// #Speed
+	// This holds heap_lock for the whole pass and makes a syscall per free node that spans
+	// whole pages, so every other thread that needs the heap blocks has to wait.
+	heap_lock_acquire();
+	
+	if (before) *before = heap_measure_fragmentation();
+	
+	Heap_Block *previous_block = 0;
+	Heap_Block *block = heap_head;
+	while (block) {
+		Heap_Block *next_block = block->next;
+		
+#if VERY_DEBUG
+		sanity_check_block(block);
+#endif
+		
+		// Free nodes are sorted by address (see heap_general_dealloc) so neighbours are next to
+		// each other in the list
+		Heap_Free_Node *node = block->free_head;
+		while (node) {
+			Heap_Free_Node *next = node->next;
+			if (next && (u8*)node + node->size == (u8*)next) {
+				node->size += next->size;
+				node->next = next->next;
+				continue;
+			}
+			node = next;
+		}
+		
+		bool empty = block->free_head && block->free_head->size == get_heap_block_size_excluding_metadata(block);
+		if (empty && block != heap_head) {
+			previous_block->next = next_block;
+			// The first page holds the block header so it's still committed
+			heap_large_release_pages(block, block->size);
+			block = next_block;
+			continue;
+		}
+		
+		for (node = block->free_head; node; node = node->next) {
+			// Keep the page with the node header, and the last page which is shared with
+			// whatever comes after the node.
+			u64 first_page = align_next((u64)node + sizeof(Heap_Free_Node), os.page_size);
+			u64 end = align_previous((u64)node + node->size, os.page_size);
+			if (end > first_page) heap_set_pages_decommitted(block, first_page, end, true);
+		}
+		
+		previous_block = block;
+		block = next_block;
+	}
+	
+	if (after) *after = heap_measure_fragmentation();
+	
+	heap_lock_release();
+}
+
+void *heap_alloc(u64 size) {
+
+	if (!heap_initted) heap_init();
+	
+	size += sizeof(Heap_Allocation_Metadata);
+	size = align_next(size, HEAP_ALIGNMENT);
+
+	Heap_Allocation_Metadata *meta;
+	if (size <= HEAP_SMALL_ALLOCATION_MAX) {
+		meta = heap_thread_cache_alloc(size);
+	} else if (size < HEAP_LARGE_ALLOCATION_MIN) {
+		// #Sync #Speed oof
+		heap_lock_acquire();
+		meta = heap_general_alloc(size, HEAP_BEST_FIT_SEARCH_LIMIT);
+		heap_lock_release();
+	} else {
+		heap_lock_acquire();
+		meta = heap_large_alloc(size);
+		heap_lock_release();
+	}
+	
+	void *p = ((u8*)meta)+sizeof(Heap_Allocation_Metadata);
+	assert((u64)p % HEAP_ALIGNMENT == 0, "Internal heap error. Result pointer is not aligned to HEAP_ALIGNMENT");
+	return p;
+}
+void heap_dealloc(void *p) {
+	
+	if (!heap_initted) heap_init();
+	
+	assert(is_pointer_in_program_memory(p), "A bad pointer was passed tp heap_dealloc: it is out of program memory bounds!"); 
+	Heap_Allocation_Metadata *meta = (Heap_Allocation_Metadata*)((u8*)p-sizeof(Heap_Allocation_Metadata));
+
+	check_meta(meta);
+	
+	// Size classes, general & large allocations never overlap in size, so the size tells us where it came from
+	if (meta->size <= HEAP_SMALL_ALLOCATION_MAX) {
+		heap_thread_cache_dealloc(meta);
+	} else if (meta->size < HEAP_LARGE_ALLOCATION_MIN) {
+		// #Sync #Speed oof
+		heap_lock_acquire();
+		heap_general_dealloc(meta);
+		heap_lock_release();
+	} else {
+		heap_lock_acquire();
+		heap_large_dealloc(meta);
+		heap_lock_release();
+	}
+}
+
+///
+// Allocation tracing
+// allocation_trace_begin(path) starts writing every allocation that goes through
+// heap_allocator_proc or temporary storage to a file, until allocation_trace_end().
+// oogabooga/tools/allocation_trace_replay.c can replay that file against this heap and other allocators, so
+// allocator changes can be measured against what a real game does.
+//
+// The file is an Allocation_Trace_Header followed by Allocation_Trace_Events, in the order they
+// happened (events from all threads go through one lock). Pointers are just ids; a free or
+// realloc refers to the pointer of an earlier event.
+// Temporary storage doesn't free, so instead it records when a scratch arena was rewound (by
+// scratch_end or reset_temporary_storage). Everything pushed to that arena in a later chunk, or
+// at/after the rewound-to pointer in the same chunk, is gone.
+
+#define ALLOCATION_TRACE_MAGIC 0x454341525442474Full // "OGBTRACE" in little endian
+#define ALLOCATION_TRACE_VERSION 1
+#ifndef ALLOCATION_TRACE_BUFFER_COUNT
+	#define ALLOCATION_TRACE_BUFFER_COUNT 4096
+#endif
+
+typedef enum Allocation_Trace_Event_Kind {
+	ALLOCATION_TRACE_ALLOCATE = 0,
+	ALLOCATION_TRACE_DEALLOCATE,
+	ALLOCATION_TRACE_REALLOCATE,
+	ALLOCATION_TRACE_TEMP_ALLOCATE,
+	ALLOCATION_TRACE_TEMP_REWIND,
+} Allocation_Trace_Event_Kind;
+
+typedef struct Allocation_Trace_Header {
+	u64 magic;
+	u32 version;
+	u32 event_size;
+} Allocation_Trace_Header;
+
+typedef struct Allocation_Trace_Event {
+	u64 cycles; // rdtsc()
+	u64 pointer; // Result of an allocation, what was freed, or where a scratch arena was rewound to
+	u64 old_pointer; // Realloc: what was reallocated. Temporary storage: the scratch chunk
+	u64 size;
+	u32 thread_id;
+	u16 kind; // Allocation_Trace_Event_Kind
+	u16 arena; // Temporary storage: index into this thread's scratch arenas
+	u64 padding;
+	// 48 bytes
+} Allocation_Trace_Event;
+
+// #Global
+ogb_instance bool allocation_trace_active;
+ogb_instance Spinlock allocation_trace_lock;
+ogb_instance File allocation_trace_file;
+ogb_instance Allocation_Trace_Event *allocation_trace_buffer;
+ogb_instance u64 allocation_trace_count;
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+bool allocation_trace_active = false;
+Spinlock allocation_trace_lock;
+File allocation_trace_file;
+Allocation_Trace_Event *allocation_trace_buffer = 0;
+u64 allocation_trace_count = 0;
+#endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
+
+// Expects allocation_trace_lock to be held
+void allocation_trace_flush() {
+	if (!allocation_trace_count) return;
+	bool ok = os_file_write_bytes(allocation_trace_file, allocation_trace_buffer, allocation_trace_count*sizeof(Allocation_Trace_Event));
+	assert(ok, "Failed writing allocation trace");
+	allocation_trace_count = 0;
+}
+
+bool allocation_trace_begin(string path) {
+	assert(!allocation_trace_active, "An allocation trace is already being recorded");
+	
+	File f = os_file_open(path, O_WRITE | O_CREATE);
+	if (f == OS_INVALID_FILE) return false;
+	
+	Allocation_Trace_Header header = ZERO(Allocation_Trace_Header);
+	header.magic = ALLOCATION_TRACE_MAGIC;
+	header.version = ALLOCATION_TRACE_VERSION;
+	header.event_size = sizeof(Allocation_Trace_Event);
+	if (!os_file_write_bytes(f, &header, sizeof(header))) {
+		os_file_close(f);
+		return false;
+	}
+	
+	// Straight from the heap so it doesn't show up in the trace
+	allocation_trace_buffer = (Allocation_Trace_Event*)heap_alloc(ALLOCATION_TRACE_BUFFER_COUNT*sizeof(Allocation_Trace_Event));
+	allocation_trace_file = f;
+	allocation_trace_count = 0;
+	spinlock_init(&allocation_trace_lock);
+	MEMORY_BARRIER;
+	allocation_trace_active = true;
+	return true;
+}
+void allocation_trace_end() {
+	assert(allocation_trace_active, "No allocation trace is being recorded");
+	
+	spinlock_acquire_or_wait(&allocation_trace_lock);
+	allocation_trace_active = false;
+	allocation_trace_flush();
+	os_file_close(allocation_trace_file);
+	heap_dealloc(allocation_trace_buffer);
+	allocation_trace_buffer = 0;
+	spinlock_release(&allocation_trace_lock);
+}
+
+void allocation_trace_record(Allocation_Trace_Event_Kind kind, void *pointer, void *old_pointer, u64 size, u16 arena) {
+	Allocation_Trace_Event e;
+	e.pointer = (u64)pointer;
+	e.old_pointer = (u64)old_pointer;
+	e.size = size;
+	e.thread_id = (u32)get_context().thread_id;
+	e.kind = (u16)kind;
+	e.arena = arena;
+	e.padding = 0;
+	
+	spinlock_acquire_or_wait(&allocation_trace_lock);
+	// Might have ended while we were waiting
+	if (allocation_trace_active) {
+		e.cycles = rdtsc();
+		allocation_trace_buffer[allocation_trace_count] = e;
+		allocation_trace_count += 1;
+		if (allocation_trace_count == ALLOCATION_TRACE_BUFFER_COUNT) allocation_trace_flush();
+	}
+	spinlock_release(&allocation_trace_lock);
 }
 
 void* heap_allocator_proc(u64 size, void *p, Allocator_Message message, void* data) {
 	switch (message) {
 		case ALLOCATOR_ALLOCATE: {
-			return heap_alloc(size);
+			void *result = heap_alloc(size);
+			if (allocation_trace_active) allocation_trace_record(ALLOCATION_TRACE_ALLOCATE, result, 0, size, 0);
+			return result;
 			break;
 		}
 		case ALLOCATOR_DEALLOCATE: {
+			if (allocation_trace_active) allocation_trace_record(ALLOCATION_TRACE_DEALLOCATE, p, 0, 0, 0);
 			heap_dealloc(p);
 			return 0;
 		}
 		case ALLOCATOR_REALLOCATE: {
 			if (!p) {
-				return heap_alloc(size);
+				void *result = heap_alloc(size);
+				if (allocation_trace_active) allocation_trace_record(ALLOCATION_TRACE_ALLOCATE, result, 0, size, 0);
+				return result;
 			}
 			assert(is_pointer_valid(p), "Invalid pointer passed to heap allocator reallocate");
 			Heap_Allocation_Metadata *meta = (Heap_Allocation_Metadata*)(((u64)p)-sizeof(Heap_Allocation_Metadata));
 			check_meta(meta);
+			
+			if (heap_resize_in_place(meta, align_next(size+sizeof(Heap_Allocation_Metadata), HEAP_ALIGNMENT))) {
+				if (allocation_trace_active) allocation_trace_record(ALLOCATION_TRACE_REALLOCATE, p, p, size, 0);
+				return p;
+			}
+			
 			void *new = heap_alloc(size);
-			memcpy(new, p, min(size, meta->size));
+			memcpy(new, p, min(size, meta->size-sizeof(Heap_Allocation_Metadata)));
+			// Before the dealloc, so nobody else can get p recorded as theirs before we're done with it
+			if (allocation_trace_active) allocation_trace_record(ALLOCATION_TRACE_REALLOCATE, new, p, size, 0);
 			heap_dealloc(p);
 			return new;
 		}
@@ -570,10 +1453,50 @@ Allocator get_heap_allocator() {
 ///
 // Temporary storage
 ///
+// Each thread has SCRATCH_ARENA_COUNT scratch arenas. The first one is what talloc() and
+// get_temporary_allocator() use, i.e. "temporary storage", which you normally throw away
+// once per frame with reset_temporary_storage().
+//
+// For temporary work that shouldn't stick around until the end of the frame, use a scope:
+//     Scratch scratch = scratch_begin();
+//     void *stuff = alloc(scratch.allocator, 1024);
+//     ...
+//     scratch_end(scratch); // Everything allocated since scratch_begin is gone
+// Scopes nest. If you were handed an allocator which might be scratch memory itself (i.e. the
+// caller passed get_temporary_allocator()), use scratch_begin_avoid(that_allocator) so you get
+// a different scratch arena. Otherwise ending your scope would also free what you allocated
+// with the caller's allocator.
+//
+// When a scratch arena is full it spills into chunks from the heap instead of wrapping around.
+// Those chunks are freed when the scope ends or temporary storage is reset.
 
 #ifndef TEMPORARY_STORAGE_SIZE
 	#define TEMPORARY_STORAGE_SIZE (1024ULL*1024ULL*2ULL) // 2mb
 #endif
+#ifndef SCRATCH_ARENA_COUNT
+	#define SCRATCH_ARENA_COUNT 2
+#endif
+
+typedef struct Scratch_Chunk Scratch_Chunk;
+typedef struct Scratch_Chunk {
+	Scratch_Chunk *previous;
+	u64 size; // Excluding this header
+} Scratch_Chunk;
+
+typedef struct Scratch_Arena {
+	Scratch_Chunk *first; // Lives as long as the thread does
+	Scratch_Chunk *current; // first or the latest overflow chunk
+	u8 *next;
+	u8 *end;
+	bool has_warned_overflow;
+} Scratch_Arena;
+
+typedef struct Scratch {
+	Allocator allocator;
+	Scratch_Arena *arena;
+	Scratch_Chunk *chunk;
+	u8 *next;
+} Scratch;
 
 ogb_instance void* talloc(u64);
 ogb_instance void* temp_allocator_proc(u64 size, void *p, Allocator_Message message, void*);
@@ -583,14 +1506,13 @@ ogb_instance Allocator
 get_temporary_allocator();
 
 #if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
-thread_local void * temporary_storage = 0;
-thread_local void * temporary_storage_pointer = 0;
-thread_local bool   has_warned_temporary_storage_overflow = false;
+thread_local Scratch_Arena scratch_arenas[SCRATCH_ARENA_COUNT];
+thread_local u64 scratch_arena_size = 0;
 thread_local Allocator temp_allocator;
 
 ogb_instance Allocator 
 get_temporary_allocator() {
-	if (!temporary_storage) return get_initialization_allocator();
+	if (!scratch_arenas[0].first) return get_initialization_allocator();
 	return temp_allocator;
 }
 #endif
@@ -601,18 +1523,86 @@ temp_allocator_proc(u64 size, void *p, Allocator_Message message, void* data);
 ogb_instance void 
 temporary_storage_init(u64 arena_size);
 
+// Frees all scratch arenas of this thread. This is done automatically when a thread made with
+// os_thread_start exits.
+ogb_instance void 
+temporary_storage_destroy();
+
 ogb_instance void* 
 talloc(u64 size);
 
+// Don't do this while there's an open scratch scope from scratch_begin() on temporary storage
 ogb_instance void 
 reset_temporary_storage();
 
+ogb_instance Scratch
+scratch_begin();
+
+ogb_instance Scratch
+scratch_begin_avoid(Allocator conflict);
+
+ogb_instance void
+scratch_end(Scratch scratch);
+
 
 #if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+void scratch_arena_init(Scratch_Arena *arena, u64 size) {
+	*arena = ZERO(Scratch_Arena);
+	arena->first = (Scratch_Chunk*)heap_alloc(sizeof(Scratch_Chunk)+size);
+	assert(arena->first, "Failed allocating temporary storage");
+	arena->first->previous = 0;
+	arena->first->size = size;
+	arena->current = arena->first;
+	arena->next = (u8*)(arena->first+1);
+	arena->end = arena->next + size;
+}
+void *scratch_arena_push(Scratch_Arena *arena, u64 size) {
+	
+	u8 *p = arena->next;
+	
+	if (p + size > arena->end) {
+		if (!arena->has_warned_overflow) {
+			os_write_string_to_stdout(STR("WARNING: temporary storage was overflown, spilling into heap memory.\n"));
+			arena->has_warned_overflow = true;
+		}
+		u64 chunk_size = max(size, arena->first->size);
+		Scratch_Chunk *chunk = (Scratch_Chunk*)heap_alloc(sizeof(Scratch_Chunk)+chunk_size);
+		chunk->previous = arena->current;
+		chunk->size = chunk_size;
+		arena->current = chunk;
+		p = (u8*)(chunk+1);
+		arena->end = p + chunk_size;
+	}
+	
+	arena->next = p + size;
+	
+	if (allocation_trace_active) {
+		allocation_trace_record(ALLOCATION_TRACE_TEMP_ALLOCATE, p, arena->current, size, (u16)(arena-scratch_arenas));
+	}
+	
+	return p;
+}
+void scratch_arena_rewind(Scratch_Arena *arena, Scratch_Chunk *chunk, u8 *next) {
+	while (arena->current != chunk) {
+		assert(arena->current != arena->first, "Scratch scope does not belong to this arena. Did you end it twice, or reset temporary storage while it was open?");
+		Scratch_Chunk *previous = arena->current->previous;
+		heap_dealloc(arena->current);
+		arena->current = previous;
+	}
+	assert(next >= (u8*)(chunk+1) && next <= (u8*)(chunk+1) + chunk->size, "Scratch scope does not belong to this arena. Did you end it twice, or reset temporary storage while it was open?");
+	arena->next = next;
+	arena->end = (u8*)(chunk+1) + chunk->size;
+	
+	if (allocation_trace_active) {
+		allocation_trace_record(ALLOCATION_TRACE_TEMP_REWIND, next, chunk, 0, (u16)(arena-scratch_arenas));
+	}
+}
+
 void* temp_allocator_proc(u64 size, void *p, Allocator_Message message, void* data) {
 	switch (message) {
 		case ALLOCATOR_ALLOCATE: {
-			return talloc(size);
+			Scratch_Arena *arena = data ? (Scratch_Arena*)data : &scratch_arenas[0];
+			return scratch_arena_push(arena, size);
 			break;
 		}
 		case ALLOCATOR_DEALLOCATE: {
@@ -628,56 +1618,97 @@ void* temp_allocator_proc(u64 size, void *p, Allocator_Message message, void* da
 
 void temporary_storage_init(u64 arena_size) {
 	
-	temporary_storage = heap_alloc(arena_size);
-	assert(temporary_storage, "Failed allocating temporary storage");
-	temporary_storage_pointer = temporary_storage;
+	scratch_arena_size = arena_size;
+	scratch_arena_init(&scratch_arenas[0], arena_size);
 
 	temp_allocator.proc = temp_allocator_proc;
 	temp_allocator.data = 0;
-	
-	temp_allocator.proc = temp_allocator_proc;
+}
+void temporary_storage_destroy() {
+	for (u64 i = 0; i < SCRATCH_ARENA_COUNT; i++) {
+		Scratch_Arena *arena = &scratch_arenas[i];
+		if (!arena->first) continue;
+		scratch_arena_rewind(arena, arena->first, (u8*)(arena->first+1));
+		heap_dealloc(arena->first);
+		*arena = ZERO(Scratch_Arena);
+	}
 }
 
 void* talloc(u64 size) {
-	
-	assert(size < TEMPORARY_STORAGE_SIZE, "Bruddah this is too large for temp allocator");
-	
-	void* p = temporary_storage_pointer;
-	
-	temporary_storage_pointer = (u8*)temporary_storage_pointer + size;
-	
-	if ((u8*)temporary_storage_pointer >= (u8*)temporary_storage+TEMPORARY_STORAGE_SIZE) {
-		if (!has_warned_temporary_storage_overflow) {
-			os_write_string_to_stdout(STR("WARNING: temporary storage was overflown, we wrap around at the start.\n"));
-			has_warned_temporary_storage_overflow = true;
-		}
-		temporary_storage_pointer = temporary_storage;
-		return talloc(size);;
-	}
-	
-	return p;
+	return scratch_arena_push(&scratch_arenas[0], size);
 }
 
 void reset_temporary_storage() {
-	temporary_storage_pointer = temporary_storage;	
-	has_warned_temporary_storage_overflow = false;
+	Scratch_Arena *arena = &scratch_arenas[0];
+	scratch_arena_rewind(arena, arena->first, (u8*)(arena->first+1));
+	arena->has_warned_overflow = false;
+}
+
+Scratch scratch_begin_avoid(Allocator conflict) {
+	u64 index = 0;
+	if (conflict.proc == temp_allocator_proc) {
+		// data is 0 for get_temporary_allocator(), which is the first arena
+		Scratch_Arena *conflicting = conflict.data ? (Scratch_Arena*)conflict.data : &scratch_arenas[0];
+		if (conflicting == &scratch_arenas[0]) index = 1;
+	}
+	assert(index < SCRATCH_ARENA_COUNT, "Not enough scratch arenas, increase SCRATCH_ARENA_COUNT");
+	
+	Scratch_Arena *arena = &scratch_arenas[index];
+	if (!arena->first) scratch_arena_init(arena, scratch_arena_size);
+	
+	Scratch scratch;
+	scratch.allocator.proc = temp_allocator_proc;
+	scratch.allocator.data = arena;
+	scratch.arena = arena;
+	scratch.chunk = arena->current;
+	scratch.next = arena->next;
+	return scratch;
+}
+Scratch scratch_begin() {
+	return scratch_begin_avoid(ZERO(Allocator));
+}
+void scratch_end(Scratch scratch) {
+	scratch_arena_rewind(scratch.arena, scratch.chunk, scratch.next);
 }
 
 #endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
 
 
+///
+///
+// Arenas
+///
+// Either a fixed size chunk of heap memory (make_arena), or a virtual arena (make_virtual_arena)
+// which reserves an address range up front and only commits pages as they get pushed into.
+// Pushing past the end of a fixed arena or past the reserved range of a virtual arena is an
+// assert, not silent corruption.
+//
+// arena_mark() & arena_rewind() let you throw away everything pushed since the mark, i.e:
+//     Arena_Mark mark = arena_mark(&level_arena);
+//     ... push stuff for this frame ...
+//     arena_rewind(&level_arena, mark);
+// Rewinding does not decommit pages, so the next push up to the high water mark is free.
+
+#ifndef ARENA_COMMIT_SIZE
+	#define ARENA_COMMIT_SIZE KB(64)
+#endif
+
 typedef struct Arena {
 	void *start;
 	void *next;
-	u64 size;
+	u64 size; // For virtual arenas this is how much is committed right now
+	u64 reserved_size; // 0 for fixed size arenas
+	u64 high_water_mark; // Most bytes that were ever pushed at once
 } Arena;
 
-
+typedef struct Arena_Mark {
+	void *next;
+} Arena_Mark;
 
 // Allocates arena from heap
 Arena make_arena(u64 size) {
 	size = align_next(size, 8);
-	Arena arena;
+	Arena arena = ZERO(Arena);
 	
 	arena.start = alloc(get_heap_allocator(), size);
 	arena.next = arena.start;
@@ -686,13 +1717,63 @@ Arena make_arena(u64 size) {
 	return arena;
 }
 
+// Reserves reserve_size bytes of address space but only commits ARENA_COMMIT_SIZE at a time.
+// Nothing in the reserved range is committed or touched until it gets pushed into.
+Arena make_virtual_arena(u64 reserve_size) {
+	reserve_size = align_next(reserve_size, ARENA_COMMIT_SIZE);
+	Arena arena = ZERO(Arena);
+	
+	arena.start = os_reserve_memory_pages(reserve_size);
+	arena.next = arena.start;
+	arena.size = 0;
+	arena.reserved_size = reserve_size;
+	
+	return arena;
+}
+// Gives the memory and the address range of a virtual arena back to the OS
+void destroy_virtual_arena(Arena *arena) {
+	assert(arena->reserved_size, "destroy_virtual_arena was called on an arena made with make_arena");
+	
+	os_release_memory_pages(arena->start, arena->reserved_size);
+	
+	*arena = ZERO(Arena);
+}
+
 void *arena_push(Arena *arena, u64 size) {
-	void *p = arena->next;
-	arena->next = (u8*)arena->next + size;
+	u8 *p = (u8*)arena->next;
+	u8 *next = p + size;
+	u8 *end = (u8*)arena->start + arena->size;
+	
+	if (next > end) {
+		assert(arena->reserved_size, "Arena overflow! Tried to push %llu bytes but only %llu of %llu are left", size, (u64)(end-p), arena->size);
+		assert(next <= (u8*)arena->start + arena->reserved_size, "Virtual arena overflow! Tried to push %llu bytes but the arena only reserved %llu bytes", size, arena->reserved_size);
+		
+		u64 commit_size = align_next((u64)(next-end), ARENA_COMMIT_SIZE);
+		commit_size = min(commit_size, arena->reserved_size-arena->size);
+		os_commit_program_memory_pages(end, commit_size);
+		arena->size += commit_size;
+	}
+	
+	arena->next = next;
+	arena->high_water_mark = max(arena->high_water_mark, (u64)(next-(u8*)arena->start));
 	return p;
 }
 #define arena_push_struct(parena, type) arena_push((parena), sizeof(type))
 
+Arena_Mark arena_mark(Arena *arena) {
+	return (Arena_Mark){ arena->next };
+}
+void arena_rewind(Arena *arena, Arena_Mark mark) {
+	assert((u8*)mark.next >= (u8*)arena->start && (u8*)mark.next <= (u8*)arena->next, "Arena mark is not from this arena, or it was rewound past already");
+	arena->next = mark.next;
+}
+void arena_reset(Arena *arena) {
+	arena->next = arena->start;
+}
+u64 arena_get_used(Arena *arena) {
+	return (u64)arena->next - (u64)arena->start;
+}
+
 void* arena_allocator_proc(u64 size, void *p, Allocator_Message message, void* data) {
 	if (size > 8) size = align_next(size, 8);
 	Arena *arena = (Arena*)data;
@@ -716,6 +1797,7 @@ Allocator make_arena_allocator(u64 size) {
 	void *mem = alloc(get_heap_allocator(), size + sizeof(Arena));
 	
 	Arena *arena = (Arena*)mem;
+	*arena = ZERO(Arena);
 	
 	arena->start = (u8*)mem + sizeof(Arena);
 	arena->next = arena->start;
@@ -728,9 +1810,8 @@ Allocator make_arena_allocator(u64 size) {
 	return allocator;
 }
 Allocator make_arena_allocator_with_memory(u64 size, void *p) {
-	void *mem = alloc(get_heap_allocator(), size + sizeof(Arena));
-	
 	Arena *arena = (Arena*)alloc(get_heap_allocator(), sizeof(Arena));
+	*arena = ZERO(Arena);
 	
 	arena->start = p;
 	arena->next = arena->start;
@@ -749,3 +1830,204 @@ Allocator make_arena_allocator_from_arena(Arena *arena) {
 	
 	return allocator;
 }
+
+///
+///
+// Pool allocator
+///
+// Fixed size slots for one type of object, i.e. entities or audio players.
+// Slots come in chunks of slots_per_chunk which are never moved or freed until pool_destroy,
+// so pointers to pooled objects stay valid. Acquire & release are O(1) through a free list.
+// Released slots are reused first (LIFO) so live objects stay packed in the earliest chunks.
+//
+// Each slot has a small header with a generation which is bumped on acquire & release
+// (odd means in use). A Pool_Handle remembers the generation, so pool_get() on a handle to
+// an object that has since been released returns 0 instead of whatever took its slot.
+//
+// The free list lives in the slot headers, not in the object memory, so a released object
+// keeps its contents until the slot is acquired again.
+//
+// Iterate live objects in memory order with:
+//     Pool_Iterator it = ZERO(Pool_Iterator);
+//     Entity *e;
+//     while ((e = pool_next(&pool, &it))) { ... }
+//
+// Pools are not thread safe. Iterating is fine while another thread acquires though, since
+// new chunks are only linked in after they are initialized.
+
+typedef struct Pool_Slot_Header Pool_Slot_Header;
+typedef struct Pool_Slot_Header {
+	u32 generation; // Odd when in use
+	u32 index;
+	Pool_Slot_Header *next_free;
+} Pool_Slot_Header;
+
+typedef struct Pool_Chunk Pool_Chunk;
+typedef struct Pool_Chunk {
+	Pool_Chunk *next;
+	u64 first_index;
+} Pool_Chunk;
+
+typedef struct Pool {
+	u64 object_size;
+	u64 slot_size; // Including header
+	u64 slots_per_chunk;
+	Allocator parent;
+	
+	Pool_Chunk *first_chunk;
+	Pool_Chunk *last_chunk;
+	Pool_Chunk **chunk_table; // Growing array, for looking up handles
+	Pool_Slot_Header *free_head;
+	
+	u64 count; // Objects in use
+	u64 capacity; // Total slots in all chunks
+} Pool;
+
+typedef struct Pool_Handle {
+	u32 index;
+	u32 generation; // 0 is never a valid generation, so a zeroed handle is invalid
+} Pool_Handle;
+
+typedef struct Pool_Iterator {
+	Pool_Chunk *chunk;
+	u64 slot;
+	bool started;
+} Pool_Iterator;
+
+#define pool_init_typed(ppool, type, slots_per_chunk, parent) pool_init((ppool), sizeof(type), (slots_per_chunk), (parent))
+
+Pool_Slot_Header *pool_get_slot_header(Pool *pool, Pool_Chunk *chunk, u64 slot) {
+	return (Pool_Slot_Header*)((u8*)(chunk+1) + slot*pool->slot_size);
+}
+
+void pool_init(Pool *pool, u64 object_size, u64 slots_per_chunk, Allocator parent) {
+	assert(object_size > 0 && slots_per_chunk > 0, "Bad pool size");
+	*pool = ZERO(Pool);
+	pool->object_size = object_size;
+	pool->slot_size = align_next(sizeof(Pool_Slot_Header)+object_size, 16);
+	pool->slots_per_chunk = slots_per_chunk;
+	pool->parent = parent;
+	growing_array_init((void**)&pool->chunk_table, sizeof(Pool_Chunk*), parent);
+}
+void pool_destroy(Pool *pool) {
+	Pool_Chunk *chunk = pool->first_chunk;
+	while (chunk) {
+		Pool_Chunk *next = chunk->next;
+		dealloc(pool->parent, chunk);
+		chunk = next;
+	}
+	growing_array_deinit((void**)&pool->chunk_table);
+	*pool = ZERO(Pool);
+}
+
+void pool_add_chunk(Pool *pool) {
+	Pool_Chunk *chunk = (Pool_Chunk*)alloc(pool->parent, sizeof(Pool_Chunk) + pool->slots_per_chunk*pool->slot_size);
+	chunk->next = 0;
+	chunk->first_index = pool->capacity;
+	
+	// Link in reverse so the lowest slot gets handed out first
+	for (s64 i = (s64)pool->slots_per_chunk-1; i >= 0; i--) {
+		Pool_Slot_Header *header = pool_get_slot_header(pool, chunk, (u64)i);
+		header->generation = 0;
+		header->index = (u32)(chunk->first_index + (u64)i);
+		header->next_free = pool->free_head;
+		pool->free_head = header;
+	}
+	
+	growing_array_add((void**)&pool->chunk_table, &chunk);
+	pool->capacity += pool->slots_per_chunk;
+	assert(pool->capacity <= UINT32_MAX, "Pool is too big for 32 bit handle indices");
+	
+	// Only link the chunk once it's initialized, for threads iterating the pool
+	MEMORY_BARRIER;
+	if (pool->last_chunk) pool->last_chunk->next = chunk;
+	else pool->first_chunk = chunk;
+	pool->last_chunk = chunk;
+}
+
+// Returns zeroed memory
+void *pool_acquire(Pool *pool) {
+	if (!pool->free_head) pool_add_chunk(pool);
+	
+	Pool_Slot_Header *header = pool->free_head;
+	pool->free_head = header->next_free;
+	header->next_free = 0;
+	
+	assert(header->generation % 2 == 0, "Pool slot on the free list was in use. The pool is probably corrupt.");
+	header->generation += 1;
+	pool->count += 1;
+	
+	void *p = header+1;
+	memset(p, 0, pool->object_size);
+	return p;
+}
+void pool_release(Pool *pool, void *p) {
+	Pool_Slot_Header *header = (Pool_Slot_Header*)p - 1;
+	assert(header->generation % 2 == 1, "Released an object which is not in use (double release?)");
+	assert(header->index < pool->capacity, "Pointer does not belong to this pool");
+	
+	header->generation += 1;
+	header->next_free = pool->free_head;
+	pool->free_head = header;
+	pool->count -= 1;
+}
+
+Pool_Handle pool_get_handle(Pool *pool, void *p) {
+	Pool_Slot_Header *header = (Pool_Slot_Header*)p - 1;
+	assert(header->generation % 2 == 1, "Object is not in use");
+	return (Pool_Handle){ header->index, header->generation };
+}
+// Returns 0 if the object was released since the handle was made
+void *pool_get(Pool *pool, Pool_Handle handle) {
+	if (handle.index >= pool->capacity) return 0;
+	Pool_Chunk *chunk = pool->chunk_table[handle.index / pool->slots_per_chunk];
+	Pool_Slot_Header *header = pool_get_slot_header(pool, chunk, handle.index % pool->slots_per_chunk);
+	if (header->generation != handle.generation) return 0;
+	return header+1;
+}
+
+// Returns the next object in use, or 0 when there are no more
+void *pool_next(Pool *pool, Pool_Iterator *it) {
+	if (!it->started) {
+		it->chunk = pool->first_chunk;
+		it->slot = 0;
+		it->started = true;
+	}
+	while (it->chunk) {
+		if (it->slot >= pool->slots_per_chunk) {
+			it->chunk = it->chunk->next;
+			it->slot = 0;
+			continue;
+		}
+		Pool_Slot_Header *header = pool_get_slot_header(pool, it->chunk, it->slot);
+		it->slot += 1;
+		if (header->generation % 2 == 1) return header+1;
+	}
+	return 0;
+}
+
+void* pool_allocator_proc(u64 size, void *p, Allocator_Message message, void* data) {
+	Pool *pool = (Pool*)data;
+	switch (message) {
+		case ALLOCATOR_ALLOCATE: {
+			assert(size <= pool->object_size, "Pool allocator can only allocate up to %llu bytes, %llu was requested", pool->object_size, size);
+			return pool_acquire(pool);
+		}
+		case ALLOCATOR_DEALLOCATE: {
+			pool_release(pool, p);
+			return 0;
+		}
+		case ALLOCATOR_REALLOCATE: {
+			if (!p) return pool_allocator_proc(size, p, ALLOCATOR_ALLOCATE, data);
+			assert(size <= pool->object_size, "Pool allocator cannot reallocate past its object size");
+			return p;
+		}
+	}
+	return 0;
+}
+Allocator make_pool_allocator(Pool *pool) {
+	Allocator allocator;
+	allocator.data = pool;
+	allocator.proc = pool_allocator_proc;
+	return allocator;
+}
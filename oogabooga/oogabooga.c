@@ -311,6 +311,7 @@ typedef u8 bool;
 #include "linmath.c"
 
 #include "hash_table.c"
+#include "swiss_table.c"
 #include "growing_array.c"
 
 #include "os_interface.c"
@@ -327,6 +328,7 @@ typedef u8 bool;
 /////
 
 #include "concurrency.c"
+#include "concurrent_hash_map.c"
 
 #include "profiling.c"
 #include "random.c"
@@ -407,6 +409,7 @@ ogb_instance void oogabooga_init(u64 program_memory_size);
 #if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
 void oogabooga_init(u64 program_memory_size) {
 	seed_for_random = rdtsc();
+	random_base_seed = rdtsc();
 	
 	context.logger = default_logger;
 	temp_allocator = get_initialization_allocator();
@@ -471,11 +474,17 @@ int main(int argc, char **argv) {
 	
 	dump_profile_result();
 	
+	log_spinlock_stats("heap_lock", &heap_lock);
+	log_spinlock_stats("_profiler_lock", &_profiler_lock);
+	
 #endif
 	
 	// This is so any threads waiting for window to close will close on exit
 	window.should_close = true;
 	
+	// Other threads give their cached heap slots back when they exit
+	heap_thread_cache_flush_all();
+	
 	printf("Ooga booga program exit with code %i\n", code);
 	
 	return code;
@@ -393,9 +393,8 @@ volatile bool win32_has_audio_thread_started = false;
 
 void os_init(u64 program_memory_capacity) {
 	
-    // #Volatile
-    // Any printing uses vsnprintf, and printing may happen in init,
-    // especially on errors, so this needs to happen first.
+    // Our own printing is formatted natively in string_format.c, but vsnprintf is still
+    // exposed for anything that wants the crt behaviour.
     os.crt = os_load_dynamic_library(STR("msvcrt.dll"));
 	assert(os.crt != 0, "Could not load win32 crt library. Might be compiled with non-msvc? #Incomplete #Portability");
 	os.crt_vsnprintf = (Crt_Vsnprintf_Proc)os_dynamic_library_load_symbol(os.crt, STR("vsnprintf"));
@@ -410,6 +409,8 @@ void os_init(u64 program_memory_capacity) {
     win32_check_hr(hr);
 	
 	context.thread_id = GetCurrentThreadId();
+	
+	win32_thread_exit_fls = FlsAlloc(win32_thread_exit_callback);
 
 
 #if CONFIGURATION == RELEASE
@@ -599,6 +600,17 @@ void s64_to_null_terminated_string(s64 num, char* str, int base)
 ///
 // Thread primitive
 
+// Fiber local storage callbacks also run when a thread exits, whoever made the thread
+DWORD win32_thread_exit_fls = FLS_OUT_OF_INDEXES;
+void NTAPI win32_thread_exit_callback(void *data) {
+	if (data) heap_thread_cache_flush_all();
+}
+
+void os_flush_heap_thread_cache_on_exit() {
+	if (win32_thread_exit_fls == FLS_OUT_OF_INDEXES) return;
+	if (!FlsGetValue(win32_thread_exit_fls)) FlsSetValue(win32_thread_exit_fls, (void*)1);
+}
+
 DWORD WINAPI win32_thread_invoker(LPVOID param) {
 
 
@@ -618,7 +630,8 @@ DWORD WINAPI win32_thread_invoker(LPVOID param) {
 	
 	t->proc(t);
 	
-	heap_dealloc(temporary_storage);
+	temporary_storage_destroy();
+	heap_thread_cache_flush_all();
 	
 	return 0;
 }
@@ -742,6 +755,24 @@ void os_binary_semaphore_signal(Binary_Semaphore *sem) {
 	SetEvent(sem->os_event);
 }
 
+bool os_wait_on_address(volatile void *address, void *compare, u64 size, s64 timeout_ms) {
+	assert(size == 1 || size == 2 || size == 4 || size == 8, "Invalid size %d passed to os_wait_on_address", size);
+	DWORD timeout = timeout_ms < 0 ? INFINITE : (DWORD)timeout_ms;
+	if (WaitOnAddress(address, compare, (SIZE_T)size, timeout)) return true;
+	
+	DWORD error = GetLastError();
+	assert(error == ERROR_TIMEOUT, "WaitOnAddress failed with error %d", error);
+	return false;
+}
+
+void os_wake_one_on_address(volatile void *address) {
+	WakeByAddressSingle((PVOID)address);
+}
+
+void os_wake_all_on_address(volatile void *address) {
+	WakeByAddressAll((PVOID)address);
+}
+
 
 void os_sleep(u32 ms) {
     Sleep(ms);
@@ -1432,6 +1463,9 @@ os_unlock_program_memory_pages(void *start, u64 size) {
 	// Probably super slow but this shouldn't happen often at all + it's only in debug.
 	// - Charlie M 28th July 2024
 	for (u8 *p = (u8*)start; p < (u8*)start+size; p += os.page_size) {
+		// heap_maintenance() may have decommitted some of these, which we can't (and don't need to) protect
+		MEMORY_BASIC_INFORMATION info;
+		if (VirtualQuery(p, &info, sizeof(info)) && info.State != MEM_COMMIT) continue;
 		DWORD old_protect = PAGE_NOACCESS;
 		BOOL ok = VirtualProtect(p, os.page_size, PAGE_READWRITE, &old_protect);
 		assert(ok, "VirtualProtect Failed with error %d", GetLastError());
@@ -1448,6 +1482,8 @@ os_lock_program_memory_pages(void *start, u64 size) {
 	// Probably super slow but this shouldn't happen often at all + it's only in debug.
 	// - Charlie M 28th July 2024
 	for (u8 *p = (u8*)start; p < (u8*)start+size; p += os.page_size) {
+		MEMORY_BASIC_INFORMATION info;
+		if (VirtualQuery(p, &info, sizeof(info)) && info.State != MEM_COMMIT) continue;
 		DWORD old_protect = PAGE_READWRITE;
 		BOOL ok = VirtualProtect(p, os.page_size, PAGE_NOACCESS, &old_protect);
 		assert(ok, "VirtualProtect Failed with error %d", GetLastError());
@@ -1455,6 +1491,62 @@ os_lock_program_memory_pages(void *start, u64 size) {
 #endif
 }
 
+void
+os_decommit_program_memory_pages(void *start, u64 size) {
+	assert((u64)start % os.page_size == 0, "When decommitting memory pages, the start address must be the start of a page");
+	assert(size       % os.page_size == 0, "When decommitting memory pages, the size must be aligned to page_size");
+	
+	// Same as with locking, the pages may be across multiple allocated regions, but we can
+	// let VirtualQuery tell us where each region ends instead of going one page at a time.
+	u8 *p = (u8*)start;
+	u8 *end = (u8*)start+size;
+	while (p < end) {
+		MEMORY_BASIC_INFORMATION info;
+		SIZE_T ok = VirtualQuery(p, &info, sizeof(info));
+		assert(ok, "VirtualQuery Failed with error %d", GetLastError());
+		u64 count = min((u64)info.RegionSize, (u64)(end-p));
+		if (info.State == MEM_COMMIT) {
+			BOOL freed = VirtualFree(p, count, MEM_DECOMMIT);
+			assert(freed, "VirtualFree Failed with error %d", GetLastError());
+		}
+		p += count;
+	}
+}
+
+void
+os_commit_program_memory_pages(void *start, u64 size) {
+	assert((u64)start % os.page_size == 0, "When committing memory pages, the start address must be the start of a page");
+	assert(size       % os.page_size == 0, "When committing memory pages, the size must be aligned to page_size");
+	
+	u8 *p = (u8*)start;
+	u8 *end = (u8*)start+size;
+	while (p < end) {
+		MEMORY_BASIC_INFORMATION info;
+		SIZE_T ok = VirtualQuery(p, &info, sizeof(info));
+		assert(ok, "VirtualQuery Failed with error %d", GetLastError());
+		u64 count = min((u64)info.RegionSize, (u64)(end-p));
+		void *result = VirtualAlloc(p, count, MEM_COMMIT, PAGE_READWRITE);
+		assert(result == p, "VirtualAlloc Failed with error %d", GetLastError());
+		p += count;
+	}
+}
+
+void*
+os_reserve_memory_pages(u64 size) {
+	assert(size % os.page_size == 0, "size was not aligned to page size in os_reserve_memory_pages");
+	
+	void *p = VirtualAlloc(0, size, MEM_RESERVE, PAGE_NOACCESS);
+	assert(p, "VirtualAlloc Failed with error %d", GetLastError());
+	return p;
+}
+
+void
+os_release_memory_pages(void *start, u64 size) {
+	(void)size;
+	BOOL ok = VirtualFree(start, 0, MEM_RELEASE);
+	assert(ok, "VirtualFree Failed with error %d", GetLastError());
+}
+
 ///
 ///
 // Mouse pointer
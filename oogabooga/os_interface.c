@@ -154,6 +154,12 @@ os_thread_start(Thread *t);
 void ogb_instance
 os_thread_join(Thread *t);
 
+// Makes the current thread give its heap thread cache back when it exits. Threads made with
+// os_thread_start do that anyway, this is for threads oogabooga didn't create (i.e. made by a
+// third party library). Cheap to call more than once.
+void ogb_instance
+os_flush_heap_thread_cache_on_exit();
+
 
 
 ///
@@ -188,6 +194,21 @@ os_binary_semaphore_wait(Binary_Semaphore *sem);
 void ogb_instance
 os_binary_semaphore_signal(Binary_Semaphore *sem);
 
+///
+// Wait on address
+// Parks the thread while the value at address equals the size bytes (1, 2, 4 or 8) at compare,
+// until another thread wakes it or timeout_ms passes (-1 waits forever). Returns false on timeout.
+// Spurious wakeups happen, so always check the value again after waking.
+// These are what Mutex, Condition_Variable and Semaphore in concurrency.c sleep on.
+bool ogb_instance
+os_wait_on_address(volatile void *address, void *compare, u64 size, s64 timeout_ms);
+
+void ogb_instance
+os_wake_one_on_address(volatile void *address);
+
+void ogb_instance
+os_wake_all_on_address(volatile void *address);
+
 ///
 // Threading utilities
 
@@ -420,6 +441,17 @@ void fprint_va_list_buffered(File f, const string fmt, va_list args) {
 	}
 }
 
+void string_builder_flush_to_file(string s, void *data) {
+	os_file_write_string((File)data, s);
+}
+// Streams the builder to f: once 'threshold' bytes have been appended they are written to f and
+// the builder is emptied. Call string_builder_flush() to write whatever is left.
+void string_builder_set_flush_file(String_Builder *b, File f, u64 threshold) {
+	b->flush_proc = string_builder_flush_to_file;
+	b->flush_data = (void*)f;
+	b->flush_threshold = threshold;
+}
+
 void os_wait_and_read_stdin(string *result, u64 max_count, Allocator allocator);
 
 ///
@@ -487,6 +519,24 @@ os_unlock_program_memory_pages(void *start, u64 size);
 void ogb_instance
 os_lock_program_memory_pages(void *start, u64 size);
 
+// Gives the physical memory behind these pages back to the OS but keeps the address range.
+// Touching decommitted pages crashes until they are committed again, which leaves them
+// zeroed and unlocked.
+// - start & size must be aligned to os.page_size
+void ogb_instance
+os_decommit_program_memory_pages(void *start, u64 size);
+void ogb_instance
+os_commit_program_memory_pages(void *start, u64 size);
+
+// Reserves address space outside of program memory without committing or touching any of it.
+// Commit pages with os_commit_program_memory_pages() before use and give the whole range back
+// with os_release_memory_pages().
+// - size must be aligned to os.page_size
+ogb_instance void*
+os_reserve_memory_pages(u64 size);
+void ogb_instance
+os_release_memory_pages(void *start, u64 size);
+
 ///
 ///
 // Mouse pointer
@@ -1,38 +1,63 @@
-
-
 // #Global
 ogb_instance String_Builder _profile_output;
+ogb_instance File _profile_file;
 ogb_instance bool profiler_initted;
+ogb_instance bool profiler_dumped;
 ogb_instance Spinlock _profiler_lock;
 
 #if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
 String_Builder _profile_output = {0};
+File _profile_file;
 bool profiler_initted = false;
+bool profiler_dumped = false;
 Spinlock _profiler_lock;
 #endif
 
+void _profiler_init() {
+	spinlock_init(&_profiler_lock);
+	profiler_initted = true;
+	
+	// Events are streamed to the file every MB so long captures don't pile up in memory
+	_profile_file = os_file_open("google_trace.json", O_CREATE | O_WRITE);
+	os_file_write_string(_profile_file, STR("["));
+	string_builder_init_reserve(&_profile_output, 1024*1000, get_heap_allocator());	
+	string_builder_set_flush_file(&_profile_output, _profile_file, 1024*1000);
+}
+
 void dump_profile_result() {
-	File file = os_file_open("google_trace.json", O_CREATE | O_WRITE);
+	if (!profiler_initted) _profiler_init();
+	
+	spinlock_acquire_or_wait(&_profiler_lock);
 	
-	os_file_write_string(file, STR("["));
-	os_file_write_string(file, _profile_output.result);
-	os_file_write_string(file, STR("{}]"));
+	// The file is closed after the first dump, so anything reported after that is dropped
+	if (profiler_dumped) {
+		spinlock_release(&_profiler_lock);
+		return;
+	}
 	
-	os_file_close(file);
+	string_builder_flush(&_profile_output);
+	os_file_write_string(_profile_file, STR("{}]"));
+	
+	os_file_close(_profile_file);
+	_profile_file = OS_INVALID_FILE;
+	string_builder_deinit(&_profile_output);
+	_profile_output = (String_Builder){0};
+	profiler_dumped = true;
+	
+	spinlock_release(&_profiler_lock);
 	
 	log_verbose("Wrote profiling result to google_trace.json");
 }
 void _profiler_report_time(string name, f64 count, f64 start) {
-	if (!profiler_initted) {
-		spinlock_init(&_profiler_lock);
-		profiler_initted = true;
-		
-		string_builder_init_reserve(&_profile_output, 1024*1000, get_heap_allocator());	
-		
-	}
+	if (!profiler_initted) _profiler_init();
 	
 	spinlock_acquire_or_wait(&_profiler_lock);
 	
+	if (profiler_dumped) {
+		spinlock_release(&_profiler_lock);
+		return;
+	}
+	
 	string fmt = STR("{\"cat\":\"function\",\"dur\":%.3f,\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%zu,\"ts\":%.3f},");
     string_builder_print(
         &_profile_output,
@@ -45,6 +70,14 @@ void _profiler_report_time(string name, f64 count, f64 start) {
 	spinlock_release(&_profiler_lock);
 }
 #if ENABLE_PROFILING
+// Spinlock and Ticket_Spinlock both have the stats fields
+#define log_spinlock_stats(name, lock_ptr) { \
+	u64 _cycles_per_second = get_rdtsc_cycles_per_second(); \
+	f64 _ms_per_cycle = _cycles_per_second ? 1000.0/(f64)_cycles_per_second : 0.0; \
+	log_verbose("%cs: %i acquires, %i had to wait. Waited %.3fms in total, at most %.3fms", \
+		(name), (lock_ptr)->acquire_count, (lock_ptr)->contended_count, \
+		(f64)(lock_ptr)->wait_cycles*_ms_per_cycle, (f64)(lock_ptr)->max_wait_cycles*_ms_per_cycle); \
+}
 #define tm_scope(name) \
     for (f64 start_time = os_get_elapsed_seconds(), end_time = start_time, elapsed_time = 0; \
          elapsed_time == 0; \
@@ -61,4 +94,5 @@ void _profiler_report_time(string name, f64 count, f64 start) {
 	#define tm_scope(...)
 	#define tm_scope_var(...)
 	#define tm_scope_accum(...)
+	#define log_spinlock_stats(...)
 #endif
\ No newline at end of file
@@ -7,6 +7,7 @@
 
 // #Global
 // set this to something like rtdsc() for very randomized seed
+// Not shared between threads but also not something you can give each system or job, see Random_State below for that
 ogb_instance thread_local u64 seed_for_random;
 
 #if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
@@ -40,4 +41,329 @@ f64 get_random_float64_in_range(f64 min, f64 max) {
 
 s64 get_random_int_in_range(s64 min, s64 max) {
     return min + (s64)(get_random() % (max - min + 1));
-}
\ No newline at end of file
+}
+
+///
+// xoshiro256++ with explicit state
+//
+// Unlike the LCG above, each Random_State is its own stream so threads and systems don't share
+// anything. A state is 4 generators side by side, one per SIMD lane, so random_fill_u64() and
+// random_fill_f32() can step all 4 at once with SSE2 or AVX2. Output is the same on every level;
+// single draws come from a small buffer of the last 4 outputs.
+//
+// For results that don't depend on which thread ran what, give each job or system its own state
+// made from a seed and a stream index:
+//
+//     Random_State rng;
+//     random_state_init(&rng, world_seed, chunk_index);
+//     random_fill_f32(&rng, heights, chunk_size*chunk_size);
+//
+// Each thread also has a default stream, see get_thread_random_state().
+
+#define RANDOM_LANES 4
+
+typedef struct Random_State {
+	u64 s[4][RANDOM_LANES]; // s[word][lane]
+	u64 buffer[RANDOM_LANES];
+	u64 buffer_index; // RANDOM_LANES when empty
+} Random_State;
+
+// #Global
+ogb_instance u64 random_base_seed;
+ogb_instance thread_local Random_State thread_random_state;
+ogb_instance thread_local bool thread_random_state_initted;
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+u64 random_base_seed = 1;
+thread_local Random_State thread_random_state;
+thread_local bool thread_random_state_initted = false;
+#endif
+
+inline u64 random_rotl(u64 x, int k) {
+	return (x << k) | (x >> (64 - k));
+}
+
+u64 splitmix64(u64 *x) {
+	u64 z = (*x += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+void random_state_init(Random_State *state, u64 seed, u64 stream) {
+	// Mix seed and stream before splitmix, since splitmix seeds that differ by its increment
+	// would give the same sequence shifted by one
+	u64 x = string_hash_mix(seed ^ PRIME64_1, stream ^ PRIME64_2);
+	for (u64 lane = 0; lane < RANDOM_LANES; lane++) {
+		for (u64 word = 0; word < 4; word++) {
+			state->s[word][lane] = splitmix64(&x);
+		}
+	}
+	state->buffer_index = RANDOM_LANES;
+}
+
+// Steps all lanes once per block and writes RANDOM_LANES outputs per block
+void random_generate_scalar(Random_State *state, u64 *out, u64 blocks) {
+	for (u64 b = 0; b < blocks; b++) {
+		for (u64 lane = 0; lane < RANDOM_LANES; lane++) {
+			u64 s0 = state->s[0][lane];
+			u64 s1 = state->s[1][lane];
+			u64 s2 = state->s[2][lane];
+			u64 s3 = state->s[3][lane];
+			
+			out[b*RANDOM_LANES + lane] = random_rotl(s0 + s3, 23) + s0;
+			
+			u64 t = s1 << 17;
+			s2 ^= s0;
+			s3 ^= s1;
+			s1 ^= s2;
+			s0 ^= s3;
+			s2 ^= t;
+			s3 = random_rotl(s3, 45);
+			
+			state->s[0][lane] = s0;
+			state->s[1][lane] = s1;
+			state->s[2][lane] = s2;
+			state->s[3][lane] = s3;
+		}
+	}
+}
+// 2 floats in [0, 1) per u64, 24 bits from each half
+void random_fill_f32_blocks_scalar(Random_State *state, f32 *out, u64 blocks) {
+	u64 x[RANDOM_LANES];
+	for (u64 b = 0; b < blocks; b++) {
+		random_generate_scalar(state, x, 1);
+		for (u64 lane = 0; lane < RANDOM_LANES; lane++) {
+			out[b*RANDOM_LANES*2 + lane*2 + 0] = (f32)(((u32)x[lane]) >> 8) * (1.0f/16777216.0f);
+			out[b*RANDOM_LANES*2 + lane*2 + 1] = (f32)(((u32)(x[lane] >> 32)) >> 8) * (1.0f/16777216.0f);
+		}
+	}
+}
+
+#if ENABLE_SIMD && COMPILER_CAN_TARGET_SSE2
+
+#define RANDOM_SSE2_ROTL(x, k) _mm_or_si128(_mm_slli_epi64((x), (k)), _mm_srli_epi64((x), 64-(k)))
+
+// Lanes 0-1 in the a registers and 2-3 in the b registers
+#define RANDOM_SSE2_STEP(result_a, result_b) { \
+	result_a = _mm_add_epi64(RANDOM_SSE2_ROTL(_mm_add_epi64(s0a, s3a), 23), s0a); \
+	result_b = _mm_add_epi64(RANDOM_SSE2_ROTL(_mm_add_epi64(s0b, s3b), 23), s0b); \
+	__m128i ta = _mm_slli_epi64(s1a, 17); \
+	__m128i tb = _mm_slli_epi64(s1b, 17); \
+	s2a = _mm_xor_si128(s2a, s0a); s2b = _mm_xor_si128(s2b, s0b); \
+	s3a = _mm_xor_si128(s3a, s1a); s3b = _mm_xor_si128(s3b, s1b); \
+	s1a = _mm_xor_si128(s1a, s2a); s1b = _mm_xor_si128(s1b, s2b); \
+	s0a = _mm_xor_si128(s0a, s3a); s0b = _mm_xor_si128(s0b, s3b); \
+	s2a = _mm_xor_si128(s2a, ta);  s2b = _mm_xor_si128(s2b, tb); \
+	s3a = RANDOM_SSE2_ROTL(s3a, 45); s3b = RANDOM_SSE2_ROTL(s3b, 45); \
+}
+#define RANDOM_SSE2_LOAD() \
+	__m128i s0a = _mm_loadu_si128((__m128i*)&state->s[0][0]), s0b = _mm_loadu_si128((__m128i*)&state->s[0][2]); \
+	__m128i s1a = _mm_loadu_si128((__m128i*)&state->s[1][0]), s1b = _mm_loadu_si128((__m128i*)&state->s[1][2]); \
+	__m128i s2a = _mm_loadu_si128((__m128i*)&state->s[2][0]), s2b = _mm_loadu_si128((__m128i*)&state->s[2][2]); \
+	__m128i s3a = _mm_loadu_si128((__m128i*)&state->s[3][0]), s3b = _mm_loadu_si128((__m128i*)&state->s[3][2]);
+#define RANDOM_SSE2_STORE() \
+	_mm_storeu_si128((__m128i*)&state->s[0][0], s0a); _mm_storeu_si128((__m128i*)&state->s[0][2], s0b); \
+	_mm_storeu_si128((__m128i*)&state->s[1][0], s1a); _mm_storeu_si128((__m128i*)&state->s[1][2], s1b); \
+	_mm_storeu_si128((__m128i*)&state->s[2][0], s2a); _mm_storeu_si128((__m128i*)&state->s[2][2], s2b); \
+	_mm_storeu_si128((__m128i*)&state->s[3][0], s3a); _mm_storeu_si128((__m128i*)&state->s[3][2], s3b);
+
+target_sse2 void random_generate_sse2(Random_State *state, u64 *out, u64 blocks) {
+	RANDOM_SSE2_LOAD();
+	for (u64 b = 0; b < blocks; b++) {
+		__m128i ra, rb;
+		RANDOM_SSE2_STEP(ra, rb);
+		_mm_storeu_si128((__m128i*)(out + b*RANDOM_LANES + 0), ra);
+		_mm_storeu_si128((__m128i*)(out + b*RANDOM_LANES + 2), rb);
+	}
+	RANDOM_SSE2_STORE();
+}
+target_sse2 void random_fill_f32_blocks_sse2(Random_State *state, f32 *out, u64 blocks) {
+	__m128 scale = _mm_set1_ps(1.0f/16777216.0f);
+	RANDOM_SSE2_LOAD();
+	for (u64 b = 0; b < blocks; b++) {
+		__m128i ra, rb;
+		RANDOM_SSE2_STEP(ra, rb);
+		_mm_storeu_ps(out + b*RANDOM_LANES*2 + 0, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(ra, 8)), scale));
+		_mm_storeu_ps(out + b*RANDOM_LANES*2 + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(rb, 8)), scale));
+	}
+	RANDOM_SSE2_STORE();
+}
+
+#undef RANDOM_SSE2_ROTL
+#undef RANDOM_SSE2_STEP
+#undef RANDOM_SSE2_LOAD
+#undef RANDOM_SSE2_STORE
+
+#endif // ENABLE_SIMD && COMPILER_CAN_TARGET_SSE2
+
+#if ENABLE_SIMD && COMPILER_CAN_TARGET_AVX2
+
+#define RANDOM_AVX2_ROTL(x, k) _mm256_or_si256(_mm256_slli_epi64((x), (k)), _mm256_srli_epi64((x), 64-(k)))
+
+#define RANDOM_AVX2_STEP(result) { \
+	result = _mm256_add_epi64(RANDOM_AVX2_ROTL(_mm256_add_epi64(s0, s3), 23), s0); \
+	__m256i t = _mm256_slli_epi64(s1, 17); \
+	s2 = _mm256_xor_si256(s2, s0); \
+	s3 = _mm256_xor_si256(s3, s1); \
+	s1 = _mm256_xor_si256(s1, s2); \
+	s0 = _mm256_xor_si256(s0, s3); \
+	s2 = _mm256_xor_si256(s2, t); \
+	s3 = RANDOM_AVX2_ROTL(s3, 45); \
+}
+#define RANDOM_AVX2_LOAD() \
+	__m256i s0 = _mm256_loadu_si256((__m256i*)state->s[0]); \
+	__m256i s1 = _mm256_loadu_si256((__m256i*)state->s[1]); \
+	__m256i s2 = _mm256_loadu_si256((__m256i*)state->s[2]); \
+	__m256i s3 = _mm256_loadu_si256((__m256i*)state->s[3]);
+#define RANDOM_AVX2_STORE() \
+	_mm256_storeu_si256((__m256i*)state->s[0], s0); \
+	_mm256_storeu_si256((__m256i*)state->s[1], s1); \
+	_mm256_storeu_si256((__m256i*)state->s[2], s2); \
+	_mm256_storeu_si256((__m256i*)state->s[3], s3);
+
+target_avx2 void random_generate_avx2(Random_State *state, u64 *out, u64 blocks) {
+	RANDOM_AVX2_LOAD();
+	for (u64 b = 0; b < blocks; b++) {
+		__m256i r;
+		RANDOM_AVX2_STEP(r);
+		_mm256_storeu_si256((__m256i*)(out + b*RANDOM_LANES), r);
+	}
+	RANDOM_AVX2_STORE();
+}
+target_avx2 void random_fill_f32_blocks_avx2(Random_State *state, f32 *out, u64 blocks) {
+	__m256 scale = _mm256_set1_ps(1.0f/16777216.0f);
+	RANDOM_AVX2_LOAD();
+	for (u64 b = 0; b < blocks; b++) {
+		__m256i r;
+		RANDOM_AVX2_STEP(r);
+		_mm256_storeu_ps(out + b*RANDOM_LANES*2, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(r, 8)), scale));
+	}
+	RANDOM_AVX2_STORE();
+}
+
+#undef RANDOM_AVX2_ROTL
+#undef RANDOM_AVX2_STEP
+#undef RANDOM_AVX2_LOAD
+#undef RANDOM_AVX2_STORE
+
+#endif // ENABLE_SIMD && COMPILER_CAN_TARGET_AVX2
+
+// Uses the same runtime dispatch as the string functions in string.c
+void random_generate(Random_State *state, u64 *out, u64 blocks) {
+	switch (get_string_simd_level()) {
+#if ENABLE_SIMD && COMPILER_CAN_TARGET_AVX2
+		case STRING_SIMD_AVX2: random_generate_avx2(state, out, blocks); break;
+#endif
+#if ENABLE_SIMD && COMPILER_CAN_TARGET_SSE2
+		case STRING_SIMD_SSE2: random_generate_sse2(state, out, blocks); break;
+#endif
+		default: random_generate_scalar(state, out, blocks); break;
+	}
+}
+void random_fill_f32_blocks(Random_State *state, f32 *out, u64 blocks) {
+	switch (get_string_simd_level()) {
+#if ENABLE_SIMD && COMPILER_CAN_TARGET_AVX2
+		case STRING_SIMD_AVX2: random_fill_f32_blocks_avx2(state, out, blocks); break;
+#endif
+#if ENABLE_SIMD && COMPILER_CAN_TARGET_SSE2
+		case STRING_SIMD_SSE2: random_fill_f32_blocks_sse2(state, out, blocks); break;
+#endif
+		default: random_fill_f32_blocks_scalar(state, out, blocks); break;
+	}
+}
+
+u64 random_u64(Random_State *state) {
+	if (state->buffer_index == RANDOM_LANES) {
+		// One block isn't worth the dispatch, the simd paths are for random_fill_xxx()
+		random_generate_scalar(state, state->buffer, 1);
+		state->buffer_index = 0;
+	}
+	return state->buffer[state->buffer_index++];
+}
+
+// [0, 1)
+f32 random_f32(Random_State *state) {
+	return (f32)(random_u64(state) >> 40) * (1.0f/16777216.0f);
+}
+// [0, 1)
+f64 random_f64(Random_State *state) {
+	return (f64)(random_u64(state) >> 11) * (1.0/9007199254740992.0);
+}
+f32 random_f32_in_range(Random_State *state, f32 min, f32 max) {
+	return (max-min)*random_f32(state)+min;
+}
+f64 random_f64_in_range(Random_State *state, f64 min, f64 max) {
+	return (max-min)*random_f64(state)+min;
+}
+// Inclusive. Scales instead of using % so there's no division.
+s64 random_int_in_range(Random_State *state, s64 min, s64 max) {
+	assert(max >= min, "random_int_in_range max (%i) is less than min (%i)", max, min);
+	u64 range = (u64)max - (u64)min + 1;
+	u64 x = random_u64(state);
+	if (range == 0) return (s64)x; // The whole s64 range
+	u64 high;
+	multiply_u64_128(x, range, &high);
+	return (s64)((u64)min + high);
+}
+
+void random_fill_u64(Random_State *state, u64 *out, u64 count) {
+	while (count > 0 && state->buffer_index < RANDOM_LANES) {
+		*out++ = state->buffer[state->buffer_index++];
+		count -= 1;
+	}
+	
+	u64 blocks = count / RANDOM_LANES;
+	random_generate(state, out, blocks);
+	out += blocks*RANDOM_LANES;
+	count -= blocks*RANDOM_LANES;
+	
+	while (count > 0) {
+		*out++ = random_u64(state);
+		count -= 1;
+	}
+}
+
+// Fills out with floats in [0, 1). Each u64 in the stream gives 2 floats, 24 bits from each half,
+// so this does not give the same values as calling random_f32() count times.
+void random_fill_f32(Random_State *state, f32 *out, u64 count) {
+	while (count > 0 && state->buffer_index < RANDOM_LANES) {
+		u64 x = state->buffer[state->buffer_index++];
+		*out++ = (f32)(((u32)x) >> 8) * (1.0f/16777216.0f);
+		count -= 1;
+		if (count > 0) {
+			*out++ = (f32)(((u32)(x >> 32)) >> 8) * (1.0f/16777216.0f);
+			count -= 1;
+		}
+	}
+	
+	u64 blocks = count / (RANDOM_LANES*2);
+	random_fill_f32_blocks(state, out, blocks);
+	out += blocks*RANDOM_LANES*2;
+	count -= blocks*RANDOM_LANES*2;
+	
+	while (count > 0) {
+		u64 x = random_u64(state);
+		*out++ = (f32)(((u32)x) >> 8) * (1.0f/16777216.0f);
+		count -= 1;
+		if (count > 0) {
+			*out++ = (f32)(((u32)(x >> 32)) >> 8) * (1.0f/16777216.0f);
+			count -= 1;
+		}
+	}
+}
+
+// This thread's default stream. Seeded from random_base_seed and the thread id the first time
+// it's used, so it's only reproducible between runs if you seed it yourself.
+Random_State *get_thread_random_state() {
+	if (!thread_random_state_initted) {
+		random_state_init(&thread_random_state, random_base_seed, get_context().thread_id);
+		thread_random_state_initted = true;
+	}
+	return &thread_random_state;
+}
+// For example with a job index, so the numbers don't depend on which thread ran the job
+void seed_thread_random_state(u64 seed, u64 stream) {
+	random_state_init(&thread_random_state, seed, stream);
+	thread_random_state_initted = true;
+}
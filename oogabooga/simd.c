@@ -27,6 +27,11 @@ inline void basic_mul_int32_128(s32 *a, s32 *b, s32* result);
 inline void basic_mul_int32_256(s32 *a, s32 *b, s32* result);
 inline void basic_mul_int32_512(s32 *a, s32 *b, s32* result);
 
+// Bit n is set if byte n of the 16 bytes at a equals b
+inline u32 basic_match_uint8_128(u8 *a, u8 b);
+// Bit n is set if byte n of the 16 bytes at a has its high bit set
+inline u32 basic_high_bit_mask_uint8_128(u8 *a);
+
 inline float32 basic_dot_product_float32_64(float32 *a, float32 *b);
 inline float32 basic_dot_product_float32_96(float32 *a, float32 *b);
 inline float32 basic_dot_product_float32_128(float32 *a, float32 *b);
@@ -210,10 +215,21 @@ inline void simd_sub_int32_128_aligned(s32 *a, s32 *b, s32* result) {
     __m128i vr = _mm_sub_epi32(va, vb);
     _mm_store_si128((__m128i*)result, vr);
 }
+inline u32 simd_match_uint8_128(u8 *a, u8 b) {
+    __m128i va = _mm_loadu_si128((__m128i*)a);
+    __m128i vr = _mm_cmpeq_epi8(va, _mm_set1_epi8((char)b));
+    return (u32)_mm_movemask_epi8(vr);
+}
+inline u32 simd_high_bit_mask_uint8_128(u8 *a) {
+    __m128i va = _mm_loadu_si128((__m128i*)a);
+    return (u32)_mm_movemask_epi8(va);
+}
 
 #else
 	#define simd_add_int32_128 		basic_add_int32_128
 	#define simd_sub_int32_128 		basic_sub_int32_128
+	#define simd_match_uint8_128 		basic_match_uint8_128
+	#define simd_high_bit_mask_uint8_128 	basic_high_bit_mask_uint8_128
 	
 	#define simd_add_int32_128_aligned 		basic_add_int32_128
 	#define simd_sub_int32_128_aligned 		basic_sub_int32_128
@@ -570,6 +586,8 @@ inline void simd_rsqrt_float32_512_aligned(float32 *a, float32 *result) {
 // SSE2
 #define simd_add_int32_128 		basic_add_int32_128
 #define simd_sub_int32_128 		basic_sub_int32_128
+#define simd_match_uint8_128 		basic_match_uint8_128
+#define simd_high_bit_mask_uint8_128 	basic_high_bit_mask_uint8_128
 #define simd_mul_int32_128 		basic_mul_int32_128
 #define simd_add_int32_128_aligned 		basic_add_int32_128
 #define simd_sub_int32_128_aligned 		basic_sub_int32_128
@@ -744,6 +762,20 @@ inline void basic_mul_int32_512(s32 *a, s32 *b, s32* result) {
 	simd_mul_int32_256(a, b, result);
 	simd_mul_int32_256(a+8, b+8, result+8);
 }
+inline u32 basic_match_uint8_128(u8 *a, u8 b) {
+	u32 mask = 0;
+	for (u32 i = 0; i < 16; i++) {
+		if (a[i] == b) mask |= 1u << i;
+	}
+	return mask;
+}
+inline u32 basic_high_bit_mask_uint8_128(u8 *a) {
+	u32 mask = 0;
+	for (u32 i = 0; i < 16; i++) {
+		if (a[i] & 0x80) mask |= 1u << i;
+	}
+	return mask;
+}
 inline float32 basic_dot_product_float32_64(float32 *a, float32 *b) {
     return a[0] * b[0] + a[1] * b[1];
 }
@@ -72,6 +72,291 @@ temp_convert_to_null_terminated_string(const string s) {
 	char *c = convert_to_null_terminated_string(s, get_temporary_allocator());
 	return c;
 }
+///
+// Searching and comparing
+// The SSE2 or AVX2 versions are picked at runtime from query_cpu_capabilities(), with plain loops
+// as the fallback. Substring search compares the first and the last byte of 'sub' at 16 or 32
+// positions at once and only compares the rest where both of them match.
+
+typedef enum String_Simd_Level {
+	STRING_SIMD_UNINITIALIZED = 0,
+	STRING_SIMD_NONE,
+	STRING_SIMD_SSE2,
+	STRING_SIMD_AVX2,
+} String_Simd_Level;
+
+// Can be set to force a level, for example for testing
+ogb_instance String_Simd_Level string_simd_level;
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+String_Simd_Level string_simd_level = STRING_SIMD_UNINITIALIZED;
+#endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
+
+String_Simd_Level 
+get_string_simd_level() {
+	if (string_simd_level == STRING_SIMD_UNINITIALIZED) {
+		String_Simd_Level level = STRING_SIMD_NONE;
+#if ENABLE_SIMD
+		Cpu_Capabilities cpu = query_cpu_capabilities();
+	#if COMPILER_CAN_TARGET_SSE2
+		if (cpu.sse2) level = STRING_SIMD_SSE2;
+	#endif
+	#if COMPILER_CAN_TARGET_AVX2
+		if (cpu.avx2) level = STRING_SIMD_AVX2;
+	#endif
+#endif
+		// Every thread comes to the same answer so racing on this is fine
+		string_simd_level = level;
+	}
+	return string_simd_level;
+}
+
+bool 
+bytes_match_scalar(u8 *a, u8 *b, u64 count) {
+	u64 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		u64 x, y;
+		memcpy(&x, a+i, 8);
+		memcpy(&y, b+i, 8);
+		if (x != y) return false;
+	}
+	for (; i < count; i++) {
+		if (a[i] != b[i]) return false;
+	}
+	return true;
+}
+s64 
+find_byte_from_left_scalar(u8 *p, u64 count, u8 b) {
+	for (u64 i = 0; i < count; i++) {
+		if (p[i] == b) return (s64)i;
+	}
+	return -1;
+}
+s64 
+find_byte_from_right_scalar(u8 *p, u64 count, u8 b) {
+	for (s64 i = (s64)count-1; i >= 0; i--) {
+		if (p[i] == b) return i;
+	}
+	return -1;
+}
+s64 
+find_bytes_from_left_scalar(u8 *p, u64 count, u8 *sub, u64 sub_count) {
+	for (u64 i = 0; i + sub_count <= count; i++) {
+		if (p[i] == sub[0] && p[i+sub_count-1] == sub[sub_count-1] && bytes_match_scalar(p+i, sub, sub_count)) return (s64)i;
+	}
+	return -1;
+}
+s64 
+find_bytes_from_right_scalar(u8 *p, u64 count, u8 *sub, u64 sub_count) {
+	for (s64 i = (s64)(count-sub_count); i >= 0; i--) {
+		if (p[i] == sub[0] && p[i+sub_count-1] == sub[sub_count-1] && bytes_match_scalar(p+i, sub, sub_count)) return i;
+	}
+	return -1;
+}
+
+#if ENABLE_SIMD && COMPILER_CAN_TARGET_SSE2
+
+target_sse2 bool 
+bytes_match_sse2(u8 *a, u8 *b, u64 count) {
+	if (count < 16) return bytes_match_scalar(a, b, count);
+	u64 i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i*)(a+i)), _mm_loadu_si128((__m128i*)(b+i)));
+		if (_mm_movemask_epi8(eq) != 0xFFFF) return false;
+	}
+	if (i < count) {
+		// Last 16 bytes, overlapping what we already compared
+		__m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i*)(a+count-16)), _mm_loadu_si128((__m128i*)(b+count-16)));
+		if (_mm_movemask_epi8(eq) != 0xFFFF) return false;
+	}
+	return true;
+}
+target_sse2 s64 
+find_byte_from_left_sse2(u8 *p, u64 count, u8 b) {
+	__m128i needle = _mm_set1_epi8((char)b);
+	u64 i = 0;
+	for (; i + 16 <= count; i += 16) {
+		u32 mask = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i*)(p+i)), needle));
+		if (mask) return (s64)(i + count_trailing_zeros_u32(mask));
+	}
+	s64 tail = find_byte_from_left_scalar(p+i, count-i, b);
+	return tail < 0 ? -1 : (s64)i + tail;
+}
+target_sse2 s64 
+find_byte_from_right_sse2(u8 *p, u64 count, u8 b) {
+	__m128i needle = _mm_set1_epi8((char)b);
+	u64 i = count;
+	for (; i >= 16; i -= 16) {
+		u32 mask = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i*)(p+i-16)), needle));
+		if (mask) return (s64)(i - 16 + 31 - count_leading_zeros_u32(mask));
+	}
+	return find_byte_from_right_scalar(p, i, b);
+}
+target_sse2 s64 
+find_bytes_from_left_sse2(u8 *p, u64 count, u8 *sub, u64 sub_count) {
+	__m128i first = _mm_set1_epi8((char)sub[0]);
+	__m128i last  = _mm_set1_epi8((char)sub[sub_count-1]);
+	u64 i = 0;
+	for (; i + sub_count - 1 + 16 <= count; i += 16) {
+		__m128i eq_first = _mm_cmpeq_epi8(first, _mm_loadu_si128((__m128i*)(p+i)));
+		__m128i eq_last  = _mm_cmpeq_epi8(last,  _mm_loadu_si128((__m128i*)(p+i+sub_count-1)));
+		u32 mask = (u32)_mm_movemask_epi8(_mm_and_si128(eq_first, eq_last));
+		while (mask) {
+			u64 candidate = i + count_trailing_zeros_u32(mask);
+			if (bytes_match_sse2(p+candidate+1, sub+1, sub_count-2)) return (s64)candidate;
+			mask &= mask - 1;
+		}
+	}
+	s64 tail = find_bytes_from_left_scalar(p+i, count-i, sub, sub_count);
+	return tail < 0 ? -1 : (s64)i + tail;
+}
+target_sse2 s64 
+find_bytes_from_right_sse2(u8 *p, u64 count, u8 *sub, u64 sub_count) {
+	__m128i first = _mm_set1_epi8((char)sub[0]);
+	__m128i last  = _mm_set1_epi8((char)sub[sub_count-1]);
+	// Candidate positions are [0, end), looked at 16 at a time from the back
+	u64 end = count - sub_count + 1;
+	for (; end >= 16; end -= 16) {
+		u64 i = end - 16;
+		__m128i eq_first = _mm_cmpeq_epi8(first, _mm_loadu_si128((__m128i*)(p+i)));
+		__m128i eq_last  = _mm_cmpeq_epi8(last,  _mm_loadu_si128((__m128i*)(p+i+sub_count-1)));
+		u32 mask = (u32)_mm_movemask_epi8(_mm_and_si128(eq_first, eq_last));
+		while (mask) {
+			u32 bit = 31 - count_leading_zeros_u32(mask);
+			if (bytes_match_sse2(p+i+bit+1, sub+1, sub_count-2)) return (s64)(i + bit);
+			mask &= ~(1u << bit);
+		}
+	}
+	return find_bytes_from_right_scalar(p, end + sub_count - 1, sub, sub_count);
+}
+
+#endif // ENABLE_SIMD && COMPILER_CAN_TARGET_SSE2
+
+#if ENABLE_SIMD && COMPILER_CAN_TARGET_AVX2
+
+target_avx2 bool 
+bytes_match_avx2(u8 *a, u8 *b, u64 count) {
+	if (count < 16) return bytes_match_scalar(a, b, count);
+	if (count < 32) {
+		// First and last 16 bytes, overlapping in the middle
+		__m128i eq_first = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i*)a), _mm_loadu_si128((__m128i*)b));
+		__m128i eq_last  = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i*)(a+count-16)), _mm_loadu_si128((__m128i*)(b+count-16)));
+		return _mm_movemask_epi8(_mm_and_si128(eq_first, eq_last)) == 0xFFFF;
+	}
+	u64 i = 0;
+	for (; i + 32 <= count; i += 32) {
+		__m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i*)(a+i)), _mm256_loadu_si256((__m256i*)(b+i)));
+		if ((u32)_mm256_movemask_epi8(eq) != 0xFFFFFFFF) return false;
+	}
+	if (i < count) {
+		// Last 32 bytes, overlapping what we already compared
+		__m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i*)(a+count-32)), _mm256_loadu_si256((__m256i*)(b+count-32)));
+		if ((u32)_mm256_movemask_epi8(eq) != 0xFFFFFFFF) return false;
+	}
+	return true;
+}
+target_avx2 s64 
+find_byte_from_left_avx2(u8 *p, u64 count, u8 b) {
+	__m256i needle = _mm256_set1_epi8((char)b);
+	u64 i = 0;
+	for (; i + 32 <= count; i += 32) {
+		u32 mask = (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i*)(p+i)), needle));
+		if (mask) return (s64)(i + count_trailing_zeros_u32(mask));
+	}
+	s64 tail = find_byte_from_left_scalar(p+i, count-i, b);
+	return tail < 0 ? -1 : (s64)i + tail;
+}
+target_avx2 s64 
+find_byte_from_right_avx2(u8 *p, u64 count, u8 b) {
+	__m256i needle = _mm256_set1_epi8((char)b);
+	u64 i = count;
+	for (; i >= 32; i -= 32) {
+		u32 mask = (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i*)(p+i-32)), needle));
+		if (mask) return (s64)(i - 32 + 31 - count_leading_zeros_u32(mask));
+	}
+	return find_byte_from_right_scalar(p, i, b);
+}
+target_avx2 s64 
+find_bytes_from_left_avx2(u8 *p, u64 count, u8 *sub, u64 sub_count) {
+	__m256i first = _mm256_set1_epi8((char)sub[0]);
+	__m256i last  = _mm256_set1_epi8((char)sub[sub_count-1]);
+	u64 i = 0;
+	for (; i + sub_count - 1 + 32 <= count; i += 32) {
+		__m256i eq_first = _mm256_cmpeq_epi8(first, _mm256_loadu_si256((__m256i*)(p+i)));
+		__m256i eq_last  = _mm256_cmpeq_epi8(last,  _mm256_loadu_si256((__m256i*)(p+i+sub_count-1)));
+		u32 mask = (u32)_mm256_movemask_epi8(_mm256_and_si256(eq_first, eq_last));
+		while (mask) {
+			u64 candidate = i + count_trailing_zeros_u32(mask);
+			if (bytes_match_avx2(p+candidate+1, sub+1, sub_count-2)) return (s64)candidate;
+			mask &= mask - 1;
+		}
+	}
+	s64 tail = find_bytes_from_left_scalar(p+i, count-i, sub, sub_count);
+	return tail < 0 ? -1 : (s64)i + tail;
+}
+target_avx2 s64 
+find_bytes_from_right_avx2(u8 *p, u64 count, u8 *sub, u64 sub_count) {
+	__m256i first = _mm256_set1_epi8((char)sub[0]);
+	__m256i last  = _mm256_set1_epi8((char)sub[sub_count-1]);
+	// Candidate positions are [0, end), looked at 32 at a time from the back
+	u64 end = count - sub_count + 1;
+	for (; end >= 32; end -= 32) {
+		u64 i = end - 32;
+		__m256i eq_first = _mm256_cmpeq_epi8(first, _mm256_loadu_si256((__m256i*)(p+i)));
+		__m256i eq_last  = _mm256_cmpeq_epi8(last,  _mm256_loadu_si256((__m256i*)(p+i+sub_count-1)));
+		u32 mask = (u32)_mm256_movemask_epi8(_mm256_and_si256(eq_first, eq_last));
+		while (mask) {
+			u32 bit = 31 - count_leading_zeros_u32(mask);
+			if (bytes_match_avx2(p+i+bit+1, sub+1, sub_count-2)) return (s64)(i + bit);
+			mask &= ~(1u << bit);
+		}
+	}
+	return find_bytes_from_right_scalar(p, end + sub_count - 1, sub, sub_count);
+}
+
+#endif // ENABLE_SIMD && COMPILER_CAN_TARGET_AVX2
+
+// Same as memcmp(a, b, count) == 0
+bool 
+bytes_match(void *a, void *b, u64 count) {
+	switch (get_string_simd_level()) {
+#if ENABLE_SIMD && COMPILER_CAN_TARGET_AVX2
+		case STRING_SIMD_AVX2: return bytes_match_avx2((u8*)a, (u8*)b, count);
+#endif
+#if ENABLE_SIMD && COMPILER_CAN_TARGET_SSE2
+		case STRING_SIMD_SSE2: return bytes_match_sse2((u8*)a, (u8*)b, count);
+#endif
+		default: return bytes_match_scalar((u8*)a, (u8*)b, count);
+	}
+}
+
+// Returns first index from left where byte b is in s. Returns -1 if it's not found.
+s64 
+string_find_byte_from_left(string s, u8 b) {
+	switch (get_string_simd_level()) {
+#if ENABLE_SIMD && COMPILER_CAN_TARGET_AVX2
+		case STRING_SIMD_AVX2: return find_byte_from_left_avx2(s.data, s.count, b);
+#endif
+#if ENABLE_SIMD && COMPILER_CAN_TARGET_SSE2
+		case STRING_SIMD_SSE2: return find_byte_from_left_sse2(s.data, s.count, b);
+#endif
+		default: return find_byte_from_left_scalar(s.data, s.count, b);
+	}
+}
+// Returns first index from right where byte b is in s. Returns -1 if it's not found.
+s64 
+string_find_byte_from_right(string s, u8 b) {
+	switch (get_string_simd_level()) {
+#if ENABLE_SIMD && COMPILER_CAN_TARGET_AVX2
+		case STRING_SIMD_AVX2: return find_byte_from_right_avx2(s.data, s.count, b);
+#endif
+#if ENABLE_SIMD && COMPILER_CAN_TARGET_SSE2
+		case STRING_SIMD_SSE2: return find_byte_from_right_sse2(s.data, s.count, b);
+#endif
+		default: return find_byte_from_right_scalar(s.data, s.count, b);
+	}
+}
+
 bool 
 strings_match(string a, string b) {
 	if (a.count != b.count) return false;
@@ -79,7 +364,7 @@ strings_match(string a, string b) {
 	// Count match, pointer match: they are the same
 	if (a.data == b.data) return true;
 
-	return memcmp(a.data, b.data, a.count) == 0;
+	return bytes_match(a.data, b.data, a.count);
 }
 
 string 
@@ -98,25 +383,37 @@ string_view(string s, u64 start_index, u64 count) {
 // Returns first index from left where "sub" matches in "s". Returns -1 if no match is found.
 s64 
 string_find_from_left(string s, string sub) {
-	for (s64 i = 0; i <= s.count-sub.count; i++) {
-		if (strings_match(string_view(s, i, sub.count), sub)) {
-			return i;
-		}
-	}
+	if (sub.count > s.count) return -1;
+	if (sub.count == 0) return 0;
+	if (sub.count == 1) return string_find_byte_from_left(s, sub.data[0]);
 	
-	return -1;
+	switch (get_string_simd_level()) {
+#if ENABLE_SIMD && COMPILER_CAN_TARGET_AVX2
+		case STRING_SIMD_AVX2: return find_bytes_from_left_avx2(s.data, s.count, sub.data, sub.count);
+#endif
+#if ENABLE_SIMD && COMPILER_CAN_TARGET_SSE2
+		case STRING_SIMD_SSE2: return find_bytes_from_left_sse2(s.data, s.count, sub.data, sub.count);
+#endif
+		default: return find_bytes_from_left_scalar(s.data, s.count, sub.data, sub.count);
+	}
 }
 
 // Returns first index from right where "sub" matches in "s" Returns -1 if no match is found.
 s64 
 string_find_from_right(string s, string sub) {
-	for (s64 i = s.count-sub.count; i >= 0 ; i--) {
-		if (strings_match(string_view(s, i, sub.count), sub)) {
-			return i;
-		}
-	}
+	if (sub.count > s.count) return -1;
+	if (sub.count == 0) return (s64)s.count;
+	if (sub.count == 1) return string_find_byte_from_right(s, sub.data[0]);
 	
-	return -1;
+	switch (get_string_simd_level()) {
+#if ENABLE_SIMD && COMPILER_CAN_TARGET_AVX2
+		case STRING_SIMD_AVX2: return find_bytes_from_right_avx2(s.data, s.count, sub.data, sub.count);
+#endif
+#if ENABLE_SIMD && COMPILER_CAN_TARGET_SSE2
+		case STRING_SIMD_SSE2: return find_bytes_from_right_sse2(s.data, s.count, sub.data, sub.count);
+#endif
+		default: return find_bytes_from_right_scalar(s.data, s.count, sub.data, sub.count);
+	}
 }
 
 bool 
@@ -136,6 +433,24 @@ string_copy(string s, Allocator allocator) {
 }
 
 
+///
+// String_Builder
+// Appends go into 'buffer' until it's full and then into a list of chunks, so data that's already
+// in the builder is never copied or moved. string_builder_get_string() only has to copy everything
+// into one buffer if there are chunks.
+// 'count' is the total count of all bytes appended (since the last flush). As long as nothing
+// has gone into a chunk, 'result' is the same thing as string_builder_get_string().
+
+typedef struct String_Builder_Chunk String_Builder_Chunk;
+typedef struct String_Builder_Chunk {
+	String_Builder_Chunk *next;
+	u64 count;
+	u64 capacity;
+	// data follows
+} String_Builder_Chunk;
+
+typedef void(*String_Builder_Flush_Proc)(string s, void *data);
+
 typedef struct String_Builder {
 	union {
 		struct {u64 count;u8 *buffer;};
@@ -143,50 +458,192 @@ typedef struct String_Builder {
 	};
 	u64 buffer_capacity;
 	Allocator allocator;
+	
+	u64 buffer_count; // How much of 'count' is in 'buffer'
+	String_Builder_Chunk *first_chunk;
+	String_Builder_Chunk *current_chunk; // Chunks after this one are empty, left from a flush
+	
+	// If set, everything is passed to flush_proc and dropped from the builder when count
+	// reaches flush_threshold. See string_builder_set_flush_file().
+	String_Builder_Flush_Proc flush_proc;
+	void *flush_data;
+	u64 flush_threshold;
 } String_Builder;
 
+inline u8 *
+string_builder_chunk_data(String_Builder_Chunk *c) {
+	return (u8*)(c+1);
+}
+
+String_Builder_Chunk *
+string_builder_add_chunk(String_Builder *b, u64 min_capacity) {
+	// Reuse empty chunks left from a flush if they are big enough
+	String_Builder_Chunk *next = b->current_chunk ? b->current_chunk->next : b->first_chunk;
+	if (next && next->capacity >= min_capacity) {
+		b->current_chunk = next;
+		return next;
+	}
+	
+	u64 last_capacity = b->current_chunk ? b->current_chunk->capacity : b->buffer_capacity;
+	u64 capacity = max(last_capacity*2, min_capacity);
+	String_Builder_Chunk *c = (String_Builder_Chunk*)alloc(b->allocator, sizeof(String_Builder_Chunk) + capacity);
+	c->count = 0;
+	c->capacity = capacity;
+	
+	// Goes in right after the current chunk, in front of any spares
+	if (b->current_chunk) {
+		c->next = b->current_chunk->next;
+		b->current_chunk->next = c;
+	} else {
+		c->next = b->first_chunk;
+		b->first_chunk = c;
+	}
+	b->current_chunk = c;
+	return c;
+}
 
+// Makes sure the next required_capacity-count bytes can be appended without allocating
 void 
 string_builder_reserve(String_Builder *b, u64 required_capacity) {
-	if (b->buffer_capacity >= required_capacity) return;
+	if (required_capacity <= b->count) return;
+	u64 needed = required_capacity - b->count;
 	
-	u64 new_capacity = max(b->buffer_capacity*2, (u64)(required_capacity*1.5));
-	u8 *new_buffer = alloc(b->allocator, new_capacity);
-	if (b->buffer) {
-		memcpy(new_buffer, b->buffer, b->count);
-		dealloc(b->allocator, b->buffer);
+	if (!b->current_chunk) {
+		if (b->buffer_capacity - b->buffer_count >= needed) return;
+		
+		if (b->buffer_count == 0) {
+			// Nothing to keep, so just swap to a bigger buffer
+			u64 new_capacity = max(b->buffer_capacity*2, (u64)(needed*1.5));
+			if (b->buffer) dealloc(b->allocator, b->buffer);
+			b->buffer = alloc(b->allocator, new_capacity);
+			b->buffer_capacity = new_capacity;
+			return;
+		}
+	} else if (b->current_chunk->capacity - b->current_chunk->count >= needed) {
+		return;
 	}
-	b->buffer = new_buffer;
-	b->buffer_capacity = new_capacity;
+	
+	string_builder_add_chunk(b, needed);
 }
 void 
 string_builder_init_reserve(String_Builder *b, u64 reserved_capacity, Allocator allocator) {
 	reserved_capacity = max(reserved_capacity, 128);
+	*b = ZERO(String_Builder);
 	b->allocator = allocator;
-	b->buffer_capacity = 0;
-	b->buffer = 0;
 	string_builder_reserve(b, reserved_capacity);
-	b->count = 0;
 }
 void 
 string_builder_init(String_Builder *b, Allocator allocator) {
 	string_builder_init_reserve(b, 128, allocator);
 }
 void 
+string_builder_free_chunks(String_Builder *b) {
+	String_Builder_Chunk *c = b->first_chunk;
+	while (c) {
+		String_Builder_Chunk *next = c->next;
+		dealloc(b->allocator, c);
+		c = next;
+	}
+	b->first_chunk = 0;
+	b->current_chunk = 0;
+}
+void 
 string_builder_deinit(String_Builder *b) {
+	string_builder_free_chunks(b);
 	dealloc(b->allocator, b->buffer);
 }
+
+// Hands everything appended so far to the flush proc and empties the builder. Memory is kept.
+void 
+string_builder_flush(String_Builder *b) {
+	if (!b->flush_proc) return;
+	
+	if (b->buffer_count) b->flush_proc((string){ b->buffer_count, b->buffer }, b->flush_data);
+	for (String_Builder_Chunk *c = b->first_chunk; c; c = c->next) {
+		if (c->count) b->flush_proc((string){ c->count, string_builder_chunk_data(c) }, b->flush_data);
+		c->count = 0;
+	}
+	b->count = 0;
+	b->buffer_count = 0;
+	b->current_chunk = 0;
+}
+
+// Returns a pointer to at least n contiguous bytes at the end of the builder. Whatever is
+// written there is appended by string_builder_advance().
+u8 *
+string_builder_get_tail(String_Builder *b, u64 n) {
+	assert(b->allocator.proc, "String_Builder is missing allocator");
+	string_builder_reserve(b, b->count+n);
+	
+	// The current chunk may still be too small after a reserve that was satisfied by spare room
+	if (b->current_chunk) {
+		if (b->current_chunk->capacity - b->current_chunk->count < n) string_builder_add_chunk(b, n);
+		return string_builder_chunk_data(b->current_chunk) + b->current_chunk->count;
+	}
+	return b->buffer + b->buffer_count;
+}
+void 
+string_builder_advance(String_Builder *b, u64 n) {
+	if (b->current_chunk) b->current_chunk->count += n;
+	else                  b->buffer_count += n;
+	b->count += n;
+	
+	if (b->flush_proc && b->count >= b->flush_threshold) string_builder_flush(b);
+}
+
 void 
 string_builder_append(String_Builder *b, string s) {
 	assert(b->allocator.proc, "String_Builder is missing allocator");
-	string_builder_reserve(b, b->count+s.count);
+	if (!s.count) return;
 	
-	memcpy(b->buffer+b->count, s.data, s.count);
-	b->count += s.count;
+	if (!b->current_chunk) {
+		if (b->buffer_count == 0 && b->buffer_capacity < s.count) string_builder_reserve(b, s.count);
+		
+		u64 n = min(s.count, b->buffer_capacity - b->buffer_count);
+		memcpy(b->buffer+b->buffer_count, s.data, n);
+		b->buffer_count += n;
+		b->count += n;
+		s.data += n;
+		s.count -= n;
+	}
+	
+	while (s.count) {
+		String_Builder_Chunk *c = b->current_chunk;
+		if (!c || c->count == c->capacity) c = string_builder_add_chunk(b, s.count);
+		
+		u64 n = min(s.count, c->capacity - c->count);
+		memcpy(string_builder_chunk_data(c)+c->count, s.data, n);
+		c->count += n;
+		b->count += n;
+		s.data += n;
+		s.count -= n;
+	}
+	
+	if (b->flush_proc && b->count >= b->flush_threshold) string_builder_flush(b);
 }
+
+// Everything in the builder (since the last flush) as one string. If the builder has chunks,
+// they are copied into one buffer here, once.
 string 
-string_builder_get_string(String_Builder b) {
-	return b.result;
+string_builder_get_string(String_Builder *b) {
+	if (!b->first_chunk || b->count == b->buffer_count) return (string){ b->buffer_count, b->buffer };
+	
+	u8 *buffer = alloc(b->allocator, b->count);
+	memcpy(buffer, b->buffer, b->buffer_count);
+	u64 offset = b->buffer_count;
+	for (String_Builder_Chunk *c = b->first_chunk; c; c = c->next) {
+		memcpy(buffer+offset, string_builder_chunk_data(c), c->count);
+		offset += c->count;
+	}
+	assert(offset == b->count, "String_Builder chunks don't add up");
+	
+	string_builder_free_chunks(b);
+	if (b->buffer) dealloc(b->allocator, b->buffer);
+	b->buffer = buffer;
+	b->buffer_capacity = b->count;
+	b->buffer_count = b->count;
+	
+	return b->result;
 }
 
 
@@ -194,23 +651,23 @@ string
 string_replace_all(string s, string old, string new, Allocator allocator) {
 
 	if (!s.data || !s.count) return string_copy(null_string, allocator);
+	if (!old.count) return string_copy(s, allocator);
 
 	String_Builder builder;
 	string_builder_init_reserve(&builder, s.count, allocator);
 	
 	while (s.count > 0) {
-		if (s.count >= old.count && strings_match(string_view(s, 0, old.count), old)) {
-			if (new.count != 0) string_builder_append(&builder, new);
-			s.data += old.count;
-			s.count -= old.count;
-		} else {
-			string_builder_append(&builder, string_view(s, 0, 1));
-			s.data += 1;
-			s.count -= 1;
-		}
+		s64 index = string_find_from_left(s, old);
+		if (index < 0) break;
+		
+		if (index > 0) string_builder_append(&builder, (string){ (u64)index, s.data });
+		if (new.count != 0) string_builder_append(&builder, new);
+		s.data  += (u64)index + old.count;
+		s.count -= (u64)index + old.count;
 	}
+	if (s.count > 0) string_builder_append(&builder, s);
 	
-	return string_builder_get_string(builder);
+	return string_builder_get_string(&builder);
 }
 	
 string
@@ -233,4 +690,205 @@ string
 string_trim(string s) {
 	s = string_trim_left(s);
 	return string_trim_right(s);
-}
\ No newline at end of file
+}
+
+///
+// String interning
+// intern_string() gives every distinct string a small number, an Atom. Comparing atoms is
+// comparing numbers and the string hash is stored with it, so it's a good fit for paths & names
+// which are passed around & looked up a lot. Intern once, for example at startup, and keep the
+// atom around.
+//
+// Interning is thread safe. Looking up an existing string and atom_get_string() never lock.
+// Interned strings live in chunks which are never freed.
+
+/*
+	Example Usage:
+	
+	Atom hit_sound = intern_string(STR("assets/sounds/EntityHit.wav"));
+	
+	// Same string, same atom
+	assert(hit_sound == ATOM("assets/sounds/EntityHit.wav"));
+	
+	string path = atom_get_string(hit_sound);
+	u64 hash = atom_get_hash(hit_sound); // == string_get_hash(path)
+*/
+
+typedef u32 Atom;
+#define NULL_ATOM 0 // The empty string
+
+#define ATOM(s) intern_string(STR(s))
+
+#define STRING_INTERNER_ATOMS_PER_PAGE 4096
+#define STRING_INTERNER_MAX_PAGES 1024
+#define STRING_INTERNER_CHUNK_SIZE (64*1024)
+
+u64 string_get_hash(string s);
+
+typedef struct Atom_Entry {
+	string s;
+	u64 hash;
+} Atom_Entry;
+
+typedef struct String_Interner_Table String_Interner_Table;
+typedef struct String_Interner_Table {
+	String_Interner_Table *next_retired;
+	u64 slot_count; // Power of two
+	volatile u32 slots[]; // Atom, NULL_ATOM for empty
+} String_Interner_Table;
+
+typedef struct String_Interner {
+	// Atom entries by atom-1. Pages never move so they can be read without a lock.
+	Atom_Entry *pages[STRING_INTERNER_MAX_PAGES];
+	volatile u32 atom_count;
+	
+	String_Interner_Table *volatile table;
+	String_Interner_Table *retired_tables; // Readers may still be in these
+	
+	u8 *chunk;
+	u64 chunk_left;
+	
+	volatile bool lock;
+} String_Interner;
+
+// #Global
+ogb_instance String_Interner string_interner;
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+String_Interner string_interner = {0};
+#endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
+
+inline Atom_Entry *
+atom_get_entry(Atom a) {
+	assert(a != NULL_ATOM && a <= string_interner.atom_count, "Invalid atom %u", a);
+	u32 index = a-1;
+	return &string_interner.pages[index/STRING_INTERNER_ATOMS_PER_PAGE][index%STRING_INTERNER_ATOMS_PER_PAGE];
+}
+inline string 
+atom_get_string(Atom a) {
+	if (a == NULL_ATOM) return null_string;
+	return atom_get_entry(a)->s;
+}
+inline u64 
+atom_get_hash(Atom a) {
+	if (a == NULL_ATOM) return string_get_hash(null_string);
+	return atom_get_entry(a)->hash;
+}
+
+Atom 
+string_interner_find_in_table(String_Interner_Table *t, string s, u64 hash) {
+	if (!t) return NULL_ATOM;
+	u64 mask = t->slot_count-1;
+	for (u64 pos = hash & mask; ; pos = (pos+1) & mask) {
+		Atom a = t->slots[pos];
+		if (a == NULL_ATOM) return NULL_ATOM;
+		Atom_Entry *entry = atom_get_entry(a);
+		if (entry->hash == hash && strings_match(entry->s, s)) return a;
+	}
+}
+
+// Returns NULL_ATOM if s was never interned
+Atom 
+find_interned_string(string s) {
+	if (s.count == 0) return NULL_ATOM;
+	return string_interner_find_in_table(string_interner.table, s, string_get_hash(s));
+}
+
+// Expects the lock
+void 
+string_interner_grow(String_Interner *interner) {
+	String_Interner_Table *old = interner->table;
+	u64 slot_count = old ? old->slot_count*2 : 1024;
+	
+	u64 size = sizeof(String_Interner_Table) + slot_count*sizeof(u32);
+	String_Interner_Table *t = (String_Interner_Table*)alloc(get_heap_allocator(), size);
+	memset(t, 0, size);
+	t->slot_count = slot_count;
+	
+	for (u32 a = 1; a <= interner->atom_count; a++) {
+		u64 pos = atom_get_entry(a)->hash & (slot_count-1);
+		while (t->slots[pos]) pos = (pos+1) & (slot_count-1);
+		t->slots[pos] = a;
+	}
+	
+	MEMORY_BARRIER;
+	interner->table = t;
+	
+	if (old) {
+		old->next_retired = interner->retired_tables;
+		interner->retired_tables = old;
+	}
+}
+
+// Expects the lock
+string 
+string_interner_store(String_Interner *interner, string s) {
+	string copy;
+	copy.count = s.count;
+	if (s.count > STRING_INTERNER_CHUNK_SIZE/4) {
+		copy.data = (u8*)alloc(get_heap_allocator(), s.count);
+	} else {
+		if (interner->chunk_left < s.count) {
+			interner->chunk = (u8*)alloc(get_heap_allocator(), STRING_INTERNER_CHUNK_SIZE);
+			interner->chunk_left = STRING_INTERNER_CHUNK_SIZE;
+		}
+		copy.data = interner->chunk;
+		interner->chunk += s.count;
+		interner->chunk_left -= s.count;
+	}
+	memcpy(copy.data, s.data, s.count);
+	return copy;
+}
+
+// Returns the atom of s, which is the same for every string with the same contents.
+// s is copied, so it can go away after this.
+Atom 
+intern_string(string s) {
+	if (s.count == 0) return NULL_ATOM;
+	
+	String_Interner *interner = &string_interner;
+	u64 hash = string_get_hash(s);
+	
+	// Fast path, no lock
+	Atom a = string_interner_find_in_table(interner->table, s, hash);
+	if (a != NULL_ATOM) return a;
+	
+	u64 backoff = 1;
+	while (!compare_and_swap_bool(&interner->lock, true, false)) {
+		while (interner->lock) spin_pause(&backoff);
+	}
+	
+	// Someone may have added it since we looked
+	a = string_interner_find_in_table(interner->table, s, hash);
+	if (a == NULL_ATOM) {
+		u32 index = interner->atom_count;
+		assert(index < STRING_INTERNER_MAX_PAGES*STRING_INTERNER_ATOMS_PER_PAGE, "Too many interned strings");
+		
+		u32 page = index/STRING_INTERNER_ATOMS_PER_PAGE;
+		if (!interner->pages[page]) {
+			interner->pages[page] = (Atom_Entry*)alloc(get_heap_allocator(), STRING_INTERNER_ATOMS_PER_PAGE*sizeof(Atom_Entry));
+		}
+		Atom_Entry *entry = &interner->pages[page][index%STRING_INTERNER_ATOMS_PER_PAGE];
+		entry->s = string_interner_store(interner, s);
+		entry->hash = hash;
+		
+		a = index+1;
+		MEMORY_BARRIER;
+		interner->atom_count = a;
+		
+		if (!interner->table || (u64)a*4 > interner->table->slot_count*3) {
+			string_interner_grow(interner);
+		} else {
+			String_Interner_Table *t = interner->table;
+			u64 pos = hash & (t->slot_count-1);
+			while (t->slots[pos]) pos = (pos+1) & (t->slot_count-1);
+			MEMORY_BARRIER;
+			t->slots[pos] = a;
+		}
+	}
+	
+	MEMORY_BARRIER;
+	interner->lock = false;
+	
+	return a;
+}
@@ -26,11 +26,17 @@
 		
 	Also includes all of the standard C printf-like format specifiers:
 	https://www.geeksforgeeks.org/format-specifiers-in-c/
+	
+	These are formatted natively without the CRT, with a few differences:
+		%g without a precision prints the shortest digits that read back as the same value
+		   ("%g", 0.1 -> "0.1"), in plain notation unless the exponent is below -7 or above 20.
+		%p prints all 16 hex digits with no prefix, like the windows CRT.
+		%a ignores precision for rounding, it only pads with zeros.
+		Precision for floats is capped at 1024.
 */
 
 ogb_instance void os_write_string_to_stdout(string s);
 inline int crt_sprintf(char *str, const char *format, ...);
-int vsnprintf(char* buffer, size_t n, const char* fmt, va_list args);
 bool is_pointer_valid(void *p);
 
 u64 format_string_to_buffer(char* buffer, u64 count, const char* fmt, va_list args);
@@ -44,6 +50,623 @@ u64 format_string_to_buffer_vararg(char* buffer, u64 count, const char* fmt, ...
 typedef struct _8_Bytes {u8 _[8];} _8_Bytes;
 typedef struct _12_Bytes {u8 _[12];} _12_Bytes;
 typedef struct _16_Bytes {u8 _[16];} _16_Bytes;
+
+///
+// Native formatting
+//
+// Everything that used to be forwarded to the CRT vsnprintf is formatted here, directly into the
+// output buffer and without any allocations.
+// Integers are converted two digits at a time.
+// Floats are converted exactly with a small fixed size bignum (Steele & White / Dragon4), so %f, %e
+// and %g round exactly like a correct CRT would. %g without a precision prints the shortest digits
+// that read back as the same value.
+
+typedef struct Format_Output {
+	char *buffer;
+	char *p;
+	u64 count;
+} Format_Output;
+
+typedef struct Format_Spec {
+	bool left;
+	bool plus;
+	bool space;
+	bool alt;
+	bool zero;
+	s64 width;
+	s64 precision; // -1 if not specified
+	char conversion;
+} Format_Spec;
+
+inline void format_put_char(Format_Output *out, char c) {
+	if ((u64)(out->p - out->buffer) >= out->count - 1) return;
+	if (out->buffer) *out->p = c;
+	out->p += 1;
+}
+inline void format_put_chars(Format_Output *out, const char *s, u64 n) {
+	u64 left = out->count - 1 - (u64)(out->p - out->buffer);
+	if (n > left) n = left;
+	if (out->buffer) memcpy(out->p, s, n);
+	out->p += n;
+}
+inline void format_put_repeat(Format_Output *out, char c, s64 n) {
+	for (s64 i = 0; i < n; i++) format_put_char(out, c);
+}
+
+// Pads to the spec width. Zero padding goes between the prefix (sign, 0x) and the body.
+void format_put_padded(Format_Output *out, Format_Spec *spec, const char *prefix, u64 prefix_len, s64 zeros, const char *body, u64 body_len) {
+	s64 total = (s64)prefix_len + zeros + (s64)body_len;
+	s64 pad = spec->width > total ? spec->width - total : 0;
+	
+	if (!spec->left && !spec->zero) format_put_repeat(out, ' ', pad);
+	format_put_chars(out, prefix, prefix_len);
+	if (!spec->left && spec->zero) format_put_repeat(out, '0', pad);
+	format_put_repeat(out, '0', zeros);
+	format_put_chars(out, body, body_len);
+	if (spec->left) format_put_repeat(out, ' ', pad);
+}
+
+const char format_digit_pairs[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+// Writes the digits backwards, ending at 'end'. Returns the digit count.
+u64 format_u64_decimal(u64 v, char *end) {
+	char *p = end;
+	while (v >= 100) {
+		u64 i = (v % 100)*2;
+		v /= 100;
+		p -= 2;
+		p[0] = format_digit_pairs[i];
+		p[1] = format_digit_pairs[i+1];
+	}
+	if (v >= 10) {
+		p -= 2;
+		p[0] = format_digit_pairs[v*2];
+		p[1] = format_digit_pairs[v*2+1];
+	} else {
+		*--p = (char)('0' + v);
+	}
+	return (u64)(end - p);
+}
+u64 format_u64_base(u64 v, char *end, u64 shift, bool upper) {
+	const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+	u64 mask = (1ULL << shift) - 1;
+	char *p = end;
+	do {
+		*--p = digits[v & mask];
+		v >>= shift;
+	} while (v);
+	return (u64)(end - p);
+}
+
+void format_integer(Format_Output *out, Format_Spec *spec, u64 magnitude, bool negative) {
+	char digits[32];
+	char *end = digits + sizeof(digits);
+	u64 n = 0;
+	
+	char prefix[3];
+	u64 prefix_len = 0;
+	
+	switch (spec->conversion) {
+		case 'x': case 'X':
+			n = format_u64_base(magnitude, end, 4, spec->conversion == 'X');
+			if (spec->alt && magnitude) {
+				prefix[prefix_len++] = '0';
+				prefix[prefix_len++] = spec->conversion;
+			}
+			break;
+		case 'o':
+			n = format_u64_base(magnitude, end, 3, false);
+			break;
+		default:
+			n = format_u64_decimal(magnitude, end);
+			if (negative)         prefix[prefix_len++] = '-';
+			else if (spec->plus)  prefix[prefix_len++] = '+';
+			else if (spec->space) prefix[prefix_len++] = ' ';
+			break;
+	}
+	
+	// Precision is the minimum digit count, and a precision of 0 prints nothing for 0
+	if (spec->precision == 0 && magnitude == 0) n = 0;
+	s64 zeros = spec->precision > (s64)n ? spec->precision - (s64)n : 0;
+	if (spec->conversion == 'o' && spec->alt && zeros == 0 && (n == 0 || end[-(s64)n] != '0')) zeros = 1;
+	
+	Format_Spec s = *spec;
+	if (spec->precision >= 0) s.zero = false;
+	format_put_padded(out, &s, prefix, prefix_len, zeros, end-n, n);
+}
+
+///
+// Float to decimal
+
+#define FORMAT_BIG_LIMBS 40 // A double scaled by any power of 10 we need fits in 1280 bits
+
+typedef struct Format_Big {
+	u32 limbs[FORMAT_BIG_LIMBS];
+	u64 count;
+} Format_Big;
+
+void format_big_set_u64(Format_Big *b, u64 v) {
+	b->count = 0;
+	while (v) {
+		b->limbs[b->count++] = (u32)v;
+		v >>= 32;
+	}
+}
+void format_big_mul_small(Format_Big *b, u32 m) {
+	u64 carry = 0;
+	for (u64 i = 0; i < b->count; i++) {
+		u64 x = (u64)b->limbs[i]*m + carry;
+		b->limbs[i] = (u32)x;
+		carry = x >> 32;
+	}
+	if (carry) {
+		assert(b->count < FORMAT_BIG_LIMBS, "Float formatting bignum overflow");
+		b->limbs[b->count++] = (u32)carry;
+	}
+}
+void format_big_mul_pow10(Format_Big *b, s64 n) {
+	const u32 pow10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+	while (n >= 9) {
+		format_big_mul_small(b, pow10[9]);
+		n -= 9;
+	}
+	if (n > 0) format_big_mul_small(b, pow10[n]);
+}
+void format_big_shift_left(Format_Big *b, u64 bits) {
+	if (!b->count) return;
+	u64 limbs = bits/32;
+	u64 shift = bits%32;
+	assert(b->count + limbs + 1 <= FORMAT_BIG_LIMBS, "Float formatting bignum overflow");
+	
+	b->limbs[b->count+limbs] = 0;
+	for (s64 i = (s64)b->count-1; i >= 0; i--) {
+		u64 x = (u64)b->limbs[i] << shift;
+		b->limbs[i+limbs+1] |= (u32)(x >> 32);
+		b->limbs[i+limbs]    = (u32)x;
+	}
+	for (u64 i = 0; i < limbs; i++) b->limbs[i] = 0;
+	b->count += limbs + 1;
+	while (b->count && !b->limbs[b->count-1]) b->count -= 1;
+}
+int format_big_compare(Format_Big *a, Format_Big *b) {
+	if (a->count != b->count) return a->count < b->count ? -1 : 1;
+	for (s64 i = (s64)a->count-1; i >= 0; i--) {
+		if (a->limbs[i] != b->limbs[i]) return a->limbs[i] < b->limbs[i] ? -1 : 1;
+	}
+	return 0;
+}
+// a -= b, a must be >= b
+void format_big_sub(Format_Big *a, Format_Big *b) {
+	u64 borrow = 0;
+	for (u64 i = 0; i < a->count; i++) {
+		u64 x = (u64)a->limbs[i] - (i < b->count ? b->limbs[i] : 0) - borrow;
+		a->limbs[i] = (u32)x;
+		borrow = (x >> 32) & 1;
+	}
+	while (a->count && !a->limbs[a->count-1]) a->count -= 1;
+}
+void format_big_add(Format_Big *result, Format_Big *a, Format_Big *b) {
+	u64 n = a->count > b->count ? a->count : b->count;
+	u64 carry = 0;
+	for (u64 i = 0; i < n; i++) {
+		u64 x = (u64)(i < a->count ? a->limbs[i] : 0) + (i < b->count ? b->limbs[i] : 0) + carry;
+		result->limbs[i] = (u32)x;
+		carry = x >> 32;
+	}
+	result->count = n;
+	if (carry) {
+		assert(n < FORMAT_BIG_LIMBS, "Float formatting bignum overflow");
+		result->limbs[result->count++] = (u32)carry;
+	}
+}
+// r < 10*s. Returns r/s and leaves the remainder in r.
+u32 format_big_divide_digit(Format_Big *r, Format_Big *s) {
+	u32 d = 0;
+	while (format_big_compare(r, s) >= 0) {
+		format_big_sub(r, s);
+		d += 1;
+	}
+	return d;
+}
+
+typedef enum Format_Float_Mode {
+	FORMAT_FLOAT_SHORTEST,    // Shortest digits that round trip
+	FORMAT_FLOAT_SIGNIFICANT, // 'precision' significant digits
+	FORMAT_FLOAT_FRACTION,    // 'precision' digits after the decimal point
+} Format_Float_Mode;
+
+#define FORMAT_FLOAT_MAX_DIGITS 800 // A double has at most 767 significant decimal digits
+
+// Exact for the common case of a modest value and precision: v*10^p fits in 128 bits, so the
+// digits and the rounding come from one multiply and shift instead of the bignum.
+bool format_float_digits_fast(u64 mantissa, s64 e, s64 p, char *digits, u64 *digit_count, s64 *exponent) {
+	const u64 pow10[20] = {
+		1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+		1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+		100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+		1000000000000000000ULL, 10000000000000000000ULL
+	};
+	if (p < 0 || p > 19 || e > 0 || e < -127) return false;
+	
+	u64 s = (u64)(-e);
+	u64 hi;
+	u64 lo = multiply_u64_128(mantissa, pow10[p], &hi);
+	
+	// q = floor(v*10^p), then round half to even on the remainder
+	u64 q;
+	int rounding; // <0 below half, 0 exactly half, >0 above half
+	if (s == 0) {
+		if (hi) return false;
+		q = lo;
+		rounding = -1;
+	} else if (s < 64) {
+		if (hi >> s) return false;
+		q = (hi << (64 - s)) | (lo >> s);
+		u64 rem = lo & ((1ULL << s) - 1);
+		u64 half = 1ULL << (s - 1);
+		rounding = rem < half ? -1 : (rem > half ? 1 : 0);
+	} else if (s == 64) {
+		q = hi;
+		rounding = lo < (1ULL << 63) ? -1 : (lo > (1ULL << 63) ? 1 : 0);
+	} else {
+		q = hi >> (s - 64);
+		u64 rem_hi = hi & ((1ULL << (s - 64)) - 1);
+		u64 half_hi = 1ULL << (s - 65);
+		if      (rem_hi < half_hi) rounding = -1;
+		else if (rem_hi > half_hi) rounding = 1;
+		else                       rounding = lo ? 1 : 0;
+	}
+	if (rounding > 0 || (rounding == 0 && (q & 1))) {
+		if (q == UINT64_MAX) return false;
+		q += 1;
+	}
+	
+	if (q == 0) {
+		*digit_count = 0;
+		*exponent = -p;
+		return true;
+	}
+	char buffer[24];
+	u64 n = format_u64_decimal(q, buffer+sizeof(buffer));
+	memcpy(digits, buffer+sizeof(buffer)-n, n);
+	*digit_count = n;
+	*exponent = (s64)n - p;
+	return true;
+}
+
+// v must be finite and > 0.
+// Returns the digit count and sets *exponent so that v ~= 0.DIGITS * 10^exponent.
+// Trailing zeros may be left out.
+u64 format_float_digits(f64 v, Format_Float_Mode mode, s64 precision, char *digits, s64 *exponent) {
+	u64 bits;
+	memcpy(&bits, &v, sizeof(bits));
+	u64 mantissa = bits & ((1ULL << 52) - 1);
+	s64 biased = (s64)((bits >> 52) & 0x7FF);
+	
+	s64 e;
+	if (biased) {
+		mantissa |= 1ULL << 52;
+		e = biased - 1075;
+	} else {
+		e = -1074;
+	}
+	
+	// Estimate of the decimal exponent from log10(2) ~= 78913/2^18, may be one too low
+	s64 bit_length = 0;
+	while (bit_length < 53 && (mantissa >> bit_length)) bit_length += 1;
+	s64 log2_v = e + bit_length - 1;
+	s64 k = (log2_v >= 0 ? (log2_v*78913) >> 18 : -((-log2_v*78913 + 262143) >> 18)) + 1;
+	
+	if (mode == FORMAT_FLOAT_FRACTION) {
+		u64 n;
+		if (format_float_digits_fast(mantissa, e, precision, digits, &n, exponent)) return n;
+	} else if (mode == FORMAT_FLOAT_SIGNIFICANT) {
+		// Scale so that exactly 'precision' digits land in the integer part. If the estimate was
+		// off we get one digit too many or too few and retry with the fixed exponent.
+		s64 wanted = precision > 1 ? precision : 1;
+		for (int attempt = 0; attempt < 2; attempt++) {
+			u64 n;
+			if (!format_float_digits_fast(mantissa, e, wanted - k, digits, &n, exponent)) break;
+			if ((s64)n == wanted) return n;
+			if ((s64)n == wanted + 1 && *exponent - 1 == k) {
+				// Either rounded up to a power of 10, or k was one too low
+				bool rounded_up = digits[0] == '1';
+				for (u64 i = 1; i < n && rounded_up; i++) rounded_up = digits[i] == '0';
+				if (rounded_up) return n;
+			}
+			k = *exponent;
+		}
+	}
+	
+	// v = r/s, and the halfway points to the neighbouring doubles are (r-m_minus)/s and (r+m_plus)/s
+	Format_Big r, s, m_plus, m_minus;
+	bool unequal_margins = biased > 1 && mantissa == (1ULL << 52);
+	if (e >= 0) {
+		format_big_set_u64(&r, mantissa);
+		format_big_shift_left(&r, (u64)e + 1 + unequal_margins);
+		format_big_set_u64(&s, 2);
+		format_big_shift_left(&s, unequal_margins);
+		format_big_set_u64(&m_minus, 1);
+		format_big_shift_left(&m_minus, (u64)e);
+	} else {
+		format_big_set_u64(&r, mantissa);
+		format_big_shift_left(&r, 1 + unequal_margins);
+		format_big_set_u64(&s, 1);
+		format_big_shift_left(&s, (u64)(-e) + 1 + unequal_margins);
+		format_big_set_u64(&m_minus, 1);
+	}
+	m_plus = m_minus;
+	if (unequal_margins) format_big_shift_left(&m_plus, 1);
+	
+	bool shortest = mode == FORMAT_FLOAT_SHORTEST;
+	bool inclusive = (mantissa & 1) == 0; // Round to even, so the halfway points read back as v
+	
+	// Scale by the estimated exponent, then fix it up so that the digits start right after the
+	// decimal point
+	if (k >= 0) {
+		format_big_mul_pow10(&s, k);
+	} else {
+		format_big_mul_pow10(&r, -k);
+		format_big_mul_pow10(&m_minus, -k);
+		format_big_mul_pow10(&m_plus, -k);
+	}
+	while (true) {
+		Format_Big r10 = r;
+		format_big_mul_small(&r10, 10);
+		if (format_big_compare(&r10, &s) >= 0) break;
+		r = r10;
+		format_big_mul_small(&m_minus, 10);
+		format_big_mul_small(&m_plus, 10);
+		k -= 1;
+	}
+	while (true) {
+		Format_Big high = r;
+		if (shortest) format_big_add(&high, &r, &m_plus);
+		if (format_big_compare(&high, &s) < 0) break;
+		format_big_mul_small(&s, 10);
+		k += 1;
+	}
+	
+	s64 wanted = 0;
+	if (mode == FORMAT_FLOAT_SIGNIFICANT) wanted = precision > 1 ? precision : 1;
+	if (mode == FORMAT_FLOAT_FRACTION)    wanted = k + precision;
+	
+	if (!shortest && wanted <= 0) {
+		// Everything is rounded away, v rounds to 0 or to a single 1 at the last position
+		*exponent = k;
+		if (wanted < 0) return 0;
+		format_big_shift_left(&r, 1);
+		if (format_big_compare(&r, &s) > 0) {
+			digits[0] = '1';
+			*exponent = k + 1;
+			return 1;
+		}
+		return 0;
+	}
+	
+	u64 n = 0;
+	while (true) {
+		assert(n < FORMAT_FLOAT_MAX_DIGITS, "Float formatting produced too many digits");
+		
+		format_big_mul_small(&r, 10);
+		u32 d = format_big_divide_digit(&r, &s);
+		
+		if (shortest) {
+			format_big_mul_small(&m_minus, 10);
+			format_big_mul_small(&m_plus, 10);
+			
+			int low_cmp = format_big_compare(&r, &m_minus);
+			bool low = inclusive ? low_cmp <= 0 : low_cmp < 0;
+			Format_Big high_sum;
+			format_big_add(&high_sum, &r, &m_plus);
+			int high_cmp = format_big_compare(&high_sum, &s);
+			bool high = inclusive ? high_cmp >= 0 : high_cmp > 0;
+			
+			if (low || high) {
+				if (low && high) {
+					format_big_shift_left(&r, 1);
+					int c = format_big_compare(&r, &s);
+					if (c > 0 || (c == 0 && (d & 1))) d += 1;
+				} else if (high) {
+					d += 1;
+				}
+				digits[n++] = (char)('0' + d);
+				break;
+			}
+			digits[n++] = (char)('0' + d);
+		} else {
+			digits[n++] = (char)('0' + d);
+			if (r.count == 0) break; // Exact, the rest are zeros
+			if ((s64)n == wanted) {
+				// Round half to even on what is left
+				format_big_shift_left(&r, 1);
+				int c = format_big_compare(&r, &s);
+				if (c > 0 || (c == 0 && (d & 1))) {
+					s64 i = (s64)n-1;
+					while (i >= 0 && digits[i] == '9') i -= 1;
+					if (i < 0) {
+						digits[0] = '1';
+						n = 1;
+						k += 1;
+					} else {
+						digits[i] += 1;
+						n = (u64)i + 1;
+					}
+				}
+				break;
+			}
+		}
+	}
+	
+	*exponent = k;
+	return n;
+}
+
+// Plain decimal notation with 'decimals' digits after the point
+u64 format_write_fixed(char *p, const char *digits, s64 n, s64 k, s64 decimals, bool alt) {
+	char *start = p;
+	if (k <= 0) {
+		*p++ = '0';
+	} else {
+		for (s64 i = 0; i < k; i++) *p++ = i < n ? digits[i] : '0';
+	}
+	if (decimals > 0 || alt) *p++ = '.';
+	for (s64 i = 0; i < decimals; i++) {
+		s64 index = k + i;
+		*p++ = (index >= 0 && index < n) ? digits[index] : '0';
+	}
+	return (u64)(p - start);
+}
+// d.ddde+XX with 'decimals' digits after the point
+u64 format_write_exponential(char *p, const char *digits, s64 n, s64 k, s64 decimals, bool alt, bool upper) {
+	char *start = p;
+	*p++ = n > 0 ? digits[0] : '0';
+	if (decimals > 0 || alt) *p++ = '.';
+	for (s64 i = 0; i < decimals; i++) *p++ = i+1 < n ? digits[i+1] : '0';
+	
+	s64 x = n > 0 ? k - 1 : 0;
+	*p++ = upper ? 'E' : 'e';
+	*p++ = x < 0 ? '-' : '+';
+	if (x < 0) x = -x;
+	char exp_digits[8];
+	u64 exp_n = format_u64_decimal((u64)x, exp_digits+sizeof(exp_digits));
+	if (exp_n < 2) *p++ = '0';
+	memcpy(p, exp_digits+sizeof(exp_digits)-exp_n, exp_n);
+	p += exp_n;
+	return (u64)(p - start);
+}
+
+#define FORMAT_FLOAT_MAX_PRECISION 1024
+
+void format_float(Format_Output *out, Format_Spec *spec, f64 v) {
+	u64 bits;
+	memcpy(&bits, &v, sizeof(bits));
+	bool negative = (bits >> 63) != 0;
+	if (negative) v = -v;
+	
+	char conversion = spec->conversion;
+	bool upper = conversion == 'F' || conversion == 'E' || conversion == 'G' || conversion == 'A';
+	
+	char prefix[3];
+	u64 prefix_len = 0;
+	if (negative)         prefix[prefix_len++] = '-';
+	else if (spec->plus)  prefix[prefix_len++] = '+';
+	else if (spec->space) prefix[prefix_len++] = ' ';
+	
+	// Fixed notation can have 309 integer digits in front of the precision
+	char body[FORMAT_FLOAT_MAX_PRECISION + 400];
+	u64 body_len = 0;
+	
+	Format_Spec s = *spec;
+	
+	if (((bits >> 52) & 0x7FF) == 0x7FF) {
+		bool nan = (bits & ((1ULL << 52) - 1)) != 0;
+		memcpy(body, nan ? (upper ? "NAN" : "nan") : (upper ? "INF" : "inf"), 3);
+		body_len = 3;
+		s.zero = false;
+		format_put_padded(out, &s, prefix, prefix_len, 0, body, body_len);
+		return;
+	}
+	
+	s64 precision = spec->precision > FORMAT_FLOAT_MAX_PRECISION ? FORMAT_FLOAT_MAX_PRECISION : spec->precision;
+	char digits[FORMAT_FLOAT_MAX_DIGITS];
+	s64 n = 0;
+	s64 k = 0;
+	
+	switch (conversion) {
+		case 'f': case 'F': {
+			if (precision < 0) precision = 6;
+			if (v != 0) n = (s64)format_float_digits(v, FORMAT_FLOAT_FRACTION, precision, digits, &k);
+			body_len = format_write_fixed(body, digits, n, k, precision, spec->alt);
+			break;
+		}
+		case 'e': case 'E': {
+			if (precision < 0) precision = 6;
+			if (v != 0) n = (s64)format_float_digits(v, FORMAT_FLOAT_SIGNIFICANT, precision+1, digits, &k);
+			body_len = format_write_exponential(body, digits, n, k, precision, spec->alt, upper);
+			break;
+		}
+		case 'g': case 'G': {
+			if (precision < 0) {
+				// Shortest round trip. Plain notation unless the exponent is far out.
+				if (v != 0) n = (s64)format_float_digits(v, FORMAT_FLOAT_SHORTEST, 0, digits, &k);
+				else        k = 1;
+				s64 x = k - 1;
+				if (x >= -7 && x < 21) {
+					body_len = format_write_fixed(body, digits, n, k, n > k ? n - k : 0, spec->alt);
+				} else {
+					body_len = format_write_exponential(body, digits, n, k, n - 1, spec->alt, upper);
+				}
+			} else {
+				if (precision == 0) precision = 1;
+				if (v != 0) n = (s64)format_float_digits(v, FORMAT_FLOAT_SIGNIFICANT, precision, digits, &k);
+				else        k = 1;
+				s64 x = k - 1;
+				bool fixed = x >= -4 && x < precision;
+				if (fixed) body_len = format_write_fixed(body, digits, n, k, precision - 1 - x, spec->alt);
+				else       body_len = format_write_exponential(body, digits, n, k, precision - 1, spec->alt, upper);
+				
+				if (!spec->alt) {
+					// Strip trailing zeros in the fraction, and the point if nothing is left
+					char *point = 0;
+					for (u64 i = 0; i < body_len; i++) {
+						if (body[i] == '.') point = body+i;
+					}
+					if (point) {
+						char *exp = point;
+						while (exp < body+body_len && *exp != 'e' && *exp != 'E') exp += 1;
+						char *last = exp - 1;
+						while (last > point && *last == '0') last -= 1;
+						if (last == point) last -= 1;
+						u64 tail = (u64)(body+body_len - exp);
+						memmove(last+1, exp, tail);
+						body_len = (u64)(last+1 - body) + tail;
+					}
+				}
+			}
+			break;
+		}
+		case 'a': case 'A': {
+			// Hexadecimal is always exact, so a precision only pads with zeros
+			u64 mantissa = bits & ((1ULL << 52) - 1);
+			s64 biased = (s64)((bits >> 52) & 0x7FF);
+			s64 x = v == 0 ? 0 : (biased ? biased - 1023 : -1022);
+			const char *hex = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+			
+			prefix[prefix_len++] = '0';
+			prefix[prefix_len++] = upper ? 'X' : 'x';
+			
+			s64 hex_digits = 13;
+			while (hex_digits > 0 && ((mantissa >> (52 - hex_digits*4)) & 0xF) == 0) hex_digits -= 1;
+			
+			body[body_len++] = biased ? '1' : '0';
+			if (hex_digits > 0 || precision > 0 || spec->alt) body[body_len++] = '.';
+			for (s64 i = 0; i < hex_digits; i++) body[body_len++] = hex[(mantissa >> (48 - i*4)) & 0xF];
+			for (s64 i = hex_digits; i < precision; i++) body[body_len++] = '0';
+			body[body_len++] = upper ? 'P' : 'p';
+			body[body_len++] = x < 0 ? '-' : '+';
+			
+			char exp_digits[8];
+			u64 exp_n = format_u64_decimal((u64)(x < 0 ? -x : x), exp_digits+sizeof(exp_digits));
+			memcpy(body+body_len, exp_digits+sizeof(exp_digits)-exp_n, exp_n);
+			body_len += exp_n;
+			break;
+		}
+	}
+	
+	format_put_padded(out, &s, prefix, prefix_len, 0, body, body_len);
+}
+
 u64 format_string_to_buffer(char* buffer, u64 count, const char* fmt, va_list args) {
 	if (!buffer) count = UINT64_MAX;
     const char* p = fmt;
@@ -147,40 +770,141 @@ u64 format_string_to_buffer(char* buffer, u64 count, const char* fmt, va_list ar
                 
                 bufp += n;
             } else {
-                // Fallback to standard vsnprintf
-                char temp_buffer[512];
-                char format_specifier[64];
-                int specifier_len = 0;
-                format_specifier[specifier_len++] = '%';
-
-                while (*p != '\0' && strchr("diuoxXfFeEgGaAcCpn%", *p) == NULL) {
-                    format_specifier[specifier_len++] = *p++;
+                // Standard printf-like specifiers: %[flags][width][.precision][length]conversion
+                Format_Spec spec = {0};
+                spec.precision = -1;
+                
+                while (true) {
+                	if      (*p == '-') spec.left  = true;
+                	else if (*p == '+') spec.plus  = true;
+                	else if (*p == ' ') spec.space = true;
+                	else if (*p == '#') spec.alt   = true;
+                	else if (*p == '0') spec.zero  = true;
+                	else break;
+                	p += 1;
                 }
-                if (*p != '\0') {
-                    format_specifier[specifier_len++] = *p++;
+                if (*p == '*') {
+                	p += 1;
+                	int width = va_arg(args, int);
+                	if (width < 0) {
+                		spec.left = true;
+                		width = -width;
+                	}
+                	spec.width = width;
+                } else {
+                	while (*p >= '0' && *p <= '9') spec.width = spec.width*10 + (*p++ - '0');
                 }
-                format_specifier[specifier_len] = '\0';
-
-                int temp_len = vsnprintf(temp_buffer, sizeof(temp_buffer), format_specifier, args);
-                switch (format_specifier[specifier_len - 1]) {
-                    case 'd': case 'i': va_arg(args, int); break;
-                    case 'u': case 'x': case 'X': case 'o': va_arg(args, unsigned int); break;
-                    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': va_arg(args, double); break;
-                    case 'c': va_arg(args, int); break;
-                    case 's': va_arg(args, char*); break;
-                    case 'p': va_arg(args, void*); break;
-                    case 'n': va_arg(args, int*); break;
-                    default: break;
+                if (*p == '.') {
+                	p += 1;
+                	spec.precision = 0;
+                	if (*p == '*') {
+                		p += 1;
+                		int precision = va_arg(args, int);
+                		spec.precision = precision < 0 ? -1 : precision;
+                	} else {
+                		while (*p >= '0' && *p <= '9') spec.precision = spec.precision*10 + (*p++ - '0');
+                	}
                 }
+                if (spec.left) spec.zero = false;
                 
-                if (temp_len < 0) {
-                    return -1; // Error in formatting
-                }
-
-                for (int i = 0; i < temp_len && (bufp - buffer) < count - 1; i++) {
-                    if (buffer) *bufp = temp_buffer[i];
-                    bufp += 1;
+                // 'l' is the platform long, which is 32 bits on windows
+                typedef enum { LENGTH_INT, LENGTH_CHAR, LENGTH_SHORT, LENGTH_LONG, LENGTH_64, LENGTH_LONG_DOUBLE } Length;
+                Length length = LENGTH_INT;
+                if      (p[0] == 'h' && p[1] == 'h') { length = LENGTH_CHAR;  p += 2; }
+                else if (p[0] == 'h')                { length = LENGTH_SHORT; p += 1; }
+                else if (p[0] == 'l' && p[1] == 'l') { length = LENGTH_64;    p += 2; }
+                else if (p[0] == 'l')                { length = LENGTH_LONG;  p += 1; }
+                else if (p[0] == 'j' || p[0] == 'z' || p[0] == 't') { length = LENGTH_64; p += 1; }
+                else if (p[0] == 'L')                { length = LENGTH_LONG_DOUBLE; p += 1; }
+                else if (p[0] == 'I' && p[1] == '6' && p[2] == '4') { length = LENGTH_64; p += 3; }
+                else if (p[0] == 'I' && p[1] == '3' && p[2] == '2') { length = LENGTH_INT; p += 3; }
+                else if (p[0] == 'I')                { length = LENGTH_64;    p += 1; }
+                
+                spec.conversion = *p;
+                if (*p != '\0') p += 1;
+                
+                Format_Output out = { buffer, bufp, count };
+                
+                switch (spec.conversion) {
+                	case 'd': case 'i': {
+                		s64 v;
+                		switch (length) {
+                			case LENGTH_CHAR:  v = (s8)va_arg(args, int);  break;
+                			case LENGTH_SHORT: v = (s16)va_arg(args, int); break;
+                			case LENGTH_LONG:  v = va_arg(args, long);     break;
+                			case LENGTH_64:    v = va_arg(args, s64);      break;
+                			default:           v = va_arg(args, int);      break;
+                		}
+                		format_integer(&out, &spec, v < 0 ? 0ULL - (u64)v : (u64)v, v < 0);
+                		break;
+                	}
+                	case 'u': case 'x': case 'X': case 'o': {
+                		u64 v;
+                		switch (length) {
+                			case LENGTH_CHAR:  v = (u8)va_arg(args, unsigned int);  break;
+                			case LENGTH_SHORT: v = (u16)va_arg(args, unsigned int); break;
+                			case LENGTH_LONG:  v = va_arg(args, unsigned long);     break;
+                			case LENGTH_64:    v = va_arg(args, u64);               break;
+                			default:           v = va_arg(args, unsigned int);      break;
+                		}
+                		format_integer(&out, &spec, v, false);
+                		break;
+                	}
+                	case 'p': {
+                		// Same as the windows CRT: all 16 hex digits, no prefix
+                		u64 v = (u64)va_arg(args, void*);
+                		spec.conversion = 'X';
+                		spec.precision = 16;
+                		format_integer(&out, &spec, v, false);
+                		break;
+                	}
+                	case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+                		f64 v = length == LENGTH_LONG_DOUBLE ? (f64)va_arg(args, long double) : va_arg(args, f64);
+                		format_float(&out, &spec, v);
+                		break;
+                	}
+                	case 'c': {
+                		char c = (char)va_arg(args, int);
+                		spec.zero = false;
+                		format_put_padded(&out, &spec, 0, 0, 0, &c, 1);
+                		break;
+                	}
+                	case 's': {
+                		// Same as plain %s, a string if it looks like one and otherwise a char*
+						va_list args2;
+						va_copy(args2, args);
+		                string s = va_arg(args2, string);
+		                va_end(args2);
+		                if (s.count < 1024ULL*1024ULL*1024ULL*256ULL && is_pointer_valid(s.data)) {
+		                	va_arg(args, string);
+		                } else {
+		                	s.data = (u8*)va_arg(args, char*);
+		                	s.count = 0;
+		                	while (s.data[s.count] && (spec.precision < 0 || s.count < (u64)spec.precision)) s.count += 1;
+		                }
+		                if (spec.precision >= 0 && s.count > (u64)spec.precision) s.count = (u64)spec.precision;
+                		spec.zero = false;
+                		format_put_padded(&out, &spec, 0, 0, 0, (char*)s.data, s.count);
+                		break;
+                	}
+                	case 'n': {
+                		*va_arg(args, int*) = (int)(bufp - buffer);
+                		break;
+                	}
+                	case '%': {
+                		format_put_char(&out, '%');
+                		break;
+                	}
+                	case '\0': break;
+                	default: {
+                		// Unknown conversion, print it as is
+                		format_put_char(&out, '%');
+                		format_put_char(&out, spec.conversion);
+                		break;
+                	}
                 }
+                
+                bufp = out.p;
             }
         } else {
             if (buffer) {
@@ -352,14 +1076,14 @@ void string_builder_prints(String_Builder *b, string fmt, ...) {
 	va_list args2 = 0;
 	va_copy(args2, args1);
 	
-	u64 formatted_count = format_string_to_buffer(0, 0, temp_convert_to_null_terminated_string(fmt), args1);
+	char *fmt_cstring = temp_convert_to_null_terminated_string(fmt);
+	u64 formatted_count = format_string_to_buffer(0, 0, fmt_cstring, args1);
 	
 	va_end(args1);
 	
-	string_builder_reserve(b, b->count+formatted_count+1);
-	
-	format_string_to_buffer((char*)b->buffer+b->count, b->count+formatted_count+1, temp_convert_to_null_terminated_string(fmt), args2);
-	b->count += formatted_count;
+	u8 *tail = string_builder_get_tail(b, formatted_count+1);
+	format_string_to_buffer((char*)tail, formatted_count+1, fmt_cstring, args2);
+	string_builder_advance(b, formatted_count);
 	
 	va_end(args2);
 }
@@ -375,10 +1099,9 @@ void string_builder_printf(String_Builder *b, const char *fmt, ...) {
 	
 	va_end(args1);
 	
-	string_builder_reserve(b, b->count+formatted_count+1);
-	
-	format_string_to_buffer((char*)b->buffer+b->count, b->buffer_capacity-b->count+1, fmt, args2);
-	b->count += formatted_count;
+	u8 *tail = string_builder_get_tail(b, formatted_count+1);
+	format_string_to_buffer((char*)tail, formatted_count+1, fmt, args2);
+	string_builder_advance(b, formatted_count);
 	
 	va_end(args2);
 }
@@ -0,0 +1,474 @@
+// A hash table which keeps one control byte per slot and probes 16 slots at a time.
+// The control byte holds 7 bits of the key hash (or marks the slot empty/deleted), so a
+// lookup compares a whole group of 16 control bytes with one simd compare and only looks at
+// the keys whose bits match. Entries live in the slots, so unlike Hash_Table there's no
+// indirection on lookup, but iteration has to skip the empty slots.
+//
+// Use this over Hash_Table for big, lookup heavy tables. Hash_Table is still nicer when you
+// iterate a lot or need entries to be packed.
+
+/*
+
+	Example Usage:
+
+
+	// Make a table with key type 'u64' and value type 'Entity*', allocated on the heap
+	Swiss_Table table = make_swiss_table(u64, Entity*, get_heap_allocator());
+
+	// Same as Hash_Table, key & value need to be lvalues
+	u64 id = 1234;
+	Entity *e = ...;
+	bool newly_added = swiss_table_set(&table, id, e);
+
+	Entity **found = swiss_table_find(&table, id);
+
+	bool removed = swiss_table_remove(&table, id);
+
+	// Set or find many keys at once. This is faster than doing it one by one because we
+	// hash a batch of keys first and prefetch their groups before touching them.
+	u64 ids[1000];
+	Entity *entities[1000];
+	swiss_table_set_many(&table, ids, entities, 1000);
+
+	Entity **results[1000]; // Null for keys that aren't in the table
+	u64 found_count = swiss_table_find_many(&table, ids, 1000, (void**)results);
+
+	// Go through all entries, in the order they are in memory
+	u64 iterator = 0;
+	u64 *key;
+	Entity **value;
+	while (swiss_table_iterate(&table, &iterator, (void**)&key, (void**)&value)) {
+
+	}
+
+	swiss_table_reset(&table);
+	swiss_table_destroy(&table);
+
+
+	Limitations:
+		- Same as Hash_Table, key can only be a base type, pointer or string, and string keys
+		  are copied into the table's allocator.
+		- The table hashes keys itself, so there's no hash parameter like in hash_table_*_raw.
+		- Pointers returned by swiss_table_find & friends are only valid until the table is
+		  changed; adding can grow the table and move every entry.
+*/
+
+typedef struct Swiss_Table Swiss_Table;
+
+// API:
+#define make_swiss_table_reserve(Key_Type, Value_Type, capacity_count, allocator) \
+	make_swiss_table_reserve_raw(sizeof(Key_Type), sizeof(Value_Type), get_hash_table_key_kind(Key_Type), capacity_count, allocator)
+
+#define make_swiss_table(Key_Type, Value_Type, allocator) \
+	make_swiss_table_raw(sizeof(Key_Type), sizeof(Value_Type), get_hash_table_key_kind(Key_Type), allocator)
+
+#define swiss_table_add(table_ptr, key, value) \
+	swiss_table_add_raw((table_ptr), &(key), &(value), sizeof(key), sizeof(value))
+
+#define swiss_table_find(table_ptr, key) \
+	swiss_table_find_raw((table_ptr), &(key), sizeof(key))
+
+#define swiss_table_contains(table_ptr, key) \
+	swiss_table_contains_raw((table_ptr), &(key), sizeof(key))
+
+#define swiss_table_set(table_ptr, key, value) \
+	swiss_table_set_raw((table_ptr), &(key), &(value), sizeof(key), sizeof(value))
+
+#define swiss_table_remove(table_ptr, key) \
+	swiss_table_remove_raw((table_ptr), &(key), sizeof(key))
+
+#define swiss_table_set_many(table_ptr, keys, values, count) \
+	swiss_table_set_many_raw((table_ptr), (keys), (values), (count), sizeof(*(keys)), sizeof(*(values)))
+
+#define swiss_table_find_many(table_ptr, keys, count, results) \
+	swiss_table_find_many_raw((table_ptr), (keys), (count), sizeof(*(keys)), (results))
+
+void swiss_table_reserve(Swiss_Table *t, u64 required_count);
+
+#define SWISS_TABLE_GROUP_SIZE 16
+
+// Control bytes. Full slots have the high bit cleared and keep the low 7 bits of the hash.
+#define SWISS_TABLE_EMPTY   0x80
+#define SWISS_TABLE_DELETED 0xFE
+
+// Grow when more than 7/8 of the slots are full or deleted
+#define SWISS_TABLE_MAX_LOAD_NUMERATOR 7
+#define SWISS_TABLE_MAX_LOAD_DENOMINATOR 8
+
+// How many keys we hash & prefetch ahead in the *_many functions
+#define SWISS_TABLE_BATCH_SIZE 16
+
+typedef struct Swiss_Table {
+
+	u8 *control; // One byte per slot
+
+	// Each entry is key-value, each padded to 8 bytes
+	void *entries;
+
+	u64 count; // Number of full slots
+	u64 capacity; // Number of slots, a power of two and a multiple of SWISS_TABLE_GROUP_SIZE
+	u64 growth_left; // How many more slots we can fill before we need to rehash
+
+	u64 _key_size;
+	u64 _value_size;
+	Hash_Table_Key_Kind _key_kind;
+
+	Allocator allocator;
+} Swiss_Table;
+
+inline u64 swiss_table_value_offset(Swiss_Table *t) {
+	return align_next(t->_key_size, 8);
+}
+inline u64 swiss_table_entry_size(Swiss_Table *t) {
+	return swiss_table_value_offset(t) + align_next(t->_value_size, 8);
+}
+inline u8 *swiss_table_get_entry(Swiss_Table *t, u64 slot) {
+	return (u8*)t->entries + slot*swiss_table_entry_size(t);
+}
+inline u64 swiss_table_max_load(u64 capacity) {
+	return (capacity*SWISS_TABLE_MAX_LOAD_NUMERATOR)/SWISS_TABLE_MAX_LOAD_DENOMINATOR;
+}
+
+u64 swiss_table_hash_key(Swiss_Table *t, void *k) {
+	if (t->_key_kind == HASH_TABLE_KEY_STRING) return string_get_hash(*(string*)k);
+	if (t->_key_size == 8) return xx_hash(*(u64*)k);
+
+	u64 hash = t->_key_size;
+	for (u64 i = 0; i < t->_key_size; i += 8) {
+		u64 chunk = 0;
+		memcpy(&chunk, (u8*)k+i, min(t->_key_size-i, 8));
+		hash = xx_hash(hash ^ chunk);
+	}
+	return hash;
+}
+
+inline u64 swiss_table_first_group(Swiss_Table *t, u64 hash) {
+	return (hash >> 7) & (t->capacity/SWISS_TABLE_GROUP_SIZE-1);
+}
+
+Swiss_Table make_swiss_table_reserve_raw(u64 key_size, u64 value_size, Hash_Table_Key_Kind key_kind, u64 capacity_count, Allocator allocator) {
+
+	Swiss_Table t = ZERO(Swiss_Table);
+
+	t._key_size = key_size;
+	t._value_size = value_size;
+	t._key_kind = key_kind;
+	t.allocator = allocator;
+
+	assert(key_kind != HASH_TABLE_KEY_STRING || key_size == sizeof(string), "Swiss table key kind is string but the key size doesn't match");
+
+	swiss_table_reserve(&t, max(capacity_count, 8));
+
+	return t;
+}
+inline Swiss_Table make_swiss_table_raw(u64 key_size, u64 value_size, Hash_Table_Key_Kind key_kind, Allocator allocator) {
+	return make_swiss_table_reserve_raw(key_size, value_size, key_kind, 128, allocator);
+}
+
+void swiss_table_free_keys(Swiss_Table *t) {
+	if (t->_key_kind != HASH_TABLE_KEY_STRING || t->count == 0) return;
+	for (u64 i = 0; i < t->capacity; i++) {
+		if (t->control[i] & 0x80) continue;
+		string *key = (string*)swiss_table_get_entry(t, i);
+		if (key->count) dealloc_string(t->allocator, *key);
+	}
+}
+
+void swiss_table_reset(Swiss_Table *t) {
+	swiss_table_free_keys(t);
+	t->count = 0;
+	t->growth_left = swiss_table_max_load(t->capacity);
+	if (t->control) memset(t->control, SWISS_TABLE_EMPTY, t->capacity);
+}
+void swiss_table_destroy(Swiss_Table *t) {
+	swiss_table_free_keys(t);
+	if (t->control) dealloc(t->allocator, t->control);
+	if (t->entries) dealloc(t->allocator, t->entries);
+
+	t->control = 0;
+	t->entries = 0;
+	t->count = 0;
+	t->capacity = 0;
+	t->growth_left = 0;
+}
+
+bool swiss_table_keys_match(Swiss_Table *t, void *a, void *b) {
+	if (t->_key_kind == HASH_TABLE_KEY_STRING) return strings_match(*(string*)a, *(string*)b);
+	if (t->_key_size == 8) return *(u64*)a == *(u64*)b;
+	return memcmp(a, b, t->_key_size) == 0;
+}
+
+// Returns the slot index, or -1 if key is not in the table
+s64 swiss_table_find_slot(Swiss_Table *t, u64 hash, void *k) {
+	if (t->count == 0) return -1;
+
+	u64 group_mask = t->capacity/SWISS_TABLE_GROUP_SIZE-1;
+	u64 group = swiss_table_first_group(t, hash);
+	u8 h2 = (u8)(hash & 0x7F);
+
+	// Triangular probing visits every group once when the group count is a power of two
+	for (u64 step = 1; ; step += 1) {
+		u8 *control = t->control + group*SWISS_TABLE_GROUP_SIZE;
+
+		u32 match = simd_match_uint8_128(control, h2);
+		while (match) {
+			u64 slot = group*SWISS_TABLE_GROUP_SIZE + count_trailing_zeros_u32(match);
+			if (swiss_table_keys_match(t, swiss_table_get_entry(t, slot), k)) return (s64)slot;
+			match &= match-1;
+		}
+
+		// The key would have been put in this group if it was in the table
+		if (simd_match_uint8_128(control, SWISS_TABLE_EMPTY)) return -1;
+
+		group = (group+step) & group_mask;
+	}
+}
+
+// Returns the first empty or deleted slot in the probe sequence of hash
+u64 swiss_table_find_free_slot(Swiss_Table *t, u64 hash) {
+	u64 group_mask = t->capacity/SWISS_TABLE_GROUP_SIZE-1;
+	u64 group = swiss_table_first_group(t, hash);
+
+	for (u64 step = 1; ; step += 1) {
+		u32 free_mask = simd_high_bit_mask_uint8_128(t->control + group*SWISS_TABLE_GROUP_SIZE);
+		if (free_mask) return group*SWISS_TABLE_GROUP_SIZE + count_trailing_zeros_u32(free_mask);
+		group = (group+step) & group_mask;
+	}
+}
+
+// Puts a new entry in the table without growing it or checking if the key exists.
+// Key is copied as is, so string keys should already be copied.
+// Returns the slot.
+u64 swiss_table_insert_no_grow(Swiss_Table *t, u64 hash, void *k, void *v) {
+	u64 slot = swiss_table_find_free_slot(t, hash);
+
+	if (t->control[slot] == SWISS_TABLE_EMPTY) {
+		assert(t->growth_left > 0, "Swiss table has no room left, this is a bug");
+		t->growth_left -= 1;
+	}
+	t->control[slot] = (u8)(hash & 0x7F);
+	t->count += 1;
+
+	u8 *entry = swiss_table_get_entry(t, slot);
+	memcpy(entry, k, t->_key_size);
+	if (v) memcpy(entry+swiss_table_value_offset(t), v, t->_value_size);
+
+	return slot;
+}
+
+void swiss_table_rehash(Swiss_Table *t, u64 new_capacity) {
+	u8 *old_control = t->control;
+	u8 *old_entries = (u8*)t->entries;
+	u64 old_capacity = t->capacity;
+	u64 entry_size = swiss_table_entry_size(t);
+
+	t->control = (u8*)alloc(t->allocator, new_capacity);
+	t->entries = alloc(t->allocator, new_capacity*entry_size);
+	memset(t->control, SWISS_TABLE_EMPTY, new_capacity);
+	t->capacity = new_capacity;
+	t->count = 0;
+	t->growth_left = swiss_table_max_load(new_capacity);
+
+	if (!old_control) return;
+
+	for (u64 i = 0; i < old_capacity; i++) {
+		if (old_control[i] & 0x80) continue;
+		u8 *entry = old_entries + i*entry_size;
+		u64 hash = swiss_table_hash_key(t, entry);
+		swiss_table_insert_no_grow(t, hash, entry, entry+swiss_table_value_offset(t));
+	}
+
+	dealloc(t->allocator, old_control);
+	dealloc(t->allocator, old_entries);
+}
+
+void swiss_table_reserve(Swiss_Table *t, u64 required_count) {
+	if (t->control && required_count <= t->count+t->growth_left) return;
+
+	u64 new_capacity = max(t->capacity, SWISS_TABLE_GROUP_SIZE);
+	while (swiss_table_max_load(new_capacity) < required_count) new_capacity *= 2;
+
+	swiss_table_rehash(t, new_capacity);
+}
+
+// Makes room for one more entry. If the table is full of deleted slots we just rehash
+// in place instead of growing.
+void swiss_table_prepare_insert(Swiss_Table *t) {
+	if (t->growth_left > 0) return;
+
+	if (t->count*2 <= swiss_table_max_load(t->capacity)) {
+		swiss_table_rehash(t, t->capacity);
+	} else {
+		swiss_table_reserve(t, t->count+1);
+	}
+}
+
+u64 swiss_table_add_hashed(Swiss_Table *t, u64 hash, void *k, void *v) {
+	swiss_table_prepare_insert(t);
+
+	if (t->_key_kind == HASH_TABLE_KEY_STRING) {
+		string key = *(string*)k;
+		string copy = ZERO(string);
+		if (key.count) {
+			copy = alloc_string(t->allocator, key.count);
+			memcpy(copy.data, key.data, key.count);
+		}
+		return swiss_table_insert_no_grow(t, hash, &copy, v);
+	}
+	return swiss_table_insert_no_grow(t, hash, k, v);
+}
+
+// This doesn't check if the key already exists, so it can add multiple entries of the same key.
+// Beware!
+void swiss_table_add_raw(Swiss_Table *t, void *k, void *v, u64 key_size, u64 value_size) {
+	assert(t->_key_size == key_size, "Key type size does not match swiss table initted key type size");
+	assert(t->_value_size == value_size, "Value type size does not match swiss table initted value type size");
+
+	swiss_table_add_hashed(t, swiss_table_hash_key(t, k), k, v);
+}
+
+void *swiss_table_find_raw(Swiss_Table *t, void *k, u64 key_size) {
+	assert(t->_key_size == key_size, "Key type size does not match swiss table initted key type size");
+
+	s64 slot = swiss_table_find_slot(t, swiss_table_hash_key(t, k), k);
+	if (slot < 0) return 0;
+
+	return swiss_table_get_entry(t, (u64)slot) + swiss_table_value_offset(t);
+}
+
+bool swiss_table_contains_raw(Swiss_Table *t, void *k, u64 key_size) {
+	return swiss_table_find_raw(t, k, key_size) != 0;
+}
+
+bool swiss_table_set_hashed(Swiss_Table *t, u64 hash, void *k, void *v) {
+	s64 slot = swiss_table_find_slot(t, hash, k);
+
+	if (slot >= 0) {
+		memcpy(swiss_table_get_entry(t, (u64)slot)+swiss_table_value_offset(t), v, t->_value_size);
+		return false;
+	}
+
+	swiss_table_add_hashed(t, hash, k, v);
+	return true;
+}
+
+// Returns true if key was newly added or false if it already existed
+bool swiss_table_set_raw(Swiss_Table *t, void *k, void *v, u64 key_size, u64 value_size) {
+	assert(t->_key_size == key_size, "Key type size does not match swiss table initted key type size");
+	assert(t->_value_size == value_size, "Value type size does not match swiss table initted value type size");
+
+	return swiss_table_set_hashed(t, swiss_table_hash_key(t, k), k, v);
+}
+
+// Returns true if the key existed
+bool swiss_table_remove_raw(Swiss_Table *t, void *k, u64 key_size) {
+	assert(t->_key_size == key_size, "Key type size does not match swiss table initted key type size");
+
+	s64 found = swiss_table_find_slot(t, swiss_table_hash_key(t, k), k);
+	if (found < 0) return false;
+
+	u64 slot = (u64)found;
+
+	if (t->_key_kind == HASH_TABLE_KEY_STRING) {
+		string *key = (string*)swiss_table_get_entry(t, slot);
+		if (key->count) dealloc_string(t->allocator, *key);
+	}
+
+	// If the group has an empty slot, no probe ever went past it, so we can mark this slot
+	// empty too. Otherwise lookups need to keep probing past it.
+	u8 *group = t->control + (slot & ~(u64)(SWISS_TABLE_GROUP_SIZE-1));
+	if (simd_match_uint8_128(group, SWISS_TABLE_EMPTY)) {
+		t->control[slot] = SWISS_TABLE_EMPTY;
+		t->growth_left += 1;
+	} else {
+		t->control[slot] = SWISS_TABLE_DELETED;
+	}
+	t->count -= 1;
+
+	return true;
+}
+
+// Sets count keys & values, which are tightly packed arrays.
+// Returns how many keys were newly added.
+u64 swiss_table_set_many_raw(Swiss_Table *t, void *keys, void *values, u64 count, u64 key_size, u64 value_size) {
+	assert(t->_key_size == key_size, "Key type size does not match swiss table initted key type size");
+	assert(t->_value_size == value_size, "Value type size does not match swiss table initted value type size");
+
+	swiss_table_reserve(t, t->count+count);
+
+	u64 hashes[SWISS_TABLE_BATCH_SIZE];
+	u64 added = 0;
+
+	for (u64 first = 0; first < count; first += SWISS_TABLE_BATCH_SIZE) {
+		u64 batch = min(count-first, SWISS_TABLE_BATCH_SIZE);
+
+		for (u64 i = 0; i < batch; i++) {
+			hashes[i] = swiss_table_hash_key(t, (u8*)keys + (first+i)*key_size);
+			prefetch(t->control + swiss_table_first_group(t, hashes[i])*SWISS_TABLE_GROUP_SIZE);
+		}
+		for (u64 i = 0; i < batch; i++) {
+			void *k = (u8*)keys + (first+i)*key_size;
+			void *v = (u8*)values + (first+i)*value_size;
+			if (swiss_table_set_hashed(t, hashes[i], k, v)) added += 1;
+		}
+	}
+
+	return added;
+}
+
+// Looks up count keys. results[i] is set to a pointer to the value of keys[i], or null if it's
+// not in the table.
+// Returns how many keys were found.
+u64 swiss_table_find_many_raw(Swiss_Table *t, void *keys, u64 count, u64 key_size, void **results) {
+	assert(t->_key_size == key_size, "Key type size does not match swiss table initted key type size");
+
+	u64 hashes[SWISS_TABLE_BATCH_SIZE];
+	u64 found = 0;
+	u64 value_offset = swiss_table_value_offset(t);
+
+	for (u64 first = 0; first < count; first += SWISS_TABLE_BATCH_SIZE) {
+		u64 batch = min(count-first, SWISS_TABLE_BATCH_SIZE);
+
+		for (u64 i = 0; i < batch; i++) {
+			hashes[i] = swiss_table_hash_key(t, (u8*)keys + (first+i)*key_size);
+			prefetch(t->control + swiss_table_first_group(t, hashes[i])*SWISS_TABLE_GROUP_SIZE);
+		}
+		for (u64 i = 0; i < batch; i++) {
+			s64 slot = swiss_table_find_slot(t, hashes[i], (u8*)keys + (first+i)*key_size);
+			if (slot >= 0) {
+				results[first+i] = swiss_table_get_entry(t, (u64)slot) + value_offset;
+				found += 1;
+			} else {
+				results[first+i] = 0;
+			}
+		}
+	}
+
+	return found;
+}
+
+// Walks the entries in memory order. Start with *iterator = 0.
+// Returns false when there are no more entries.
+bool swiss_table_iterate(Swiss_Table *t, u64 *iterator, void **key, void **value) {
+	u64 slot = *iterator;
+
+	while (slot < t->capacity) {
+		u64 group_start = slot & ~(u64)(SWISS_TABLE_GROUP_SIZE-1);
+		u32 full_mask = ~simd_high_bit_mask_uint8_128(t->control + group_start) & 0xFFFF;
+		full_mask &= 0xFFFF << (slot-group_start);
+
+		if (full_mask) {
+			slot = group_start + count_trailing_zeros_u32(full_mask);
+			u8 *entry = swiss_table_get_entry(t, slot);
+			if (key) *key = entry;
+			if (value) *value = entry + swiss_table_value_offset(t);
+			*iterator = slot+1;
+			return true;
+		}
+
+		slot = group_start + SWISS_TABLE_GROUP_SIZE;
+	}
+
+	*iterator = slot;
+	return false;
+}
@@ -197,6 +197,599 @@ void test_allocator(bool do_log_heap) {
     if (do_log_heap) log_heap();
 }
 
+typedef struct Heap_Trace_Op {
+	u32 slot;
+	u32 size; // 0 means free
+} Heap_Trace_Op;
+#define HEAP_TRACE_SLOT_COUNT 4096
+#define HEAP_TRACE_OP_COUNT 200000
+
+// Full best-fit search on the free list, i.e. how the heap worked before size classes
+void *legacy_heap_alloc(u64 size) {
+	size = align_next(size+sizeof(Heap_Allocation_Metadata), HEAP_ALIGNMENT);
+	spinlock_acquire_or_wait(&heap_lock);
+	Heap_Allocation_Metadata *meta = heap_general_alloc(size, 0);
+	spinlock_release(&heap_lock);
+	return meta+1;
+}
+void legacy_heap_dealloc(void *p) {
+	spinlock_acquire_or_wait(&heap_lock);
+	heap_general_dealloc((Heap_Allocation_Metadata*)p-1);
+	spinlock_release(&heap_lock);
+}
+
+u64 run_heap_trace(Heap_Trace_Op *ops, u64 op_count, void *(*alloc_proc)(u64), void (*dealloc_proc)(void*)) {
+	void **slots = (void**)alloc(get_heap_allocator(), HEAP_TRACE_SLOT_COUNT*sizeof(void*));
+
+	u64 start = rdtsc();
+	for (u64 i = 0; i < op_count; i++) {
+		Heap_Trace_Op op = ops[i];
+		if (op.size) {
+			u8 *p = (u8*)alloc_proc(op.size);
+			p[0] = (u8)op.slot;
+			p[op.size-1] = (u8)op.slot;
+			slots[op.slot] = p;
+		} else {
+			u8 *p = (u8*)slots[op.slot];
+			assert(p[0] == (u8)op.slot, "Heap trace memory was corrupted");
+			dealloc_proc(p);
+			slots[op.slot] = 0;
+		}
+	}
+	u64 cycles = rdtsc()-start;
+
+	dealloc(get_heap_allocator(), slots);
+	return cycles;
+}
+
+void test_heap_allocator_trace() {
+
+	// Generate a trace that looks somewhat like a game: mostly small stuff churning,
+	// some medium sized buffers and a few bigger ones.
+	u64 seed = seed_for_random;
+	seed_for_random = 1337;
+
+	Heap_Trace_Op *ops = (Heap_Trace_Op*)alloc(get_heap_allocator(), (HEAP_TRACE_OP_COUNT+HEAP_TRACE_SLOT_COUNT)*sizeof(Heap_Trace_Op));
+	u32 *sizes = (u32*)alloc(get_heap_allocator(), HEAP_TRACE_SLOT_COUNT*sizeof(u32));
+	u64 op_count = 0;
+	for (u64 i = 0; i < HEAP_TRACE_OP_COUNT; i++) {
+		u32 slot = (u32)get_random_int_in_range(0, HEAP_TRACE_SLOT_COUNT-1);
+		if (sizes[slot]) {
+			ops[op_count++] = (Heap_Trace_Op){slot, 0};
+			sizes[slot] = 0;
+		} else {
+			f32 r = get_random_float32();
+			u32 size;
+			if      (r < 0.80) size = (u32)get_random_int_in_range(1, 256);
+			else if (r < 0.98) size = (u32)get_random_int_in_range(257, KB(4));
+			else              size = (u32)get_random_int_in_range(KB(4)+1, KB(64));
+			ops[op_count++] = (Heap_Trace_Op){slot, size};
+			sizes[slot] = size;
+		}
+	}
+	// Free whatever is left so both runs start & end with the same heap (ops has room for one
+	// extra free per slot)
+	for (u32 slot = 0; slot < HEAP_TRACE_SLOT_COUNT; slot++) {
+		if (sizes[slot]) ops[op_count++] = (Heap_Trace_Op){slot, 0};
+	}
+	seed_for_random = seed;
+
+	u64 legacy_cycles = run_heap_trace(ops, op_count, legacy_heap_alloc, legacy_heap_dealloc);
+	u64 cycles = run_heap_trace(ops, op_count, heap_alloc, heap_dealloc);
+
+	print("\n\tBest-fit free list: %llu cycles/op\n", legacy_cycles/op_count);
+	print("\tSize classes:       %llu cycles/op\n", cycles/op_count);
+
+	dealloc(get_heap_allocator(), sizes);
+	dealloc(get_heap_allocator(), ops);
+}
+
+#define HEAP_CONTENTION_THREAD_COUNT 4
+#define HEAP_CONTENTION_OP_COUNT 100000
+#define HEAP_CONTENTION_LIVE_COUNT 64
+typedef struct Heap_Contention_Test_Data {
+	void *(*alloc_proc)(u64);
+	void (*dealloc_proc)(void*);
+	// Each thread hands pointers to the next one through these, so they get freed on
+	// another thread than they were allocated on.
+	volatile u64 mailboxes[HEAP_CONTENTION_THREAD_COUNT];
+} Heap_Contention_Test_Data;
+typedef struct Heap_Contention_Thread_Data {
+	Heap_Contention_Test_Data *shared;
+	u64 index;
+} Heap_Contention_Thread_Data;
+
+// Size classes behind heap_lock without the thread caches in front
+void *uncached_heap_alloc(u64 size) {
+	size = align_next(size+sizeof(Heap_Allocation_Metadata), HEAP_ALIGNMENT);
+	heap_lock_acquire();
+	Heap_Allocation_Metadata *meta = heap_size_class_alloc(size);
+	heap_lock_release();
+	return meta+1;
+}
+void uncached_heap_dealloc(void *p) {
+	heap_lock_acquire();
+	heap_size_class_dealloc((Heap_Allocation_Metadata*)p-1);
+	heap_lock_release();
+}
+
+void heap_contention_thread_proc(Thread *t) {
+	Heap_Contention_Thread_Data *thread_data = (Heap_Contention_Thread_Data*)t->data;
+	Heap_Contention_Test_Data *data = thread_data->shared;
+	u64 index = thread_data->index;
+	u64 next_index = (index+1)%HEAP_CONTENTION_THREAD_COUNT;
+
+	seed_for_random = index+1;
+
+	u8 *live[HEAP_CONTENTION_LIVE_COUNT] = {0};
+	for (u64 i = 0; i < HEAP_CONTENTION_OP_COUNT; i++) {
+		u64 size = (u64)get_random_int_in_range(1, 1024);
+		u8 *p = (u8*)data->alloc_proc(size);
+		memset(p, (u8)index, size);
+
+		u64 slot = i%HEAP_CONTENTION_LIVE_COUNT;
+		if (live[slot]) {
+			assert(live[slot][0] == (u8)index, "Heap memory was corrupted by another thread");
+			data->dealloc_proc(live[slot]);
+		}
+		live[slot] = p;
+
+		if (i % 8 == 0) {
+			u64 received = data->mailboxes[index];
+			if (received && compare_and_swap_64(&data->mailboxes[index], 0, received)) {
+				data->dealloc_proc((void*)received);
+			}
+
+			u8 *gift = (u8*)data->alloc_proc(size);
+			if (!compare_and_swap_64(&data->mailboxes[next_index], (u64)gift, 0)) {
+				data->dealloc_proc(gift);
+			}
+		}
+	}
+
+	for (u64 i = 0; i < HEAP_CONTENTION_LIVE_COUNT; i++) {
+		if (live[i]) data->dealloc_proc(live[i]);
+	}
+}
+
+Heap_Lock_Stats run_heap_contention_test(void *(*alloc_proc)(u64), void (*dealloc_proc)(void*)) {
+	Heap_Contention_Test_Data data = ZERO(Heap_Contention_Test_Data);
+	data.alloc_proc = alloc_proc;
+	data.dealloc_proc = dealloc_proc;
+
+	Thread threads[HEAP_CONTENTION_THREAD_COUNT];
+	Heap_Contention_Thread_Data thread_data[HEAP_CONTENTION_THREAD_COUNT];
+	for (u64 i = 0; i < HEAP_CONTENTION_THREAD_COUNT; i++) {
+		thread_data[i] = (Heap_Contention_Thread_Data){&data, i};
+		os_thread_init(&threads[i], heap_contention_thread_proc);
+		threads[i].data = &thread_data[i];
+	}
+
+	reset_heap_lock_stats();
+#if ENABLE_PROFILING
+	u64 spinlock_acquires = heap_lock.acquire_count;
+#endif
+	for (u64 i = 0; i < HEAP_CONTENTION_THREAD_COUNT; i++) {
+		os_thread_start(&threads[i]);
+	}
+	for (u64 i = 0; i < HEAP_CONTENTION_THREAD_COUNT; i++) {
+		os_thread_join(&threads[i]);
+	}
+	Heap_Lock_Stats stats = get_heap_lock_stats();
+#if ENABLE_PROFILING
+	// The spinlock stats that get logged should agree with the heap's own
+	spinlock_acquires = heap_lock.acquire_count - spinlock_acquires;
+	assert(spinlock_acquires == stats.acquisitions, "heap_lock spinlock stats counted %llu acquires but the heap counted %llu", spinlock_acquires, stats.acquisitions);
+#endif
+
+	for (u64 i = 0; i < HEAP_CONTENTION_THREAD_COUNT; i++) {
+		os_thread_destroy(&threads[i]);
+		if (data.mailboxes[i]) dealloc_proc((void*)data.mailboxes[i]);
+	}
+
+	return stats;
+}
+
+void test_heap_thread_caches() {
+	Heap_Lock_Stats uncached = run_heap_contention_test(uncached_heap_alloc, uncached_heap_dealloc);
+	Heap_Lock_Stats cached = run_heap_contention_test(heap_alloc, heap_dealloc);
+
+	print("\n\tShared size classes: %llu lock acquisitions, %llu contended, %llu wait cycles\n", uncached.acquisitions, uncached.contended_acquisitions, uncached.wait_cycles);
+	print("\tThread caches:       %llu lock acquisitions, %llu contended, %llu wait cycles\n", cached.acquisitions, cached.contended_acquisitions, cached.wait_cycles);
+
+	assert(cached.acquisitions < uncached.acquisitions, "Thread caches should take heap_lock less often");
+}
+
+void test_heap_large_allocations() {
+	Allocator heap = get_heap_allocator();
+
+	u64 sizes[] = { HEAP_LARGE_ALLOCATION_MIN, MB(3), MB(8), MB(2)+123 };
+	u8 *p[4];
+	for (u64 i = 0; i < 4; i++) {
+		p[i] = (u8*)alloc(heap, sizes[i]);
+		assert((u64)p[i] % HEAP_ALIGNMENT == 0, "Large allocation is not aligned");
+		memset(p[i], (u8)i, sizes[i]);
+	}
+	for (u64 i = 0; i < 4; i++) {
+		assert(p[i][0] == (u8)i && p[i][sizes[i]-1] == (u8)i, "Large allocation was overwritten");
+	}
+
+	// Freed ranges should be reused, and neighbours merged
+	Heap_Block *block1 = ((Heap_Allocation_Metadata*)p[1]-1)->block;
+	bool adjacent = (u8*)block1 + block1->size == (u8*)p[2]-sizeof(Heap_Allocation_Metadata)-sizeof(Heap_Block);
+	dealloc(heap, p[1]);
+	dealloc(heap, p[2]);
+	u8 *big = (u8*)alloc(heap, MB(10));
+	if (adjacent) assert(big == p[1], "Freed large allocations were not merged and reused");
+	memset(big, 0x42, MB(10));
+	assert(p[3][0] == 3 && p[3][sizes[3]-1] == 3, "Large allocation was overwritten");
+
+
+	// Realloc from the general heap into a large allocation should keep the data
+	u8 *grow = (u8*)alloc(heap, 1000);
+	memset(grow, 7, 1000);
+	grow = (u8*)heap_allocator_proc(MB(4), grow, ALLOCATOR_REALLOCATE, 0);
+	for (u64 i = 0; i < 1000; i++) assert(grow[i] == 7, "Data lost when reallocating into a large allocation");
+
+	dealloc(heap, grow);
+	dealloc(heap, big);
+	dealloc(heap, p[0]);
+	dealloc(heap, p[3]);
+}
+
+void *test_realloc(void *p, u64 size) {
+	return heap_allocator_proc(size, p, ALLOCATOR_REALLOCATE, 0);
+}
+void test_heap_realloc_in_place() {
+	// Size class slot, shrinking a little stays, growing moves
+	u8 *a = (u8*)test_realloc(0, 100);
+	memset(a, 1, 100);
+	u8 *b = (u8*)test_realloc(a, 90);
+	assert(b == a, "Small shrink should stay in place");
+	b = (u8*)test_realloc(b, 2000);
+	for (u64 i = 0; i < 90; i++) assert(b[i] == 1, "Data lost in realloc");
+	dealloc(get_heap_allocator(), b);
+
+	// General heap, shrinking frees the tail which we can then grow back into
+	u8 *c = (u8*)test_realloc(0, 16000);
+	memset(c, 2, 16000);
+	u8 *d = (u8*)test_realloc(c, 8000);
+	assert(d == c, "General shrink should stay in place");
+	d = (u8*)test_realloc(d, 16000);
+	assert(d == c, "General grow into the free tail should stay in place");
+	for (u64 i = 0; i < 8000; i++) assert(d[i] == 2, "Data lost in realloc");
+	memset(d, 3, 16000);
+	dealloc(get_heap_allocator(), d);
+	
+	// Growing into a free neighbour when blocks were freed out of address order, which used to
+	// leave the free list unsorted so the neighbour wasn't found
+	const u64 neighbour_size = KB(200);
+	const u64 stride = align_next(neighbour_size, HEAP_ALIGNMENT) + sizeof(Heap_Allocation_Metadata);
+	u8 *g[12];
+	for (u64 i = 0; i < 12; i++) g[i] = (u8*)test_realloc(0, neighbour_size);
+	// Earlier holes may take the first few, find 5 in a row
+	u8 **run = 0;
+	for (u64 i = 0; i+5 <= 12 && !run; i++) {
+		bool consecutive = true;
+		for (u64 j = i+1; j < i+5; j++) consecutive = consecutive && (u64)(g[j]-g[j-1]) == stride;
+		if (consecutive) run = &g[i];
+	}
+	assert(run, "Expected consecutive allocations to be next to each other");
+	dealloc(get_heap_allocator(), run[0]);
+	dealloc(get_heap_allocator(), run[2]);
+	dealloc(get_heap_allocator(), run[4]);
+	memset(run[1], 6, neighbour_size);
+	memset(run[3], 7, neighbour_size);
+	u8 *h = (u8*)test_realloc(run[3], neighbour_size*2);
+	assert(h == run[3], "Grow into a free neighbour should stay in place (freed last)");
+	h = (u8*)test_realloc(run[1], neighbour_size*2);
+	assert(h == run[1], "Grow into a free neighbour should stay in place (freed between others)");
+	for (u64 i = 0; i < neighbour_size; i++) assert(run[1][i] == 6 && run[3][i] == 7, "Data lost in realloc");
+	run[0] = run[2] = run[4] = 0;
+	for (u64 i = 0; i < 12; i++) if (g[i]) dealloc(get_heap_allocator(), g[i]);
+
+	// Large allocations, same thing but with pages
+	u8 *e = (u8*)test_realloc(0, MB(8));
+	memset(e, 4, MB(8));
+	u8 *f = (u8*)test_realloc(e, MB(2));
+	assert(f == e, "Large shrink should stay in place");
+	f = (u8*)test_realloc(f, MB(8));
+	assert(f == e, "Large grow into the released tail should stay in place");
+	for (u64 i = 0; i < MB(2); i++) assert(f[i] == 4, "Data lost in realloc");
+	memset(f, 5, MB(8));
+	dealloc(get_heap_allocator(), f);
+}
+
+// Compares every pair of free nodes in a block rather than list neighbours, so this doesn't
+// rely on the free list being sorted by address.
+u64 count_adjacent_heap_free_nodes() {
+	u64 count = 0;
+	heap_lock_acquire();
+	for (Heap_Block *block = heap_head; block; block = block->next) {
+		for (Heap_Free_Node *node = block->free_head; node; node = node->next) {
+			for (Heap_Free_Node *other = block->free_head; other; other = other->next) {
+				if ((u8*)node + node->size == (u8*)other) count += 1;
+			}
+		}
+	}
+	heap_lock_release();
+	return count;
+}
+void test_heap_maintenance() {
+	Allocator heap = get_heap_allocator();
+	
+	// Free every other allocation first so the rest are freed in between two free nodes, and
+	// dealloc has to merge with both of them.
+	const u64 count = 64;
+	const u64 size = KB(20);
+	u8 *p[64];
+	for (u64 i = 0; i < count; i++) p[i] = (u8*)alloc(heap, size);
+	for (u64 i = 1; i < count; i += 2) dealloc(heap, p[i]);
+	for (u64 i = 0; i < count; i += 2) dealloc(heap, p[i]);
+	
+	u64 adjacent = count_adjacent_heap_free_nodes();
+	assert(adjacent == 0, "Dealloc left %llu free nodes next to each other without merging them", adjacent);
+	
+	Heap_Fragmentation_Stats before, after;
+	heap_maintenance(&before, &after);
+	print("\n\t%llu adjacent free nodes\n", adjacent);
+	print("\tBefore: %llu free nodes, %llu largest, %.3f fragmentation, %llu decommitted\n", before.free_node_count, before.largest_free_node, before.fragmentation, before.decommitted_size);
+	print("\tAfter:  %llu free nodes, %llu largest, %.3f fragmentation, %llu decommitted\n", after.free_node_count, after.largest_free_node, after.fragmentation, after.decommitted_size);
+	
+	assert(after.free_size == before.free_size, "Heap maintenance changed the amount of free memory");
+	assert(after.free_node_count == before.free_node_count-adjacent, "Heap maintenance did not merge all adjacent free nodes");
+	assert(count_adjacent_heap_free_nodes() == 0, "Heap maintenance did not merge all adjacent free nodes");
+	assert(after.largest_free_node >= before.largest_free_node, "Heap maintenance shrunk a free node");
+	assert(after.fragmentation <= before.fragmentation, "Heap maintenance made fragmentation worse");
+	assert(after.decommitted_size > 0, "Heap maintenance did not decommit anything");
+	
+	// Decommitted pages must be usable again
+	for (u64 i = 0; i < count; i++) {
+		p[i] = (u8*)alloc(heap, size);
+		memset(p[i], (u8)i, size);
+	}
+	for (u64 i = 0; i < count; i++) {
+		assert(p[i][0] == (u8)i && p[i][size-1] == (u8)i, "Allocation in recommitted pages was overwritten");
+	}
+	// Only what was actually decommitted gets committed again, and is taken off the count
+	Heap_Fragmentation_Stats reused = get_heap_fragmentation_stats();
+	assert(reused.decommitted_size < after.decommitted_size, "Recommitted pages are still counted as decommitted");
+	u8 *grow = (u8*)test_realloc(p[count-1], size*8);
+	assert(grow[0] == (u8)(count-1), "Data lost when growing into recommitted pages");
+	memset(grow, 0x42, size*8);
+	p[count-1] = grow;
+	for (u64 i = 0; i < count; i++) dealloc(heap, p[i]);
+	
+	// An empty block that isn't the first one should be released
+	heap_lock_acquire();
+	Heap_Block *last = heap_head;
+	while (last->next) last = last->next;
+	make_heap_block(last, INITIAL_PROGRAM_MEMORY_SIZE);
+	heap_lock_release();
+	
+	heap_maintenance(&before, &after);
+	assert(after.block_count == before.block_count-1, "Heap maintenance did not release an empty block");
+	assert(after.released_size > before.released_size, "Released heap block did not end up in the large spans");
+}
+
+void test_allocation_trace() {
+	Allocator heap = get_heap_allocator();
+	
+	bool ok = allocation_trace_begin(STR("allocation_trace_test.bin"));
+	assert(ok, "Failed starting allocation trace");
+	
+	void *a = alloc(heap, 100);
+	void *b = alloc(heap, 20000);
+	b = test_realloc(b, 40000);
+	dealloc(heap, a);
+	
+	Scratch scratch = scratch_begin();
+	void *t = alloc(scratch.allocator, 64);
+	scratch_end(scratch);
+	
+	dealloc(heap, b);
+	
+	allocation_trace_end();
+	
+	// Not recorded anymore
+	dealloc(heap, alloc(heap, 100));
+	
+	string trace;
+	ok = os_read_entire_file("allocation_trace_test.bin", &trace, heap);
+	assert(ok, "Failed reading allocation trace");
+	os_file_delete("allocation_trace_test.bin");
+	
+	Allocation_Trace_Header *header = (Allocation_Trace_Header*)trace.data;
+	assert(trace.count >= sizeof(Allocation_Trace_Header), "Allocation trace is missing its header");
+	assert(header->magic == ALLOCATION_TRACE_MAGIC && header->version == ALLOCATION_TRACE_VERSION, "Bad allocation trace header");
+	assert(header->event_size == sizeof(Allocation_Trace_Event), "Bad allocation trace header");
+	
+	Allocation_Trace_Event *events = (Allocation_Trace_Event*)(header+1);
+	u64 event_count = (trace.count-sizeof(Allocation_Trace_Header))/sizeof(Allocation_Trace_Event);
+	
+	Allocation_Trace_Event_Kind expected[] = {
+		ALLOCATION_TRACE_ALLOCATE, ALLOCATION_TRACE_ALLOCATE, ALLOCATION_TRACE_REALLOCATE, ALLOCATION_TRACE_DEALLOCATE,
+		ALLOCATION_TRACE_TEMP_ALLOCATE, ALLOCATION_TRACE_TEMP_REWIND, ALLOCATION_TRACE_DEALLOCATE,
+	};
+	u64 expected_count = sizeof(expected)/sizeof(expected[0]);
+	
+	// Only look at this thread, in case something else is allocating
+	u64 found = 0;
+	u64 last_cycles = 0;
+	for (u64 i = 0; i < event_count; i++) {
+		Allocation_Trace_Event e = events[i];
+		if (e.thread_id != (u32)context.thread_id) continue;
+		assert(found < expected_count, "Allocation trace has more events than expected");
+		assert(e.kind == expected[found], "Allocation trace event %llu is kind %d, expected %d", found, e.kind, expected[found]);
+		assert(e.cycles >= last_cycles, "Allocation trace events are out of order");
+		last_cycles = e.cycles;
+		
+		switch (found) {
+			case 0: assert(e.pointer == (u64)a && e.size == 100, "Bad allocation trace event"); break;
+			case 2: assert(e.pointer == (u64)b && e.size == 40000, "Bad allocation trace event"); break;
+			case 3: assert(e.pointer == (u64)a, "Bad allocation trace event"); break;
+			case 4: assert(e.pointer == (u64)t && e.size == 64 && e.arena == 0, "Bad allocation trace event"); break;
+			case 5: assert(e.pointer == (u64)scratch.next, "Bad allocation trace event"); break;
+			case 6: assert(e.pointer == (u64)b, "Bad allocation trace event"); break;
+		}
+		found += 1;
+	}
+	assert(found == expected_count, "Allocation trace is missing events");
+	
+	dealloc_string(heap, trace);
+}
+
+void test_arenas() {
+	Arena fixed = make_arena(1000);
+	u8 *a = (u8*)arena_push(&fixed, 600);
+	u8 *b = (u8*)arena_push(&fixed, 400);
+	assert(b == a+600, "Arena push is not linear");
+	assert(arena_get_used(&fixed) == 1000, "Arena used is wrong");
+	arena_reset(&fixed);
+	assert(arena_push(&fixed, 10) == a, "Arena reset did not go back to start");
+	dealloc(get_heap_allocator(), fixed.start);
+
+	Arena arena = make_virtual_arena(MB(64));
+	assert(arena.size == 0, "Virtual arena should not commit anything up front");
+
+	u8 *first = (u8*)arena_push(&arena, 100);
+	memset(first, 1, 100);
+	assert(arena.size == ARENA_COMMIT_SIZE, "Virtual arena should commit in ARENA_COMMIT_SIZE chunks");
+
+	Arena_Mark mark = arena_mark(&arena);
+	for (u64 i = 0; i < 100; i++) {
+		u8 *p = (u8*)arena_push(&arena, KB(100));
+		memset(p, (u8)i, KB(100));
+	}
+	assert(arena.size >= 100*KB(100)+100, "Virtual arena did not commit enough");
+	assert(arena.high_water_mark == 100*KB(100)+100, "Wrong high water mark");
+
+	arena_rewind(&arena, mark);
+	assert(arena_get_used(&arena) == 100, "Arena rewind did not go back to mark");
+	assert(arena.high_water_mark == 100*KB(100)+100, "Rewinding should not lower the high water mark");
+	for (u64 i = 0; i < 100; i++) assert(first[i] == 1, "Arena memory before mark was overwritten");
+
+	// Nested marks
+	Arena_Mark outer = arena_mark(&arena);
+	arena_push(&arena, 64);
+	Arena_Mark inner = arena_mark(&arena);
+	arena_push(&arena, 64);
+	arena_rewind(&arena, inner);
+	assert(arena.next == inner.next, "Inner rewind failed");
+	arena_rewind(&arena, outer);
+	assert(arena.next == outer.next, "Outer rewind failed");
+
+	// Allocator interface over the same arena
+	Allocator allocator = make_arena_allocator_from_arena(&arena);
+	string s = string_copy(STR("Hello arena"), allocator);
+	assert(strings_match(s, STR("Hello arena")), "String in arena allocator is wrong");
+
+	destroy_virtual_arena(&arena);
+}
+
+// Allocates its result with the caller's allocator but does its own work in scratch memory
+string test_scratch_make_greeting(string name, Allocator allocator) {
+	Scratch scratch = scratch_begin_avoid(allocator);
+	assert(scratch.allocator.data != allocator.data || allocator.proc != temp_allocator_proc, "Scratch scope aliases the caller's allocator");
+
+	string temp = string_concat(STR("Hello, "), name, scratch.allocator);
+	string result = string_concat(temp, STR("!"), allocator);
+
+	scratch_end(scratch);
+	return result;
+}
+void test_scratch_scopes() {
+	reset_temporary_storage();
+
+	u8 *before = (u8*)talloc(16);
+	memset(before, 1, 16);
+
+	// Nested scopes rewind in order and don't touch what was there before
+	Scratch outer = scratch_begin();
+	u8 *a = (u8*)alloc(outer.allocator, 100);
+	Scratch inner = scratch_begin();
+	u8 *b = (u8*)alloc(inner.allocator, 100);
+	assert(b == a+100, "Nested scratch scope did not continue where the outer one was");
+	scratch_end(inner);
+	u8 *c = (u8*)alloc(outer.allocator, 100);
+	assert(c == b, "Ending the inner scope did not rewind");
+	scratch_end(outer);
+	assert(talloc(16) == a, "Ending the outer scope did not rewind");
+	for (u64 i = 0; i < 16; i++) assert(before[i] == 1, "Scratch scope overwrote memory from before the scope");
+
+	// Callee scratch must not alias the caller's temporary allocator
+	string greeting = test_scratch_make_greeting(STR("Charlie"), get_temporary_allocator());
+	u8 *after = (u8*)talloc(64);
+	memset(after, 0, 64);
+	assert(strings_match(greeting, STR("Hello, Charlie!")), "Scratch scope freed memory allocated with the caller's allocator");
+
+	// Overflowing spills to the heap instead of wrapping around and is freed again on scope end
+	Scratch big = scratch_begin();
+	u8 *first = (u8*)alloc(big.allocator, 16);
+	memset(first, 7, 16);
+	for (u64 i = 0; i < 4; i++) {
+		u8 *p = (u8*)alloc(big.allocator, TEMPORARY_STORAGE_SIZE/2+1);
+		memset(p, 9, TEMPORARY_STORAGE_SIZE/2+1);
+	}
+	for (u64 i = 0; i < 16; i++) assert(first[i] == 7, "Temporary storage wrapped around");
+	scratch_end(big);
+	assert(scratch_arenas[0].current == scratch_arenas[0].first, "Overflow chunks were not released");
+
+	reset_temporary_storage();
+}
+
+typedef struct Pool_Test_Thing {
+	u64 id;
+	Vector3 pos;
+} Pool_Test_Thing;
+void test_pool_allocator() {
+	Pool pool;
+	pool_init_typed(&pool, Pool_Test_Thing, 8, get_heap_allocator());
+
+	Pool_Test_Thing *things[20];
+	for (u64 i = 0; i < 20; i++) {
+		things[i] = (Pool_Test_Thing*)pool_acquire(&pool);
+		assert(things[i]->id == 0, "Pool memory was not zeroed");
+		things[i]->id = i;
+	}
+	assert(pool.count == 20 && pool.capacity == 24, "Pool did not grow in chunks");
+	assert(things[1] == (Pool_Test_Thing*)((u8*)things[0]+pool.slot_size), "Pool slots are not dense");
+
+	// Handles go stale once released, even if the slot gets reused
+	Pool_Handle handle = pool_get_handle(&pool, things[5]);
+	assert(pool_get(&pool, handle) == things[5], "Pool handle lookup failed");
+	pool_release(&pool, things[5]);
+	assert(pool_get(&pool, handle) == 0, "Stale pool handle still resolved");
+	Pool_Test_Thing *reused = (Pool_Test_Thing*)pool_acquire(&pool);
+	assert(reused == things[5], "Released slot was not reused first");
+	assert(pool_get(&pool, handle) == 0, "Stale pool handle resolved to the new object");
+	assert(pool_get(&pool, ZERO(Pool_Handle)) == 0, "Zero handle should never resolve");
+	reused->id = 5;
+
+	// Iteration is in memory order and skips released slots
+	pool_release(&pool, things[3]);
+	pool_release(&pool, things[17]);
+	Pool_Iterator it = ZERO(Pool_Iterator);
+	Pool_Test_Thing *thing;
+	u64 n = 0;
+	u64 last_id = 0;
+	while ((thing = (Pool_Test_Thing*)pool_next(&pool, &it))) {
+		assert(thing->id != 3 && thing->id != 17, "Iterated a released object");
+		assert(n == 0 || thing->id > last_id, "Pool iteration is not in memory order");
+		last_id = thing->id;
+		n += 1;
+	}
+	assert(n == 18, "Pool iteration missed objects");
+
+	// Allocator interface
+	Allocator allocator = make_pool_allocator(&pool);
+	Pool_Test_Thing *a = (Pool_Test_Thing*)alloc(allocator, sizeof(Pool_Test_Thing));
+	assert(a == things[17] || a == things[3], "Pool allocator did not reuse a released slot");
+	dealloc(allocator, a);
+
+	pool_destroy(&pool);
+}
+
 void test_thread_proc1(Thread* t) {
 	os_sleep(5);
 	print("Hello from thread %llu\n", t->id);
@@ -395,7 +988,7 @@ void test_strings() {
     assert(memcmp(builder.buffer, expected_result, builder.count) == 0, "Failed: string_builder_printf");
     
     // Test string_builder_get_string
-    string result_str = string_builder_get_string(builder);
+    string result_str = string_builder_get_string(&builder);
     assert(result_str.count == builder.count, "Failed: string_builder_get_string");
     assert(memcmp(result_str.data, builder.buffer, result_str.count) == 0, "Failed: string_builder_get_string");
     
@@ -405,7 +998,7 @@ void test_strings() {
     // Test handling of empty builder
     String_Builder empty_builder;
     string_builder_init(&empty_builder, heap);
-    result_str = string_builder_get_string(empty_builder);
+    result_str = string_builder_get_string(&empty_builder);
     assert(result_str.count == 0, "Failed: empty builder handling");
     dealloc(heap, empty_builder.buffer);
     
@@ -450,6 +1043,587 @@ void test_strings() {
     assert(strings_match(hello_balls, STR("Greetings, Balls!")), "Failed: string_replace");
 }
 
+void string_builder_test_flush_proc(string s, void *data) {
+	String_Builder *collected = (String_Builder*)data;
+	string_builder_append(collected, s);
+}
+
+void test_string_builder_chunks() {
+	Allocator heap = get_heap_allocator();
+	
+	// Appending past the first buffer goes into chunks and never moves what's already there
+	String_Builder b;
+	string_builder_init(&b, heap);
+	u8 *first_buffer = 0;
+	
+	u8 *reference = alloc(heap, 1024*1024);
+	u64 reference_count = 0;
+	u64 seed = 7;
+	while (reference_count < 900*1024) {
+		u64 n = xx_hash(seed++) % 3000;
+		u8 piece[3000];
+		for (u64 i = 0; i < n; i++) piece[i] = (u8)('a' + (reference_count+i) % 26);
+		string_builder_append(&b, (string){ n, piece });
+		memcpy(reference+reference_count, piece, n);
+		reference_count += n;
+		// An empty builder may swap to a bigger buffer, after that it stays put
+		if (!first_buffer && b.count) first_buffer = b.buffer;
+		
+		if ((seed % 7) == 0) {
+			string_builder_print(&b, "[%d]", (int)seed);
+			string printed = tprint("[%d]", (int)seed);
+			memcpy(reference+reference_count, printed.data, printed.count);
+			reference_count += printed.count;
+		}
+	}
+	assert(b.buffer == first_buffer, "Failed: String_Builder moved its first buffer");
+	assert(b.count == reference_count, "Failed: String_Builder count");
+	assert(b.first_chunk != 0, "Failed: String_Builder should have chunks by now");
+	
+	string result = string_builder_get_string(&b);
+	assert(result.count == reference_count && memcmp(result.data, reference, reference_count) == 0, "Failed: string_builder_get_string");
+	assert(b.first_chunk == 0, "Failed: string_builder_get_string should have merged the chunks");
+	
+	// Appending after getting the string keeps working
+	string_builder_append(&b, STR("tail"));
+	result = string_builder_get_string(&b);
+	assert(result.count == reference_count+4 && memcmp(result.data+reference_count, "tail", 4) == 0, "Failed: append after string_builder_get_string");
+	string_builder_deinit(&b);
+	
+	// Streaming: everything goes out through the flush proc and the builder stays small
+	String_Builder collected;
+	string_builder_init_reserve(&collected, 1024*1024, heap);
+	
+	string_builder_init(&b, heap);
+	b.flush_proc = string_builder_test_flush_proc;
+	b.flush_data = &collected;
+	b.flush_threshold = 4096;
+	for (u64 offset = 0; offset < reference_count; ) {
+		u64 n = xx_hash(seed++) % 1000;
+		n = min(n, reference_count-offset);
+		string_builder_append(&b, (string){ n, reference+offset });
+		offset += n;
+		assert(b.count < 4096, "Failed: String_Builder did not flush");
+	}
+	string_builder_flush(&b);
+	assert(b.count == 0, "Failed: string_builder_flush");
+	result = string_builder_get_string(&collected);
+	assert(result.count == reference_count && memcmp(result.data, reference, reference_count) == 0, "Failed: flushed data");
+	
+	string_builder_deinit(&b);
+	string_builder_deinit(&collected);
+	dealloc(heap, reference);
+}
+
+s64 naive_find_from_left(string s, string sub) {
+	for (s64 i = 0; i + (s64)sub.count <= (s64)s.count; i++) {
+		if (memcmp(s.data+i, sub.data, sub.count) == 0) return i;
+	}
+	return -1;
+}
+s64 naive_find_from_right(string s, string sub) {
+	for (s64 i = (s64)s.count - (s64)sub.count; i >= 0; i--) {
+		if (memcmp(s.data+i, sub.data, sub.count) == 0) return i;
+	}
+	return -1;
+}
+
+void test_string_search() {
+	Cpu_Capabilities cpu = query_cpu_capabilities();
+	String_Simd_Level levels[] = { STRING_SIMD_NONE, STRING_SIMD_SSE2, STRING_SIMD_AVX2 };
+	const char *level_names[] = { "scalar", "sse2  ", "avx2  " };
+	bool level_supported[] = { true, ENABLE_SIMD && COMPILER_CAN_TARGET_SSE2 && cpu.sse2, ENABLE_SIMD && COMPILER_CAN_TARGET_AVX2 && cpu.avx2 };
+	String_Simd_Level original_level = get_string_simd_level();
+	
+	// Small alphabet so there are lots of partial matches
+	u8 buffer[200];
+	u8 needle[48];
+	u64 seed = 1;
+	
+	for (u64 l = 0; l < 3; l++) {
+		if (!level_supported[l]) continue;
+		string_simd_level = levels[l];
+		
+		for (u64 iteration = 0; iteration < 20000; iteration++) {
+			u64 count = xx_hash(seed++) % sizeof(buffer);
+			u64 sub_count = xx_hash(seed++) % 40;
+			for (u64 i = 0; i < count; i++) buffer[i] = 'a' + xx_hash(seed++) % 3;
+			for (u64 i = 0; i < sub_count; i++) needle[i] = 'a' + xx_hash(seed++) % 3;
+			string s = { count, buffer };
+			string sub = { sub_count, needle };
+			
+			if (sub.count > 0) {
+				assert(string_find_from_left(s, sub) == naive_find_from_left(s, sub), "Failed: %cs string_find_from_left", level_names[l]);
+				assert(string_find_from_right(s, sub) == naive_find_from_right(s, sub), "Failed: %cs string_find_from_right", level_names[l]);
+				
+				string one = { 1, needle };
+				assert(string_find_byte_from_left(s, needle[0]) == naive_find_from_left(s, one), "Failed: %cs string_find_byte_from_left", level_names[l]);
+				assert(string_find_byte_from_right(s, needle[0]) == naive_find_from_right(s, one), "Failed: %cs string_find_byte_from_right", level_names[l]);
+			}
+			
+			// Compare with a copy that differs in at most one place
+			u8 copy[200];
+			memcpy(copy, buffer, count);
+			if (count && (iteration & 1)) copy[xx_hash(seed++) % count] ^= 1;
+			string c = { count, copy };
+			assert(strings_match(s, c) == (memcmp(buffer, copy, count) == 0), "Failed: %cs strings_match", level_names[l]);
+		}
+		
+		assert(string_find_from_left(STR("abc"), STR("")) == 0, "Failed: empty sub");
+		assert(string_find_from_right(STR("abc"), STR("")) == 3, "Failed: empty sub");
+		assert(string_find_from_left(STR("ab"), STR("abc")) == -1, "Failed: sub longer than s");
+		
+		string replaced = string_replace_all(STR("a--b--c--"), STR("--"), STR("+"), get_temporary_allocator());
+		assert(strings_match(replaced, STR("a+b+c+")), "Failed: %cs string_replace_all", level_names[l]);
+		replaced = string_replace_all(STR("no match here"), STR("xyz"), STR("+"), get_temporary_allocator());
+		assert(strings_match(replaced, STR("no match here")), "Failed: %cs string_replace_all", level_names[l]);
+	}
+	
+	// Searching a big log-like buffer for something at the very end
+	u64 big_count = 8*1024*1024;
+	string big = alloc_string(get_heap_allocator(), big_count);
+	for (u64 i = 0; i < big_count; i++) big.data[i] = "[INFO]: frame took 16ms\n"[i % 24];
+	string tail = STR("[ERROR]: out of memory");
+	memcpy(big.data + big_count - tail.count, tail.data, tail.count);
+	string big_copy = string_copy(big, get_heap_allocator());
+	
+	print("\n");
+	for (u64 l = 0; l < 3; l++) {
+		if (!level_supported[l]) continue;
+		string_simd_level = levels[l];
+		
+		u64 start = rdtsc();
+		s64 index = string_find_from_left(big, tail);
+		u64 find_cycles = rdtsc()-start;
+		assert(index == (s64)(big_count - tail.count), "Failed: %cs big search", level_names[l]);
+		
+		start = rdtsc();
+		index = string_find_byte_from_left(big, '!');
+		u64 byte_cycles = rdtsc()-start;
+		assert(index == -1, "Failed: %cs big byte search", level_names[l]);
+		
+		start = rdtsc();
+		bool match = strings_match(big, big_copy);
+		u64 match_cycles = rdtsc()-start;
+		assert(match, "Failed: %cs big strings_match", level_names[l]);
+		
+		print("\t%cs find %.3f, find byte %.3f, match %.3f cycles/byte\n", level_names[l], (f64)find_cycles/big_count, (f64)byte_cycles/big_count, (f64)match_cycles/big_count);
+	}
+	
+	dealloc_string(get_heap_allocator(), big);
+	dealloc_string(get_heap_allocator(), big_copy);
+	string_simd_level = original_level;
+}
+
+u64 utf8_test_encode(u32 c, u8 *out) {
+	if (c < 0x80)    { out[0] = (u8)c; return 1; }
+	if (c < 0x800)   { out[0] = 0xC0 | (c >> 6);  out[1] = 0x80 | (c & 0x3F); return 2; }
+	if (c < 0x10000) { out[0] = 0xE0 | (c >> 12); out[1] = 0x80 | ((c >> 6) & 0x3F);  out[2] = 0x80 | (c & 0x3F); return 3; }
+	out[0] = 0xF0 | (c >> 18); out[1] = 0x80 | ((c >> 12) & 0x3F); out[2] = 0x80 | ((c >> 6) & 0x3F); out[3] = 0x80 | (c & 0x3F);
+	return 4;
+}
+// Mostly ASCII runs with some codepoints from every encoded length, like a chat log
+u64 utf8_test_random_text(u8 *out, u64 max_count, u64 *seed) {
+	u64 n = 0;
+	while (n + 4 <= max_count) {
+		u64 r = xx_hash((*seed)++);
+		u32 c;
+		switch (r % 8) {
+			case 0:  c = 0x80 + (u32)((r >> 8) % (0x800-0x80)); break;
+			case 1:  c = 0x800 + (u32)((r >> 8) % (0xD800-0x800)); break;
+			case 2:  c = 0x10000 + (u32)((r >> 8) % (0x110000-0x10000)); break;
+			default: {
+				u64 run = (r >> 8) % 40;
+				for (u64 i = 0; i < run && n < max_count; i++) out[n++] = ' ' + (u8)(xx_hash((*seed)++) % 95);
+				continue;
+			}
+		}
+		n += utf8_test_encode(c, out+n);
+	}
+	return n;
+}
+
+void test_utf8_bulk() {
+	Cpu_Capabilities cpu = query_cpu_capabilities();
+	String_Simd_Level levels[] = { STRING_SIMD_NONE, STRING_SIMD_SSE2, STRING_SIMD_AVX2 };
+	const char *level_names[] = { "scalar", "sse2  ", "avx2  " };
+	bool level_supported[] = { true, ENABLE_SIMD && COMPILER_CAN_TARGET_SSE2 && cpu.sse2, ENABLE_SIMD && COMPILER_CAN_TARGET_AVX2 && cpu.avx2 };
+	String_Simd_Level original_level = get_string_simd_level();
+	
+	u8 text[300];
+	u32 expected[300];
+	u32 decoded[300];
+	u64 seed = 1;
+	
+	for (u64 l = 0; l < 3; l++) {
+		if (!level_supported[l]) continue;
+		string_simd_level = levels[l];
+		
+		// Decoding matches utf8_to_utf32() one at a time, also for broken text
+		for (u64 iteration = 0; iteration < 20000; iteration++) {
+			u64 count = utf8_test_random_text(text, xx_hash(seed++) % sizeof(text), &seed);
+			if (count && (iteration % 4) == 1) text[xx_hash(seed++) % count] = (u8)xx_hash(seed++);
+			if (count && (iteration % 4) == 2) count -= 1 + xx_hash(seed++) % min(count, 3);
+			
+			u64 expected_count = 0;
+			string rest = { count, text };
+			while (rest.count > 0) {
+				Utf8_To_Utf32_Result r = utf8_to_utf32(rest.data, (s64)rest.count, false);
+				if (r.error) break;
+				expected[expected_count++] = r.utf32;
+				rest.data  += r.continuation_bytes;
+				rest.count -= r.continuation_bytes;
+			}
+			
+			string s = { count, text };
+			u64 decoded_count = 0;
+			while (true) {
+				u64 batch = 1 + xx_hash(seed++) % 64;
+				u64 n = utf8_to_utf32_many(&s, decoded+decoded_count, batch);
+				decoded_count += n;
+				if (n < batch) break;
+			}
+			assert(decoded_count == expected_count, "Failed: %cs utf8_to_utf32_many count %i, expected %i", level_names[l], decoded_count, expected_count);
+			assert(memcmp(decoded, expected, decoded_count*sizeof(u32)) == 0, "Failed: %cs utf8_to_utf32_many", level_names[l]);
+			assert(s.data == rest.data, "Failed: %cs utf8_to_utf32_many stopped at the wrong byte", level_names[l]);
+			
+			u64 index = expected_count ? xx_hash(seed++) % (expected_count+1) : 0;
+			string walk = { count, text };
+			for (u64 i = 0; i < index && walk.count > 0; i++) {
+				string last = walk;
+				if (!next_utf8(&walk)) { walk = last; break; }
+			}
+			assert(utf8_index_to_byte_index((string){count, text}, index) == (u64)(walk.data-text), "Failed: %cs utf8_index_to_byte_index", level_names[l]);
+			
+			// Validation matches the scalar reference, with sequences at every offset within a block
+			assert(utf8_is_valid((string){count, text}) == utf8_is_valid_scalar(text, count), "Failed: %cs utf8_is_valid", level_names[l]);
+			u64 offset = xx_hash(seed++) % 64;
+			u8 shifted[400];
+			memset(shifted, 'x', offset);
+			memcpy(shifted+offset, text, count);
+			assert(utf8_is_valid((string){count+offset, shifted}) == utf8_is_valid_scalar(shifted, count+offset), "Failed: %cs utf8_is_valid at offset %i", level_names[l], offset);
+		}
+		
+		// Every two byte pair at every position in a 64 byte block
+		u8 block[64];
+		for (u32 pair = 0; pair < 0x10000; pair++) {
+			u64 at = pair % 63;
+			memset(block, 'x', sizeof(block));
+			block[at] = (u8)(pair >> 8);
+			block[at+1] = (u8)pair;
+			assert(utf8_is_valid((string){sizeof(block), block}) == utf8_is_valid_scalar(block, sizeof(block)), "Failed: %cs utf8_is_valid pair %x", level_names[l], pair);
+		}
+		
+		assert( utf8_is_valid(STR("\xEF\xBF\xBF")), "Failed: %cs U+FFFF", level_names[l]);
+		assert( utf8_is_valid(STR("\xF4\x8F\xBF\xBF")), "Failed: %cs U+10FFFF", level_names[l]);
+		assert(!utf8_is_valid(STR("\xC0\x80")), "Failed: %cs overlong 2", level_names[l]);
+		assert(!utf8_is_valid(STR("\xE0\x9F\xBF")), "Failed: %cs overlong 3", level_names[l]);
+		assert(!utf8_is_valid(STR("\xF0\x8F\xBF\xBF")), "Failed: %cs overlong 4", level_names[l]);
+		assert(!utf8_is_valid(STR("\xED\xA0\x80")), "Failed: %cs surrogate", level_names[l]);
+		assert(!utf8_is_valid(STR("\xF4\x90\x80\x80")), "Failed: %cs too large", level_names[l]);
+		assert(!utf8_is_valid(STR("abc\xE2\x82")), "Failed: %cs cut off", level_names[l]);
+	}
+	
+	string str = STR("h\xC3\xA9llo w\xC3\xB6rld");
+	assert(strings_match(utf8_slice(str, 1, 4), STR("\xC3\xA9llo")), "Failed: utf8_slice");
+	u64 cursor_utf8_index = 0;
+	u64 cursor_byte_index = 0;
+	assert(utf8_cursor_to_byte_index(str, &cursor_utf8_index, &cursor_byte_index, 2) == 3, "Failed: utf8_cursor_to_byte_index");
+	assert(utf8_cursor_to_byte_index(str, &cursor_utf8_index, &cursor_byte_index, 8) == 10, "Failed: utf8_cursor_to_byte_index");
+	assert(utf8_cursor_to_byte_index(str, &cursor_utf8_index, &cursor_byte_index, 1) == 1, "Failed: utf8_cursor_to_byte_index going back");
+	
+	// A big chat log, one next_utf8() at a time against the bulk decoder
+	u64 big_count = 8*1024*1024;
+	u8 *big = alloc(get_heap_allocator(), big_count);
+	big_count = utf8_test_random_text(big, big_count, &seed);
+	u32 *big_decoded = alloc(get_heap_allocator(), big_count*sizeof(u32));
+	
+	u64 start = rdtsc();
+	string s = { big_count, big };
+	u64 next_count = 0;
+	while (s.count > 0) {
+		big_decoded[next_count++] = next_utf8(&s);
+	}
+	u64 next_cycles = rdtsc()-start;
+	
+	print("\n\tnext_utf8     %.3f cycles/byte\n", (f64)next_cycles/big_count);
+	for (u64 l = 0; l < 3; l++) {
+		if (!level_supported[l]) continue;
+		string_simd_level = levels[l];
+		
+		start = rdtsc();
+		s = (string){ big_count, big };
+		u64 n = utf8_to_utf32_many(&s, big_decoded, big_count);
+		u64 decode_cycles = rdtsc()-start;
+		assert(n == next_count && s.count == 0, "Failed: %cs big decode", level_names[l]);
+		
+		start = rdtsc();
+		bool valid = utf8_is_valid((string){ big_count, big });
+		u64 validate_cycles = rdtsc()-start;
+		assert(valid, "Failed: %cs big validate", level_names[l]);
+		
+		print("\t%cs decode %.3f, validate %.3f cycles/byte\n", level_names[l], (f64)decode_cycles/big_count, (f64)validate_cycles/big_count);
+	}
+	
+	dealloc(get_heap_allocator(), big);
+	dealloc(get_heap_allocator(), big_decoded);
+	string_simd_level = original_level;
+}
+
+u64 crt_format_to_buffer(char *buffer, u64 count, const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(buffer, count, fmt, args);
+	va_end(args);
+	return (u64)n;
+}
+// Significant digits only, so shortest output can be compared to exact output regardless of notation
+string format_test_significant_digits(string s) {
+	u64 first = 0;
+	while (first < s.count && (s.data[first] < '1' || s.data[first] > '9')) {
+		if (s.data[first] == 'e') break;
+		first += 1;
+	}
+	u8 *digits = alloc(get_temporary_allocator(), s.count);
+	u64 n = 0;
+	for (u64 i = first; i < s.count && s.data[i] != 'e'; i++) {
+		if (s.data[i] >= '0' && s.data[i] <= '9') digits[n++] = s.data[i];
+	}
+	while (n > 0 && digits[n-1] == '0') n -= 1;
+	return (string){ n, digits };
+}
+
+#define FORMAT_CHECK(expected, ...) { \
+	string _s = tprint(__VA_ARGS__); \
+	assert(strings_match(_s, STR(expected)), "Failed: %cs gave '%s', expected '%cs'", #__VA_ARGS__, _s, expected); \
+}
+
+void test_string_format() {
+	// Integers
+	FORMAT_CHECK("0 -1 -2147483648", "%d %i %d", 0, -1, (s32)0x80000000);
+	FORMAT_CHECK("-9223372036854775808 18446744073709551615", "%lld %llu", (s64)0x8000000000000000ULL, 0xFFFFFFFFFFFFFFFFULL);
+	FORMAT_CHECK("   42|42   |00042|-0042", "%5d|%-5d|%05d|%05d", 42, 42, 42, -42);
+	FORMAT_CHECK("+5  5", "%+d % d", 5, 5);
+	FORMAT_CHECK("007||  007", "%.3d|%.0d|%5.3d", 7, 0, 7);
+	FORMAT_CHECK("ff FF 0xff 10 010 0", "%x %X %#x %o %#o %#x", 255, 255, 255, 8, 8, 0);
+	FORMAT_CHECK("0x00000000deadbeef", "0x%016I64x", 0xDEADBEEFULL);
+	FORMAT_CHECK("44 1 123", "%hhd %hu %zu", 300, 65537, (u64)123);
+	FORMAT_CHECK("   42|42   |", "%*d|%-*d|", 5, 42, -5, 42);
+	FORMAT_CHECK("0000000000001234", "%p", (void*)0x1234);
+	
+	// Floats with precision, rounded exactly
+	FORMAT_CHECK("0.000000 -0.000000 3.14 2.67", "%f %f %.2f %.2f", 0.0, -0.0, 3.14, 2.675);
+	FORMAT_CHECK("0 2 2 0.1 1.0 1000.00", "%.0f %.0f %.0f %.1f %.1f %.2f", 0.5, 1.5, 2.5, 0.05, 0.96, 999.999);
+	FORMAT_CHECK("0.000 -003.142 3.14", "%.3f %08.3f %.*f", 1e-10, -3.14159, 2, 3.14159);
+	FORMAT_CHECK("100000000000000000000.000000", "%f", 1e20);
+	FORMAT_CHECK("1.234568e+04 1.23E-04 0.000000e+00 1e+308", "%e %.2E %e %.0e", 12345.678, 0.000123, 0.0, 1e308);
+	FORMAT_CHECK("0.10000000000000001 1.23457e+06 0.000123 1.00 100", "%.17g %.6g %.3g %#.3g %.6g", 0.1, 1234567.0, 0.0001234, 1.0, 100.0);
+	u64 nan_bits = 0x7FF8000000000000ULL;
+	f64 nan;
+	memcpy(&nan, &nan_bits, sizeof(nan));
+	FORMAT_CHECK("inf -INF nan NAN   inf", "%f %F %g %G %5e", 1.0/0.0, -1.0/0.0, nan, nan, 1.0/0.0);
+	FORMAT_CHECK("0x1p+0 0x1.8p+1 -0x1.91eb851eb851fp+1", "%a %a %a", 1.0, 3.0, -3.14);
+	
+	// Shortest round trip
+	FORMAT_CHECK("0.1 0.3333333333333333 100 123456789 0", "%g %g %g %g %g", 0.1, 1.0/3.0, 100.0, 123456789.0, 0.0);
+	FORMAT_CHECK("1e+21 1.5e-08 5e-324 1.7976931348623157e+308", "%g %g %g %g", 1e21, 1.5e-8, 5e-324, 1.7976931348623157e308);
+	FORMAT_CHECK("0.10000000149011612", "%g", (f64)0.1f);
+	
+	// Engine specifiers and everything else
+	FORMAT_CHECK("x|  x|%|Hi|ab    |abc", "%c|%3c|%%|%s|%-6s|%.3s", 'x', 'x', STR("Hi"), STR("ab"), STR("abcdef"));
+	FORMAT_CHECK("true false", "%b %b", true, false);
+	
+	// Truncation
+	char small[5];
+	u64 n = format_string_to_buffer_va(small, sizeof(small), "%d", 123456);
+	assert(n == 4 && memcmp(small, "1234", 5) == 0, "Failed: truncated format");
+	n = format_string_to_buffer_va(small, sizeof(small), "%.3f", 3.14159);
+	assert(n == 4 && memcmp(small, "3.14", 5) == 0, "Failed: truncated format");
+	
+	// Known correct output, the crt can't be the reference for these since msvcrt prints 3 digit
+	// exponents, rounds ties away from zero and isn't exact past 17 significant digits.
+	{
+		const char *fmts[] = { "%.17g", "%.3f", "%e", "%.0e", "%.5g", "%.3g", "%.0f" };
+		typedef struct { u64 bits; const char *expected[7]; } Format_Case;
+		Format_Case cases[] = {
+		{ 0x400269E0F2A74DE4ULL, { "2.3016985852534493", "2.302", "2.301699e+00", "2e+00", "2.3017", "2.3", "2" } },
+		{ 0xC2A128B20C5C7FD0ULL, { "-9433241759295.9062", "-9433241759295.906", "-9.433242e+12", "-9e+12", "-9.4332e+12", "-9.43e+12", "-9433241759296" } },
+		{ 0xC1B5D9DC1818E811ULL, { "-366599192.09729105", "-366599192.097", "-3.665992e+08", "-4e+08", "-3.666e+08", "-3.67e+08", "-366599192" } },
+		{ 0x3DE81E74E8E25D94ULL, { "1.7548861360783974e-10", "0.000", "1.754886e-10", "2e-10", "1.7549e-10", "1.75e-10", "0" } },
+		{ 0x3DB6F0361600A35AULL, { "2.0862285315215674e-11", "0.000", "2.086229e-11", "2e-11", "2.0862e-11", "2.09e-11", "0" } },
+		{ 0xBDF1738F3D9C1724ULL, { "-2.5395135786765452e-10", "-0.000", "-2.539514e-10", "-3e-10", "-2.5395e-10", "-2.54e-10", "-0" } },
+		{ 0xC0DD3AC90F21DDB6ULL, { "-29931.141548601641", "-29931.142", "-2.993114e+04", "-3e+04", "-29931", "-2.99e+04", "-29931" } },
+		{ 0xBE639263F28C105DULL, { "-3.6455388324432812e-08", "-0.000", "-3.645539e-08", "-4e-08", "-3.6455e-08", "-3.65e-08", "-0" } },
+		{ 0x427F29D0953F48F1ULL, { "2141528347636.5588", "2141528347636.559", "2.141528e+12", "2e+12", "2.1415e+12", "2.14e+12", "2141528347637" } },
+		{ 0x420658CD95E60AF5ULL, { "11997393596.75535", "11997393596.755", "1.199739e+10", "1e+10", "1.1997e+10", "1.2e+10", "11997393597" } },
+		{ 0xBF38E8190BECD7B0ULL, { "-0.00038004504669985738", "-0.000", "-3.800450e-04", "-4e-04", "-0.00038005", "-0.00038", "-0" } },
+		{ 0x3E86B4CB4A23D596ULL, { "1.6917457396735794e-07", "0.000", "1.691746e-07", "2e-07", "1.6917e-07", "1.69e-07", "0" } },
+		{ 0x41C922761E27A1C0ULL, { "843377724.30962372", "843377724.310", "8.433777e+08", "8e+08", "8.4338e+08", "8.43e+08", "843377724" } },
+		{ 0x41EAE97BD0EDA82FULL, { "3612073607.4267802", "3612073607.427", "3.612074e+09", "4e+09", "3.6121e+09", "3.61e+09", "3612073607" } },
+		{ 0xBE4923A794E3BF91ULL, { "-1.1706387550704018e-08", "-0.000", "-1.170639e-08", "-1e-08", "-1.1706e-08", "-1.17e-08", "-0" } },
+		{ 0xBEF18F135F557203ULL, { "-1.6745461797073115e-05", "-0.000", "-1.674546e-05", "-2e-05", "-1.6745e-05", "-1.67e-05", "-0" } },
+		{ 0x3FE0000000000000ULL, { "0.5", "0.500", "5.000000e-01", "5e-01", "0.5", "0.5", "0" } },
+		{ 0x3FF8000000000000ULL, { "1.5", "1.500", "1.500000e+00", "2e+00", "1.5", "1.5", "2" } },
+		{ 0x4004000000000000ULL, { "2.5", "2.500", "2.500000e+00", "2e+00", "2.5", "2.5", "2" } },
+		{ 0xC004000000000000ULL, { "-2.5", "-2.500", "-2.500000e+00", "-2e+00", "-2.5", "-2.5", "-2" } },
+		{ 0x3FC0000000000000ULL, { "0.125", "0.125", "1.250000e-01", "1e-01", "0.125", "0.125", "0" } },
+		{ 0x3FF2000000000000ULL, { "1.125", "1.125", "1.125000e+00", "1e+00", "1.125", "1.12", "1" } },
+		{ 0x3FF1000000000000ULL, { "1.0625", "1.062", "1.062500e+00", "1e+00", "1.0625", "1.06", "1" } },
+		{ 0x408F3C0000000000ULL, { "999.5", "999.500", "9.995000e+02", "1e+03", "999.5", "1e+03", "1000" } },
+		{ 0x3F40624DE0000000ULL, { "0.00050000002374872565", "0.001", "5.000000e-04", "5e-04", "0.0005", "0.0005", "0" } },
+		{ 0x407ED676C0000000ULL, { "493.40399169921875", "493.404", "4.934040e+02", "5e+02", "493.4", "493", "493" } },
+		{ 0xC08B229380000000ULL, { "-868.322021484375", "-868.322", "-8.683220e+02", "-9e+02", "-868.32", "-868", "-868" } },
+		{ 0x4066F21CA0000000ULL, { "183.56599426269531", "183.566", "1.835660e+02", "2e+02", "183.57", "184", "184" } },
+		{ 0xC08B581060000000ULL, { "-875.00799560546875", "-875.008", "-8.750080e+02", "-9e+02", "-875.01", "-875", "-875" } },
+		{ 0x4072A28320000000ULL, { "298.15701293945312", "298.157", "2.981570e+02", "3e+02", "298.16", "298", "298" } },
+		{ 0xC081C09780000000ULL, { "-568.073974609375", "-568.074", "-5.680740e+02", "-6e+02", "-568.07", "-568", "-568" } },
+		{ 0x4044872B00000000ULL, { "41.055999755859375", "41.056", "4.105600e+01", "4e+01", "41.056", "41.1", "41" } },
+		{ 0x44B52D02C7E14AF6ULL, { "9.9999999999999992e+22", "99999999999999991611392.000", "1.000000e+23", "1e+23", "1e+23", "1e+23", "99999999999999991611392" } },
+		{ 0xC455EB851EB851ECULL, { "-1.6174105203828536e+21", "-1617410520382853611520.000", "-1.617411e+21", "-2e+21", "-1.6174e+21", "-1.62e+21", "-1617410520382853611520" } },
+		};
+		for (u64 i = 0; i < sizeof(cases)/sizeof(cases[0]); i++) {
+			f64 v;
+			memcpy(&v, &cases[i].bits, sizeof(v));
+			for (u64 f = 0; f < sizeof(fmts)/sizeof(fmts[0]); f++) {
+				string native = tprint(fmts[f], v);
+				assert(strings_match(native, STR(cases[i].expected[f])), "Failed: %cs of %.17g gave '%s', expected '%cs'", fmts[f], v, native, cases[i].expected[f]);
+			}
+		}
+		reset_temporary_storage();
+	}
+	
+	// Shortest digits on random doubles must be the correctly rounded digits at that length
+	for (u64 i = 0; i < 20000; i++) {
+		u64 bits = xx_hash(i+1);
+		if (((bits >> 52) & 0x7FF) == 0x7FF) continue;
+		f64 v;
+		memcpy(&v, &bits, sizeof(v));
+		f64 small_v = (f64)(f32)(((f64)(bits % 2000000) - 1000000.0)/1000.0);
+		f64 values[2] = { v, small_v };
+		
+		for (u64 j = 0; j < 2; j++) {
+			v = values[j];
+			string shortest = tprint("%g", v);
+			string digits = format_test_significant_digits(shortest);
+			u64 digit_count = digits.count ? digits.count : 1;
+			string exact = tprint("%.*e", (int)digit_count-1, v);
+			string exact_digits = format_test_significant_digits(exact);
+			assert(strings_match(digits, exact_digits), "Failed: shortest %.17g gave '%s', exact gave '%s'", v, shortest, exact);
+			
+			reset_temporary_storage();
+		}
+	}
+	
+	// Native vs crt
+	{
+		const u64 calls = 100000;
+		char buffer[256];
+		u64 sink = 0;
+		
+		const char *names[] = { "%d    ", "%llx  ", "%.3f  ", "%f    ", "%e    " };
+		u64 native_cycles[5];
+		u64 crt_cycles[5];
+		for (u64 native = 0; native < 2; native++) {
+			u64 *cycles = native ? native_cycles : crt_cycles;
+			u64 (*proc)(char*, u64, const char*, ...) = native ? format_string_to_buffer_va : crt_format_to_buffer;
+			
+			u64 start = rdtsc();
+			for (u64 i = 0; i < calls; i++) sink += proc(buffer, sizeof(buffer), "%d", (int)(xx_hash(i) >> 34) - 100000);
+			cycles[0] = rdtsc()-start;
+			start = rdtsc();
+			for (u64 i = 0; i < calls; i++) sink += proc(buffer, sizeof(buffer), "%llx", xx_hash(i));
+			cycles[1] = rdtsc()-start;
+			start = rdtsc();
+			for (u64 i = 0; i < calls; i++) sink += proc(buffer, sizeof(buffer), "%.3f", (f64)(i%100000)*0.0137);
+			cycles[2] = rdtsc()-start;
+			start = rdtsc();
+			for (u64 i = 0; i < calls; i++) sink += proc(buffer, sizeof(buffer), "%f", (f64)(i%100000)*0.0137);
+			cycles[3] = rdtsc()-start;
+			start = rdtsc();
+			for (u64 i = 0; i < calls; i++) sink += proc(buffer, sizeof(buffer), "%e", (f64)(i%100000)*0.0137);
+			cycles[4] = rdtsc()-start;
+		}
+		
+		print("\n");
+		for (u64 i = 0; i < 5; i++) {
+			print("\t%cs native %llu cycles/call, crt %llu cycles/call\n", names[i], native_cycles[i]/calls, crt_cycles[i]/calls);
+		}
+		assert(sink, "Nothing was formatted");
+	}
+}
+
+#define STRING_INTERNER_TEST_THREAD_COUNT 4
+#define STRING_INTERNER_TEST_STRING_COUNT 5000
+
+typedef struct String_Interner_Test_Data {
+	Atom *atoms; // STRING_INTERNER_TEST_STRING_COUNT per thread
+	u64 index;
+} String_Interner_Test_Data;
+
+void string_interner_test_thread_proc(Thread *t) {
+	String_Interner_Test_Data *data = (String_Interner_Test_Data*)t->data;
+	Atom *atoms = data->atoms + data->index*STRING_INTERNER_TEST_STRING_COUNT;
+	for (u64 i = 0; i < STRING_INTERNER_TEST_STRING_COUNT; i++) {
+		// Every thread interns the same strings, in a different order
+		u64 n = (i + data->index*997) % STRING_INTERNER_TEST_STRING_COUNT;
+		atoms[n] = intern_string(tprint("threaded/interned/string/%llu", n));
+		reset_temporary_storage();
+	}
+}
+
+void test_string_interner() {
+	Allocator heap = get_heap_allocator();
+
+	Atom a = intern_string(STR("assets/sounds/EntityHit.wav"));
+	Atom b = ATOM("assets/sounds/EntityDestroy.wav");
+	assert(a != NULL_ATOM && b != NULL_ATOM && a != b, "Failed: Different strings should get different atoms");
+	assert(ATOM("assets/sounds/EntityHit.wav") == a, "Failed: Same string should get the same atom");
+	assert(strings_match(atom_get_string(a), STR("assets/sounds/EntityHit.wav")), "Failed: Atom string does not match");
+	assert(atom_get_hash(a) == string_get_hash(STR("assets/sounds/EntityHit.wav")), "Failed: Atom hash does not match the string hash");
+	assert(intern_string(null_string) == NULL_ATOM, "Failed: Empty string should be NULL_ATOM");
+	assert(atom_get_string(NULL_ATOM).count == 0, "Failed: NULL_ATOM should be the empty string");
+
+	assert(find_interned_string(STR("Never interned")) == NULL_ATOM, "Failed: Found a string that was never interned");
+	assert(find_interned_string(STR("assets/sounds/EntityDestroy.wav")) == b, "Failed: Could not find interned string");
+
+	// Interned strings are copied
+	string temp = alloc_string(heap, 13);
+	memcpy(temp.data, "Temporary key", 13);
+	Atom temp_atom = intern_string(temp);
+	dealloc_string(heap, temp);
+	assert(strings_match(atom_get_string(temp_atom), STR("Temporary key")), "Failed: Interned string was not copied");
+	assert(ATOM("Temporary key") == temp_atom, "Failed: Same string should get the same atom");
+
+	// Many threads interning the same strings at once all get the same atoms
+	Atom *atoms = alloc(heap, STRING_INTERNER_TEST_THREAD_COUNT*STRING_INTERNER_TEST_STRING_COUNT*sizeof(Atom));
+	Thread threads[STRING_INTERNER_TEST_THREAD_COUNT];
+	String_Interner_Test_Data thread_data[STRING_INTERNER_TEST_THREAD_COUNT];
+	for (u64 i = 0; i < STRING_INTERNER_TEST_THREAD_COUNT; i++) {
+		thread_data[i] = (String_Interner_Test_Data){atoms, i};
+		os_thread_init(&threads[i], string_interner_test_thread_proc);
+		threads[i].data = &thread_data[i];
+	}
+	for (u64 i = 0; i < STRING_INTERNER_TEST_THREAD_COUNT; i++) {
+		os_thread_start(&threads[i]);
+	}
+	for (u64 i = 0; i < STRING_INTERNER_TEST_THREAD_COUNT; i++) {
+		os_thread_join(&threads[i]);
+		os_thread_destroy(&threads[i]);
+	}
+	for (u64 n = 0; n < STRING_INTERNER_TEST_STRING_COUNT; n++) {
+		Atom atom = atoms[n];
+		for (u64 i = 1; i < STRING_INTERNER_TEST_THREAD_COUNT; i++) {
+			assert(atoms[i*STRING_INTERNER_TEST_STRING_COUNT + n] == atom, "Failed: Threads got different atoms for string %llu", n);
+		}
+		string expected = tprint("threaded/interned/string/%llu", n);
+		assert(strings_match(atom_get_string(atom), expected), "Failed: Atom %u has the wrong string", atom);
+		reset_temporary_storage();
+	}
+	dealloc(heap, atoms);
+
+	assert(ATOM("assets/sounds/EntityHit.wav") == a, "Failed: Atom changed after the interner grew");
+}
+
 void test_file_io() {
 
 #if TARGET_OS == WINDOWS && !OOGABOOGA_LINK_EXTERNAL_INSTANCE
@@ -1342,11 +2516,619 @@ void test_hash_table() {
     assert(table.entries == NULL, "Failed: Hash table entries should be NULL after destroy");
     assert(table.count == 0, "Failed: Hash table count should be 0 after destroy");
     assert(table.capacity_count == 0, "Failed: Hash table capacity count should be 0 after destroy");
+
+    // Keys are verified, so a hash collision doesn't return the wrong value
+    table = make_hash_table(string, int, get_heap_allocator());
+    string colliding1 = STR("First");
+    string colliding2 = STR("Second");
+    int colliding_value1 = 1;
+    int colliding_value2 = 2;
+    hash_table_add_raw(&table, 42, &colliding1, &colliding_value1, sizeof(string), sizeof(int));
+    hash_table_add_raw(&table, 42, &colliding2, &colliding_value2, sizeof(string), sizeof(int));
+    found_value = hash_table_find_raw(&table, 42, &colliding2, sizeof(string));
+    assert(found_value && *found_value == 2, "Failed: Hash collision returned the wrong value");
+    found_value = hash_table_find_raw(&table, 42, &key2, sizeof(string));
+    assert(found_value == NULL, "Failed: Hash collision found a key that was never added");
+    bool removed = hash_table_remove_raw(&table, 42, &colliding1, sizeof(string));
+    assert(removed, "Failed: Could not remove colliding key");
+    found_value = hash_table_find_raw(&table, 42, &colliding2, sizeof(string));
+    assert(found_value && *found_value == 2, "Failed: Removing a colliding key lost the other one");
+
+    // String keys are copied, so the key we passed can go away
+    string temp_key = alloc_string(get_heap_allocator(), 13);
+    memcpy(temp_key.data, "Temporary key", 13);
+    int temp_value = 5;
+    hash_table_set(&table, temp_key, temp_value);
+    dealloc_string(get_heap_allocator(), temp_key);
+    string same_key = STR("Temporary key");
+    found_value = hash_table_find(&table, same_key);
+    assert(found_value && *found_value == 5, "Failed: String key was not copied into the table");
+    hash_table_destroy(&table);
+
+    // Lots of keys, with removes in between, so we grow and shift slots around
+    Hash_Table numbers = make_hash_table(u64, u64, get_heap_allocator());
+    const u64 number_count = 20000;
+    for (u64 i = 0; i < number_count; i++) {
+        u64 value = i*3;
+        newly_added = hash_table_set(&numbers, i, value);
+        assert(newly_added, "Failed: Key %llu should be newly added", i);
+    }
+    assert(numbers.count == number_count, "Failed: Wrong hash table count");
+    for (u64 i = 0; i < number_count; i += 2) {
+        removed = hash_table_remove(&numbers, i);
+        assert(removed, "Failed: Could not remove key %llu", i);
+    }
+    assert(numbers.count == number_count/2, "Failed: Wrong hash table count after removing");
+    for (u64 i = 0; i < number_count; i++) {
+        u64 *number = hash_table_find(&numbers, i);
+        if (i % 2 == 0) {
+            assert(number == NULL, "Failed: Removed key %llu was still found", i);
+        } else {
+            assert(number && *number == i*3, "Failed: Key %llu has the wrong value after removes", i);
+        }
+    }
+    u64 sum = 0;
+    for (u64 i = 0; i < numbers.count; i++) {
+        u64 k = *(u64*)hash_table_get_nth_key(&numbers, i);
+        u64 v = *(u64*)hash_table_get_nth_value(&numbers, i);
+        assert(v == k*3, "Failed: Iterated key & value don't match");
+        sum += k;
+    }
+    assert(sum == (number_count/2)*(number_count/2), "Failed: Iteration did not visit every key once");
+    u64 missing = number_count*2;
+    removed = hash_table_remove(&numbers, missing);
+    assert(!removed, "Failed: Removed a key that doesn't exist");
+    hash_table_destroy(&numbers);
+}
+
+void test_swiss_table() {
+    Swiss_Table table = make_swiss_table(string, int, get_heap_allocator());
+
+    string key1 = STR("Key string");
+    int value1 = 69;
+    bool newly_added = swiss_table_set(&table, key1, value1);
+    assert(newly_added == true, "Failed: Key should be newly added");
+
+    int *found_value = swiss_table_find(&table, key1);
+    assert(found_value != NULL, "Failed: Key should exist in swiss table");
+    assert(*found_value == 69, "Failed: Value should be 69, got %i", *found_value);
+
+    int new_value1 = 70;
+    newly_added = swiss_table_set(&table, key1, new_value1);
+    assert(newly_added == false, "Failed: Key should not be newly added");
+    found_value = swiss_table_find(&table, key1);
+    assert(found_value && *found_value == 70, "Failed: Value should be 70");
+
+    string key2 = STR("Non-existing key");
+    assert(!swiss_table_contains(&table, key2), "Failed: Swiss table should not contain key2");
+
+    // String keys are copied, so the key we passed can go away
+    string temp_key = alloc_string(get_heap_allocator(), 13);
+    memcpy(temp_key.data, "Temporary key", 13);
+    int temp_value = 5;
+    swiss_table_set(&table, temp_key, temp_value);
+    dealloc_string(get_heap_allocator(), temp_key);
+    string same_key = STR("Temporary key");
+    found_value = swiss_table_find(&table, same_key);
+    assert(found_value && *found_value == 5, "Failed: String key was not copied into the table");
+
+    swiss_table_reset(&table);
+    assert(table.count == 0, "Failed: Swiss table count should be 0 after reset");
+    assert(!swiss_table_contains(&table, key1), "Failed: Swiss table should be empty after reset");
+
+    swiss_table_destroy(&table);
+    assert(table.control == NULL && table.entries == NULL, "Failed: Swiss table memory should be NULL after destroy");
+    assert(table.capacity == 0, "Failed: Swiss table capacity should be 0 after destroy");
+
+    // Lots of keys, with removes in between, so we grow, leave deleted slots and reuse them
+    Swiss_Table numbers = make_swiss_table(u64, u64, get_heap_allocator());
+    const u64 number_count = 20000;
+    for (u64 i = 0; i < number_count; i++) {
+        u64 value = i*3;
+        newly_added = swiss_table_set(&numbers, i, value);
+        assert(newly_added, "Failed: Key %llu should be newly added", i);
+    }
+    assert(numbers.count == number_count, "Failed: Wrong swiss table count");
+    for (u64 i = 0; i < number_count; i += 2) {
+        bool removed = swiss_table_remove(&numbers, i);
+        assert(removed, "Failed: Could not remove key %llu", i);
+    }
+    assert(numbers.count == number_count/2, "Failed: Wrong swiss table count after removing");
+    for (u64 i = 0; i < number_count; i++) {
+        u64 *number = swiss_table_find(&numbers, i);
+        if (i % 2 == 0) {
+            assert(number == NULL, "Failed: Removed key %llu was still found", i);
+        } else {
+            assert(number && *number == i*3, "Failed: Key %llu has the wrong value after removes", i);
+        }
+    }
+    u64 missing = number_count*2;
+    assert(!swiss_table_remove(&numbers, missing), "Failed: Removed a key that doesn't exist");
+
+    // Churn through many more keys than the table has room for, so deleted slots have to be
+    // cleaned up without the table growing forever
+    u64 capacity_before = numbers.capacity;
+    for (u64 i = 0; i < number_count*10; i++) {
+        u64 key = number_count*4 + i;
+        swiss_table_set(&numbers, key, i);
+        swiss_table_remove(&numbers, key);
+    }
+    assert(numbers.count == number_count/2, "Failed: Wrong swiss table count after churn");
+    assert(numbers.capacity == capacity_before, "Failed: Swiss table grew from only adding & removing");
+
+    // Iteration visits every key once, in memory order
+    u64 sum = 0;
+    u64 visited = 0;
+    u64 iterator = 0;
+    u64 last_iterator = 0;
+    u64 *k;
+    u64 *v;
+    while (swiss_table_iterate(&numbers, &iterator, (void**)&k, (void**)&v)) {
+        assert(*v == *k*3, "Failed: Iterated key & value don't match");
+        assert(iterator > last_iterator, "Failed: Swiss table iteration went backwards");
+        last_iterator = iterator;
+        sum += *k;
+        visited += 1;
+    }
+    assert(visited == numbers.count, "Failed: Iteration visited %llu entries, expected %llu", visited, numbers.count);
+    assert(sum == (number_count/2)*(number_count/2), "Failed: Iteration did not visit every key once");
+
+    // Bulk insert & lookup
+    const u64 bulk_count = 1000;
+    u64 *bulk_keys = alloc(get_heap_allocator(), bulk_count*2*sizeof(u64));
+    u64 *bulk_values = alloc(get_heap_allocator(), bulk_count*sizeof(u64));
+    void **results = alloc(get_heap_allocator(), bulk_count*2*sizeof(void*));
+    for (u64 i = 0; i < bulk_count; i++) {
+        bulk_keys[i] = i; // Odd ones are already in the table
+        bulk_values[i] = i*3;
+        bulk_keys[bulk_count+i] = number_count*100 + i; // Never added
+    }
+    u64 added = swiss_table_set_many(&numbers, bulk_keys, bulk_values, bulk_count);
+    assert(added == bulk_count/2, "Failed: Bulk insert added %llu keys, expected %llu", added, bulk_count/2);
+    u64 found = swiss_table_find_many(&numbers, bulk_keys, bulk_count*2, results);
+    assert(found == bulk_count, "Failed: Bulk lookup found %llu keys, expected %llu", found, bulk_count);
+    for (u64 i = 0; i < bulk_count*2; i++) {
+        if (i < bulk_count) {
+            assert(results[i] && *(u64*)results[i] == bulk_keys[i]*3, "Failed: Bulk lookup returned the wrong value for key %llu", bulk_keys[i]);
+        } else {
+            assert(results[i] == NULL, "Failed: Bulk lookup found key %llu which was never added", bulk_keys[i]);
+        }
+    }
+    dealloc(get_heap_allocator(), bulk_keys);
+    dealloc(get_heap_allocator(), bulk_values);
+    dealloc(get_heap_allocator(), results);
+
+    swiss_table_destroy(&numbers);
+
+    // Keys which aren't a multiple of 8 bytes
+    Swiss_Table small = make_swiss_table(u16, u8, get_heap_allocator());
+    for (u16 i = 0; i < 1000; i++) {
+        u8 value = (u8)i;
+        swiss_table_set(&small, i, value);
+    }
+    for (u16 i = 0; i < 1000; i++) {
+        u8 *value = swiss_table_find(&small, i);
+        assert(value && *value == (u8)i, "Failed: u16 key %i has the wrong value", i);
+    }
+    swiss_table_destroy(&small);
+}
+
+void test_hash_table_performance() {
+
+    const u64 sizes[] = { 1000, 100000, 1000000 };
+
+    print("\n");
+    for (u64 s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++) {
+        u64 n = sizes[s];
+
+        // First n keys are added, next n are misses. Hashed so they aren't sequential in memory.
+        u64 *keys = alloc(get_heap_allocator(), n*2*sizeof(u64));
+        for (u64 i = 0; i < n*2; i++) keys[i] = xx_hash(i+1);
+        void **results = alloc(get_heap_allocator(), n*2*sizeof(void*));
+
+        u64 start;
+        u64 found = 0;
+
+        // Scalar table
+        Hash_Table hash_table = make_hash_table(u64, u64, get_heap_allocator());
+        start = rdtsc();
+        for (u64 i = 0; i < n; i++) hash_table_set(&hash_table, keys[i], i);
+        u64 scalar_insert = rdtsc()-start;
+        start = rdtsc();
+        for (u64 i = 0; i < n; i++) found += hash_table_find(&hash_table, keys[i]) != 0;
+        u64 scalar_hit = rdtsc()-start;
+        start = rdtsc();
+        for (u64 i = n; i < n*2; i++) found += hash_table_find(&hash_table, keys[i]) != 0;
+        u64 scalar_miss = rdtsc()-start;
+        start = rdtsc();
+        for (u64 i = 0; i < hash_table.count; i++) found += *(u64*)hash_table_get_nth_value(&hash_table, i) == 0;
+        u64 scalar_iterate = rdtsc()-start;
+        hash_table_destroy(&hash_table);
+
+        // Swiss table, one key at a time
+        Swiss_Table swiss = make_swiss_table(u64, u64, get_heap_allocator());
+        start = rdtsc();
+        for (u64 i = 0; i < n; i++) swiss_table_set(&swiss, keys[i], i);
+        u64 swiss_insert = rdtsc()-start;
+        start = rdtsc();
+        for (u64 i = 0; i < n; i++) found += swiss_table_find(&swiss, keys[i]) != 0;
+        u64 swiss_hit = rdtsc()-start;
+        start = rdtsc();
+        for (u64 i = n; i < n*2; i++) found += swiss_table_find(&swiss, keys[i]) != 0;
+        u64 swiss_miss = rdtsc()-start;
+        start = rdtsc();
+        u64 iterator = 0;
+        u64 *value;
+        while (swiss_table_iterate(&swiss, &iterator, 0, (void**)&value)) found += *value == 0;
+        u64 swiss_iterate = rdtsc()-start;
+        swiss_table_destroy(&swiss);
+
+        // Swiss table, in bulk
+        u64 *values = alloc(get_heap_allocator(), n*sizeof(u64));
+        for (u64 i = 0; i < n; i++) values[i] = i;
+        swiss = make_swiss_table(u64, u64, get_heap_allocator());
+        start = rdtsc();
+        swiss_table_set_many(&swiss, keys, values, n);
+        u64 bulk_insert = rdtsc()-start;
+        start = rdtsc();
+        found += swiss_table_find_many(&swiss, keys, n, results);
+        u64 bulk_hit = rdtsc()-start;
+        start = rdtsc();
+        found += swiss_table_find_many(&swiss, keys+n, n, results+n);
+        u64 bulk_miss = rdtsc()-start;
+        swiss_table_destroy(&swiss);
+
+        // Every added key is found 3 times and key 0 is iterated twice
+        assert(found == n*3+2, "Failed: Tables disagree on which keys exist (%llu)", found);
+
+        print("\t%llu keys, cycles per key (insert / hit / miss / iterate):\n", n);
+        print("\t\tHash_Table:          %5llu / %5llu / %5llu / %5llu\n", scalar_insert/n, scalar_hit/n, scalar_miss/n, scalar_iterate/n);
+        print("\t\tSwiss_Table:         %5llu / %5llu / %5llu / %5llu\n", swiss_insert/n, swiss_hit/n, swiss_miss/n, swiss_iterate/n);
+        print("\t\tSwiss_Table (bulk):  %5llu / %5llu / %5llu\n", bulk_insert/n, bulk_hit/n, bulk_miss/n);
+
+        dealloc(get_heap_allocator(), keys);
+        dealloc(get_heap_allocator(), values);
+        dealloc(get_heap_allocator(), results);
+    }
+}
+
+void test_string_hash() {
+    Allocator heap = get_heap_allocator();
+
+    const u64 max_count = 1100;
+    u8 *buffer = alloc(heap, max_count+64);
+    u8 *copy = alloc(heap, max_count+64);
+    seed_for_random = 1234;
+    for (u64 i = 0; i < max_count+64; i++) buffer[i] = (u8)get_random();
+
+    for (u64 count = 0; count <= max_count; count++) {
+        string s = (string){count, buffer+32};
+        u64 hash = string_get_hash(s);
+
+        // Bytes around the string don't matter
+        buffer[31] ^= 0xFF;
+        buffer[32+count] ^= 0xFF;
+        assert(string_get_hash(s) == hash, "Failed: Hash of %llu bytes depends on bytes outside the string", count);
+        buffer[31] ^= 0xFF;
+        buffer[32+count] ^= 0xFF;
+
+        // Neither does where the string is
+        memcpy(copy+7, s.data, count);
+        assert(string_get_hash((string){count, copy+7}) == hash, "Failed: Hash of %llu bytes depends on the address", count);
+
+        // Every byte does
+        for (u64 i = 0; i < count; i += max(count/7, 1)) {
+            s.data[i] ^= 1;
+            assert(string_get_hash(s) != hash, "Failed: Changing byte %llu of %llu did not change the hash", i, count);
+            s.data[i] ^= 1;
+        }
+
+        assert(string_get_hash_seeded(s, 0) == hash, "Failed: Seed 0 should match the unseeded hash");
+        assert(string_get_hash_seeded(s, 1) != string_get_hash_seeded(s, 2), "Failed: Seed did not change the hash of %llu bytes", count);
+    }
+
+    // No collisions between lots of similar strings
+    const u64 path_count = 100000;
+    Swiss_Table hashes = make_swiss_table_reserve(u64, u64, path_count, heap);
+    for (u64 i = 0; i < path_count; i++) {
+        string path = tprint("oogabooga/examples/assets/sounds/sound_number_%llu.ogg", i);
+        u64 hash = string_get_hash(path);
+        bool newly_added = swiss_table_set(&hashes, hash, i);
+        assert(newly_added, "Failed: Hash collision for '%s'", path);
+        reset_temporary_storage();
+    }
+    swiss_table_destroy(&hashes);
+
+    dealloc(heap, buffer);
+    dealloc(heap, copy);
+
+    // Throughput, old byte-at-a-time djb2 against the new hash
+    const u64 sizes[] = { 8, 24, 48, 96, 256, 1024, 65536 };
+    const u64 total_bytes = MB(16);
+    u8 *data = alloc(heap, sizes[sizeof(sizes)/sizeof(sizes[0])-1]);
+    memset(data, 'a', sizes[sizeof(sizes)/sizeof(sizes[0])-1]);
+
+    print("\n");
+    for (u64 i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+        string s = (string){sizes[i], data};
+        u64 iterations = total_bytes/sizes[i];
+        u64 sink = 0;
+
+        u64 start = rdtsc();
+        for (u64 j = 0; j < iterations; j++) {
+            data[0] = (u8)j;
+            sink += djb2_hash(s);
+        }
+        u64 djb2_cycles = rdtsc()-start;
+
+        start = rdtsc();
+        for (u64 j = 0; j < iterations; j++) {
+            data[0] = (u8)j;
+            sink += string_get_hash(s);
+        }
+        u64 cycles = rdtsc()-start;
+
+        print("\t%llu bytes: djb2 %.2f cycles/byte, string_get_hash %.2f cycles/byte (%llu)\n", sizes[i], (float64)djb2_cycles/(float64)total_bytes, (float64)cycles/(float64)total_bytes, sink & 1);
+    }
+    dealloc(heap, data);
+}
+
+#define CONCURRENT_HASH_MAP_TEST_THREAD_COUNT 4
+#define CONCURRENT_HASH_MAP_TEST_KEY_COUNT 20000
+#define CONCURRENT_HASH_MAP_TEST_SHARED_COUNT 1000
+
+typedef struct Concurrent_Hash_Map_Test_Data {
+	Concurrent_Hash_Map *map;
+	u64 index;
+} Concurrent_Hash_Map_Test_Data;
+
+void concurrent_hash_map_test_thread_proc(Thread *t) {
+	Concurrent_Hash_Map_Test_Data *data = (Concurrent_Hash_Map_Test_Data*)t->data;
+	Concurrent_Hash_Map *map = data->map;
+	u64 first_key = (data->index+1)*1000000;
+
+	for (u64 i = 0; i < CONCURRENT_HASH_MAP_TEST_KEY_COUNT; i++) {
+		// Own keys, which are grown into the table while other threads are reading & writing
+		u64 key = first_key+i;
+		u64 value = key*3;
+		bool newly_added = concurrent_hash_map_set(map, key, value);
+		assert(newly_added, "Failed: Key %llu should be newly added", key);
+		if (i % 2 == 1) {
+			bool removed = concurrent_hash_map_remove(map, key);
+			assert(removed, "Failed: Could not remove key %llu", key);
+		}
+
+		// Shared keys which were there from the start
+		u64 shared = i % CONCURRENT_HASH_MAP_TEST_SHARED_COUNT;
+		u64 *found = concurrent_hash_map_find(map, shared);
+		assert(found && *found == shared*3, "Failed: Shared key %llu was lost or corrupted", shared);
+
+		// Keys every thread races to add, like a cache which several threads load into
+		u64 contended = CONCURRENT_HASH_MAP_TEST_SHARED_COUNT + i % CONCURRENT_HASH_MAP_TEST_SHARED_COUNT;
+		u64 contended_value = contended*3;
+		found = concurrent_hash_map_find_or_add(map, contended, contended_value, 0);
+		assert(found && *found == contended*3, "Failed: Contended key %llu has the wrong value", contended);
+	}
+
+	for (u64 i = 0; i < CONCURRENT_HASH_MAP_TEST_KEY_COUNT; i++) {
+		u64 key = first_key+i;
+		u64 *found = concurrent_hash_map_find(map, key);
+		if (i % 2 == 1) {
+			assert(!found, "Failed: Removed key %llu was still found", key);
+		} else {
+			assert(found && *found == key*3, "Failed: Key %llu has the wrong value", key);
+		}
+	}
+}
+
+void test_concurrent_hash_map() {
+	assert(sizeof(Concurrent_Hash_Map_Stripe) % 64 == 0, "Hash map stripes should each fill whole cache lines");
+
+	Concurrent_Hash_Map map = make_concurrent_hash_map(string, int, get_heap_allocator());
+
+	string key1 = STR("Key string");
+	int value1 = 69;
+	bool newly_added = concurrent_hash_map_set(&map, key1, value1);
+	assert(newly_added, "Failed: Key should be newly added");
+
+	int *found_value = concurrent_hash_map_find(&map, key1);
+	assert(found_value && *found_value == 69, "Failed: Value should be 69");
+
+	// Setting again publishes a new value, the old pointer keeps the old value
+	int value2 = 70;
+	newly_added = concurrent_hash_map_set(&map, key1, value2);
+	assert(!newly_added, "Failed: Key should not be newly added");
+	int *new_found_value = concurrent_hash_map_find(&map, key1);
+	assert(new_found_value && *new_found_value == 70, "Failed: Value should be 70");
+	assert(*found_value == 69, "Failed: Old value pointer should still be valid");
+
+	bool added;
+	int value3 = 71;
+	found_value = concurrent_hash_map_find_or_add(&map, key1, value3, &added);
+	assert(!added && *found_value == 70, "Failed: find_or_add should find the existing value");
+
+	string key2 = STR("Another key string");
+	found_value = concurrent_hash_map_find_or_add(&map, key2, value3, &added);
+	assert(added && *found_value == 71, "Failed: find_or_add should add a missing key");
+	assert(map.count == 2, "Failed: Wrong concurrent hash map count");
+
+	bool removed = concurrent_hash_map_remove(&map, key1);
+	assert(removed, "Failed: Could not remove key");
+	assert(!concurrent_hash_map_contains(&map, key1), "Failed: Removed key was still found");
+	removed = concurrent_hash_map_remove(&map, key1);
+	assert(!removed, "Failed: Removed a key that doesn't exist");
+
+	concurrent_hash_map_destroy(&map);
+	assert(map.table == 0 && map.count == 0, "Failed: Concurrent hash map should be empty after destroy");
+
+	// Many threads reading & writing at once
+	Concurrent_Hash_Map numbers = make_concurrent_hash_map(u64, u64, get_heap_allocator());
+	for (u64 i = 0; i < CONCURRENT_HASH_MAP_TEST_SHARED_COUNT; i++) {
+		u64 value = i*3;
+		concurrent_hash_map_set(&numbers, i, value);
+	}
+
+	Thread threads[CONCURRENT_HASH_MAP_TEST_THREAD_COUNT];
+	Concurrent_Hash_Map_Test_Data thread_data[CONCURRENT_HASH_MAP_TEST_THREAD_COUNT];
+	for (u64 i = 0; i < CONCURRENT_HASH_MAP_TEST_THREAD_COUNT; i++) {
+		thread_data[i] = (Concurrent_Hash_Map_Test_Data){&numbers, i};
+		os_thread_init(&threads[i], concurrent_hash_map_test_thread_proc);
+		threads[i].data = &thread_data[i];
+	}
+	for (u64 i = 0; i < CONCURRENT_HASH_MAP_TEST_THREAD_COUNT; i++) {
+		os_thread_start(&threads[i]);
+	}
+	for (u64 i = 0; i < CONCURRENT_HASH_MAP_TEST_THREAD_COUNT; i++) {
+		os_thread_join(&threads[i]);
+		os_thread_destroy(&threads[i]);
+	}
+
+	u64 expected_count = CONCURRENT_HASH_MAP_TEST_SHARED_COUNT*2 + CONCURRENT_HASH_MAP_TEST_THREAD_COUNT*CONCURRENT_HASH_MAP_TEST_KEY_COUNT/2;
+	assert(numbers.count == expected_count, "Failed: Concurrent hash map has %llu entries, expected %llu", numbers.count, expected_count);
+
+	concurrent_hash_map_destroy(&numbers);
 }
 
 #define NUM_BINS 100
 #define NUM_SAMPLES 100000000
 
+// Plain one-lane xoshiro256++ to check the lanes against
+u64 random_test_reference_next(u64 *s) {
+	u64 result = random_rotl(s[0] + s[3], 23) + s[0];
+	u64 t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = random_rotl(s[3], 45);
+	return result;
+}
+
+void test_random_streams() {
+	Cpu_Capabilities cpu = query_cpu_capabilities();
+	String_Simd_Level levels[] = { STRING_SIMD_NONE, STRING_SIMD_SSE2, STRING_SIMD_AVX2 };
+	const char *level_names[] = { "scalar", "sse2  ", "avx2  " };
+	bool level_supported[] = { true, ENABLE_SIMD && COMPILER_CAN_TARGET_SSE2 && cpu.sse2, ENABLE_SIMD && COMPILER_CAN_TARGET_AVX2 && cpu.avx2 };
+	String_Simd_Level original_level = get_string_simd_level();
+	
+	const u64 count = 1000;
+	u64 expected[1000];
+	u64 got[1000];
+	f32 expected_f32[1000];
+	f32 got_f32[1000];
+	
+	// Each lane is a plain xoshiro256++, outputs interleaved lane by lane
+	Random_State rng;
+	random_state_init(&rng, 1337, 0);
+	u64 lanes[RANDOM_LANES][4];
+	for (u64 lane = 0; lane < RANDOM_LANES; lane++) {
+		for (u64 word = 0; word < 4; word++) lanes[lane][word] = rng.s[word][lane];
+	}
+	for (u64 i = 0; i < count; i++) {
+		expected[i] = random_test_reference_next(lanes[i % RANDOM_LANES]);
+	}
+	for (u64 i = 0; i < count; i++) {
+		u64 x = expected[i/2];
+		expected_f32[i] = (f32)((u32)(i % 2 ? x >> 32 : x) >> 8) * (1.0f/16777216.0f);
+	}
+	
+	for (u64 l = 0; l < 3; l++) {
+		if (!level_supported[l]) continue;
+		string_simd_level = levels[l];
+		
+		random_state_init(&rng, 1337, 0);
+		random_fill_u64(&rng, got, count);
+		assert(memcmp(got, expected, sizeof(got)) == 0, "Failed: %cs random_fill_u64", level_names[l]);
+		
+		// Same stream no matter how it's split between single draws and fills
+		random_state_init(&rng, 1337, 0);
+		u64 seed = 7;
+		for (u64 i = 0; i < count; ) {
+			u64 n = min(xx_hash(seed) % 13, count-i);
+			seed += 1;
+			if (n == 0) {
+				got[i++] = random_u64(&rng);
+			} else {
+				random_fill_u64(&rng, got+i, n);
+				i += n;
+			}
+		}
+		assert(memcmp(got, expected, sizeof(got)) == 0, "Failed: %cs mixed random_u64 and random_fill_u64", level_names[l]);
+		
+		random_state_init(&rng, 1337, 0);
+		random_fill_f32(&rng, got_f32, count);
+		assert(memcmp(got_f32, expected_f32, sizeof(got_f32)) == 0, "Failed: %cs random_fill_f32", level_names[l]);
+	}
+	string_simd_level = original_level;
+	
+	// Streams and seeds don't give the same numbers
+	Random_State a, b;
+	random_state_init(&a, 1337, 0);
+	random_state_init(&b, 1337, 1);
+	assert(random_u64(&a) != random_u64(&b), "Failed: streams 0 and 1 are the same");
+	random_state_init(&b, 1338, 0);
+	random_state_init(&a, 1337, 0);
+	assert(random_u64(&a) != random_u64(&b), "Failed: seeds 1337 and 1338 are the same");
+	
+	// Ranges
+	random_state_init(&rng, 42, 0);
+	u64 hits[7] = {0};
+	f64 sum = 0;
+	for (u64 i = 0; i < 100000; i++) {
+		s64 r = random_int_in_range(&rng, -3, 3);
+		assert(r >= -3 && r <= 3, "Failed: random_int_in_range gave %i", r);
+		hits[r+3] += 1;
+		
+		f32 f = random_f32(&rng);
+		assert(f >= 0.0f && f < 1.0f, "Failed: random_f32 gave %f", f);
+		f64 d = random_f64(&rng);
+		assert(d >= 0.0 && d < 1.0, "Failed: random_f64 gave %f", d);
+		sum += f;
+		
+		f32 ranged = random_f32_in_range(&rng, -5.0f, 5.0f);
+		assert(ranged >= -5.0f && ranged <= 5.0f, "Failed: random_f32_in_range gave %f", ranged);
+	}
+	for (u64 i = 0; i < 7; i++) {
+		assert(hits[i] > 100000/7 - 1000 && hits[i] < 100000/7 + 1000, "Failed: random_int_in_range is skewed (%i hits for %i)", hits[i], (s64)i-3);
+	}
+	assert(sum/100000 > 0.49 && sum/100000 < 0.51, "Failed: random_f32 mean is %f", sum/100000);
+	assert(random_int_in_range(&rng, 5, 5) == 5, "Failed: random_int_in_range with min == max");
+	
+	seed_thread_random_state(99, 3);
+	u64 first = random_u64(get_thread_random_state());
+	random_state_init(&rng, 99, 3);
+	assert(first == random_u64(&rng), "Failed: seed_thread_random_state");
+	
+	// Millions of floats like a particle system would want, against the LCG one at a time
+	u64 big_count = 16*1024*1024;
+	f32 *big = alloc(get_heap_allocator(), big_count*sizeof(f32));
+	
+	u64 start = rdtsc();
+	for (u64 i = 0; i < big_count; i++) big[i] = get_random_float32();
+	u64 lcg_cycles = rdtsc()-start;
+	
+	random_state_init(&rng, 1, 0);
+	start = rdtsc();
+	for (u64 i = 0; i < big_count; i++) big[i] = random_f32(&rng);
+	u64 single_cycles = rdtsc()-start;
+	
+	print("\n\tget_random_float32 %.3f, random_f32 %.3f cycles/float\n", (f64)lcg_cycles/big_count, (f64)single_cycles/big_count);
+	for (u64 l = 0; l < 3; l++) {
+		if (!level_supported[l]) continue;
+		string_simd_level = levels[l];
+		
+		start = rdtsc();
+		random_fill_f32(&rng, big, big_count);
+		u64 fill_cycles = rdtsc()-start;
+		
+		print("\t%cs random_fill_f32 %.3f cycles/float\n", level_names[l], (f64)fill_cycles/big_count);
+	}
+	
+	dealloc(get_heap_allocator(), big);
+	string_simd_level = original_level;
+}
+
 void test_random_distribution() {
     int bins[NUM_BINS] = {0};
     seed_for_random = rdtsc();
@@ -1368,6 +3150,80 @@ void test_random_distribution() {
     print("Min: %d, max: %d\n", min_bin, max_bin);
 }
 
+#define SPINLOCK_TEST_THREAD_COUNT 8
+#define SPINLOCK_TEST_INCREMENTS 20000
+typedef struct Spinlock_Test_Data {
+	Spinlock lock;
+	Ticket_Spinlock ticket_lock;
+	volatile u64 counter;
+	bool use_ticket;
+} Spinlock_Test_Data;
+void spinlock_test_increment(Thread *t) {
+	Spinlock_Test_Data *data = (Spinlock_Test_Data*)t->data;
+	for (u64 i = 0; i < SPINLOCK_TEST_INCREMENTS; i++) {
+		if (data->use_ticket) ticket_spinlock_acquire_or_wait(&data->ticket_lock);
+		else                  spinlock_acquire_or_wait(&data->lock);
+		
+		// Not atomic on purpose, the lock is what keeps this correct
+		u64 value = data->counter;
+		data->counter = value + 1;
+		
+		if (data->use_ticket) ticket_spinlock_release(&data->ticket_lock);
+		else                  spinlock_release(&data->lock);
+	}
+}
+
+void test_spinlocks() {
+	Spinlock_Test_Data data = ZERO(Spinlock_Test_Data);
+	spinlock_init(&data.lock);
+	ticket_spinlock_init(&data.ticket_lock);
+	
+	for (u64 ticket = 0; ticket < 2; ticket++) {
+		data.use_ticket = ticket == 1;
+		data.counter = 0;
+		Thread threads[SPINLOCK_TEST_THREAD_COUNT];
+		u64 start = rdtsc();
+		for (u64 i = 0; i < SPINLOCK_TEST_THREAD_COUNT; i++) {
+			os_thread_init(&threads[i], spinlock_test_increment);
+			threads[i].data = &data;
+			os_thread_start(&threads[i]);
+		}
+		for (u64 i = 0; i < SPINLOCK_TEST_THREAD_COUNT; i++) {
+			os_thread_join(&threads[i]);
+			os_thread_destroy(&threads[i]);
+		}
+		u64 cycles = rdtsc()-start;
+		assert(data.counter == SPINLOCK_TEST_THREAD_COUNT*SPINLOCK_TEST_INCREMENTS, "Failed: %cs lost increments (%i)", ticket ? "Ticket_Spinlock" : "Spinlock", data.counter);
+		
+		print("\n\t%cs %i threads: %.1f cycles per acquire", ticket ? "Ticket_Spinlock" : "Spinlock       ", (u64)SPINLOCK_TEST_THREAD_COUNT, (f64)cycles/(SPINLOCK_TEST_THREAD_COUNT*SPINLOCK_TEST_INCREMENTS));
+	}
+	print("\n");
+	
+#if ENABLE_PROFILING
+	assert(data.lock.acquire_count == SPINLOCK_TEST_THREAD_COUNT*SPINLOCK_TEST_INCREMENTS, "Failed: Spinlock acquire_count");
+	assert(data.ticket_lock.acquire_count == SPINLOCK_TEST_THREAD_COUNT*SPINLOCK_TEST_INCREMENTS, "Failed: Ticket_Spinlock acquire_count");
+	assert(data.lock.contended_count <= data.lock.acquire_count, "Failed: Spinlock contended_count");
+#endif
+	
+	// Timeouts, with and without rdtsc calibrated
+	Spinlock l;
+	spinlock_init(&l);
+	spinlock_acquire_or_wait(&l);
+	for (u64 i = 0; i < 2; i++) {
+		f64 start = os_get_elapsed_seconds();
+		bool acquired = spinlock_acquire_or_wait_timeout(&l, 0.002);
+		f64 waited = os_get_elapsed_seconds()-start;
+		assert(!acquired, "Failed: spinlock_acquire_or_wait_timeout acquired a taken lock");
+		assert(waited >= 0.0015 && waited < 0.5, "Failed: spinlock_acquire_or_wait_timeout waited %f seconds", waited);
+		os_sleep((u32)(SPINLOCK_CYCLE_CALIBRATION_SECONDS*1000)+10);
+		get_rdtsc_cycles_per_second();
+	}
+	assert(get_rdtsc_cycles_per_second() > 100000000, "Failed: get_rdtsc_cycles_per_second gave %i", get_rdtsc_cycles_per_second());
+	spinlock_release(&l);
+	assert(spinlock_acquire_or_wait_timeout(&l, 0.002), "Failed: spinlock_acquire_or_wait_timeout on a free lock");
+	spinlock_release(&l);
+}
+
 #define MUTEX_TEST_TASK_COUNT 1000
 typedef struct Mutex_Test_Shared_Data {
     int counter;
@@ -1391,14 +3247,18 @@ void test_mutex() {
     // Test initialization
     mutex_init(&m);
     assert(m.spin_time_microseconds == MUTEX_DEFAULT_SPIN_TIME_MICROSECONDS, "Failed: Default spin time incorrect");
-    assert(!m.spinlock_acquired, "Failed: Spinlock should not be acquired after initialization");
+    assert(m.state == MUTEX_UNLOCKED, "Failed: Mutex should not be acquired after initialization");
 
     // Test acquire and release without contention
     mutex_acquire_or_wait(&m);
-    assert(m.spinlock_acquired, "Failed: Mutex should be acquired after mutex_acquire_or_wait");
+    assert(m.state == MUTEX_LOCKED, "Failed: Mutex should be acquired after mutex_acquire_or_wait");
+    assert(!mutex_try_acquire(&m), "Failed: mutex_try_acquire should fail on an acquired mutex");
     
     mutex_release(&m);
-    assert(!m.spinlock_acquired, "Failed: Spinlock should not be acquired after mutex_release");
+    assert(m.state == MUTEX_UNLOCKED, "Failed: Mutex should not be acquired after mutex_release");
+    
+    assert(mutex_try_acquire(&m), "Failed: mutex_try_acquire should succeed on a free mutex");
+    mutex_release(&m);
 
     // Clean up
     mutex_destroy(&m);
@@ -1429,6 +3289,153 @@ void test_mutex() {
     mutex_destroy(&data.mutex);
 }
 
+#define SYNC_TEST_QUEUE_CAPACITY 8
+#define SYNC_TEST_ITEMS_PER_PRODUCER 2000
+typedef struct Sync_Test_Queue {
+	Mutex mutex;
+	Condition_Variable not_empty;
+	Condition_Variable not_full;
+	u64 items[SYNC_TEST_QUEUE_CAPACITY];
+	u64 read;
+	u64 write;
+	u64 consumed_sum;
+	u64 consumed_count;
+	bool done;
+	
+	Semaphore available;
+	Semaphore finished;
+	volatile u32 semaphore_taken;
+} Sync_Test_Queue;
+void sync_test_producer(Thread *t) {
+	Sync_Test_Queue *q = (Sync_Test_Queue*)t->data;
+	for (u64 i = 1; i <= SYNC_TEST_ITEMS_PER_PRODUCER; i++) {
+		mutex_acquire_or_wait(&q->mutex);
+		while (q->write - q->read == SYNC_TEST_QUEUE_CAPACITY) {
+			condition_variable_wait(&q->not_full, &q->mutex);
+		}
+		q->items[q->write % SYNC_TEST_QUEUE_CAPACITY] = i;
+		q->write += 1;
+		condition_variable_signal(&q->not_empty);
+		mutex_release(&q->mutex);
+	}
+}
+void sync_test_consumer(Thread *t) {
+	Sync_Test_Queue *q = (Sync_Test_Queue*)t->data;
+	mutex_acquire_or_wait(&q->mutex);
+	while (true) {
+		while (q->write == q->read && !q->done) {
+			condition_variable_wait(&q->not_empty, &q->mutex);
+		}
+		if (q->write == q->read) break;
+		q->consumed_sum += q->items[q->read % SYNC_TEST_QUEUE_CAPACITY];
+		q->consumed_count += 1;
+		q->read += 1;
+		condition_variable_signal(&q->not_full);
+	}
+	mutex_release(&q->mutex);
+}
+void sync_test_semaphore_consumer(Thread *t) {
+	Sync_Test_Queue *q = (Sync_Test_Queue*)t->data;
+	while (true) {
+		semaphore_wait(&q->available);
+		if (q->done) break;
+		atomic_fetch_add_32(&q->semaphore_taken, 1);
+		semaphore_signal(&q->finished, 1);
+	}
+}
+void test_condition_variable_and_semaphore() {
+	Allocator allocator = get_heap_allocator();
+	Sync_Test_Queue *q = alloc(allocator, sizeof(Sync_Test_Queue));
+	memset(q, 0, sizeof(Sync_Test_Queue));
+	mutex_init(&q->mutex);
+	condition_variable_init(&q->not_empty);
+	condition_variable_init(&q->not_full);
+	
+	// Timing out with nothing signaled gives the mutex back
+	mutex_acquire_or_wait(&q->mutex);
+	f64 start = os_get_elapsed_seconds();
+	bool woken = condition_variable_wait_timeout(&q->not_empty, &q->mutex, 0.005);
+	f64 waited = os_get_elapsed_seconds()-start;
+	assert(q->mutex.acquiring_thread == context.thread_id, "Failed: condition_variable_wait_timeout should take the mutex again");
+	assert(!woken || waited < 0.005, "Failed: condition_variable_wait_timeout returned true without a signal after %f seconds", waited);
+	mutex_release(&q->mutex);
+	condition_variable_signal(&q->not_empty);
+	condition_variable_broadcast(&q->not_empty);
+	
+	// Producers and consumers through a small bounded queue
+	const u64 producer_count = 4;
+	const u64 consumer_count = 3;
+	Thread *producers = alloc(allocator, sizeof(Thread)*producer_count);
+	Thread *consumers = alloc(allocator, sizeof(Thread)*consumer_count);
+	for (u64 i = 0; i < producer_count; i++) {
+		os_thread_init(&producers[i], sync_test_producer);
+		producers[i].data = q;
+		os_thread_start(&producers[i]);
+	}
+	for (u64 i = 0; i < consumer_count; i++) {
+		os_thread_init(&consumers[i], sync_test_consumer);
+		consumers[i].data = q;
+		os_thread_start(&consumers[i]);
+	}
+	for (u64 i = 0; i < producer_count; i++) {
+		os_thread_join(&producers[i]);
+	}
+	mutex_acquire_or_wait(&q->mutex);
+	q->done = true;
+	condition_variable_broadcast(&q->not_empty);
+	mutex_release(&q->mutex);
+	for (u64 i = 0; i < consumer_count; i++) {
+		os_thread_join(&consumers[i]);
+	}
+	
+	u64 expected_sum = producer_count*(SYNC_TEST_ITEMS_PER_PRODUCER*(SYNC_TEST_ITEMS_PER_PRODUCER+1)/2);
+	assert(q->consumed_count == producer_count*SYNC_TEST_ITEMS_PER_PRODUCER, "Failed: Consumed %i items, expected %i", q->consumed_count, producer_count*SYNC_TEST_ITEMS_PER_PRODUCER);
+	assert(q->consumed_sum == expected_sum, "Failed: Consumed items sum to %i, expected %i", q->consumed_sum, expected_sum);
+	
+	// Semaphore without contention
+	Semaphore s;
+	semaphore_init(&s, 2);
+	assert(semaphore_try_wait(&s), "Failed: semaphore_try_wait with count 2");
+	semaphore_wait(&s);
+	assert(!semaphore_try_wait(&s), "Failed: semaphore_try_wait should fail with count 0");
+	assert(!semaphore_wait_timeout(&s, 0.002), "Failed: semaphore_wait_timeout should time out with count 0");
+	semaphore_signal(&s, 3);
+	assert(semaphore_wait_timeout(&s, 0.002), "Failed: semaphore_wait_timeout with count 3");
+	assert(s.count == 2, "Failed: Semaphore count is %i, expected 2", s.count);
+	
+	// Every signal lets exactly one wait through
+	q->done = false;
+	semaphore_init(&q->available, 0);
+	semaphore_init(&q->finished, 0);
+	for (u64 i = 0; i < consumer_count; i++) {
+		os_thread_init(&consumers[i], sync_test_semaphore_consumer);
+		consumers[i].data = q;
+		os_thread_start(&consumers[i]);
+	}
+	const u32 signal_count = 5000;
+	u32 signaled = 0;
+	while (signaled < signal_count) {
+		u32 n = min(signal_count-signaled, (signaled % 3) + 1);
+		semaphore_signal(&q->available, n);
+		signaled += n;
+	}
+	for (u32 i = 0; i < signal_count; i++) {
+		semaphore_wait(&q->finished);
+	}
+	assert(q->semaphore_taken == signal_count, "Failed: Semaphore let %i waits through, expected %i", q->semaphore_taken, signal_count);
+	assert(!semaphore_try_wait(&q->finished), "Failed: Semaphore was signaled more times than it was waited on");
+	
+	q->done = true;
+	semaphore_signal(&q->available, (u32)consumer_count);
+	for (u64 i = 0; i < consumer_count; i++) {
+		os_thread_join(&consumers[i]);
+	}
+	
+	dealloc(allocator, producers);
+	dealloc(allocator, consumers);
+	dealloc(allocator, q);
+}
+
 #ifndef OOGABOOGA_HEADLESS
 int compare_draw_quads(const void *a, const void *b) {
     return ((Draw_Quad*)a)->z-((Draw_Quad*)b)->z;
@@ -1499,6 +3506,64 @@ void test_sort() {
     
     print("Merge sort took on average %llu cycles and %.2f ms\n", cycles / num_samples, (seconds * 1000.0) / (float64)num_samples);
 }
+void test_draw_frame_world_to_clip() {
+	const u64 quad_count = 40000;
+	Draw_Frame frame;
+	draw_frame_init_reserve(&frame, quad_count);
+	draw_frame_reset(&frame);
+	
+	float32 aspect = (float32)window.width/(float32)window.height;
+	float32 pixel_width = 2.0f/(float32)window.width;
+	float32 pixel_height = 2.0f/(float32)window.height;
+	frame.projection = m4_make_orthographic_projection(-aspect, aspect, -1, 1, -1, 10);
+	
+	// Changing projection or camera_xform between draws must be picked up
+	for (int i = 0; i < 4; i++) {
+		if (i == 2) frame.projection = m4_make_orthographic_projection(-aspect*2, aspect*2, -2, 2, -1, 10);
+		else        frame.camera_xform = m4_translate(frame.camera_xform, v3(0.1, -0.05, 0));
+		
+		Matrix4 expected = m4_mul(frame.projection, m4_inverse(frame.camera_xform));
+		Matrix4 world_to_clip = draw_frame_get_world_to_clip(&frame);
+		assert(memcmp(&world_to_clip, &expected, sizeof(Matrix4)) == 0, "Failed: world_to_clip was not updated after changing the camera (%i)", i);
+		
+		Matrix4 xform = m4_rotate_z(m4_make_translation(v3(0.2, 0.1, 0)), 0.3f);
+		Draw_Quad *q = draw_rect_xform_in_frame(xform, v2(0.1, 0.1), COLOR_WHITE, &frame);
+		Vector2 top_right = m4_transform(m4_mul(expected, xform), v4(0.1, 0.1, 0, 1)).xy;
+		assert(fabsf(q->top_right.x-top_right.x) <= pixel_width && fabsf(q->top_right.y-top_right.y) <= pixel_height, "Failed: draw_rect_xform_in_frame put the quad at %f, %f, expected %f, %f", q->top_right.x, q->top_right.y, top_right.x, top_right.y);
+		
+		q = draw_rect_in_frame(v2(0.2, 0.1), v2(0.1, 0.1), COLOR_WHITE, &frame);
+		Vector2 bottom_left = m4_transform(expected, v4(0.2, 0.1, 0, 1)).xy;
+		assert(fabsf(q->bottom_left.x-bottom_left.x) <= pixel_width && fabsf(q->bottom_left.y-bottom_left.y) <= pixel_height, "Failed: draw_rect_in_frame put the quad at %f, %f, expected %f, %f", q->bottom_left.x, q->bottom_left.y, bottom_left.x, bottom_left.y);
+	}
+	
+	// Like examples/renderer_stress_test.c, lots of small quads spread over the screen
+	draw_frame_reset(&frame);
+	frame.projection = m4_make_orthographic_projection(-aspect, aspect, -1, 1, -1, 10);
+	frame.camera_xform = m4_make_translation(v3(0.05, 0.02, 0));
+	f64 start = os_get_elapsed_seconds();
+	for (u64 i = 0; i < quad_count; i++) {
+		float32 x = (float32)(i % 200)/100.0f*aspect - aspect;
+		float32 y = (float32)(i / 200)/100.0f - 1.0f;
+		draw_rect_in_frame(v2(x, y), v2(0.1, 0.1), COLOR_WHITE, &frame);
+	}
+	f64 rect_seconds = os_get_elapsed_seconds()-start;
+	
+	draw_frame_reset(&frame);
+	frame.projection = m4_make_orthographic_projection(-aspect, aspect, -1, 1, -1, 10);
+	frame.camera_xform = m4_make_translation(v3(0.05, 0.02, 0));
+	start = os_get_elapsed_seconds();
+	for (u64 i = 0; i < quad_count; i++) {
+		float32 x = (float32)(i % 200)/100.0f*aspect - aspect;
+		float32 y = (float32)(i / 200)/100.0f - 1.0f;
+		Matrix4 xform = m4_rotate_z(m4_make_translation(v3(x, y, 0)), (float32)i*0.01f);
+		draw_rect_xform_in_frame(xform, v2(0.1, 0.1), COLOR_WHITE, &frame);
+	}
+	f64 xform_seconds = os_get_elapsed_seconds()-start;
+	
+	print("\n\tdraw_rect %.0f quads/ms, draw_rect_xform %.0f quads/ms\n", (f64)quad_count/(rect_seconds*1000.0), (f64)quad_count/(xform_seconds*1000.0));
+	
+	growing_array_deinit((void**)&frame.quad_buffer);
+}
 #endif /* OOGABOOGA_HEADLESS */
 
 typedef struct Test_Thing {
@@ -1698,6 +3763,336 @@ void test_os_binary_semaphore() {
 
 }
 
+volatile u64 job_test_counter = 0;
+void job_test_increment(void *data) {
+	atomic_fetch_add_64(&job_test_counter, 1);
+	
+	// Each worker has its own temporary storage, so this must not be stomped by another job.
+	// Only on workers since they reset it after each job, other threads that help out don't.
+	if (job_system_get_thread_index() <= 0) return;
+	u64 id = (u64)data;
+	u64 *scratch = (u64*)talloc(8*sizeof(u64));
+	for (u64 i = 0; i < 8; i++) scratch[i] = id;
+	for (u64 i = 0; i < 8; i++) assert(scratch[i] == id, "Failed: temporary storage shared between jobs");
+}
+
+typedef struct Job_Test_Sum {
+	u64 *numbers;
+	u64 start;
+	u64 end;
+	u64 result;
+} Job_Test_Sum;
+// Fork-join, so jobs wait on counters from inside other jobs
+void job_test_sum(void *data) {
+	Job_Test_Sum *s = (Job_Test_Sum*)data;
+	if (s->end - s->start <= 1000) {
+		s->result = 0;
+		for (u64 i = s->start; i < s->end; i++) s->result += s->numbers[i];
+		return;
+	}
+	u64 mid = s->start + (s->end - s->start)/2;
+	Job_Test_Sum left  = { s->numbers, s->start, mid, 0 };
+	Job_Test_Sum right = { s->numbers, mid, s->end, 0 };
+	Job_Counter counter = ZERO(Job_Counter);
+	job_run(job_test_sum, &right, &counter);
+	job_test_sum(&left);
+	job_wait_for_counter(&counter);
+	s->result = left.result + right.result;
+}
+
+void job_test_mark(u64 start, u64 end, void *data) {
+	u8 *marks = (u8*)data;
+	for (u64 i = start; i < end; i++) marks[i] += 1;
+}
+
+typedef struct Job_Test_Work {
+	f32 *values;
+	u64 iterations;
+} Job_Test_Work;
+void job_test_work(u64 start, u64 end, void *data) {
+	Job_Test_Work *w = (Job_Test_Work*)data;
+	for (u64 i = start; i < end; i++) {
+		f32 x = (f32)i;
+		for (u64 k = 0; k < w->iterations; k++) x = x*0.999f + 1.0f;
+		w->values[i] = x;
+	}
+}
+
+void job_test_outside_thread(Thread *t) {
+	Job_Counter *counter = (Job_Counter*)t->data;
+	for (u64 i = 0; i < 2000; i++) job_run(job_test_increment, (void*)i, counter);
+}
+
+void test_job_system() {
+	// Not initialized, everything runs right away
+	job_test_counter = 0;
+	Job_Counter counter = ZERO(Job_Counter);
+	job_run(job_test_increment, 0, &counter);
+	assert(job_test_counter == 1 && job_counter_is_done(&counter), "Failed: job_run without job system");
+	
+	u64 worker_counts[] = { 0, 1, 3 };
+	for (u64 w = 0; w < sizeof(worker_counts)/sizeof(u64); w++) {
+		job_system_init(worker_counts[w]);
+		assert(job_system_get_thread_index() == 0, "Failed: init thread index");
+		
+		// Lots of small jobs, more than fit in the deque
+		job_test_counter = 0;
+		counter = ZERO(Job_Counter);
+		for (u64 i = 0; i < 10000; i++) job_run(job_test_increment, (void*)i, &counter);
+		job_wait_for_counter(&counter);
+		assert(job_test_counter == 10000, "Failed: %i of 10000 jobs ran", job_test_counter);
+		
+		// Jobs from a thread which is not part of the job system
+		job_test_counter = 0;
+		counter = ZERO(Job_Counter);
+		Thread t;
+		os_thread_init(&t, job_test_outside_thread);
+		t.data = &counter;
+		os_thread_start(&t);
+		os_thread_join(&t);
+		os_thread_destroy(&t);
+		job_wait_for_counter(&counter);
+		assert(job_test_counter == 2000, "Failed: %i of 2000 jobs from another thread ran", job_test_counter);
+		
+		// Nested waits
+		u64 number_count = 1000000;
+		u64 *numbers = (u64*)alloc(get_heap_allocator(), number_count*sizeof(u64));
+		u64 expected = 0;
+		for (u64 i = 0; i < number_count; i++) {
+			numbers[i] = xx_hash(i) % 1000;
+			expected += numbers[i];
+		}
+		Job_Test_Sum sum = { numbers, 0, number_count, 0 };
+		counter = ZERO(Job_Counter);
+		job_run(job_test_sum, &sum, &counter);
+		job_wait_for_counter(&counter);
+		assert(sum.result == expected, "Failed: fork-join sum");
+		dealloc(get_heap_allocator(), numbers);
+		
+		// Every index exactly once, for all kinds of batch sizes
+		u8 marks[5000];
+		u64 batch_sizes[] = { 0, 1, 7, 64, 5000, 100000 };
+		for (u64 b = 0; b < sizeof(batch_sizes)/sizeof(u64); b++) {
+			memset(marks, 0, sizeof(marks));
+			parallel_for(sizeof(marks), batch_sizes[b], job_test_mark, marks);
+			for (u64 i = 0; i < sizeof(marks); i++) {
+				assert(marks[i] == 1, "Failed: parallel_for batch size %i did index %i %i times", batch_sizes[b], i, (u64)marks[i]);
+			}
+		}
+		parallel_for(0, 0, job_test_mark, marks);
+		
+		job_system_shutdown();
+		assert(job_system_get_thread_count() == 1, "Failed: job_system_shutdown");
+	}
+	
+	// Speedup on something that's actually parallel
+	job_system_init(0);
+	u64 value_count = 1024*256;
+	Job_Test_Work work = { (f32*)alloc(get_heap_allocator(), value_count*sizeof(f32)), 200 };
+	
+	u64 start = rdtsc();
+	job_test_work(0, value_count, &work);
+	u64 serial_cycles = rdtsc()-start;
+	f32 check = work.values[value_count-1];
+	
+	start = rdtsc();
+	parallel_for(value_count, 0, job_test_work, &work);
+	u64 parallel_cycles = rdtsc()-start;
+	assert(work.values[value_count-1] == check, "Failed: parallel_for result");
+	
+	print("\n\t%i threads: serial %.2fM cycles, parallel_for %.2fM cycles (%.2fx)\n", job_system_get_thread_count(), (f64)serial_cycles/1000000.0, (f64)parallel_cycles/1000000.0, (f64)serial_cycles/(f64)parallel_cycles);
+	
+	dealloc(get_heap_allocator(), work.values);
+	job_system_shutdown();
+}
+
+#define RING_TEST_MAX_THREADS 8
+#define RING_TEST_MAX_BATCH 32
+typedef struct Ring_Test_Thread {
+	Spsc_Ring *spsc;
+	Mpmc_Ring *mpmc;
+	u64 id;
+	u64 count; // For producers
+	u64 batch;
+	volatile u64 *consumed;
+	u64 total;
+	u64 sum;
+	u64 last_seen[RING_TEST_MAX_THREADS];
+} Ring_Test_Thread;
+void ring_test_producer(Thread *t) {
+	Ring_Test_Thread *p = (Ring_Test_Thread*)t->data;
+	u64 items[RING_TEST_MAX_BATCH];
+	u64 next = 1;
+	while (next <= p->count) {
+		u64 n = min(p->batch, p->count-next+1);
+		for (u64 i = 0; i < n; i++) items[i] = (p->id << 32) | (next+i);
+		
+		u64 pushed;
+		if (p->batch == 1) {
+			pushed = p->spsc ? spsc_ring_push(p->spsc, items) : mpmc_ring_push(p->mpmc, items);
+		} else {
+			pushed = p->spsc ? spsc_ring_push_many(p->spsc, items, n) : mpmc_ring_push_many(p->mpmc, items, n);
+		}
+		if (pushed == 0) os_yield_thread();
+		next += pushed;
+	}
+}
+void ring_test_consumer(Thread *t) {
+	Ring_Test_Thread *c = (Ring_Test_Thread*)t->data;
+	u64 items[RING_TEST_MAX_BATCH];
+	while (atomic_load_acquire_64(c->consumed) < c->total) {
+		u64 popped;
+		if (c->batch == 1) {
+			popped = c->spsc ? spsc_ring_pop(c->spsc, items) : mpmc_ring_pop(c->mpmc, items);
+		} else {
+			popped = c->spsc ? spsc_ring_pop_many(c->spsc, items, c->batch) : mpmc_ring_pop_many(c->mpmc, items, c->batch);
+		}
+		if (popped == 0) {
+			os_yield_thread();
+			continue;
+		}
+		atomic_fetch_add_64(c->consumed, (s64)popped);
+		for (u64 i = 0; i < popped; i++) {
+			u64 producer = items[i] >> 32;
+			u64 sequence = items[i] & 0xFFFFFFFF;
+			// Any one consumer sees each producer's items in the order they were pushed
+			assert(sequence > c->last_seen[producer], "Failed: Ring item %i from producer %i came after %i", sequence, producer, c->last_seen[producer]);
+			c->last_seen[producer] = sequence;
+			c->sum += sequence;
+		}
+	}
+}
+// Returns rdtsc cycles per item
+f64 ring_test_run(bool mpmc, u64 producer_count, u64 consumer_count, u64 batch, u64 items_per_producer) {
+	Allocator allocator = get_heap_allocator();
+	Spsc_Ring *spsc = 0;
+	Mpmc_Ring *mpmc_ring = 0;
+	if (mpmc) {
+		mpmc_ring = alloc(allocator, sizeof(Mpmc_Ring));
+		mpmc_ring_init(mpmc_ring, sizeof(u64), 1024, allocator);
+	} else {
+		assert(producer_count == 1 && consumer_count == 1, "Spsc_Ring test with more than 1 producer or consumer");
+		spsc = alloc(allocator, sizeof(Spsc_Ring));
+		spsc_ring_init(spsc, sizeof(u64), 1024, allocator);
+	}
+	
+	volatile u64 consumed = 0;
+	Ring_Test_Thread *data = alloc(allocator, sizeof(Ring_Test_Thread)*(producer_count+consumer_count));
+	Thread *threads = alloc(allocator, sizeof(Thread)*(producer_count+consumer_count));
+	memset(data, 0, sizeof(Ring_Test_Thread)*(producer_count+consumer_count));
+	for (u64 i = 0; i < producer_count+consumer_count; i++) {
+		bool producer = i < producer_count;
+		data[i].spsc = spsc;
+		data[i].mpmc = mpmc_ring;
+		data[i].id = i;
+		data[i].count = items_per_producer;
+		data[i].batch = batch;
+		data[i].consumed = &consumed;
+		data[i].total = producer_count*items_per_producer;
+		os_thread_init(&threads[i], producer ? ring_test_producer : ring_test_consumer);
+		threads[i].data = &data[i];
+	}
+	
+	u64 start = rdtsc();
+	for (u64 i = 0; i < producer_count+consumer_count; i++) os_thread_start(&threads[i]);
+	for (u64 i = 0; i < producer_count+consumer_count; i++) os_thread_join(&threads[i]);
+	u64 cycles = rdtsc()-start;
+	
+	u64 sum = 0;
+	for (u64 i = producer_count; i < producer_count+consumer_count; i++) sum += data[i].sum;
+	u64 expected_sum = producer_count*(items_per_producer*(items_per_producer+1)/2);
+	assert(consumed == producer_count*items_per_producer, "Failed: Consumed %i ring items, expected %i", consumed, producer_count*items_per_producer);
+	assert(sum == expected_sum, "Failed: Ring items sum to %i, expected %i", sum, expected_sum);
+	
+	if (mpmc) {
+		assert(mpmc_ring_count(mpmc_ring) == 0, "Failed: Mpmc_Ring should be empty");
+		mpmc_ring_destroy(mpmc_ring);
+		dealloc(allocator, mpmc_ring);
+	} else {
+		assert(spsc_ring_count(spsc) == 0, "Failed: Spsc_Ring should be empty");
+		spsc_ring_destroy(spsc);
+		dealloc(allocator, spsc);
+	}
+	dealloc(allocator, data);
+	dealloc(allocator, threads);
+	
+	return (f64)cycles/(f64)(producer_count*items_per_producer);
+}
+typedef struct Ring_Test_Item {
+	u32 a, b, c; // 12 bytes so Mpmc_Ring slots need padding
+} Ring_Test_Item;
+void test_ring_buffers() {
+	Allocator allocator = get_heap_allocator();
+	
+	// Single threaded: full, empty, wrapping around and partial batches
+	Spsc_Ring spsc;
+	spsc_ring_init(&spsc, sizeof(Ring_Test_Item), 8, allocator);
+	Mpmc_Ring mpmc;
+	mpmc_ring_init(&mpmc, sizeof(Ring_Test_Item), 8, allocator);
+	
+	Ring_Test_Item item, items[16];
+	assert(!spsc_ring_pop(&spsc, &item), "Failed: Pop from empty Spsc_Ring");
+	assert(!mpmc_ring_pop(&mpmc, &item), "Failed: Pop from empty Mpmc_Ring");
+	assert(spsc_ring_pop_many(&spsc, items, 16) == 0, "Failed: Pop many from empty Spsc_Ring");
+	assert(mpmc_ring_pop_many(&mpmc, items, 16) == 0, "Failed: Pop many from empty Mpmc_Ring");
+	
+	u32 next_push = 0;
+	u32 next_pop = 0;
+	for (u32 round = 0; round < 20; round++) {
+		// Leaves a different number of items in the ring each round so the batches wrap at different spots
+		u32 push_count = (round % 5) + 3;
+		for (u32 i = 0; i < 16; i++) items[i] = (Ring_Test_Item){next_push+i, round, ~(next_push+i)};
+		u64 pushed_spsc = spsc_ring_push_many(&spsc, items, push_count);
+		u64 pushed_mpmc = mpmc_ring_push_many(&mpmc, items, push_count);
+		assert(pushed_spsc == pushed_mpmc, "Failed: Spsc_Ring pushed %i, Mpmc_Ring pushed %i", pushed_spsc, pushed_mpmc);
+		assert(pushed_spsc == min(push_count, 8 - (next_push-next_pop)), "Failed: Pushed %i of %i items", pushed_spsc, push_count);
+		next_push += (u32)pushed_spsc;
+		assert(spsc_ring_count(&spsc) == next_push-next_pop, "Failed: spsc_ring_count");
+		assert(mpmc_ring_count(&mpmc) == next_push-next_pop, "Failed: mpmc_ring_count");
+		
+		if (next_push-next_pop == 8) {
+			assert(!spsc_ring_push(&spsc, items), "Failed: Push to full Spsc_Ring");
+			assert(!mpmc_ring_push(&mpmc, items), "Failed: Push to full Mpmc_Ring");
+		}
+		
+		u32 pop_count = (round % 3) + 2;
+		for (u32 i = 0; i < pop_count; i++) {
+			bool from_mpmc = (round+i) % 2 == 0;
+			Ring_Test_Item a, b;
+			bool popped_spsc = spsc_ring_pop(&spsc, &a);
+			bool popped_mpmc = from_mpmc ? mpmc_ring_pop(&mpmc, &b) : mpmc_ring_pop_many(&mpmc, &b, 1) == 1;
+			assert(popped_spsc == popped_mpmc, "Failed: Spsc_Ring and Mpmc_Ring disagree on being empty");
+			if (!popped_spsc) break;
+			assert(a.a == next_pop && a.c == ~next_pop, "Failed: Spsc_Ring popped %i, expected %i", a.a, next_pop);
+			assert(b.a == next_pop && b.c == ~next_pop, "Failed: Mpmc_Ring popped %i, expected %i", b.a, next_pop);
+			next_pop += 1;
+		}
+	}
+	u64 left = next_push-next_pop;
+	assert(spsc_ring_pop_many(&spsc, items, 16) == left, "Failed: Spsc_Ring pop many should return the %i items left", left);
+	assert(mpmc_ring_pop_many(&mpmc, items, 16) == left, "Failed: Mpmc_Ring pop many should return the %i items left", left);
+	assert(items[left-1].a == next_push-1, "Failed: Last item popped from Mpmc_Ring is %i, expected %i", items[left-1].a, next_push-1);
+	spsc_ring_destroy(&spsc);
+	mpmc_ring_destroy(&mpmc);
+	
+	// Threaded, checks that every item arrives once and in order per producer
+	const u64 item_count = 1 << 17;
+	print("\n");
+	for (u64 batch = 1; batch <= RING_TEST_MAX_BATCH; batch *= RING_TEST_MAX_BATCH) {
+		f64 cycles = ring_test_run(false, 1, 1, batch, item_count);
+		print("\tSpsc_Ring 1:1 batch %2i: %6.1f cycles per item\n", batch, cycles);
+	}
+	u64 thread_counts[][2] = { {1, 1}, {2, 2}, {4, 4}, {1, 4}, {4, 1} };
+	for (u64 batch = 1; batch <= RING_TEST_MAX_BATCH; batch *= RING_TEST_MAX_BATCH) {
+		for (u64 i = 0; i < sizeof(thread_counts)/sizeof(thread_counts[0]); i++) {
+			u64 producers = thread_counts[i][0];
+			u64 consumers = thread_counts[i][1];
+			f64 cycles = ring_test_run(true, producers, consumers, batch, item_count/producers);
+			print("\tMpmc_Ring %i:%i batch %2i: %6.1f cycles per item\n", producers, consumers, batch, cycles);
+		}
+	}
+}
+
 void oogabooga_run_tests() {
 	
 	print("Testing growing array... ");
@@ -1707,7 +4102,43 @@ void oogabooga_run_tests() {
 	print("Testing allocator... ");
 	test_allocator(true);
 	print("OK!\n");
-	
+
+	print("Testing heap allocator trace... ");
+	test_heap_allocator_trace();
+	print("OK!\n");
+
+	print("Testing large heap allocations... ");
+	test_heap_large_allocations();
+	print("OK!\n");
+
+	print("Testing heap realloc in place... ");
+	test_heap_realloc_in_place();
+	print("OK!\n");
+
+	print("Testing heap maintenance... ");
+	test_heap_maintenance();
+	print("OK!\n");
+
+	print("Testing allocation trace... ");
+	test_allocation_trace();
+	print("OK!\n");
+
+	print("Testing arenas... ");
+	test_arenas();
+	print("OK!\n");
+
+	print("Testing scratch scopes... ");
+	test_scratch_scopes();
+	print("OK!\n");
+
+	print("Testing pool allocator... ");
+	test_pool_allocator();
+	print("OK!\n");
+
+	print("Testing heap thread caches... ");
+	test_heap_thread_caches();
+	print("OK!\n");
+
 	print("Testing threads... ");
 	test_threads();
 	print("OK!\n");
@@ -1716,6 +4147,26 @@ void oogabooga_run_tests() {
 	test_strings();
 	print("OK!\n");
 	
+	print("Testing chunked string builder... ");
+	test_string_builder_chunks();
+	print("OK!\n");
+	
+	print("Testing string search... ");
+	test_string_search();
+	print("OK!\n");
+	
+	print("Testing utf8 bulk decode and validation... ");
+	test_utf8_bulk();
+	print("OK!\n");
+	
+	print("Testing string format... ");
+	test_string_format();
+	print("OK!\n");
+	
+	print("Testing string interner... ");
+	test_string_interner();
+	print("OK!\n");
+	
 	print("Testing file IO... ");
 	test_file_io();
 	print("OK!\n");
@@ -1732,26 +4183,66 @@ void oogabooga_run_tests() {
 	test_simd();
 	print("OK!\n");
 	
+	print("Testing string hash... ");
+	test_string_hash();
+	print("OK!\n");
+	
 	print("Testing hash table... ");
 	test_hash_table();
 	print("OK!\n");
 	
+	print("Testing swiss table... ");
+	test_swiss_table();
+	print("OK!\n");
+	
+	print("Testing hash table performance... ");
+	test_hash_table_performance();
+	print("OK!\n");
+	
+	print("Testing concurrent hash map... ");
+	test_concurrent_hash_map();
+	print("OK!\n");
+	
 	print("Testing random distribution... ");
 	test_random_distribution();
 	print("OK!\n");
 	
+	print("Testing random streams... ");
+	test_random_streams();
+	print("OK!\n");
+	
+	print("Testing spinlocks... ");
+	test_spinlocks();
+	print("OK!\n");
+	
 	print("Testing mutex... ");
 	test_mutex();
 	print("OK!\n");
 	
+	print("Testing condition variable and semaphore... ");
+	test_condition_variable_and_semaphore();
+	print("OK!\n");
+	
 	print("Testing binary semaphore... ");
 	test_os_binary_semaphore();
 	print("OK!\n");
+	
+	print("Testing job system... ");
+	test_job_system();
+	print("OK!\n");
+	
+	print("Testing ring buffers... ");
+	test_ring_buffers();
+	print("OK!\n");
 
 #ifndef OOGABOOGA_HEADLESS
 	print("Testing radix sort... ");
 	test_sort();
 	print("OK!\n");
+	
+	print("Testing draw frame world_to_clip... ");
+	test_draw_frame_world_to_clip();
+	print("OK!\n");
 #endif
 
 	
@@ -0,0 +1,581 @@
+
+// Replays an allocation trace recorded with allocation_trace_begin()/allocation_trace_end()
+// against different allocators. For each one it reports throughput, peak RSS and fragmentation.
+//
+// By default this is a standalone program that doesn't use oogabooga, so it builds headless on linux:
+//     gcc -O2 -o allocation_trace_replay oogabooga/tools/allocation_trace_replay.c
+//     ./allocation_trace_replay trace.bin           (every allocator)
+//     ./allocation_trace_replay trace.bin libc      (just one)
+//
+// To replay against the oogabooga heap (heap_alloc & heap_dealloc) as well, build it on top of
+// oogabooga with REPLAY_OOGABOOGA_HEAP, which means windows. Use the same libraries as build.bat,
+// and a release build or you're measuring the debug checks:
+//     clang -O2 -DNDEBUG -DREPLAY_OOGABOOGA_HEAP=1 -o allocation_trace_replay.exe oogabooga/tools/allocation_trace_replay.c -lkernel32 ...
+//     allocation_trace_replay.exe trace.bin            (libc, bump & oogabooga)
+//     allocation_trace_replay.exe trace.bin oogabooga  (just one)
+//
+// Every allocator is replayed in a fresh process (fork on linux, the same exe again on
+// windows), so peak RSS isn't polluted by the previous one.
+// To measure another allocator, implement the functions in Replay_Allocator and add it to
+// replay_allocators.
+//
+// Events are replayed on one thread in the order they were recorded. Temporary storage
+// allocations are replayed as regular allocations, which are freed when their scratch arena
+// is rewound. That's what the allocator would have to deal with if there was no temporary
+// storage.
+//
+// Fragmentation is how much of the memory the process gained during the replay (peak RSS
+// minus RSS before replay) was not used by live allocations at their peak:
+//     1 - peak_live_bytes / (peak_rss - baseline_rss)
+// Every allocation is touched once per page, like a game writing to its allocations would,
+// otherwise untouched pages wouldn't show up in RSS at all.
+
+#ifndef REPLAY_OOGABOOGA_HEAP
+	#define REPLAY_OOGABOOGA_HEAP 0
+#endif
+
+#if REPLAY_OOGABOOGA_HEAP
+
+#define OOGABOOGA_HEADLESS 1
+#define ENTRY_PROC replay_main
+#include <stdlib.h>
+#include <string.h>
+#include "../oogabooga.c"
+#include <psapi.h>
+// The replay compares against libc, so it needs the real malloc & free
+#undef malloc
+#undef free
+// oogabooga replaces printf, and its %s takes a char* as well
+#define print_error(...) printf(__VA_ARGS__)
+
+#else // REPLAY_OOGABOOGA_HEAP
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef double   float64;
+
+#define print_error(...) fprintf(stderr, __VA_ARGS__)
+
+// Must match memory.c
+#define ALLOCATION_TRACE_MAGIC 0x454341525442474Full // "OGBTRACE" in little endian
+#define ALLOCATION_TRACE_VERSION 1
+
+typedef enum Allocation_Trace_Event_Kind {
+	ALLOCATION_TRACE_ALLOCATE = 0,
+	ALLOCATION_TRACE_DEALLOCATE,
+	ALLOCATION_TRACE_REALLOCATE,
+	ALLOCATION_TRACE_TEMP_ALLOCATE,
+	ALLOCATION_TRACE_TEMP_REWIND,
+} Allocation_Trace_Event_Kind;
+
+typedef struct Allocation_Trace_Header {
+	u64 magic;
+	u32 version;
+	u32 event_size;
+} Allocation_Trace_Header;
+
+typedef struct Allocation_Trace_Event {
+	u64 cycles;
+	u64 pointer;
+	u64 old_pointer;
+	u64 size;
+	u32 thread_id;
+	u16 kind;
+	u16 arena;
+	u64 padding;
+} Allocation_Trace_Event;
+
+#endif // NOT REPLAY_OOGABOOGA_HEAP
+
+///
+// Platform
+
+#if REPLAY_OOGABOOGA_HEAP
+
+float64 seconds_now() {
+	return os_get_elapsed_seconds();
+}
+
+// Every replay gets a fresh process, so there's nothing to reset
+void reset_peak_rss() {}
+u64 get_rss(bool peak) {
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return peak ? (u64)counters.PeakWorkingSetSize : (u64)counters.WorkingSetSize;
+}
+
+u8 *read_entire_file(const char *path, u64 *size) {
+	string data;
+	if (!os_read_entire_file(path, &data, get_heap_allocator())) return 0;
+	*size = data.count;
+	return data.data;
+}
+
+#else // REPLAY_OOGABOOGA_HEAP
+
+float64 seconds_now() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (float64)t.tv_sec + (float64)t.tv_nsec/1e9;
+}
+
+// In bytes, from /proc/self/status
+u64 read_proc_status_kb(const char *field) {
+	FILE *f = fopen("/proc/self/status", "r");
+	if (!f) return 0;
+	char line[256];
+	u64 result = 0;
+	u64 field_length = strlen(field);
+	while (fgets(line, sizeof(line), f)) {
+		if (strncmp(line, field, field_length) == 0 && line[field_length] == ':') {
+			result = strtoull(line+field_length+1, 0, 10)*1024;
+			break;
+		}
+	}
+	fclose(f);
+	return result;
+}
+void reset_peak_rss() {
+	// Writing 5 to clear_refs resets VmHWM (linux 4.0+)
+	int fd = open("/proc/self/clear_refs", O_WRONLY);
+	if (fd < 0) return;
+	ssize_t ignored = write(fd, "5", 1);
+	(void)ignored;
+	close(fd);
+}
+u64 get_rss(bool peak) {
+	return read_proc_status_kb(peak ? "VmHWM" : "VmRSS");
+}
+
+u8 *read_entire_file(const char *path, u64 *size) {
+	FILE *f = fopen(path, "rb");
+	if (!f) return 0;
+	fseek(f, 0, SEEK_END);
+	*size = (u64)ftell(f);
+	fseek(f, 0, SEEK_SET);
+	u8 *data = (u8*)malloc(*size + 1);
+	bool ok = data && fread(data, 1, *size, f) == *size;
+	fclose(f);
+	if (!ok) {
+		free(data);
+		return 0;
+	}
+	return data;
+}
+
+#endif // NOT REPLAY_OOGABOOGA_HEAP
+
+///
+// Allocators
+
+typedef struct Replay_Allocator {
+	const char *name;
+	void  (*init)(void);
+	void *(*alloc)(u64 size);
+	void  (*dealloc)(void *p, u64 size);
+	void *(*realloc)(void *p, u64 old_size, u64 new_size);
+} Replay_Allocator;
+
+void  libc_init(void) {}
+void *libc_alloc(u64 size) { return malloc(size); }
+void  libc_dealloc(void *p, u64 size) { free(p); }
+void *libc_realloc(void *p, u64 old_size, u64 new_size) { return realloc(p, new_size); }
+
+// Never frees or reuses anything, so it shows how much memory the trace would need without
+// any reuse at all. Every realloc that grows has to copy.
+u8 *bump_next = 0;
+u8 *bump_end = 0;
+void bump_init(void) {
+	bump_next = 0;
+	bump_end = 0;
+}
+void *bump_alloc(u64 size) {
+	size = (size+15) & ~15ull;
+	if (bump_next + size > bump_end) {
+		u64 chunk_size = size > (64ull<<20) ? size : (64ull<<20);
+		bump_next = (u8*)malloc(chunk_size);
+		if (!bump_next) return 0;
+		bump_end = bump_next + chunk_size;
+	}
+	void *p = bump_next;
+	bump_next += size;
+	return p;
+}
+void bump_dealloc(void *p, u64 size) {}
+void *bump_realloc(void *p, u64 old_size, u64 new_size) {
+	if (new_size <= old_size) return p;
+	void *new = bump_alloc(new_size);
+	if (new && p) memcpy(new, p, old_size);
+	return new;
+}
+
+#if REPLAY_OOGABOOGA_HEAP
+// The engine heap, which oogabooga_init() already initialized. Reallocs go through
+// heap_allocator_proc so they get the same in-place resizing a game would.
+void  ogb_heap_init(void) {}
+void *ogb_heap_alloc(u64 size) { return heap_alloc(size); }
+void  ogb_heap_dealloc(void *p, u64 size) { heap_dealloc(p); }
+void *ogb_heap_realloc(void *p, u64 old_size, u64 new_size) { return heap_allocator_proc(new_size, p, ALLOCATOR_REALLOCATE, 0); }
+#endif
+
+Replay_Allocator replay_allocators[] = {
+	{ "libc", libc_init, libc_alloc, libc_dealloc, libc_realloc },
+	{ "bump", bump_init, bump_alloc, bump_dealloc, bump_realloc },
+#if REPLAY_OOGABOOGA_HEAP
+	{ "oogabooga", ogb_heap_init, ogb_heap_alloc, ogb_heap_dealloc, ogb_heap_realloc },
+#endif
+};
+#define REPLAY_ALLOCATOR_COUNT (sizeof(replay_allocators)/sizeof(replay_allocators[0]))
+
+///
+// Recorded pointer -> replayed allocation
+// Open addressing with linear probing & backward shift deletion, so no tombstones.
+
+typedef struct Live_Allocation {
+	u64 recorded; // 0 means empty
+	void *p;
+	u64 size;
+} Live_Allocation;
+
+typedef struct Live_Table {
+	Live_Allocation *slots;
+	u64 capacity; // Power of two
+	u64 count;
+} Live_Table;
+
+u64 hash_pointer(u64 x) {
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdull;
+	x ^= x >> 33;
+	return x;
+}
+
+void live_table_insert(Live_Table *t, u64 recorded, void *p, u64 size);
+void live_table_grow(Live_Table *t) {
+	Live_Table old = *t;
+	t->capacity = old.capacity ? old.capacity*2 : 1024;
+	t->slots = (Live_Allocation*)calloc(t->capacity, sizeof(Live_Allocation));
+	t->count = 0;
+	for (u64 i = 0; i < old.capacity; i++) {
+		if (old.slots[i].recorded) live_table_insert(t, old.slots[i].recorded, old.slots[i].p, old.slots[i].size);
+	}
+	free(old.slots);
+}
+void live_table_insert(Live_Table *t, u64 recorded, void *p, u64 size) {
+	if ((t->count+1)*4 > t->capacity*3) live_table_grow(t);
+	u64 mask = t->capacity-1;
+	u64 i = hash_pointer(recorded) & mask;
+	while (t->slots[i].recorded && t->slots[i].recorded != recorded) i = (i+1) & mask;
+	if (!t->slots[i].recorded) t->count += 1;
+	t->slots[i] = (Live_Allocation){ recorded, p, size };
+}
+Live_Allocation *live_table_find(Live_Table *t, u64 recorded) {
+	if (!t->capacity) return 0;
+	u64 mask = t->capacity-1;
+	u64 i = hash_pointer(recorded) & mask;
+	while (t->slots[i].recorded) {
+		if (t->slots[i].recorded == recorded) return &t->slots[i];
+		i = (i+1) & mask;
+	}
+	return 0;
+}
+void live_table_remove(Live_Table *t, Live_Allocation *slot) {
+	u64 mask = t->capacity-1;
+	u64 hole = (u64)(slot - t->slots);
+	u64 i = hole;
+	while (true) {
+		i = (i+1) & mask;
+		if (!t->slots[i].recorded) break;
+		u64 home = hash_pointer(t->slots[i].recorded) & mask;
+		// Move it back into the hole if the hole is between its home slot and where it is now
+		bool movable = (hole <= i) ? (home <= hole || home > i) : (home <= hole && home > i);
+		if (movable) {
+			t->slots[hole] = t->slots[i];
+			hole = i;
+		}
+	}
+	t->slots[hole].recorded = 0;
+	t->count -= 1;
+}
+
+///
+// Temporary storage
+// One stack of allocations per thread & scratch arena, in the order they were pushed.
+
+typedef struct Temp_Allocation {
+	u64 recorded;
+	u64 chunk;
+	void *p;
+	u64 size;
+} Temp_Allocation;
+
+typedef struct Temp_Arena {
+	u32 thread_id;
+	u16 arena;
+	Temp_Allocation *allocations;
+	u64 count;
+	u64 capacity;
+} Temp_Arena;
+
+Temp_Arena *temp_arenas = 0;
+u64 temp_arena_count = 0;
+
+Temp_Arena *get_temp_arena(u32 thread_id, u16 arena) {
+	for (u64 i = 0; i < temp_arena_count; i++) {
+		if (temp_arenas[i].thread_id == thread_id && temp_arenas[i].arena == arena) return &temp_arenas[i];
+	}
+	temp_arenas = (Temp_Arena*)realloc(temp_arenas, (temp_arena_count+1)*sizeof(Temp_Arena));
+	Temp_Arena *a = &temp_arenas[temp_arena_count];
+	temp_arena_count += 1;
+	memset(a, 0, sizeof(*a));
+	a->thread_id = thread_id;
+	a->arena = arena;
+	return a;
+}
+
+///
+// Replay
+
+typedef struct Replay_Result {
+	u64 op_count;
+	u64 failed_count;
+	float64 seconds; // Only time spent in the allocator
+	u64 peak_live_bytes;
+	u64 baseline_rss;
+	u64 peak_rss;
+} Replay_Result;
+
+void touch(void *p, u64 size) {
+	volatile u8 *bytes = (volatile u8*)p;
+	for (u64 i = 0; i < size; i += 4096) bytes[i] = 1;
+}
+
+Replay_Result replay(Replay_Allocator *allocator, Allocation_Trace_Event *events, u64 event_count) {
+	Replay_Result result;
+	memset(&result, 0, sizeof(result));
+
+	Live_Table live;
+	memset(&live, 0, sizeof(live));
+	u64 live_bytes = 0;
+
+	allocator->init();
+
+	reset_peak_rss();
+	result.baseline_rss = get_rss(false);
+
+	for (u64 i = 0; i < event_count; i++) {
+		Allocation_Trace_Event *e = &events[i];
+		float64 start;
+		switch ((Allocation_Trace_Event_Kind)e->kind) {
+			case ALLOCATION_TRACE_ALLOCATE: {
+				start = seconds_now();
+				void *p = allocator->alloc(e->size);
+				result.seconds += seconds_now()-start;
+				result.op_count += 1;
+				if (!p) { result.failed_count += 1; break; }
+				touch(p, e->size);
+				live_table_insert(&live, e->pointer, p, e->size);
+				live_bytes += e->size;
+				break;
+			}
+			case ALLOCATION_TRACE_DEALLOCATE: {
+				Live_Allocation *a = live_table_find(&live, e->pointer);
+				if (!a) { result.failed_count += 1; break; }
+				start = seconds_now();
+				allocator->dealloc(a->p, a->size);
+				result.seconds += seconds_now()-start;
+				result.op_count += 1;
+				live_bytes -= a->size;
+				live_table_remove(&live, a);
+				break;
+			}
+			case ALLOCATION_TRACE_REALLOCATE: {
+				Live_Allocation *a = live_table_find(&live, e->old_pointer);
+				if (!a) { result.failed_count += 1; break; }
+				void *old_p = a->p;
+				u64 old_size = a->size;
+				start = seconds_now();
+				void *p = allocator->realloc(old_p, old_size, e->size);
+				result.seconds += seconds_now()-start;
+				result.op_count += 1;
+				live_bytes -= old_size;
+				live_table_remove(&live, a);
+				if (!p) { result.failed_count += 1; break; }
+				if (e->size > old_size) touch((u8*)p+old_size, e->size-old_size);
+				live_table_insert(&live, e->pointer, p, e->size);
+				live_bytes += e->size;
+				break;
+			}
+			case ALLOCATION_TRACE_TEMP_ALLOCATE: {
+				Temp_Arena *arena = get_temp_arena(e->thread_id, e->arena);
+				start = seconds_now();
+				void *p = allocator->alloc(e->size ? e->size : 1);
+				result.seconds += seconds_now()-start;
+				result.op_count += 1;
+				if (!p) { result.failed_count += 1; break; }
+				touch(p, e->size);
+				if (arena->count == arena->capacity) {
+					arena->capacity = arena->capacity ? arena->capacity*2 : 256;
+					arena->allocations = (Temp_Allocation*)realloc(arena->allocations, arena->capacity*sizeof(Temp_Allocation));
+				}
+				arena->allocations[arena->count] = (Temp_Allocation){ e->pointer, e->old_pointer, p, e->size };
+				arena->count += 1;
+				live_bytes += e->size;
+				break;
+			}
+			case ALLOCATION_TRACE_TEMP_REWIND: {
+				Temp_Arena *arena = get_temp_arena(e->thread_id, e->arena);
+				// Pop everything in later chunks, and in this chunk at or after the rewound-to pointer
+				while (arena->count) {
+					Temp_Allocation *a = &arena->allocations[arena->count-1];
+					if (a->chunk == e->old_pointer && a->recorded < e->pointer) break;
+					start = seconds_now();
+					allocator->dealloc(a->p, a->size);
+					result.seconds += seconds_now()-start;
+					result.op_count += 1;
+					live_bytes -= a->size;
+					arena->count -= 1;
+				}
+				break;
+			}
+			default: {
+				print_error("Unknown event kind %u at event %llu\n", e->kind, (unsigned long long)i);
+				exit(1);
+			}
+		}
+		if (live_bytes > result.peak_live_bytes) result.peak_live_bytes = live_bytes;
+	}
+
+	result.peak_rss = get_rss(true);
+
+	return result;
+}
+
+void print_result(Replay_Allocator *allocator, Replay_Result r) {
+	u64 gained = r.peak_rss > r.baseline_rss ? r.peak_rss - r.baseline_rss : 0;
+	float64 fragmentation = gained ? 1.0 - (float64)r.peak_live_bytes/(float64)gained : 0.0;
+	if (fragmentation < 0) fragmentation = 0;
+	float64 ops_per_ms = r.seconds > 0 ? (float64)r.op_count/(r.seconds*1000.0) : 0;
+
+	printf("%-10s %12llu ops %10.1f ops/ms %10.2f MB peak live %10.2f MB peak RSS %8.3f fragmentation",
+		allocator->name, (unsigned long long)r.op_count, ops_per_ms,
+		(float64)r.peak_live_bytes/(1024.0*1024.0), (float64)gained/(1024.0*1024.0), fragmentation);
+	if (r.failed_count) printf(" (%llu failed ops)", (unsigned long long)r.failed_count);
+	printf("\n");
+}
+
+// Replays in a fresh process and prints the result. Returns false if that process crashed.
+#if REPLAY_OOGABOOGA_HEAP
+bool replay_in_new_process(Replay_Allocator *allocator, const char *trace_path, Allocation_Trace_Event *events, u64 event_count) {
+	// No fork, so run this exe again for just this allocator. It reads the trace again, but
+	// --result-only keeps it from printing the summary again.
+	char exe_path[MAX_PATH];
+	if (!GetModuleFileNameA(0, exe_path, MAX_PATH)) return false;
+	char command_line[MAX_PATH*3];
+	format_string_to_buffer_vararg(command_line, sizeof(command_line), "\"%cs\" \"%cs\" %cs --result-only", exe_path, trace_path, allocator->name);
+	
+	STARTUPINFOA startup_info = {0};
+	startup_info.cb = sizeof(startup_info);
+	PROCESS_INFORMATION process = {0};
+	if (!CreateProcessA(0, command_line, 0, 0, TRUE, 0, 0, 0, &startup_info, &process)) return false;
+	WaitForSingleObject(process.hProcess, INFINITE);
+	DWORD exit_code = 1;
+	GetExitCodeProcess(process.hProcess, &exit_code);
+	CloseHandle(process.hProcess);
+	CloseHandle(process.hThread);
+	return exit_code == 0;
+}
+#else
+bool replay_in_new_process(Replay_Allocator *allocator, const char *trace_path, Allocation_Trace_Event *events, u64 event_count) {
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid == 0) {
+		print_result(allocator, replay(allocator, events, event_count));
+		fflush(stdout);
+		_exit(0);
+	}
+	int status = 0;
+	waitpid(pid, &status, 0);
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+#endif
+
+#if REPLAY_OOGABOOGA_HEAP
+int replay_main(int argc, char **argv) {
+#else
+int main(int argc, char **argv) {
+#endif
+	if (argc < 2) {
+		print_error("Usage: %s <trace file> [allocator]\n", argv[0]);
+		return 1;
+	}
+	bool result_only = argc >= 4 && strcmp(argv[3], "--result-only") == 0;
+
+	u64 file_size = 0;
+	u8 *file = read_entire_file(argv[1], &file_size);
+	if (!file) {
+		print_error("Could not read %s\n", argv[1]);
+		return 1;
+	}
+	Allocation_Trace_Header header;
+	if (file_size < sizeof(header)) {
+		print_error("%s is not an allocation trace\n", argv[1]);
+		return 1;
+	}
+	memcpy(&header, file, sizeof(header));
+	if (header.magic != ALLOCATION_TRACE_MAGIC) {
+		print_error("%s is not an allocation trace\n", argv[1]);
+		return 1;
+	}
+	if (header.version != ALLOCATION_TRACE_VERSION || header.event_size != sizeof(Allocation_Trace_Event)) {
+		print_error("%s is trace version %u but this replays version %u\n", argv[1], header.version, ALLOCATION_TRACE_VERSION);
+		return 1;
+	}
+
+	u64 event_count = (file_size - sizeof(header)) / sizeof(Allocation_Trace_Event);
+	Allocation_Trace_Event *events = (Allocation_Trace_Event*)(file + sizeof(header));
+
+	if (!result_only) {
+		u64 kind_counts[5] = {0};
+		for (u64 i = 0; i < event_count; i++) {
+			if (events[i].kind < 5) kind_counts[events[i].kind] += 1;
+		}
+		float64 recorded_cycles = event_count ? (float64)(events[event_count-1].cycles - events[0].cycles) : 0;
+		printf("%llu events over %.0f recorded cycles: %llu alloc, %llu free, %llu realloc, %llu temp alloc, %llu temp rewind\n",
+			(unsigned long long)event_count, recorded_cycles,
+			(unsigned long long)kind_counts[0], (unsigned long long)kind_counts[1], (unsigned long long)kind_counts[2],
+			(unsigned long long)kind_counts[3], (unsigned long long)kind_counts[4]);
+	}
+
+	bool any = false;
+	for (u64 i = 0; i < REPLAY_ALLOCATOR_COUNT; i++) {
+		Replay_Allocator *allocator = &replay_allocators[i];
+		if (argc >= 3 && strcmp(argv[2], allocator->name) != 0) continue;
+		any = true;
+
+		if (result_only) {
+			print_result(allocator, replay(allocator, events, event_count));
+		} else if (!replay_in_new_process(allocator, argv[1], events, event_count)) {
+			printf("%-10s crashed\n", allocator->name);
+		}
+	}
+	if (!any) {
+		print_error("No allocator named %s\n", argv[2]);
+		return 1;
+	}
+
+	return 0;
+}
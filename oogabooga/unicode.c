@@ -110,25 +110,340 @@ u32 next_utf8(string *s) {
     return result.utf32;
 }
 
+///
+// Bulk decoding and validation
+// Runs of ASCII are handled 16 (SSE2) or 32 (AVX2) bytes at a time, everything else goes through
+// utf8_to_utf32() one codepoint at a time. The level is picked at runtime like the string search
+// in string.c. Validation on AVX2 is the lookup algorithm from Keiser & Lemire, "Validating UTF-8
+// In Less Than One Instruction Per Byte".
+
+// Writes the leading ASCII bytes of p (at most count) to utf32. Returns how many there were.
+u64 utf8_ascii_to_utf32_scalar(u8 *p, u64 count, u32 *utf32) {
+	u64 i = 0;
+	while (i < count && p[i] < 0x80) {
+		utf32[i] = p[i];
+		i += 1;
+	}
+	return i;
+}
+
+// Strict, as in the Unicode standard table 3-7. No overlongs, surrogates or anything past U+10FFFF.
+bool utf8_is_valid_scalar(u8 *p, u64 count) {
+	u64 i = 0;
+	while (i < count) {
+		u8 c = p[i];
+		if (c < 0x80) {
+			i += 1;
+			continue;
+		}
+		
+		u64 continuation_bytes;
+		u8 lo = 0x80;
+		u8 hi = 0xBF;
+		if (c >= 0xC2 && c <= 0xDF) {
+			continuation_bytes = 1;
+		} else if (c >= 0xE0 && c <= 0xEF) {
+			continuation_bytes = 2;
+			if (c == 0xE0) lo = 0xA0;
+			if (c == 0xED) hi = 0x9F;
+		} else if (c >= 0xF0 && c <= 0xF4) {
+			continuation_bytes = 3;
+			if (c == 0xF0) lo = 0x90;
+			if (c == 0xF4) hi = 0x8F;
+		} else {
+			return false;
+		}
+		
+		if (count - i - 1 < continuation_bytes) return false;
+		if (p[i+1] < lo || p[i+1] > hi) return false;
+		for (u64 k = 2; k <= continuation_bytes; k++) {
+			if ((p[i+k] & 0xC0) != 0x80) return false;
+		}
+		i += continuation_bytes + 1;
+	}
+	return true;
+}
+
+#if ENABLE_SIMD && COMPILER_CAN_TARGET_SSE2
+
+target_sse2 u64 utf8_ascii_to_utf32_sse2(u8 *p, u64 count, u32 *utf32) {
+	__m128i zero = _mm_setzero_si128();
+	u64 i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m128i bytes = _mm_loadu_si128((__m128i*)(p+i));
+		
+		// Widen all 16 even if some are not ASCII, there's room for count codepoints anyway
+		__m128i lo = _mm_unpacklo_epi8(bytes, zero);
+		__m128i hi = _mm_unpackhi_epi8(bytes, zero);
+		_mm_storeu_si128((__m128i*)(utf32+i+0),  _mm_unpacklo_epi16(lo, zero));
+		_mm_storeu_si128((__m128i*)(utf32+i+4),  _mm_unpackhi_epi16(lo, zero));
+		_mm_storeu_si128((__m128i*)(utf32+i+8),  _mm_unpacklo_epi16(hi, zero));
+		_mm_storeu_si128((__m128i*)(utf32+i+12), _mm_unpackhi_epi16(hi, zero));
+		
+		u32 mask = (u32)_mm_movemask_epi8(bytes);
+		if (mask) return i + count_trailing_zeros_u32(mask);
+	}
+	return i + utf8_ascii_to_utf32_scalar(p+i, count-i, utf32+i);
+}
+
+target_sse2 bool utf8_is_valid_sse2(u8 *p, u64 count) {
+	// Skip ASCII a block at a time and validate the rest one sequence at a time
+	u64 i = 0;
+	while (i < count) {
+		if (i + 16 <= count && !_mm_movemask_epi8(_mm_loadu_si128((__m128i*)(p+i)))) {
+			i += 16;
+			continue;
+		}
+		if (p[i] < 0x80) {
+			i += 1;
+			continue;
+		}
+		u64 length = p[i] >= 0xF0 ? 4 : (p[i] >= 0xE0 ? 3 : 2);
+		if (length > count - i) length = count - i;
+		if (!utf8_is_valid_scalar(p+i, length)) return false;
+		i += length;
+	}
+	return true;
+}
+
+#endif // ENABLE_SIMD && COMPILER_CAN_TARGET_SSE2
+
+#if ENABLE_SIMD && COMPILER_CAN_TARGET_AVX2
+
+target_avx2 u64 utf8_ascii_to_utf32_avx2(u8 *p, u64 count, u32 *utf32) {
+	u64 i = 0;
+	for (; i + 32 <= count; i += 32) {
+		__m256i bytes = _mm256_loadu_si256((__m256i*)(p+i));
+		
+		// Widen all 32 even if some are not ASCII, there's room for count codepoints anyway
+		_mm256_storeu_si256((__m256i*)(utf32+i+0),  _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i*)(p+i+0))));
+		_mm256_storeu_si256((__m256i*)(utf32+i+8),  _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i*)(p+i+8))));
+		_mm256_storeu_si256((__m256i*)(utf32+i+16), _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i*)(p+i+16))));
+		_mm256_storeu_si256((__m256i*)(utf32+i+24), _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i*)(p+i+24))));
+		
+		u32 mask = (u32)_mm256_movemask_epi8(bytes);
+		if (mask) return i + count_trailing_zeros_u32(mask);
+	}
+	return i + utf8_ascii_to_utf32_scalar(p+i, count-i, utf32+i);
+}
+
+// The last n bytes of prev followed by input, shifted so byte k of the result is byte k-n of the stream
+#define UTF8_AVX2_PREV(input, prev, n) _mm256_alignr_epi8((input), _mm256_permute2x128_si256((prev), (input), 0x21), 16-(n))
+
+target_avx2 bool utf8_is_valid_avx2(u8 *p, u64 count) {
+	if (count == 0) return true;
+	
+	// Error classes for a pair of bytes. A pair is an error if a class is set for the high
+	// nibble of the first byte, the low nibble of the first byte and the high nibble of the second.
+	#define TOO_SHORT      (1<<0) // lead followed by a lead or ASCII
+	#define TOO_LONG       (1<<1) // ASCII followed by a continuation
+	#define OVERLONG_3     (1<<2)
+	#define TOO_LARGE      (1<<3)
+	#define SURROGATE      (1<<4)
+	#define OVERLONG_2     (1<<5)
+	#define TOO_LARGE_1000 (1<<6)
+	#define OVERLONG_4     (1<<6)
+	#define TWO_CONTS      (1<<7) // two continuations, only ok inside a 3 or 4 byte sequence
+	#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+	
+	#define UTF8_BYTE_1_HIGH \
+		TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, \
+		TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS, \
+		TOO_SHORT | OVERLONG_2, \
+		TOO_SHORT, \
+		TOO_SHORT | OVERLONG_3 | SURROGATE, \
+		TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+	#define UTF8_BYTE_1_LOW \
+		CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, \
+		CARRY | OVERLONG_2, \
+		CARRY, \
+		CARRY, \
+		CARRY | TOO_LARGE, \
+		CARRY | TOO_LARGE | TOO_LARGE_1000, \
+		CARRY | TOO_LARGE | TOO_LARGE_1000, \
+		CARRY | TOO_LARGE | TOO_LARGE_1000, \
+		CARRY | TOO_LARGE | TOO_LARGE_1000, \
+		CARRY | TOO_LARGE | TOO_LARGE_1000, \
+		CARRY | TOO_LARGE | TOO_LARGE_1000, \
+		CARRY | TOO_LARGE | TOO_LARGE_1000, \
+		CARRY | TOO_LARGE | TOO_LARGE_1000, \
+		CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE, \
+		CARRY | TOO_LARGE | TOO_LARGE_1000, \
+		CARRY | TOO_LARGE | TOO_LARGE_1000
+	#define UTF8_BYTE_2_HIGH \
+		TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, \
+		TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4, \
+		TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE, \
+		TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE  | TOO_LARGE, \
+		TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE  | TOO_LARGE, \
+		TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+	
+	// Shuffles look up within each 128 bit lane, so the tables are in both lanes
+	const __m256i byte_1_high_table = _mm256_setr_epi8(UTF8_BYTE_1_HIGH, UTF8_BYTE_1_HIGH);
+	const __m256i byte_1_low_table  = _mm256_setr_epi8(UTF8_BYTE_1_LOW,  UTF8_BYTE_1_LOW);
+	const __m256i byte_2_high_table = _mm256_setr_epi8(UTF8_BYTE_2_HIGH, UTF8_BYTE_2_HIGH);
+	
+	#undef TOO_SHORT
+	#undef TOO_LONG
+	#undef OVERLONG_3
+	#undef TOO_LARGE
+	#undef SURROGATE
+	#undef OVERLONG_2
+	#undef TOO_LARGE_1000
+	#undef OVERLONG_4
+	#undef TWO_CONTS
+	#undef CARRY
+	#undef UTF8_BYTE_1_HIGH
+	#undef UTF8_BYTE_1_LOW
+	#undef UTF8_BYTE_2_HIGH
+	
+	const __m256i nibble_mask = _mm256_set1_epi8(0x0F);
+	// Anything above these in the last 3 bytes of a block is a sequence that continues in the next block
+	const __m256i incomplete_max = _mm256_setr_epi8(
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, (char)(0xF0-1), (char)(0xE0-1), (char)(0xC0-1)
+	);
+	
+	__m256i error = _mm256_setzero_si256();
+	__m256i prev_input = _mm256_setzero_si256();
+	__m256i prev_incomplete = _mm256_setzero_si256();
+	
+	for (u64 i = 0; i < count; i += 32) {
+		__m256i input;
+		if (i + 32 <= count) {
+			input = _mm256_loadu_si256((__m256i*)(p+i));
+		} else {
+			// Zero padding is ASCII, so a sequence cut off by the end is caught as too short
+			u8 tail[32] = {0};
+			memcpy(tail, p+i, count-i);
+			input = _mm256_loadu_si256((__m256i*)tail);
+		}
+		
+		if (!_mm256_movemask_epi8(input)) {
+			error = _mm256_or_si256(error, prev_incomplete);
+			prev_incomplete = _mm256_setzero_si256();
+		} else {
+			__m256i prev1 = UTF8_AVX2_PREV(input, prev_input, 1);
+			__m256i byte_1_high = _mm256_shuffle_epi8(byte_1_high_table, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble_mask));
+			__m256i byte_1_low  = _mm256_shuffle_epi8(byte_1_low_table,  _mm256_and_si256(prev1, nibble_mask));
+			__m256i byte_2_high = _mm256_shuffle_epi8(byte_2_high_table, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble_mask));
+			__m256i special = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+			
+			// The 2nd byte after a 3 or 4 byte lead, and the 3rd after a 4 byte lead, must be
+			// continuations. Those are exactly the places where TWO_CONTS is allowed.
+			__m256i prev2 = UTF8_AVX2_PREV(input, prev_input, 2);
+			__m256i prev3 = UTF8_AVX2_PREV(input, prev_input, 3);
+			__m256i is_third_byte  = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0-0x80)));
+			__m256i is_fourth_byte = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0-0x80)));
+			__m256i must_be_continuation = _mm256_and_si256(_mm256_or_si256(is_third_byte, is_fourth_byte), _mm256_set1_epi8((char)0x80));
+			
+			error = _mm256_or_si256(error, _mm256_xor_si256(must_be_continuation, special));
+			prev_incomplete = _mm256_subs_epu8(input, incomplete_max);
+		}
+		prev_input = input;
+	}
+	error = _mm256_or_si256(error, prev_incomplete);
+	
+	return _mm256_testz_si256(error, error);
+}
+
+#endif // ENABLE_SIMD && COMPILER_CAN_TARGET_AVX2
+
+// Decodes up to max_count codepoints from *s into utf32 and advances *s past them, the same as
+// calling next_utf8() until it returns 0 but without the per call overhead.
+// Returns how many codepoints were decoded. Stops early at the end of *s or at a sequence that's
+// cut off by the end, which is left in *s.
+u64 utf8_to_utf32_many(string *s, u32 *utf32, u64 max_count) {
+	String_Simd_Level level = get_string_simd_level();
+	
+	u8 *p = s->data;
+	u64 left = s->count;
+	u64 n = 0;
+	while (n < max_count && left > 0) {
+		if (p[0] < 0x80) {
+			u64 limit = min(left, max_count-n);
+			u64 run;
+			switch (level) {
+#if ENABLE_SIMD && COMPILER_CAN_TARGET_AVX2
+				case STRING_SIMD_AVX2: run = utf8_ascii_to_utf32_avx2(p, limit, utf32+n); break;
+#endif
+#if ENABLE_SIMD && COMPILER_CAN_TARGET_SSE2
+				case STRING_SIMD_SSE2: run = utf8_ascii_to_utf32_sse2(p, limit, utf32+n); break;
+#endif
+				default: run = utf8_ascii_to_utf32_scalar(p, limit, utf32+n); break;
+			}
+			p += run;
+			left -= run;
+			n += run;
+			continue;
+		}
+		
+		Utf8_To_Utf32_Result result = utf8_to_utf32(p, (s64)left, false);
+		if (result.error) break;
+		utf32[n] = result.utf32;
+		n += 1;
+		p += result.continuation_bytes;
+		left -= result.continuation_bytes;
+	}
+	
+	s->data = p;
+	s->count = left;
+	return n;
+}
+
+// Strict validation: no overlong encodings, surrogates, codepoints past U+10FFFF or cut off sequences.
+bool utf8_is_valid(string s) {
+	switch (get_string_simd_level()) {
+#if ENABLE_SIMD && COMPILER_CAN_TARGET_AVX2
+		case STRING_SIMD_AVX2: return utf8_is_valid_avx2(s.data, s.count);
+#endif
+#if ENABLE_SIMD && COMPILER_CAN_TARGET_SSE2
+		case STRING_SIMD_SSE2: return utf8_is_valid_sse2(s.data, s.count);
+#endif
+		default: return utf8_is_valid_scalar(s.data, s.count);
+	}
+}
+
 u64 utf8_index_to_byte_index(string str, u64 index) {
-	u64 byte_index = 0;
+	// Decode in batches so runs of ASCII take the SIMD path in utf8_to_utf32_many()
+	u32 codepoints[128];
+	string rest = str;
 	u64 utf8_index = 0;
-	while (utf8_index < index && str.count != 0) {
-		string last_str = str;
-		u32 codepoint = next_utf8(&str);
-		if (!codepoint) break;
-
-		u64 byte_diff = ((u8*)str.data)-((u8*)last_str.data);
-		assert(byte_diff != 0);
-		byte_index += byte_diff;
-		utf8_index += 1;
+	while (utf8_index < index && rest.count != 0) {
+		string batch = rest;
+		u64 n = utf8_to_utf32_many(&rest, codepoints, min(index-utf8_index, 128));
+		if (n == 0) break;
+		
+		// Stop at a null terminator, same as next_utf8() returning 0
+		for (u64 i = 0; i < n; i++) {
+			if (codepoints[i] == 0) {
+				utf8_to_utf32_many(&batch, codepoints, i);
+				return ((u8*)batch.data)-((u8*)str.data);
+			}
+		}
+		utf8_index += n;
 	}
-	return byte_index;
+	return ((u8*)rest.data)-((u8*)str.data);
 }
 string utf8_slice(string str, u64 index, u64 count) {
 	u64 byte_index = utf8_index_to_byte_index(str, index);
-	u64 byte_end_index = utf8_index_to_byte_index(str, index+count);
+	// Continue from byte_index rather than walking from the start again
+	string rest = (string){str.count-byte_index, str.data+byte_index};
+	u64 byte_end_index = byte_index + utf8_index_to_byte_index(rest, count);
 	u64 byte_count = byte_end_index - byte_index;
 
 	return string_view(str, byte_index, byte_count);
 }
+
+// Like utf8_index_to_byte_index(), but walks on from a previous lookup when utf8_index is at or
+// past it. Makes converting increasing indices (line breaks, selections) linear instead of quadratic.
+u64 utf8_cursor_to_byte_index(string str, u64 *cursor_utf8_index, u64 *cursor_byte_index, u64 utf8_index) {
+	if (utf8_index < *cursor_utf8_index) {
+		*cursor_utf8_index = 0;
+		*cursor_byte_index = 0;
+	}
+	string rest = (string){str.count-*cursor_byte_index, str.data+*cursor_byte_index};
+	*cursor_byte_index += utf8_index_to_byte_index(rest, utf8_index-*cursor_utf8_index);
+	*cursor_utf8_index = utf8_index;
+	return *cursor_byte_index;
+}
@@ -109,7 +109,7 @@ void merge_sort(void *collection, void *help_buffer, u64 item_count, u64 item_si
     }
 }
 
-inline bool bytes_match(void *a, void *b, u64 count) { return memcmp(a, b, count) == 0; }
+// bytes_match() is in string.c
 
 #define swap(a, b, type) { type t = a; a = b; b = t;  }
 